@@ -63,11 +63,11 @@ UserChartData::compute(RideItem *item, Specification spec, DateRange dr)
     relevant=x=y=z=d=t=Result(0);
 
     // always init first
-    if (finit) root->eval(rt, finit, Result(0), 0, const_cast<RideItem*>(item), NULL, NULL, spec, dr);
+    if (finit) rt->run(finit, Result(0), 0, const_cast<RideItem*>(item), NULL, NULL, spec, dr);
 
     // is it relevant ?
     if (frelevant) {
-        relevant = root->eval(rt, frelevant, Result(0), 0, const_cast<RideItem*>(item), NULL, NULL, spec, dr);
+        relevant = rt->run(frelevant, Result(0), 0, const_cast<RideItem*>(item), NULL, NULL, spec, dr);
         if (relevant.number() == 0) return;
     }
 
@@ -88,33 +88,29 @@ UserChartData::compute(RideItem *item, Specification spec, DateRange dr)
                 if (!spec.pass(ride)) continue; // relies upon the daterange being passed to eval...
 
 
-                root->eval(rt, factivity, Result(0), 0, const_cast<RideItem*>(ride), NULL, NULL, spec, dr);
+                rt->run(factivity, Result(0), 0, const_cast<RideItem*>(ride), NULL, NULL, spec, dr);
             }
         }
 
     } else {
         if (!spec.isEmpty(item->ride()) && fsample) {
             RideFileIterator it(item->ride(), spec);
-
-            while(it.hasNext()) {
-                struct RideFilePoint *point = it.next();
-                root->eval(rt, fsample, Result(0), 0, const_cast<RideItem*>(item), point, NULL, spec, dr);
-            }
+            rt->runSamples(fsample, const_cast<RideItem*>(item), it, NULL, spec, dr);
         }
 
     }
 
     // finalise computation
     if (ffinalise) {
-        root->eval(rt, ffinalise, Result(0), 0, const_cast<RideItem*>(item), NULL, NULL, spec, dr);
+        rt->run(ffinalise, Result(0), 0, const_cast<RideItem*>(item), NULL, NULL, spec, dr);
     }
 
     // values
-    if (fx) x = root->eval(rt, fx, Result(0), 0, const_cast<RideItem*>(item), NULL, NULL, spec, dr);
-    if (fy) y = root->eval(rt, fy, Result(0), 0, const_cast<RideItem*>(item), NULL, NULL, spec, dr);
-    if (fz) z = root->eval(rt, fz, Result(0), 0, const_cast<RideItem*>(item), NULL, NULL, spec, dr);
-    if (ft) t = root->eval(rt, ft, Result(0), 0, const_cast<RideItem*>(item), NULL, NULL, spec, dr);
-    if (fd) d = root->eval(rt, fd, Result(0), 0, const_cast<RideItem*>(item), NULL, NULL, spec, dr);
-    if (ff) f = root->eval(rt, ff, Result(0), 0, const_cast<RideItem*>(item), NULL, NULL, spec, dr);
+    if (fx) x = rt->run(fx, Result(0), 0, const_cast<RideItem*>(item), NULL, NULL, spec, dr);
+    if (fy) y = rt->run(fy, Result(0), 0, const_cast<RideItem*>(item), NULL, NULL, spec, dr);
+    if (fz) z = rt->run(fz, Result(0), 0, const_cast<RideItem*>(item), NULL, NULL, spec, dr);
+    if (ft) t = rt->run(ft, Result(0), 0, const_cast<RideItem*>(item), NULL, NULL, spec, dr);
+    if (fd) d = rt->run(fd, Result(0), 0, const_cast<RideItem*>(item), NULL, NULL, spec, dr);
+    if (ff) f = rt->run(ff, Result(0), 0, const_cast<RideItem*>(item), NULL, NULL, spec, dr);
 
 }
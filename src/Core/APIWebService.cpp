@@ -73,7 +73,7 @@ APIWebService::athleteData(QStringList &paths, HttpRequest &request, HttpRespons
         return;
     } else {
         QFile ridedb(home.absolutePath() + "/" + paths[0] + "/cache/rideDB.json");
-        if (!ridedb.exists()) {
+        if (!ridedb.exists() && !RideDBStore::exists(home.absolutePath() + "/" + paths[0] + "/cache")) {
             response.setStatus(404); // malformed URL
             response.setHeader("Content-Type", "text; charset=ISO-8859-1");
             response.write("unknown athlete " + paths[0].toLocal8Bit());
@@ -175,7 +175,7 @@ APIWebService::listAthletes(HttpRequest &, HttpResponse &response)
         // sure fire sign the athlete has been upgraded to post 3.2 and not some
         // random directory full of other things & check something basic is set
         QString ridedb = home.absolutePath() + "/" + name + "/cache/rideDB.json";
-        if (QFile(ridedb).exists()) {
+        if (QFile(ridedb).exists() || RideDBStore::exists(home.absolutePath() + "/" + name + "/cache")) {
             // we need to initialize athlete settings for cvalue to work
             appsettings->initializeQSettingsAthlete(home.absolutePath(), name);
             if (appsettings->cvalue(name, GC_SEX, "") == "") continue;
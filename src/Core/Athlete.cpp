@@ -37,6 +37,7 @@
 #include "CalendarDownload.h"
 #include "PMCData.h"
 #include "Banister.h"
+#include "DataFilterCache.h"
 #include "ErgDB.h"
 #ifdef GC_HAVE_ICAL
 #include "ICalendar.h"
@@ -152,6 +153,9 @@ Athlete::Athlete(Context *context, const QDir &homeDir)
     // Metadata
     rideCache = NULL; // let metadata know we don't have a ridecache yet
 
+    // memoised DataFilter builtins, before any rides are loaded
+    filterCache = new DataFilterCache(context, this);
+
     // Date Ranges
     seasons = new Seasons(home->config());
 
@@ -203,6 +207,12 @@ Athlete::loadComplete()
 
     // done, tell main window
     context->notifyLoadCompleted(cyclist, context);
+
+#ifdef GC_DEBUG
+    // cold start time to first paint, the views are up now
+    qDebug()<<cyclist<<"ready in"<<rideCache->startupTime()<<"ms,"
+            <<rideCache->rides().count()<<"rides restored in"<<rideCache->loadTime()<<"ms";
+#endif
 }
 
 void
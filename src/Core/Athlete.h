@@ -62,6 +62,7 @@ class AnalysisSidebar;
 class Tab;
 class Leaf;
 class DataFilterRuntime;
+class DataFilterCache;
 class CloudServiceAutoDownload;
 class Banister;
 
@@ -139,6 +140,9 @@ class Athlete : public QObject
         // DataFilter global storage/cache
         QMap<QString,Result> dfcache;
 
+        // memoised DataFilter builtins
+        DataFilterCache *filterCache;
+
         Context *context;
 
         // ride collection
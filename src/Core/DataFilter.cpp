@@ -34,7 +34,9 @@
 #include "SearchFilterBox.h" // for SearchFilterBox::matches
 #include <QDebug>
 #include <QMutex>
-#include "lmcurve.h"
+#include <QThread>
+#include <QtConcurrent>
+#include "LMCurve.h"
 #include "LTMTrend.h" // for LR when copying CP chart filtering mechanism
 #include "WPrime.h" // for LR when copying CP chart filtering mechanism
 
@@ -58,6 +60,8 @@ QMutex pythonMutex;
 #include "PaceZones.h"
 #include "HrZones.h"
 #include "UserChart.h"
+#include "DataFilterProgram.h"
+#include "DataFilterCache.h"
 
 #include "DataFilter_yacc.h"
 
@@ -1395,6 +1399,23 @@ static bool isCoggan(QString symbol)
     return false;
 }
 
+// symbols that are handled specially rather than looked up in the
+// ride metrics and metadata
+bool
+Leaf::isSpecial(const QString &symbol)
+{
+    return !symbol.compare("Date", Qt::CaseInsensitive) ||
+           !symbol.compare("x", Qt::CaseInsensitive) || // used by which and [lexpr]
+           !symbol.compare("i", Qt::CaseInsensitive) || // used by which and [lexpr]
+           !symbol.compare("Today", Qt::CaseInsensitive) ||
+           !symbol.compare("Current", Qt::CaseInsensitive) ||
+           !symbol.compare("RECINTSECS", Qt::CaseInsensitive) ||
+           !symbol.compare("NA", Qt::CaseInsensitive) ||
+           symbol == "isRide" || symbol == "isSwim" ||
+           symbol == "isRun" || symbol == "isXtrain" ||
+           isCoggan(symbol);
+}
+
 bool Leaf::isNumber(DataFilterRuntime *df, Leaf *leaf)
 {
 
@@ -1494,17 +1515,7 @@ void Leaf::validateFilter(Context *context, DataFilterRuntime *df, Leaf *leaf)
             if (lookup == "") {
 
                 // isRun isa special, we may add more later (e.g. date)
-                if (symbol.compare("Date", Qt::CaseInsensitive) &&
-                    symbol.compare("x", Qt::CaseInsensitive) && // used by which and [lexpr]
-                    symbol.compare("i", Qt::CaseInsensitive) && // used by which and [lexpr]
-                    symbol.compare("Today", Qt::CaseInsensitive) &&
-                    symbol.compare("Current", Qt::CaseInsensitive) &&
-                    symbol.compare("RECINTSECS", Qt::CaseInsensitive) &&
-                    symbol.compare("NA", Qt::CaseInsensitive) &&
-                    !df->dataSeriesSymbols.contains(symbol) &&
-                    symbol != "isRide" && symbol != "isSwim" &&
-                    symbol != "isRun" && symbol != "isXtrain" &&
-                    !isCoggan(symbol)) {
+                if (!isSpecial(symbol) && !df->dataSeriesSymbols.contains(symbol)) {
 
                     // unknown, is it user defined ?
                     if (!df->symbols.contains(symbol)) {
@@ -2690,6 +2701,7 @@ DataFilter::DataFilter(QObject *parent, Context *context) : QObject(parent), con
 
     // be sure not to enable this by accident!
     rt.isdynamic = false;
+    rt.memoising = NULL;
 
     // set up the models we support
     rt.models << new CP2Model(context);
@@ -2718,6 +2730,7 @@ DataFilter::DataFilter(QObject *parent, Context *context, QString formula) : QOb
 
     // be sure not to enable this by accident!
     rt.isdynamic = false;
+    rt.memoising = NULL;
 
     // set up the models we support
     rt.models << new CP2Model(context);
@@ -2752,6 +2765,8 @@ DataFilter::DataFilter(QObject *parent, Context *context, QString formula) : QOb
     // save away the results if it passed semantic validation
     if (DataFiltererrors.count() != 0)
         treeRoot= NULL;
+    else
+        rt.compile(treeRoot);
 }
 
 Result DataFilter::evaluate(RideItem *item, RideFilePoint *p)
@@ -2769,12 +2784,12 @@ Result DataFilter::evaluate(RideItem *item, RideFilePoint *p)
 
         // ... start at main
         if (rt.functions.contains("main"))
-            res = treeRoot->eval(&rt, rt.functions.value("main"), Result(0), 0, item, p);
+            res = rt.run(rt.functions.value("main"), Result(0), 0, item, p);
 
     } else {
 
         // otherwise just evaluate the entire tree
-        res = treeRoot->eval(&rt, treeRoot, Result(0), 0, item, p);
+        res = rt.run(treeRoot, Result(0), 0, item, p);
     }
 
     return res;
@@ -2801,12 +2816,12 @@ Result DataFilter::evaluate(DateRange dr, QString filter)
 
         // ... start at main
         if (rt.functions.contains("main"))
-            res = treeRoot->eval(&rt, rt.functions.value("main"), Result(0), 0, const_cast<RideItem*>(context->currentRideItem()), NULL, NULL, spec, dr);
+            res = rt.run(rt.functions.value("main"), Result(0), 0, const_cast<RideItem*>(context->currentRideItem()), NULL, NULL, spec, dr);
 
     } else {
 
         // otherwise just evaluate the entire tree
-        res = treeRoot->eval(&rt, treeRoot, Result(0), 0, const_cast<RideItem*>(context->currentRideItem()), NULL, NULL, spec, dr);
+        res = rt.run(treeRoot, Result(0), 0, const_cast<RideItem*>(context->currentRideItem()), NULL, NULL, spec, dr);
     }
 
     return res;
@@ -2884,23 +2899,14 @@ QStringList DataFilter::parseFilter(Context *context, QString query, QStringList
     } else { // yep! .. we have a winner!
 
         rt.isdynamic = treeRoot->isDynamic(treeRoot);
+        rt.compile(treeRoot);
 
         // successfully parsed, lets check semantics
         //treeRoot->print(0,NULL);
         emit parseGood();
 
-        // clear current filter list
-        filenames.clear();
-
-        // get all fields...
-        foreach(RideItem *item, context->athlete->rideCache->rides()) {
-
-            // evaluate each ride...
-            Result result = treeRoot->eval(&rt, treeRoot, Result(0), 0,item, NULL);
-            if (result.isNumber && result.number()) {
-                filenames << item->fileName;
-            }
-        }
+        // rides that pass
+        filenames = passing();
         emit results(filenames);
         if (list) *list = filenames;
     }
@@ -2915,24 +2921,81 @@ DataFilter::dynamicParse()
     if (rt.isdynamic) {
         // need to reapply on current state
 
-        // clear current filter list
-        filenames.clear();
+        // rides that pass
+        filenames = passing();
+        emit results(filenames);
+        if (list) *list = filenames;
+    }
+}
 
-        // get all fields...
-        foreach(RideItem *item, context->athlete->rideCache->rides()) {
+// a slice of the rides evaluated on one thread
+struct DataFilterSlice {
+    DataFilterRuntime *rt;
+    Leaf *root;
+    const QVector<RideItem*> *rides;
+    QVector<char> *pass;
+    int from, to;
+};
+
+static void
+filterSlice(DataFilterSlice &slice)
+{
+    for(int i=slice.from; i<slice.to; i++) {
+        Result result = slice.rt->run(slice.root, Result(0), 0, slice.rides->at(i));
+        (*slice.pass)[i] = (result.isNumber && result.number()) ? 1 : 0;
+    }
+}
 
-            // evaluate each ride...
-            Result result = treeRoot->eval(&rt, treeRoot, Result(0), 0, item, NULL);
-            if (result.isNumber && result.number())
-                filenames << item->fileName;
+QStringList
+DataFilter::passing()
+{
+    const QVector<RideItem*> &rides = context->athlete->rideCache->rides();
+
+    // filters that only look at the ride (no functions or assignments)
+    // don't touch the runtime when they run, so the rides can be split
+    // across threads sharing it. Anything else is evaluated in turn, as
+    // it may depend on state left behind by the previous ride
+    QSharedPointer<DataFilterProgram> program = rt.programs.value(treeRoot);
+    int threads = QThread::idealThreadCount();
+    if (program && program->isPure() && threads > 1 && rides.count() >= 256) {
+
+        QVector<char> pass(rides.count(), 0);
+
+        // a few slices per thread to even out the load
+        QVector<DataFilterSlice> slices;
+        int n = threads * 4;
+        for(int i=0; i<n; i++) {
+            DataFilterSlice slice;
+            slice.rt = &rt;
+            slice.root = treeRoot;
+            slice.rides = &rides;
+            slice.pass = &pass;
+            slice.from = (rides.count() * i) / n;
+            slice.to = (rides.count() * (i+1)) / n;
+            slices << slice;
         }
-        emit results(filenames);
-        if (list) *list = filenames;
+        QtConcurrent::blockingMap(slices, filterSlice);
+
+        // in ride order, as if done serially
+        QStringList returning;
+        for(int i=0; i<rides.count(); i++) if (pass[i]) returning << rides[i]->fileName;
+        return returning;
     }
+
+    QStringList returning;
+    foreach(RideItem *item, rides) {
+
+        // evaluate each ride...
+        Result result = rt.run(treeRoot, Result(0), 0, item);
+        if (result.isNumber && result.number()) returning << item->fileName;
+    }
+    return returning;
 }
 
 void DataFilter::clearFilter()
 {
+    rt.programs.clear();
+    rt.memos.clear();
     if (treeRoot) {
         treeRoot->clear(treeRoot);
         treeRoot = NULL;
@@ -2973,6 +3036,73 @@ void DataFilter::configChanged(qint32)
 
     // sample date series
     rt.dataSeriesSymbols = RideFile::symbols();
+
+    // symbols are resolved when compiled
+    if (treeRoot) rt.compile(treeRoot);
+}
+
+void
+DataFilterRuntime::compile(Leaf *root, bool optimise)
+{
+    programs.clear();
+    programs.insert(root, QSharedPointer<DataFilterProgram>(new DataFilterProgram(this, root, root, false, optimise)));
+
+    // user functions are evaluated on their own, e.g. by user metrics,
+    // and the sample function is run for each sample
+    foreach(Leaf *function, functions)
+        if (!programs.contains(function))
+            programs.insert(function, QSharedPointer<DataFilterProgram>(new DataFilterProgram(this, function, root,
+                                                                                              function == functions.value("sample"), optimise)));
+
+    // and the calls we can memoise
+    memos.clear();
+    DataFilterCache::plan(this, root, memos);
+    foreach(Leaf *function, functions) DataFilterCache::plan(this, function, memos);
+}
+
+Result
+DataFilterRuntime::run(Leaf *leaf, const Result &x, long it, RideItem *m, RideFilePoint *p, const QHash<QString,RideMetric*> *c,
+                       const Specification &s, const DateRange &d)
+{
+    QHash<Leaf*, QSharedPointer<DataFilterProgram> >::const_iterator program = programs.constFind(leaf);
+    if (program != programs.constEnd()) return program.value()->run(this, x, it, m, p, c, s, d);
+    return leaf->eval(this, leaf, x, it, m, p, c, s, d);
+}
+
+void
+DataFilterRuntime::runSamples(Leaf *leaf, RideItem *m, RideFileIterator &samples, const QHash<QString,RideMetric*> *c,
+                              const Specification &s, const DateRange &d)
+{
+    static const int CHUNK = 1024;
+
+    QHash<Leaf*, QSharedPointer<DataFilterProgram> >::const_iterator program = programs.constFind(leaf);
+    bool chunked = program != programs.constEnd() && program.value()->isReduction();
+
+    QVector<RideFilePoint*> chunk;
+    if (chunked) chunk.reserve(CHUNK);
+
+    // values that don't depend on the sample are only computed once
+    DataFilterProgram::Registers registers;
+
+    while(samples.hasNext()) {
+
+        struct RideFilePoint *point = samples.next();
+        if (!chunked) {
+            if (program != programs.constEnd()) program.value()->run(this, Result(0), 0, m, point, c, s, d, &registers);
+            else run(leaf, Result(0), 0, m, point, c, s, d);
+            continue;
+        }
+
+        chunk << point;
+        if (chunk.count() == CHUNK || !samples.hasNext()) {
+
+            // one sample at a time if it can't be done in one go
+            if (!program.value()->runSamples(this, m, chunk, c, s, d))
+                foreach(RideFilePoint *p, chunk) program.value()->run(this, Result(0), 0, m, p, c, s, d, &registers);
+
+            chunk.clear();
+        }
+    }
 }
 
 void
@@ -3020,6 +3150,166 @@ static int monthsTo(QDate from, QDate to)
     return months;
 }
 
+// apply a binary operator to operands that have already been
+// evaluated, used by the tree walker and by compiled programs
+Result
+Leaf::operate(int op, Result &lhs, Result &rhs)
+{
+    switch (op) {
+
+    // basic operations should all work with vectors or numbers
+    case ADD:
+    case SUBTRACT:
+    case DIVIDE:
+    case MULTIPLY:
+    case POW:
+    {
+        Result returning(0);
+
+        // only if numberic on both sides
+        if (lhs.isNumber && rhs.isNumber) {
+
+
+            // its a vector operation...
+            if (lhs.asNumeric().count() || rhs.asNumeric().count()) {
+
+                int size = lhs.asNumeric().count() > rhs.asNumeric().count() ? lhs.asNumeric().count() : rhs.asNumeric().count();
+
+                // coerce both into a vector of matching size
+                lhs.vectorize(size);
+                rhs.vectorize(size);
+
+                for(int i=0; i<size; i++) {
+                    double left = lhs.asNumeric()[i];
+                    double right = rhs.asNumeric()[i];
+                    double value = 0;
+
+                    switch (op) {
+                    case ADD: value = left + right; break;
+                    case SUBTRACT: value = left - right; break;
+                    case DIVIDE: value = right ? left / right : 0; break;
+                    case MULTIPLY: value = left * right; break;
+                    case POW: value = pow(left,right); break;
+                    }
+                    returning.asNumeric() << value;
+                    returning.number() += value;
+                }
+
+            } else {
+                switch (op) {
+                case ADD: returning.number() = lhs.number() + rhs.number(); break;
+                case SUBTRACT: returning.number() = lhs.number() - rhs.number(); break;
+                case DIVIDE: returning.number() = rhs.number() ? lhs.number() / rhs.number() : 0; break;
+                case MULTIPLY: returning.number() = lhs.number() * rhs.number(); break;
+                case POW: returning.number() = pow(lhs.number(), rhs.number()); break;
+                }
+            }
+        } else {
+
+            // either the left or rhs is not a number, it is a string
+            // so we need to return a string result
+            returning.isNumber = false;
+
+            // basically add is the only meaningful operation to apply
+            // to string values; for vectors append, for string just concatenate
+            if (op == ADD) {
+                if (lhs.isVector() || rhs.isVector()) {
+
+                    // create a bigger vector
+                    if (lhs.isVector()) returning.asString() << lhs.asString();
+                    else returning.asString() << lhs.string();
+                    if (rhs.isVector()) returning.asString() << rhs.asString();
+                    else returning.asString() << rhs.string();
+
+                } else {
+                    // cat strings
+                    returning.string() = lhs.string() + rhs.string();
+                }
+            } else {
+                // just return the lhs
+                returning = lhs;
+            }
+        }
+        return returning;
+    }
+    break;
+
+    case EQ:
+    {
+        if (lhs.isNumber) return Result(lhs.number() == rhs.number());
+        else return Result(lhs.string() == rhs.string());
+    }
+    break;
+
+    case NEQ:
+    {
+        if (lhs.isNumber) return Result(lhs.number() != rhs.number());
+        else return Result(lhs.string() != rhs.string());
+    }
+    break;
+
+    case LT:
+    {
+        if (lhs.isNumber) return Result(lhs.number() < rhs.number());
+        else return Result(lhs.string() < rhs.string());
+    }
+    break;
+    case LTE:
+    {
+        if (lhs.isNumber) return Result(lhs.number() <= rhs.number());
+        else return Result(lhs.string() <= rhs.string());
+    }
+    break;
+    case GT:
+    {
+        if (lhs.isNumber) return Result(lhs.number() > rhs.number());
+        else return Result(lhs.string() > rhs.string());
+    }
+    break;
+    case GTE:
+    {
+        if (lhs.isNumber) return Result(lhs.number() >= rhs.number());
+        else return Result(lhs.string() >= rhs.string());
+    }
+    break;
+
+    case ELVIS:
+    {
+        // it was evaluated above, which is kinda cheating
+        // but its optimal and this is a special case.
+        if (lhs.isNumber && lhs.number()) return Result(lhs.number());
+        else return Result(rhs.number());
+    }
+    case MATCHES:
+        if (!lhs.isNumber && !rhs.isNumber) return Result(QRegExp(rhs.string()).exactMatch(lhs.string()));
+        else return Result(false);
+        break;
+
+    case ENDSWITH:
+        if (!lhs.isNumber && !rhs.isNumber) return Result(lhs.string().endsWith(rhs.string()));
+        else return Result(false);
+        break;
+
+    case BEGINSWITH:
+        if (!lhs.isNumber && !rhs.isNumber) return Result(lhs.string().startsWith(rhs.string()));
+        else return Result(false);
+        break;
+
+    case CONTAINS:
+        {
+        if (!lhs.isNumber && !rhs.isNumber) {
+            if (lhs.isVector()) return Result(lhs.asString().contains(rhs.string()));
+            else return Result(lhs.string().contains(rhs.string()) ? true : false);
+        } else return Result(false);
+        }
+        break;
+
+    default:
+        break;
+    }
+    return Result(0);
+}
+
 Result Leaf::eval(DataFilterRuntime *df, Leaf *leaf, const Result &x, long it, RideItem *m, RideFilePoint *p, const QHash<QString,RideMetric*> *c, Specification s, DateRange d)
 {
     // if error state all bets are off
@@ -3087,6 +3377,13 @@ Result Leaf::eval(DataFilterRuntime *df, Leaf *leaf, const Result &x, long it, R
             return res;
         }
 
+        // expensive builtins are memoised for the athlete
+        if (p == NULL && m && df->memoising != leaf) {
+            QHash<Leaf*, QSharedPointer<DataFilterMemo> >::const_iterator memo = df->memos.constFind(leaf);
+            if (memo != df->memos.constEnd() && m->context->athlete && m->context->athlete->filterCache)
+                return m->context->athlete->filterCache->evaluate(df, leaf, *memo.value(), x, it, m, c, s, d);
+        }
+
         if (leaf->function == "isNumber") {
             return eval(df, leaf->fparms[0],x, it, m, p, c, s, d).isNumber;
         }
@@ -6492,155 +6789,8 @@ Result Leaf::eval(DataFilterRuntime *df, Leaf *leaf, const Result &x, long it, R
 
         break;
 
-        // basic operations should all work with vectors or numbers
-        case ADD:
-        case SUBTRACT:
-        case DIVIDE:
-        case MULTIPLY:
-        case POW:
-        {
-            Result returning(0);
-
-            // only if numberic on both sides
-            if (lhs.isNumber && rhs.isNumber) {
-
-
-                // its a vector operation...
-                if (lhs.asNumeric().count() || rhs.asNumeric().count()) {
-
-                    int size = lhs.asNumeric().count() > rhs.asNumeric().count() ? lhs.asNumeric().count() : rhs.asNumeric().count();
-
-                    // coerce both into a vector of matching size
-                    lhs.vectorize(size);
-                    rhs.vectorize(size);
-
-                    for(int i=0; i<size; i++) {
-                        double left = lhs.asNumeric()[i];
-                        double right = rhs.asNumeric()[i];
-                        double value = 0;
-
-                        switch (leaf->op) {
-                        case ADD: value = left + right; break;
-                        case SUBTRACT: value = left - right; break;
-                        case DIVIDE: value = right ? left / right : 0; break;
-                        case MULTIPLY: value = left * right; break;
-                        case POW: value = pow(left,right); break;
-                        }
-                        returning.asNumeric() << value;
-                        returning.number() += value;
-                    }
-
-                } else {
-                    switch (leaf->op) {
-                    case ADD: returning.number() = lhs.number() + rhs.number(); break;
-                    case SUBTRACT: returning.number() = lhs.number() - rhs.number(); break;
-                    case DIVIDE: returning.number() = rhs.number() ? lhs.number() / rhs.number() : 0; break;
-                    case MULTIPLY: returning.number() = lhs.number() * rhs.number(); break;
-                    case POW: returning.number() = pow(lhs.number(), rhs.number()); break;
-                    }
-                }
-            } else {
-
-                // either the left or rhs is not a number, it is a string
-                // so we need to return a string result
-                returning.isNumber = false;
-
-                // basically add is the only meaningful operation to apply
-                // to string values; for vectors append, for string just concatenate
-                if (leaf->op == ADD) {
-                    if (lhs.isVector() || rhs.isVector()) {
-
-                        // create a bigger vector
-                        if (lhs.isVector()) returning.asString() << lhs.asString();
-                        else returning.asString() << lhs.string();
-                        if (rhs.isVector()) returning.asString() << rhs.asString();
-                        else returning.asString() << rhs.string();
-
-                    } else {
-                        // cat strings
-                        returning.string() = lhs.string() + rhs.string();
-                    }
-                } else {
-                    // just return the lhs
-                    returning = lhs;
-                }
-            }
-            return returning;
-        }
-        break;
-
-        case EQ:
-        {
-            if (lhs.isNumber) return Result(lhs.number() == rhs.number());
-            else return Result(lhs.string() == rhs.string());
-        }
-        break;
-
-        case NEQ:
-        {
-            if (lhs.isNumber) return Result(lhs.number() != rhs.number());
-            else return Result(lhs.string() != rhs.string());
-        }
-        break;
-
-        case LT:
-        {
-            if (lhs.isNumber) return Result(lhs.number() < rhs.number());
-            else return Result(lhs.string() < rhs.string());
-        }
-        break;
-        case LTE:
-        {
-            if (lhs.isNumber) return Result(lhs.number() <= rhs.number());
-            else return Result(lhs.string() <= rhs.string());
-        }
-        break;
-        case GT:
-        {
-            if (lhs.isNumber) return Result(lhs.number() > rhs.number());
-            else return Result(lhs.string() > rhs.string());
-        }
-        break;
-        case GTE:
-        {
-            if (lhs.isNumber) return Result(lhs.number() >= rhs.number());
-            else return Result(lhs.string() >= rhs.string());
-        }
-        break;
-
-        case ELVIS:
-        {
-            // it was evaluated above, which is kinda cheating
-            // but its optimal and this is a special case.
-            if (lhs.isNumber && lhs.number()) return Result(lhs.number());
-            else return Result(rhs.number());
-        }
-        case MATCHES:
-            if (!lhs.isNumber && !rhs.isNumber) return Result(QRegExp(rhs.string()).exactMatch(lhs.string()));
-            else return Result(false);
-            break;
-
-        case ENDSWITH:
-            if (!lhs.isNumber && !rhs.isNumber) return Result(lhs.string().endsWith(rhs.string()));
-            else return Result(false);
-            break;
-
-        case BEGINSWITH:
-            if (!lhs.isNumber && !rhs.isNumber) return Result(lhs.string().startsWith(rhs.string()));
-            else return Result(false);
-            break;
-
-        case CONTAINS:
-            {
-            if (!lhs.isNumber && !rhs.isNumber) {
-                if (lhs.isVector()) return Result(lhs.asString().contains(rhs.string()));
-                else return Result(lhs.string().contains(rhs.string()) ? true : false);
-            } else return Result(false);
-            }
-            break;
-
         default:
-            break;
+            return operate(leaf->op, lhs, rhs);
         }
     }
     break;
@@ -6834,19 +6984,14 @@ DFModel::fitData(QVector<double>&x, QVector<double>&y)
         startingparms << p.number();
     }
 
-    // get access to lmfit, single threaded :(
+    // get access to lmfit
     lm_control_struct control = lm_control_double;
     lm_status_struct status;
 
-    // use forwarder via global variable, so mutex around this !
-    calllmfit.lock();
-    calllmfitmodel = this;
-
+    // the model is passed to the curve, so fits can run concurrently
     //fprintf(stderr, "Fitting ...\n" ); fflush(stderr);
-    lmcurve(parameters.count(), const_cast<double*>(startingparms.constData()), x.count(), x.constData(), y.constData(), calllmfitf, &control, &status);
-
-    // release for others
-    calllmfit.unlock();
+    lmcurve_r(parameters.count(), const_cast<double*>(startingparms.constData()), x.count(), x.constData(), y.constData(),
+              lmcurve_f<DFModel>, this, &control, &status);
 
     // starting parms now contain final output lets
     // update the runtime to get them back to the user
@@ -25,6 +25,7 @@
 #include <QList>
 #include <QMap>
 #include <QHash>
+#include <QSharedPointer>
 #include <QStringList>
 #include <QTextDocument>
 #include "RideCache.h"
@@ -107,6 +108,8 @@ class Result {
 };
 
 class DataFilterRuntime;
+class DataFilterProgram;
+struct DataFilterMemo;
 class Leaf {
     Q_DECLARE_TR_FUNCTIONS(Leaf)
 
@@ -126,6 +129,12 @@ class Leaf {
         //
         Result eval(DataFilterRuntime *df, Leaf *, const Result &x, long it, RideItem *m, RideFilePoint *p = NULL, const QHash<QString,RideMetric*> *metrics=NULL, Specification spec=Specification(), DateRange d=DateRange());
 
+        // apply a binary operator to evaluated operands
+        static Result operate(int op, Result &lhs, Result &rhs);
+
+        // symbols like Date, x and isRun that aren't metrics or metadata
+        static bool isSpecial(const QString &symbol);
+
         // tree traversal etc
         void print(int level, DataFilterRuntime*);  // print leaf and all children
         void color(Leaf *, QTextDocument *);  // update the document to match
@@ -163,6 +172,43 @@ class Leaf {
         RideFile::XDataJoin xjoin; // how to join xdata with main
 };
 
+// user defined symbols, each one has a slot that is allocated
+// the first time it is seen so compiled programs can refer to
+// it by index rather than looking it up by name every time
+class DataFilterSymbols {
+
+    public:
+
+        // same semantics as QHash<QString,Result>
+        bool contains(const QString &name) const { int s=index.value(name, -1); return s >= 0 && defined[s]; }
+        Result value(const QString &name) const { int s=index.value(name, -1); return s >= 0 && defined[s] ? values[s] : Result(); }
+        void insert(const QString &name, const Result &value) { int s=slot(name); values[s] = value; defined[s] = true; }
+        void clear() { index.clear(); values.clear(); defined.clear(); }
+
+        // slot for name, allocating one if needed
+        int slot(const QString &name) {
+            int s = index.value(name, -1);
+            if (s < 0) {
+                s = values.count();
+                index.insert(name, s);
+                values.append(Result());
+                defined.append(false);
+            }
+            return s;
+        }
+
+        // access by slot
+        bool isDefined(int slot) const { return defined[slot]; }
+        const Result &at(int slot) const { return values[slot]; }
+        void set(int slot, const Result &value) { values[slot] = value; defined[slot] = true; }
+
+    private:
+
+        QHash<QString, int> index;
+        QVector<Result> values;
+        QVector<bool> defined;
+};
+
 class UserChart;
 class DataFilterRuntime {
 
@@ -190,7 +236,7 @@ public:
     QStringList dataSeriesSymbols;
 
     // user defined symbols
-    QHash<QString, Result> symbols;
+    DataFilterSymbols symbols;
 
     // user defined functions
     QHash<QString, Leaf*> functions;
@@ -200,6 +246,23 @@ public:
     // pd models for estimates
     QList <PDModel*>models;
 
+    // compiled programs for the root and each user function, these
+    // are immutable so are shared when the runtime is copied
+    QHash<Leaf*, QSharedPointer<DataFilterProgram> > programs;
+    void compile(Leaf *root, bool optimise=true);
+
+    // calls to expensive builtins that can be memoised, see DataFilterCache
+    QHash<Leaf*, QSharedPointer<DataFilterMemo> > memos;
+    Leaf *memoising; // the call being computed for the cache
+
+    // evaluate leaf, using its compiled program if it has one
+    Result run(Leaf *leaf, const Result &x, long it, RideItem *m, RideFilePoint *p = NULL, const QHash<QString,RideMetric*> *metrics=NULL,
+               const Specification &spec=Specification(), const DateRange &d=DateRange());
+
+    // evaluate leaf for each sample, a chunk at a time if it can be
+    void runSamples(Leaf *leaf, RideItem *m, RideFileIterator &samples, const QHash<QString,RideMetric*> *metrics=NULL,
+                    const Specification &spec=Specification(), const DateRange &d=DateRange());
+
 #ifdef GC_WANT_PYTHON
     // embedded python runtime
     double runPythonScript(Context *context, QString script, RideItem *m, const QHash<QString,RideMetric*> *metrics, Specification spec);
@@ -263,6 +326,9 @@ class DataFilter : public QObject
     private:
         void setSignature(QString &query);
 
+        // filenames of the rides that pass the filter
+        QStringList passing();
+
         Leaf *treeRoot;
         QStringList errors;
 
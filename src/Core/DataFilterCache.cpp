@@ -0,0 +1,325 @@
+/*
+ * Copyright (c) 2020 Mark Liversedge (liversedge@gmail.com)
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by the Free
+ * Software Foundation; either version 2 of the License, or (at your option)
+ * any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License for
+ * more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc., 51
+ * Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+#include "DataFilterCache.h"
+#include "Specification.h"
+#include "RideItem.h"
+#include "Context.h"
+
+#include <QDate>
+
+#include "DataFilter_yacc.h"
+
+// when we have this many results we start again, a chart
+// refresh rarely needs more than a few hundred
+static const int MAXRESULTS = 10000;
+
+// the builtins worth memoising
+static bool memoised(const QString &function)
+{
+    return function == "meanmax" || function == "pmc" || function == "banister" ||
+           function == "estimate" || function == "estimates" || function == "tests" ||
+           function == "measure" || function == "measures" || function == "metrics";
+}
+
+// builtins that have side effects or don't return the same
+// result each time, calls that use them can't be memoised
+static bool isVolatile(const QString &function)
+{
+    return function == "random" || function == "set" || function == "unset" ||
+           function == "store" || function == "fetch" || function == "autoprocess" ||
+           function == "postprocess" || function == "print" || function == "annotate" ||
+           function == "append" || function == "remove" || function == "multisort" ||
+           function == "curve";
+}
+
+bool
+DataFilterCache::describe(DataFilterRuntime *df, Leaf *leaf, QString &text, DataFilterMemo &memo)
+{
+    switch(leaf->type) {
+
+    case Leaf::Float : text += QString::number(leaf->lvalue.f, 'g', 9); return true;
+    case Leaf::Integer : text += QString::number(leaf->lvalue.i); return true;
+    case Leaf::String : text += "\"" + *(leaf->lvalue.s) + "\""; return true;
+
+    case Leaf::Symbol :
+        {
+            QString symbol = *(leaf->lvalue.n);
+
+            // the ride that is selected, not the one we're evaluating
+            if (symbol == "Current") return false;
+
+            if (!symbol.compare("x", Qt::CaseInsensitive)) memo.x = true;
+            else if (!symbol.compare("i", Qt::CaseInsensitive)) memo.i = true;
+            else if (!Leaf::isSpecial(symbol) && !memo.symbols.contains(symbol)) memo.symbols << symbol;
+            if (df->dataSeriesSymbols.contains(symbol)) memo.sample = true;
+
+            text += symbol;
+            return true;
+        }
+
+    case Leaf::Logical :
+    case Leaf::Operation :
+    case Leaf::BinaryOperation :
+        {
+            if (leaf->type == Leaf::Operation && leaf->op == ASSIGN) return false;
+
+            text += "(";
+            if (!describe(df, leaf->lvalue.l, text, memo)) return false;
+            if (leaf->op) {
+                text += QString(" %1 ").arg(leaf->op);
+                if (!describe(df, leaf->rvalue.l, text, memo)) return false;
+            }
+            text += ")";
+            return true;
+        }
+
+    case Leaf::UnaryOperation :
+        text += QString("(%1 ").arg(leaf->op);
+        if (!describe(df, leaf->lvalue.l, text, memo)) return false;
+        text += ")";
+        return true;
+
+    case Leaf::Function :
+        {
+            if (df->functions.contains(leaf->function) || isVolatile(leaf->function)) return false;
+
+            // xdata is interpolated at the current sample
+            if (leaf->function == "xdata" || leaf->function == "XDATA" || leaf->function == "XDATA_UNITS") memo.sample = true;
+
+            text += leaf->function + "(";
+            if (leaf->series) {
+                text += *(leaf->series->lvalue.n);
+                if (leaf->lvalue.l) {
+                    text += ",";
+                    if (!describe(df, leaf->lvalue.l, text, memo)) return false;
+                }
+            } else {
+                for(int i=0; i<leaf->fparms.count(); i++) {
+                    if (i) text += ",";
+                    if (!describe(df, leaf->fparms[i], text, memo)) return false;
+                }
+            }
+            text += ")";
+            return true;
+        }
+
+    case Leaf::Index :
+    case Leaf::Select :
+        if (!describe(df, leaf->lvalue.l, text, memo)) return false;
+        text += leaf->type == Leaf::Index ? "[" : "[[";
+        if (!describe(df, leaf->fparms[0], text, memo)) return false;
+        text += leaf->type == Leaf::Index ? "]" : "]]";
+        return true;
+
+    case Leaf::Conditional :
+        text += QString("(%1 ").arg(leaf->op); // if or while
+        if (!describe(df, leaf->cond.l, text, memo)) return false;
+        text += " ? ";
+        if (!describe(df, leaf->lvalue.l, text, memo)) return false;
+        if (leaf->rvalue.l) {
+            text += " : ";
+            if (!describe(df, leaf->rvalue.l, text, memo)) return false;
+        }
+        text += ")";
+        return true;
+
+    default:
+        // blocks and scripts
+        return false;
+    }
+}
+
+void
+DataFilterCache::plan(DataFilterRuntime *df, Leaf *leaf, QHash<Leaf*, QSharedPointer<DataFilterMemo> > &memos)
+{
+    if (leaf == NULL) return;
+
+    switch(leaf->type) {
+
+    case Leaf::Compound :
+        foreach(Leaf *statement, *(leaf->lvalue.b)) plan(df, statement, memos);
+        break;
+
+    case Leaf::Logical :
+    case Leaf::Operation :
+    case Leaf::BinaryOperation :
+        plan(df, leaf->lvalue.l, memos);
+        if (leaf->op) plan(df, leaf->rvalue.l, memos);
+        break;
+
+    case Leaf::UnaryOperation :
+        plan(df, leaf->lvalue.l, memos);
+        break;
+
+    case Leaf::Index :
+    case Leaf::Select :
+        plan(df, leaf->lvalue.l, memos);
+        plan(df, leaf->fparms[0], memos);
+        break;
+
+    case Leaf::Conditional :
+        plan(df, leaf->cond.l, memos);
+        plan(df, leaf->lvalue.l, memos);
+        plan(df, leaf->rvalue.l, memos);
+        break;
+
+    case Leaf::Function :
+        {
+            if (leaf->series) {
+                plan(df, leaf->lvalue.l, memos);
+                break;
+            }
+            foreach(Leaf *parameter, leaf->fparms) plan(df, parameter, memos);
+
+            if (!memoised(leaf->function) || df->functions.contains(leaf->function)) break;
+
+            QSharedPointer<DataFilterMemo> memo(new DataFilterMemo());
+            memo->x = memo->i = memo->sample = false;
+            if (describe(df, leaf, memo->call, *memo)) memos.insert(leaf, memo);
+        }
+        break;
+
+    default:
+        break;
+    }
+}
+
+DataFilterCache::DataFilterCache(Context *context, QObject *parent) : QObject(parent), context(context), stamp(0), hits_(0), misses_(0)
+{
+    // anything that changes the athlete's data
+    connect(context, SIGNAL(configChanged(qint32)), this, SLOT(invalidate()));
+    connect(context, SIGNAL(rideAdded(RideItem*)), this, SLOT(invalidate()));
+    connect(context, SIGNAL(rideDeleted(RideItem*)), this, SLOT(invalidate()));
+    connect(context, SIGNAL(rideChanged(RideItem*)), this, SLOT(invalidate()));
+    connect(context, SIGNAL(rideSaved(RideItem*)), this, SLOT(invalidate()));
+    connect(context, SIGNAL(intervalsUpdate(RideItem*)), this, SLOT(invalidate()));
+    connect(context, SIGNAL(filterChanged()), this, SLOT(invalidate()));
+    connect(context, SIGNAL(homeFilterChanged()), this, SLOT(invalidate()));
+    connect(context, SIGNAL(estimatesRefreshed()), this, SLOT(invalidate()));
+    connect(context, SIGNAL(refreshEnd()), this, SLOT(invalidate()));
+}
+
+void
+DataFilterCache::invalidate()
+{
+    // bump first, so results computed from stale data aren't kept
+    stamp.fetchAndAddOrdered(1);
+
+    QMutexLocker locker(&lock);
+    results.clear();
+}
+
+// append a value to the key
+static void digest(QString &key, Result value)
+{
+    if (value.isVector()) {
+        if (value.isNumber) key += QString("[%1:%2]").arg(value.asNumeric().count()).arg(qHashRange(value.asNumeric().constBegin(), value.asNumeric().constEnd()));
+        else key += QString("[%1:%2]").arg(value.asString().count()).arg(qHashRange(value.asString().constBegin(), value.asString().constEnd()));
+    } else {
+        if (value.isNumber) key += QString::number(value.number(), 'g', 17);
+        else key += "\"" + value.string() + "\"";
+    }
+}
+
+QString
+DataFilterCache::key(DataFilterRuntime *df, const DataFilterMemo &memo, int version, const Result &x, long it, RideItem *m,
+                     const Specification &s, const DateRange &d) const
+{
+    QString returning = QString("%1|%2|%3|%4|%5|%6|%7")
+                        .arg(version)
+                        .arg(memo.call)
+                        .arg(quintptr(m))
+                        .arg(s.signature())
+                        .arg(d.from.toString(Qt::ISODate))
+                        .arg(d.to.toString(Qt::ISODate))
+                        .arg(QDate::currentDate().toString(Qt::ISODate));
+
+    if (memo.x) { returning += "|x="; digest(returning, x); }
+    if (memo.i) returning += QString("|i=%1").arg(it);
+
+    // user symbols the arguments refer to, the rest are
+    // metrics and metadata of the ride or specials like Date
+    foreach(const QString &symbol, memo.symbols) {
+        if (!df->symbols.contains(symbol)) continue;
+        returning += "|" + symbol + "=";
+        digest(returning, df->symbols.value(symbol));
+    }
+    return returning;
+}
+
+Result
+DataFilterCache::evaluate(DataFilterRuntime *df, Leaf *leaf, const DataFilterMemo &memo, const Result &x, long it, RideItem *m,
+                          const QHash<QString,RideMetric*> *c, const Specification &s, const DateRange &d)
+{
+    int version = stamp.load();
+    QString k = key(df, memo, version, x, it, m, s, d);
+
+    lock.lock();
+    QHash<QString, Result>::const_iterator found = results.constFind(k);
+    if (found != results.constEnd()) {
+        Result returning = found.value();
+        hits_++;
+        lock.unlock();
+        return returning;
+    }
+    misses_++;
+    lock.unlock();
+
+    // compute it, eval won't come back here for this leaf
+    Leaf *memoising = df->memoising;
+    df->memoising = leaf;
+    Result returning = leaf->eval(df, leaf, x, it, m, NULL, c, s, d);
+    df->memoising = memoising;
+
+    // data changed whilst we were busy, so don't keep it
+    QMutexLocker locker(&lock);
+    if (version == stamp.load()) {
+        if (results.count() >= MAXRESULTS) results.clear();
+        results.insert(k, returning);
+    }
+    return returning;
+}
+
+quint64
+DataFilterCache::hits() const
+{
+    QMutexLocker locker(&lock);
+    return hits_;
+}
+
+quint64
+DataFilterCache::misses() const
+{
+    QMutexLocker locker(&lock);
+    return misses_;
+}
+
+double
+DataFilterCache::hitRate() const
+{
+    QMutexLocker locker(&lock);
+    return (hits_ + misses_) ? double(hits_) / double(hits_ + misses_) : 0;
+}
+
+int
+DataFilterCache::count() const
+{
+    QMutexLocker locker(&lock);
+    return results.count();
+}
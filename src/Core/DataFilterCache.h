@@ -0,0 +1,108 @@
+/*
+ * Copyright (c) 2020 Mark Liversedge (liversedge@gmail.com)
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by the Free
+ * Software Foundation; either version 2 of the License, or (at your option)
+ * any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License for
+ * more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc., 51
+ * Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+#ifndef _GC_DataFilterCache_h
+#define _GC_DataFilterCache_h 1
+
+#include "DataFilter.h"
+
+#include <QObject>
+#include <QHash>
+#include <QMutex>
+#include <QString>
+#include <QStringList>
+#include <QAtomicInt>
+#include <QSharedPointer>
+
+class Context;
+
+//
+// Memoised DataFilter builtins
+//
+// Builtins like meanmax(), pmc(), banister(), estimate(), tests(),
+// measure() and metrics() aggregate across the ride cache, PMC data
+// or the .cpx files, and a chart refresh will often call them many
+// times with exactly the same arguments, e.g. once per series on a
+// user chart, or once per ride for a user metric.
+//
+// So their results are kept in a cache for the athlete, which is
+// shared by every formula (user charts, LTM formula curves and user
+// metrics). The key is the call itself (as text), the values of any
+// user symbols and x/i that the arguments refer to, the ride, the
+// specification and date range being evaluated and a version stamp
+// for the athlete's data, which is bumped whenever rides are added,
+// removed or changed, the filters change or the config changes.
+//
+// A call is only memoised if its arguments are free of side effects;
+// no user functions, assignments, random numbers and so on. Which
+// calls qualify is worked out when the program is compiled.
+//
+struct DataFilterMemo {
+    QString call;           // the call and its arguments, as text
+    QStringList symbols;    // user symbols the arguments refer to
+    bool x, i;              // arguments refer to x or i
+    bool sample;            // arguments refer to the current sample
+};
+
+class DataFilterCache : public QObject
+{
+    Q_OBJECT
+
+    public:
+
+        DataFilterCache(Context *context, QObject *parent);
+
+        // write the expression as text, collecting the symbols it refers to,
+        // returns false if it has side effects so can't be memoised
+        static bool describe(DataFilterRuntime *df, Leaf *leaf, QString &text, DataFilterMemo &memo);
+
+        // find calls that can be memoised in the tree rooted at leaf
+        static void plan(DataFilterRuntime *df, Leaf *leaf, QHash<Leaf*, QSharedPointer<DataFilterMemo> > &memos);
+
+        // evaluate a memoised call, from the cache if we can
+        Result evaluate(DataFilterRuntime *df, Leaf *leaf, const DataFilterMemo &memo, const Result &x, long it, RideItem *m,
+                        const QHash<QString,RideMetric*> *c, const Specification &s, const DateRange &d);
+
+        // bumped whenever the athlete's data changes
+        int version() const { return stamp.load(); }
+
+        // hit rate
+        quint64 hits() const;
+        quint64 misses() const;
+        double hitRate() const;
+        int count() const;
+
+    public slots:
+
+        // data changed, anything we have is stale
+        void invalidate();
+
+    private:
+
+        QString key(DataFilterRuntime *df, const DataFilterMemo &memo, int version, const Result &x, long it, RideItem *m,
+                    const Specification &s, const DateRange &d) const;
+
+        Context *context;
+
+        QAtomicInt stamp;
+        mutable QMutex lock;
+        QHash<QString, Result> results;
+        quint64 hits_, misses_;
+};
+
+#endif // _GC_DataFilterCache_h
@@ -0,0 +1,915 @@
+/*
+ * Copyright (c) 2020 Mark Liversedge (liversedge@gmail.com)
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by the Free
+ * Software Foundation; either version 2 of the License, or (at your option)
+ * any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License for
+ * more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc., 51
+ * Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+#include "DataFilterProgram.h"
+#include "DataFilterCache.h"
+#include "RideFile.h"
+#include "RideItem.h"
+#include "RideMetric.h"
+#include "Context.h"
+#include "Athlete.h"
+
+#include <QDate>
+#include <QDebug>
+#include <QVarLengthArray>
+#include <cmath>
+
+#include "DataFilter_yacc.h"
+
+// user symbols the formula assigns to, and whether it changes
+// rides or symbols in place, so we know what values can be reused
+static void findWrites(Leaf *leaf, QSet<QString> &assigned, bool &writes)
+{
+    if (leaf == NULL) return;
+
+    switch(leaf->type) {
+
+    case Leaf::Script :
+        writes = true; // could do anything
+        break;
+
+    case Leaf::Compound :
+        foreach(Leaf *statement, *(leaf->lvalue.b)) findWrites(statement, assigned, writes);
+        break;
+
+    case Leaf::Logical :
+    case Leaf::Operation :
+    case Leaf::BinaryOperation :
+        if (leaf->type != Leaf::Logical && leaf->op == ASSIGN) {
+            Leaf *target = leaf->lvalue.l;
+            if (target->type == Leaf::Index) target = target->lvalue.l;
+            if (target->type == Leaf::Symbol) assigned << *(target->lvalue.n);
+            else writes = true;
+        }
+        findWrites(leaf->lvalue.l, assigned, writes);
+        if (leaf->op) findWrites(leaf->rvalue.l, assigned, writes);
+        break;
+
+    case Leaf::UnaryOperation :
+        findWrites(leaf->lvalue.l, assigned, writes);
+        break;
+
+    case Leaf::Index :
+    case Leaf::Select :
+        findWrites(leaf->lvalue.l, assigned, writes);
+        findWrites(leaf->fparms[0], assigned, writes);
+        break;
+
+    case Leaf::Conditional :
+        findWrites(leaf->cond.l, assigned, writes);
+        findWrites(leaf->lvalue.l, assigned, writes);
+        findWrites(leaf->rvalue.l, assigned, writes);
+        break;
+
+    case Leaf::Function :
+        {
+            if (leaf->series) {
+                findWrites(leaf->lvalue.l, assigned, writes);
+                break;
+            }
+            foreach(Leaf *parameter, leaf->fparms) findWrites(parameter, assigned, writes);
+
+            // updating symbols in place
+            if (leaf->function == "append" || leaf->function == "remove" || leaf->function == "multisort") {
+                foreach(Leaf *parameter, leaf->fparms)
+                    if (parameter->type == Leaf::Symbol) assigned << *(parameter->lvalue.n);
+            }
+
+            // updating rides, or the athlete's storage
+            if (leaf->function == "set" || leaf->function == "unset" || leaf->function == "store" ||
+                leaf->function == "autoprocess" || leaf->function == "postprocess") writes = true;
+        }
+        break;
+
+    default:
+        break;
+    }
+}
+
+DataFilterProgram::DataFilterProgram(DataFilterRuntime *df, Leaf *leaf, Leaf *root, bool loop, bool optimise) :
+    writes(false), loop(loop), optimise(optimise), keeping(false)
+{
+    // metadata ids are for the athlete's dictionary
+    Context *context = df->owner ? df->owner->context : NULL;
+    if (context && context->athlete) dictionary = MetadataDictionary::dictionary(context->athlete->cyclist);
+    metricCount = RideMetricFactory::instance().metricCount();
+    pure = true;
+
+    // what the formula changes, and which calls are repeated
+    findWrites(root ? root : leaf, assigned, writes);
+    foreach(Leaf *function, df->functions) findWrites(function, assigned, writes);
+    countCalls(df, leaf);
+
+    compile(df, leaf);
+    compileReduction(df, leaf);
+}
+
+int
+DataFilterProgram::emit(opcode op, int arg)
+{
+    if (op == Eval || op == Call || op == Store) pure = false;
+    code << instruction(op, arg);
+    return code.count() - 1;
+}
+
+int
+DataFilterProgram::constant(const Result &value)
+{
+    constants << value;
+    return constants.count() - 1;
+}
+
+int
+DataFilterProgram::resolve(DataFilterRuntime *df, Leaf *leaf)
+{
+    QString name = *(leaf->lvalue.n);
+
+    symbol sym;
+    sym.leaf = leaf;
+    sym.slot = df->symbols.slot(name);
+    sym.series = df->dataSeriesSymbols.contains(name) ? static_cast<int>(RideFile::seriesForSymbol(name)) : -1;
+    sym.name = df->lookupMap.value(name, "");
+    sym.metric = -1;
+    sym.key = -1;
+
+    if (Leaf::isSpecial(name)) {
+        sym.kind = symbol::Special;
+
+        // the coggan PMC symbols create the PMC data when first used
+        if (!name.compare("ctl", Qt::CaseInsensitive) || !name.compare("atl", Qt::CaseInsensitive) ||
+            !name.compare("tsb", Qt::CaseInsensitive)) pure = false;
+    } else {
+        sym.kind = df->lookupType.value(name) ? symbol::Number : symbol::String;
+
+        const RideMetric *metric = RideMetricFactory::instance().rideMetric(sym.name);
+        if (metric) sym.metric = metric->index();
+        if (dictionary) sym.key = dictionary->intern(sym.name);
+    }
+
+    symbols << sym;
+    return symbols.count() - 1;
+}
+
+int
+DataFilterProgram::fallback(Leaf *leaf)
+{
+    int index = leaves.indexOf(leaf);
+    if (index < 0) {
+        leaves << leaf;
+        index = leaves.count() - 1;
+    }
+    return index;
+}
+
+// evaluate constant expressions, the same way the program would
+bool
+DataFilterProgram::fold(Leaf *leaf, Result &value) const
+{
+    if (!optimise) return false;
+
+    switch(leaf->type) {
+
+    case Leaf::Float :
+        value = Result(leaf->lvalue.f);
+        return true;
+
+    case Leaf::Integer :
+        value = Result(leaf->lvalue.i);
+        return true;
+
+    case Leaf::String :
+        {
+            QString string = *(leaf->lvalue.s);
+            QDate date = QDate::fromString(string, "yyyy/MM/dd");
+            if (date.isValid()) value = Result(QDate(1900,01,01).daysTo(date));
+            else value = Result(string);
+        }
+        return true;
+
+    case Leaf::Logical :
+        {
+            if (leaf->op != AND && leaf->op != OR) return fold(leaf->lvalue.l, value); // parenthesis
+
+            // the lhs may be enough
+            Result left, right;
+            if (!fold(leaf->lvalue.l, left)) return false;
+            bool truth = left.isNumber && left.number();
+            if (truth == (leaf->op == OR)) {
+                value = Result(truth);
+                return true;
+            }
+            if (!fold(leaf->rvalue.l, right)) return false;
+            value = Result(right.isNumber && right.number());
+        }
+        return true;
+
+    case Leaf::UnaryOperation :
+        {
+            Result operand;
+            if (!fold(leaf->lvalue.l, operand)) return false;
+            if (leaf->op == '-') value = Result(operand.number() * -1);
+            else if (leaf->op == '!') value = Result(!operand.number());
+            else value = Result(0);
+        }
+        return true;
+
+    case Leaf::BinaryOperation :
+    case Leaf::Operation :
+        {
+            if (leaf->op == ASSIGN) return false;
+
+            Result lhs, rhs;
+            if (!fold(leaf->lvalue.l, lhs)) return false;
+            if (leaf->op == ELVIS) {
+                if (lhs.number()) value = Result(lhs.isNumber ? lhs.number() : 0);
+                else if (fold(leaf->rvalue.l, rhs)) value = Result(rhs.number());
+                else return false;
+                return true;
+            }
+            if (!fold(leaf->rvalue.l, rhs)) return false;
+            value = Leaf::operate(leaf->op, lhs, rhs);
+        }
+        return true;
+
+    case Leaf::Conditional :
+        {
+            if (leaf->op != IF_ && leaf->op != 0) return false;
+
+            Result condition;
+            if (!fold(leaf->cond.l, condition)) return false;
+            if (condition.isNumber && condition.number()) return fold(leaf->lvalue.l, value);
+            if (leaf->rvalue.l) return fold(leaf->rvalue.l, value);
+            value = Result(0);
+        }
+        return true;
+
+    default:
+        return false;
+    }
+}
+
+// count the calls to builtins that the program makes
+void
+DataFilterProgram::countCalls(DataFilterRuntime *df, Leaf *leaf)
+{
+    if (leaf == NULL) return;
+
+    switch(leaf->type) {
+
+    case Leaf::Compound :
+        foreach(Leaf *statement, *(leaf->lvalue.b)) countCalls(df, statement);
+        break;
+
+    case Leaf::Logical :
+    case Leaf::Operation :
+    case Leaf::BinaryOperation :
+        countCalls(df, leaf->lvalue.l);
+        if (leaf->op) countCalls(df, leaf->rvalue.l);
+        break;
+
+    case Leaf::UnaryOperation :
+        countCalls(df, leaf->lvalue.l);
+        break;
+
+    case Leaf::Conditional :
+        countCalls(df, leaf->cond.l);
+        countCalls(df, leaf->lvalue.l);
+        countCalls(df, leaf->rvalue.l);
+        break;
+
+    case Leaf::Function :
+        {
+            if (df->functions.contains(leaf->function)) break;
+
+            DataFilterMemo memo;
+            memo.x = memo.i = memo.sample = false;
+            QString text;
+            if (DataFilterCache::describe(df, leaf, text, memo)) calls[text]++;
+        }
+        break;
+
+    default:
+        break;
+    }
+}
+
+// register for the value of leaf if it is worth keeping, or -1
+int
+DataFilterProgram::reusable(DataFilterRuntime *df, Leaf *leaf)
+{
+    if (!optimise) return -1;
+
+    // only calls are repeated outside the sample function
+    if (!loop && leaf->type != Leaf::Function) return -1;
+
+    // lookups and calls, and operators using them
+    switch(leaf->type) {
+    case Leaf::Function :
+        if (df->functions.contains(leaf->function)) return -1;
+        break;
+    case Leaf::Symbol :
+    case Leaf::Logical :
+    case Leaf::Operation :
+    case Leaf::BinaryOperation :
+    case Leaf::UnaryOperation :
+    case Leaf::Conditional :
+    case Leaf::Index :
+    case Leaf::Select :
+        break;
+    default:
+        return -1;
+    }
+
+    // the value must be the same whenever we use it
+    if (writes) return -1;
+    DataFilterMemo memo;
+    memo.x = memo.i = memo.sample = false;
+    QString text;
+    if (!DataFilterCache::describe(df, leaf, text, memo)) return -1;
+    foreach(const QString &symbol, memo.symbols)
+        if (assigned.contains(symbol)) return -1;
+
+    // calls made more than once, or in the sample
+    // function anything that doesn't use the sample
+    bool invariant = loop && !memo.x && !memo.i && !memo.sample;
+    if (!invariant && !(leaf->type == Leaf::Function && calls.value(text) > 1)) return -1;
+
+    int reg = reused.value(text, -1);
+    if (reg < 0) {
+        reg = invariants.count();
+        reused.insert(text, reg);
+        invariants << invariant;
+    }
+    return reg;
+}
+
+void
+DataFilterProgram::compile(DataFilterRuntime *df, Leaf *leaf)
+{
+    // constant expressions are evaluated now
+    Result value;
+    if (fold(leaf, value)) {
+        emit(Const, constant(value));
+        return;
+    }
+
+    // reused values are computed the first time and kept in a register
+    int reg = keeping ? -1 : reusable(df, leaf);
+    if (reg < 0) {
+        generate(df, leaf);
+        return;
+    }
+
+    int fetch = emit(Fetch, fetches.count());
+    fetches << QPair<int,int>(reg, 0);
+    keeping = true;
+    generate(df, leaf);
+    keeping = false;
+    emit(Keep, reg);
+    fetches[code[fetch].arg].second = code.count();
+}
+
+void
+DataFilterProgram::generate(DataFilterRuntime *df, Leaf *leaf)
+{
+    switch(leaf->type) {
+
+    case Leaf::Float :
+        emit(Const, constant(Result(leaf->lvalue.f)));
+        break;
+
+    case Leaf::Integer :
+        emit(Const, constant(Result(leaf->lvalue.i)));
+        break;
+
+    case Leaf::String :
+        {
+            // dates are returned as numbers, same as Leaf::eval
+            QString string = *(leaf->lvalue.s);
+            QDate date = QDate::fromString(string, "yyyy/MM/dd");
+            if (date.isValid()) emit(Const, constant(Result(QDate(1900,01,01).daysTo(date))));
+            else emit(Const, constant(Result(string)));
+        }
+        break;
+
+    case Leaf::Logical :
+        {
+            switch (leaf->op) {
+            case AND :
+            case OR :
+                {
+                    // a constant lhs didn't decide it (else we'd have folded), so it's the rhs
+                    Result left;
+                    if (fold(leaf->lvalue.l, left)) {
+                        compile(df, leaf->rvalue.l);
+                        int otherwise = emit(JumpIfFalse);
+                        emit(Const, constant(Result(true)));
+                        int end = emit(Jump);
+                        code[otherwise].arg = emit(Const, constant(Result(false)));
+                        code[end].arg = code.count();
+                        break;
+                    }
+
+                    // short circuit, the result is always true or false
+                    compile(df, leaf->lvalue.l);
+                    int first = emit(leaf->op == AND ? JumpIfFalse : JumpIfTrue);
+                    compile(df, leaf->rvalue.l);
+                    int second = emit(leaf->op == AND ? JumpIfFalse : JumpIfTrue);
+                    emit(Const, constant(Result(leaf->op == AND)));
+                    int end = emit(Jump);
+                    code[first].arg = code[second].arg = emit(Const, constant(Result(leaf->op != AND)));
+                    code[end].arg = code.count();
+                }
+                break;
+
+            default : // parenthesis
+                compile(df, leaf->lvalue.l);
+                break;
+            }
+        }
+        break;
+
+    case Leaf::UnaryOperation :
+        {
+            compile(df, leaf->lvalue.l);
+            if (leaf->op == '-') emit(Negate);
+            else if (leaf->op == '!') emit(Not);
+            else {
+                emit(Pop);
+                emit(Const, constant(Result(0)));
+            }
+        }
+        break;
+
+    case Leaf::BinaryOperation :
+    case Leaf::Operation :
+        {
+            switch (leaf->op) {
+            case ASSIGN :
+                {
+                    // only plain symbols, assigning to an index is left to eval
+                    if (leaf->lvalue.l->type != Leaf::Symbol) {
+                        emit(Eval, fallback(leaf));
+                        break;
+                    }
+                    compile(df, leaf->rvalue.l);
+                    emit(Store, df->symbols.slot(*(leaf->lvalue.l->lvalue.n)));
+                }
+                break;
+
+            case ELVIS :
+                {
+                    // a constant lhs must be zero (else we'd have folded)
+                    Result lhs;
+                    if (fold(leaf->lvalue.l, lhs)) {
+                        compile(df, leaf->rvalue.l);
+                        emit(Number);
+                        break;
+                    }
+
+                    // only evaluate the rhs if the lhs is zero
+                    compile(df, leaf->lvalue.l);
+                    int elvis = emit(Elvis);
+                    compile(df, leaf->rvalue.l);
+                    emit(Number);
+                    code[elvis].arg = code.count();
+                }
+                break;
+
+            default :
+                compile(df, leaf->lvalue.l);
+                compile(df, leaf->rvalue.l);
+                emit(Operate, leaf->op);
+                break;
+            }
+        }
+        break;
+
+    case Leaf::Conditional :
+        {
+            // while loops are bounded and timed by the tree walker
+            if (leaf->op != IF_ && leaf->op != 0) {
+                emit(Eval, fallback(leaf));
+                break;
+            }
+
+            // only the branch that's taken if we know which
+            Result condition;
+            if (fold(leaf->cond.l, condition)) {
+                if (condition.isNumber && condition.number()) compile(df, leaf->lvalue.l);
+                else if (leaf->rvalue.l) compile(df, leaf->rvalue.l);
+                else emit(Const, constant(Result(0)));
+                break;
+            }
+
+            compile(df, leaf->cond.l);
+            int otherwise = emit(JumpIfFalse);
+            compile(df, leaf->lvalue.l);
+            int end = emit(Jump);
+            code[otherwise].arg = code.count();
+            if (leaf->rvalue.l) compile(df, leaf->rvalue.l);
+            else emit(Const, constant(Result(0)));
+            code[end].arg = code.count();
+        }
+        break;
+
+    case Leaf::Compound :
+        {
+            // value of the last statement
+            if (leaf->lvalue.b->isEmpty()) emit(Const, constant(Result(0)));
+            for(int i=0; i<leaf->lvalue.b->count(); i++) {
+                if (i) emit(Pop);
+                compile(df, leaf->lvalue.b->at(i));
+            }
+        }
+        break;
+
+    case Leaf::Function :
+        {
+            // user defined functions are called, builtins evaluated
+            if (df->functions.contains(leaf->function)) emit(Call, fallback(df->functions.value(leaf->function)));
+            else emit(Eval, fallback(leaf));
+        }
+        break;
+
+    case Leaf::Symbol :
+        emit(Load, resolve(df, leaf));
+        break;
+
+    default:
+        // indexing, selection and scripts
+        emit(Eval, fallback(leaf));
+        break;
+    }
+}
+
+void
+DataFilterProgram::compileReduction(DataFilterRuntime *df, Leaf *leaf)
+{
+    // must be a block of "a <- a + expr" or "a <- a - expr" statements
+    if (leaf->type != Leaf::Compound || leaf->lvalue.b->isEmpty()) return;
+
+    QStringList assigned;
+    foreach(Leaf *statement, *(leaf->lvalue.b)) {
+        if ((statement->type != Leaf::Operation && statement->type != Leaf::BinaryOperation) ||
+             statement->op != ASSIGN || statement->lvalue.l->type != Leaf::Symbol) return;
+        assigned << *(statement->lvalue.l->lvalue.n);
+    }
+
+    QVector<reduction> compiled;
+    foreach(Leaf *statement, *(leaf->lvalue.b)) {
+
+        // series override user symbols when iterating samples
+        QString name = *(statement->lvalue.l->lvalue.n);
+        if (df->dataSeriesSymbols.contains(name)) return;
+
+        Leaf *rhs = statement->rvalue.l;
+        if ((rhs->type != Leaf::Operation && rhs->type != Leaf::BinaryOperation) ||
+            (rhs->op != ADD && rhs->op != SUBTRACT)) return;
+
+        // which side is the accumulator, only the left for subtract
+        Leaf *expr = NULL;
+        Leaf *left = rhs->lvalue.l, *right = rhs->rvalue.l;
+        if (left->type == Leaf::Symbol && *(left->lvalue.n) == name) expr = right;
+        else if (rhs->op == ADD && right->type == Leaf::Symbol && *(right->lvalue.n) == name) expr = left;
+        if (expr == NULL) return;
+
+        // the expression can't depend on anything accumulated
+        reduction r;
+        r.slot = df->symbols.slot(name);
+        r.subtract = (rhs->op == SUBTRACT);
+        if (!vectorize(df, expr, assigned, r.code)) return;
+        compiled << r;
+    }
+    reductions = compiled;
+}
+
+bool
+DataFilterProgram::vectorize(DataFilterRuntime *df, Leaf *leaf, const QStringList &assigned, QVector<instruction> &code)
+{
+    switch(leaf->type) {
+
+    case Leaf::Float :
+        code << instruction(Constant, constant(Result(leaf->lvalue.f)));
+        return true;
+
+    case Leaf::Integer :
+        code << instruction(Constant, constant(Result(leaf->lvalue.i)));
+        return true;
+
+    case Leaf::Logical :
+        return leaf->op == 0 && vectorize(df, leaf->lvalue.l, assigned, code); // parenthesis
+
+    case Leaf::Operation :
+    case Leaf::BinaryOperation :
+        {
+            int op;
+            switch(leaf->op) {
+            case ADD: op = Add; break;
+            case SUBTRACT: op = Subtract; break;
+            case MULTIPLY: op = Multiply; break;
+            case DIVIDE: op = Divide; break;
+            case POW: op = Pow; break;
+            default: return false; // comparisons etc aren't elementwise
+            }
+            if (!vectorize(df, leaf->lvalue.l, assigned, code) || !vectorize(df, leaf->rvalue.l, assigned, code)) return false;
+            code << instruction(op, 0);
+        }
+        return true;
+
+    case Leaf::Symbol :
+        {
+            QString name = *(leaf->lvalue.n);
+            if (assigned.contains(name)) return false;
+
+            // series vary by sample, everything else is constant for the ride
+            if (df->dataSeriesSymbols.contains(name)) {
+                RideFile::SeriesType type = RideFile::seriesForSymbol(name);
+                if (type == RideFile::index) return false;
+                code << instruction(Series, static_cast<int>(type));
+                return true;
+            }
+
+            int index = resolve(df, leaf);
+            if (symbols[index].kind == symbol::String) return false;
+            code << instruction(Scalar, index);
+        }
+        return true;
+
+    default:
+        return false;
+    }
+}
+
+bool
+DataFilterProgram::runSamples(DataFilterRuntime *df, RideItem *m, const QVector<RideFilePoint*> &points,
+                              const QHash<QString,RideMetric*> *c, const Specification &s, const DateRange &d) const
+{
+    int n = points.count();
+    if (n == 0) return true;
+
+    // the accumulators must be plain numbers
+    foreach(const reduction &r, reductions) {
+        if (!df->symbols.isDefined(r.slot)) return false;
+        const Result &value = df->symbols.at(r.slot);
+        if (!value.isNumber || value.isVector()) return false;
+    }
+
+    // evaluate each expression over the chunk before updating any, they
+    // can't refer to the accumulators so this is the same as doing each
+    // sample in turn (give or take rounding)
+    QVector<double> sums(reductions.count(), 0);
+    QVector<QVector<double> > stack;
+    for(int k=0; k<reductions.count(); k++) {
+
+        int top = -1;
+        foreach(const instruction &i, reductions[k].code) {
+
+            if (i.op == Series || i.op == Scalar || i.op == Constant) {
+
+                top++;
+                if (stack.count() <= top) stack.resize(top+1);
+                QVector<double> &values = stack[top];
+                values.resize(n);
+
+                if (i.op == Series) {
+                    RideFile::SeriesType type = static_cast<RideFile::SeriesType>(i.arg);
+                    for(int j=0; j<n; j++) values[j] = points[j]->value(type);
+                } else {
+                    Result value;
+                    if (i.op == Constant) value = constants.at(i.arg);
+                    else {
+                        const symbol &sym = symbols.at(i.arg);
+                        if (df->symbols.isDefined(sym.slot)) value = df->symbols.at(sym.slot);
+                        else value = this->value(sym, df, Result(0), 0, m, NULL, c, s, d);
+                    }
+                    if (!value.isNumber || value.isVector()) return false;
+                    values.fill(value.number());
+                }
+                continue;
+            }
+
+            // binary operators, the same as Leaf::operate for numbers
+            double *a = stack[top-1].data();
+            const double *b = stack[top].constData();
+            switch(i.op) {
+            case Add: for(int j=0; j<n; j++) a[j] += b[j]; break;
+            case Subtract: for(int j=0; j<n; j++) a[j] -= b[j]; break;
+            case Multiply: for(int j=0; j<n; j++) a[j] *= b[j]; break;
+            case Divide: for(int j=0; j<n; j++) a[j] = b[j] ? a[j] / b[j] : 0; break;
+            case Pow: for(int j=0; j<n; j++) a[j] = pow(a[j], b[j]); break;
+            }
+            top--;
+        }
+
+        const double *values = stack[0].constData();
+        for(int j=0; j<n; j++) sums[k] += values[j];
+    }
+
+    // and accumulate
+    for(int k=0; k<reductions.count(); k++) {
+        const reduction &r = reductions[k];
+        Result value = df->symbols.at(r.slot);
+        df->symbols.set(r.slot, Result(r.subtract ? value.number() - sums[k] : value.number() + sums[k]));
+    }
+    return true;
+}
+
+Result
+DataFilterProgram::run(DataFilterRuntime *df, const Result &x, long it, RideItem *m, RideFilePoint *p,
+                       const QHash<QString,RideMetric*> *c, const Specification &s, const DateRange &d,
+                       Registers *registers) const
+{
+    QVarLengthArray<Result, 16> stack;
+
+    // only invariants are kept from the last run
+    Registers local;
+    Registers &kept = registers ? *registers : local;
+    if (kept.set.count() != invariants.count()) {
+        kept.values.fill(Result(0), invariants.count());
+        kept.set.fill(false, invariants.count());
+    } else {
+        for(int k=0; k<invariants.count(); k++)
+            if (!invariants[k]) kept.set[k] = false;
+    }
+
+    const instruction *pc = code.constData();
+    const instruction *end = pc + code.count();
+
+    while (pc < end) {
+
+        const instruction &i = *pc++;
+
+        switch (i.op) {
+
+        case Const:
+            stack.append(constants.at(i.arg));
+            break;
+
+        case Eval:
+            {
+                Leaf *leaf = leaves.at(i.arg);
+                stack.append(leaf->eval(df, leaf, x, it, m, p, c, s, d));
+            }
+            break;
+
+        case Call:
+            {
+                // going down
+                df->stack += 1;
+
+                // stack overflow
+                if (df->stack > 500) {
+                    qDebug()<<"stack overflow";
+                    df->stack = 0;
+                    stack.append(Result(0));
+                    break;
+                }
+
+                stack.append(df->run(leaves.at(i.arg), x, it, m, p, c, s, d));
+
+                // pop stack - if we haven't overflowed and reset
+                if (df->stack > 0) df->stack -= 1;
+            }
+            break;
+
+        case Load:
+            {
+                const symbol &sym = symbols.at(i.arg);
+                // user symbols override all but series when iterating samples
+                if (!(p && sym.series >= 0) && df->symbols.isDefined(sym.slot)) stack.append(df->symbols.at(sym.slot));
+                else stack.append(value(sym, df, x, it, m, p, c, s, d));
+            }
+            break;
+
+        case Store:
+            df->symbols.set(i.arg, stack.last());
+            break;
+
+        case Pop:
+            stack.removeLast();
+            break;
+
+        case Jump:
+            pc = code.constData() + i.arg;
+            break;
+
+        case JumpIfFalse:
+        case JumpIfTrue:
+            {
+                Result &top = stack.last();
+                bool truth = top.isNumber && top.number();
+                stack.removeLast();
+                if (truth == (i.op == JumpIfTrue)) pc = code.constData() + i.arg;
+            }
+            break;
+
+        case Elvis:
+            {
+                Result &top = stack.last();
+                if (top.number()) {
+                    top = Result(top.isNumber ? top.number() : 0);
+                    pc = code.constData() + i.arg;
+                } else {
+                    stack.removeLast();
+                }
+            }
+            break;
+
+        case Number:
+            stack.last() = Result(stack.last().number());
+            break;
+
+        case Negate:
+            stack.last() = Result(stack.last().number() * -1);
+            break;
+
+        case Not:
+            stack.last() = Result(!stack.last().number());
+            break;
+
+        case Operate:
+            {
+                Result rhs = stack.last();
+                stack.removeLast();
+                stack.last() = Leaf::operate(i.arg, stack.last(), rhs);
+            }
+            break;
+
+        case Fetch:
+            {
+                const QPair<int,int> &fetch = fetches.at(i.arg);
+                if (kept.set[fetch.first]) {
+                    stack.append(kept.values[fetch.first]);
+                    pc = code.constData() + fetch.second;
+                }
+            }
+            break;
+
+        case Keep:
+            kept.values[i.arg] = stack.last();
+            kept.set[i.arg] = true;
+            break;
+        }
+    }
+
+    return stack.isEmpty() ? Result(0) : stack.last();
+}
+
+// the same as the Symbol case in Leaf::eval, but using the resolved symbol
+Result
+DataFilterProgram::value(const symbol &sym, DataFilterRuntime *df, const Result &x, long it, RideItem *m, RideFilePoint *p,
+                         const QHash<QString,RideMetric*> *c, const Specification &s, const DateRange &d) const
+{
+    // ride series when running through samples
+    if (p && sym.series >= 0) {
+        if (sym.series == RideFile::index) return Result(m->ride()->dataPoints().indexOf(p));
+        return Result(p->value(static_cast<RideFile::SeriesType>(sym.series)));
+    }
+
+    switch (sym.kind) {
+
+    case symbol::Number:
+        {
+            // check metadata string to number first ...
+            QString meta = text(sym, m, "unknown");
+            if (meta != "unknown") return Result(meta.toDouble());
+            if (c) return Result(RideMetric::getForSymbol(sym.name, c));
+            if (sym.metric >= 0 && metricCount == RideMetricFactory::instance().metricCount()) return Result(m->getForIndex(sym.metric));
+            return Result(m->getForSymbol(sym.name));
+        }
+
+    case symbol::String:
+        return Result(text(sym, m, ""));
+
+    default:
+    case symbol::Special:
+        return sym.leaf->eval(df, sym.leaf, x, it, m, p, c, s, d);
+    }
+}
+
+QString
+DataFilterProgram::text(const symbol &sym, RideItem *m, const QString &fallback) const
+{
+    const MetadataMap &metadata = m->metadata();
+    if (dictionary && metadata.dictionary() == dictionary) {
+        int id = metadata.valueId(sym.key);
+        return id < 0 ? fallback : dictionary->string(id);
+    }
+    return m->getText(sym.name, fallback);
+}
@@ -0,0 +1,191 @@
+/*
+ * Copyright (c) 2020 Mark Liversedge (liversedge@gmail.com)
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by the Free
+ * Software Foundation; either version 2 of the License, or (at your option)
+ * any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License for
+ * more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc., 51
+ * Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+#ifndef _GC_DataFilterProgram_h
+#define _GC_DataFilterProgram_h 1
+
+#include "DataFilter.h"
+#include "MetadataDictionary.h"
+
+#include <QVector>
+#include <QString>
+#include <QStringList>
+#include <QHash>
+#include <QSet>
+#include <QPair>
+
+//
+// Compiled DataFilter expressions
+//
+// Leaf::eval walks the parse tree recursively, copying the specification
+// and date range and building a Result at every node. For the hot paths
+// (filters run per ride, user metrics and charts run per sample) we
+// compile the tree into bytecode for a simple stack machine instead.
+//
+// The structure of the program (literals, operators, logical and
+// conditional expressions, blocks, assignment to user symbols and calls
+// to user functions) is compiled. Everything else, the builtin functions,
+// indexing, selection and so on, is left to the tree walker via an Eval
+// instruction so the semantics are exactly the same; the operators are
+// applied with Leaf::operate which is shared by both.
+//
+// Symbols are resolved when the program is compiled, which happens after
+// validateFilter and again when the configuration changes. User symbols
+// are referred to by their slot in the runtime, data series by type,
+// metrics by index and metadata fields by their id in the athlete's
+// metadata dictionary, so evaluating them is just indexing. The special
+// symbols (Date, x, isRun etc) are still evaluated by the tree walker.
+//
+// Whilst compiling we also optimise a little. Constant expressions are
+// evaluated up front, and conditionals with a constant condition only
+// compile the branch that is taken. Calls to builtins without side
+// effects that are made more than once are only evaluated once per run,
+// and in the sample function, expressions that don't depend on the
+// sample (e.g. a metric or config(cp)) are only evaluated once per ride.
+// The values are kept in registers, which the caller provides when
+// they should be kept between runs.
+//
+// Programs are immutable once compiled and all state is on the stack
+// or in the registers when they run, so they are shared by copies of
+// the runtime.
+//
+class DataFilterProgram
+{
+    public:
+
+        // compile the expression rooted at leaf, root is the whole formula
+        // and loop is set when the program is run for each sample, without
+        // optimise constants aren't folded and values aren't reused
+        DataFilterProgram(DataFilterRuntime *df, Leaf *leaf, Leaf *root=NULL, bool loop=false, bool optimise=true);
+
+        // values of expressions that are reused
+        struct Registers {
+            QVector<Result> values;
+            QVector<bool> set;
+        };
+
+        // run it, the parameters are the same as for Leaf::eval, values that
+        // don't depend on the sample are kept in registers between runs
+        Result run(DataFilterRuntime *df, const Result &x, long it, RideItem *m, RideFilePoint *p,
+                   const QHash<QString,RideMetric*> *c, const Specification &s, const DateRange &d,
+                   Registers *registers=NULL) const;
+
+        // sample blocks that only accumulate expressions of the data series,
+        // e.g. "joules <- joules + (POWER * RECINTSECS);", can be run over a
+        // chunk of samples at a time. Returns false if the accumulators or the
+        // values the expressions use aren't plain numbers, in which case the
+        // caller must run the program for each sample as usual. As in the
+        // sample loops x and i are zero.
+        bool isReduction() const { return !reductions.isEmpty(); }
+        bool runSamples(DataFilterRuntime *df, RideItem *m, const QVector<RideFilePoint*> &points,
+                        const QHash<QString,RideMetric*> *c, const Specification &s, const DateRange &d) const;
+
+        // doesn't call functions or assign to symbols, so running it
+        // doesn't change the runtime and it can be run concurrently
+        bool isPure() const { return pure; }
+
+    private:
+
+        enum opcode {
+            Const=0,        // push constants[arg]
+            Eval,           // push leaves[arg] evaluated by the tree walker
+            Call,           // push user function leaves[arg] called
+            Load,           // push the value of symbols[arg]
+            Store,          // set user symbol in slot arg to top of stack, leaving it there
+            Pop,            // discard top of stack
+            Jump,           // jump to arg
+            JumpIfFalse,    // pop, jump to arg if not a non-zero number
+            JumpIfTrue,     // pop, jump to arg if a non-zero number
+            Elvis,          // pop, if non-zero push it as a number and jump to arg
+            Number,         // replace top of stack with it as a number
+            Negate,         // unary minus
+            Not,            // unary not
+            Operate,        // pop rhs and lhs, push Leaf::operate(arg, lhs, rhs)
+            Fetch,          // if the register in fetches[arg] is set push it and jump
+            Keep            // set register arg to top of stack, leaving it there
+        };
+
+        struct instruction {
+            instruction(int op, int arg) : op(op), arg(arg) {}
+            instruction() : op(Pop), arg(0) {}
+            int op;
+            int arg;
+        };
+
+        // a resolved symbol
+        struct symbol {
+            enum { Special, Number, String } kind;
+            Leaf *leaf;
+            QString name;   // metric or metadata field name
+            int slot;       // user symbol slot
+            int series;     // when iterating samples, -1 if not a series
+            int metric;     // metric index, -1 if not a metric
+            int key;        // metadata dictionary id
+        };
+        Result value(const symbol &sym, DataFilterRuntime *df, const Result &x, long it, RideItem *m, RideFilePoint *p,
+                     const QHash<QString,RideMetric*> *c, const Specification &s, const DateRange &d) const;
+        QString text(const symbol &sym, RideItem *m, const QString &fallback) const;
+
+        // a statement accumulating an expression evaluated over a chunk of
+        // samples, the code is postfix and each instruction works on arrays
+        enum vectorop { Series=0, Scalar, Constant, Add, Subtract, Multiply, Divide, Pow };
+        struct reduction {
+            int slot;       // user symbol accumulated
+            bool subtract;  // a <- a - expr
+            QVector<instruction> code; // op is a vectorop here
+        };
+        bool vectorize(DataFilterRuntime *df, Leaf *leaf, const QStringList &assigned, QVector<instruction> &code);
+        void compileReduction(DataFilterRuntime *df, Leaf *leaf);
+
+        // optimisation
+        bool fold(Leaf *leaf, Result &value) const;
+        int reusable(DataFilterRuntime *df, Leaf *leaf);
+        void countCalls(DataFilterRuntime *df, Leaf *leaf);
+
+        // code generation
+        void compile(DataFilterRuntime *df, Leaf *leaf);
+        void generate(DataFilterRuntime *df, Leaf *leaf);
+        int resolve(DataFilterRuntime *df, Leaf *leaf);
+        int emit(opcode op, int arg=0);
+        int constant(const Result &value);
+        int fallback(Leaf *leaf);
+
+        QVector<instruction> code;
+        QVector<Result> constants;
+        QVector<Leaf*> leaves;
+        QVector<symbol> symbols;
+        QVector<reduction> reductions;
+        bool pure;
+
+        // registers for reused expressions, invariants are kept between runs
+        QHash<QString, int> reused; // register for each expression
+        QVector<bool> invariants;
+        QVector<QPair<int,int> > fetches; // register, and where to continue if it's set
+
+        QHash<QString, int> calls;  // calls to builtins, and how many times they're made
+        QSet<QString> assigned;     // user symbols the formula assigns to
+        bool writes;                // formula changes rides or symbols in place, e.g. set()
+        bool loop;                  // run for each sample
+        bool optimise;              // fold constants and reuse values
+        bool keeping;               // compiling an expression that's kept
+
+        QSharedPointer<MetadataDictionary> dictionary; // the athlete's
+        int metricCount;                               // metric indexes are only good if unchanged
+};
+
+#endif // _GC_DataFilterProgram_h
@@ -23,6 +23,253 @@
 #include "IntervalItem.h"
 #include "RideCache.h"
 
+#include <QFile>
+#include <QSaveFile>
+#include <QDataStream>
+#include <QDebug>
+
+// bump if the saved index changes
+static const quint32 INDEX_MAGIC = 0x47434653; // GCFS
+static const quint32 INDEX_VERSION = 1;
+
+// distinct case folded words, runs of letters and numbers
+static QStringList words(const QString &text)
+{
+    QSet<QString> returning;
+    QString folded = text.toCaseFolded();
+
+    int start = -1;
+    for(int i=0; i<=folded.length(); i++) {
+        bool letter = i < folded.length() && folded.at(i).isLetterOrNumber();
+        if (letter && start < 0) start = i;
+        else if (!letter && start >= 0) {
+            returning << folded.mid(start, i-start);
+            start = -1;
+        }
+    }
+    return returning.toList();
+}
+
+// the ride content the index was built from, all known without
+// decoding a ride restored from the ride cache snapshot
+static quint64 stamp(RideItem *item)
+{
+    return (quint64(item->crc) << 32) ^ quint64(item->metacrc) ^ quint64(item->timestamp);
+}
+
+// the original scan, for tokens the words can't answer
+static bool matches(RideItem *item, const QString &token)
+{
+    QMapIterator<QString,QString> meta(item->metadata().toMap());
+    while (meta.hasNext()) {
+        meta.next();
+        if (meta.value().contains(token, Qt::CaseInsensitive)) return true;
+    }
+
+    // user intervals - even autodiscovered
+    foreach(IntervalItem *interval, item->intervals())
+        if (interval->name.contains(token, Qt::CaseInsensitive)) return true;
+
+    return false;
+}
+
+FreeSearchIndex::FreeSearchIndex(QString cachePath) : loaded(false), dirty(false)
+{
+    filename = QString("%1/search.index").arg(cachePath);
+}
+
+void
+FreeSearchIndex::update(RideItem *item, bool intervals)
+{
+    QMutexLocker locker(&lock);
+
+    // index when we first search
+    if (!loaded || (!intervals && !entries.contains(item->fileName))) {
+        stale << item->fileName;
+        return;
+    }
+    index(item, intervals);
+}
+
+void
+FreeSearchIndex::remove(QString filename)
+{
+    QMutexLocker locker(&lock);
+
+    stale.remove(filename);
+    if (loaded) unindex(filename);
+}
+
+void
+FreeSearchIndex::index(RideItem *item, bool intervals)
+{
+    entry e;
+    e.stamp = stamp(item);
+
+    QSet<QString> metadata;
+    QMapIterator<QString,QString> meta(item->metadata().toMap());
+    while (meta.hasNext()) {
+        meta.next();
+        foreach(const QString &word, words(meta.value())) metadata << word;
+    }
+    e.metadata = metadata.toList();
+
+    if (intervals) {
+        QSet<QString> names;
+        foreach(IntervalItem *interval, item->intervals())
+            foreach(const QString &word, words(interval->name)) names << word;
+        e.intervals = names.toList();
+    } else {
+        e.intervals = entries.value(item->fileName).intervals;
+    }
+
+    unindex(item->fileName);
+    foreach(const QString &word, e.metadata) postings[word] << item->fileName;
+    foreach(const QString &word, e.intervals) postings[word] << item->fileName;
+    entries.insert(item->fileName, e);
+    dirty = true;
+}
+
+void
+FreeSearchIndex::unindex(const QString &filename)
+{
+    QHash<QString, entry>::iterator it = entries.find(filename);
+    if (it == entries.end()) return;
+
+    foreach(const QString &word, it.value().metadata + it.value().intervals) {
+        QHash<QString, QSet<QString> >::iterator p = postings.find(word);
+        if (p == postings.end()) continue;
+        p.value().remove(filename);
+        if (p.value().isEmpty()) postings.erase(p);
+    }
+    entries.erase(it);
+    dirty = true;
+}
+
+void
+FreeSearchIndex::load(const QVector<RideItem*> &rides)
+{
+    loaded = true;
+
+    QFile file(filename);
+    if (file.open(QFile::ReadOnly)) {
+
+        QDataStream in(&file);
+        in.setVersion(QDataStream::Qt_5_0);
+
+        quint32 magic=0, version=0, count=0;
+        in >> magic >> version >> count;
+        if (magic == INDEX_MAGIC && version == INDEX_VERSION) {
+            for(quint32 i=0; i<count && in.status() == QDataStream::Ok; i++) {
+                QString name;
+                entry e;
+                in >> name >> e.stamp >> e.metadata >> e.intervals;
+                if (in.status() == QDataStream::Ok) entries.insert(name, e);
+            }
+            if (in.status() != QDataStream::Ok) {
+                qDebug()<<"search index is corrupt:"<<filename;
+                entries.clear();
+            }
+        }
+        file.close();
+    }
+
+    // keep what is still current, rides that changed since are indexed again
+    QHash<QString, entry> saved = entries;
+    entries.clear();
+    foreach(RideItem *item, rides) {
+        QHash<QString, entry>::const_iterator it = saved.constFind(item->fileName);
+        if (it == saved.constEnd() || it.value().stamp != stamp(item) || stale.contains(item->fileName)) {
+            stale << item->fileName;
+            continue;
+        }
+        entries.insert(item->fileName, it.value());
+        foreach(const QString &word, it.value().metadata) postings[word] << item->fileName;
+        foreach(const QString &word, it.value().intervals) postings[word] << item->fileName;
+    }
+    dirty = saved.count() != entries.count();
+}
+
+void
+FreeSearchIndex::save()
+{
+    QMutexLocker locker(&lock);
+
+    if (!loaded || !dirty) return;
+
+    QSaveFile file(filename);
+    if (!file.open(QFile::WriteOnly)) return;
+
+    QDataStream out(&file);
+    out.setVersion(QDataStream::Qt_5_0);
+    out << INDEX_MAGIC << INDEX_VERSION << quint32(entries.count());
+
+    QHashIterator<QString, entry> it(entries);
+    while (it.hasNext()) {
+        it.next();
+        out << it.key() << it.value().stamp << it.value().metadata << it.value().intervals;
+    }
+
+    if (file.commit()) dirty = false;
+    else qDebug()<<"unable to save search index"<<filename;
+}
+
+QSet<QString>
+FreeSearchIndex::matching(const QString &word) const
+{
+    QSet<QString> returning;
+    QHashIterator<QString, QSet<QString> > it(postings);
+    while (it.hasNext()) {
+        it.next();
+        if (it.key().contains(word)) returning += it.value();
+    }
+    return returning;
+}
+
+QStringList
+FreeSearchIndex::search(const QStringList &tokens, const QVector<RideItem*> &rides)
+{
+    QMutexLocker locker(&lock);
+
+    // bring it up to date
+    if (!loaded) load(rides);
+    if (!stale.isEmpty()) {
+        foreach(RideItem *item, rides)
+            if (stale.contains(item->fileName)) index(item, true);
+        stale.clear();
+    }
+
+    QSet<QString> matched;
+    foreach(const QString &token, tokens) {
+
+        QString folded = token.toCaseFolded();
+        QStringList parts = words(folded);
+
+        // a single word is in the text if it is in one of its words
+        if (parts.count() == 1 && parts[0] == folded) {
+            matched += matching(folded);
+            continue;
+        }
+
+        // check the rides with its longest word
+        QString longest;
+        foreach(const QString &part, parts) if (part.length() > longest.length()) longest = part;
+        QSet<QString> candidates;
+        if (longest != "") candidates = matching(longest);
+
+        foreach(RideItem *item, rides) {
+            if (matched.contains(item->fileName)) continue;
+            if (longest != "" && !candidates.contains(item->fileName)) continue;
+            if (matches(item, token)) matched << item->fileName;
+        }
+    }
+
+    QStringList returning;
+    foreach(RideItem *item, rides)
+        if (matched.contains(item->fileName)) returning << item->fileName;
+    return returning;
+}
+
 FreeSearch::FreeSearch(QObject *parent, Context *context) : QObject(parent), context(context)
 {
     // nothing to do, all the data we need is in the ridecache
@@ -83,36 +330,9 @@ QList<QString> FreeSearch::search(QString query)
     // search split will tokenise and handle quoting and escaping
     QStringList tokens = searchSplit(query);
 
-    foreach(RideItem*item, context->athlete->rideCache->rides()) {
-
-        QMapIterator<QString,QString> meta(item->metadata());
-        meta.toFront();
-        while (meta.hasNext()) {
-            meta.next();
-
-            // does the super string contain the tokens?
-            foreach(QString token, tokens) {
-
-                if (meta.value().contains(token, Qt::CaseInsensitive)) {
-                    filenames << item->fileName;
-                    goto nextItem;
-                }
-            }
-        }
-
-        // user intervals - even autodiscovered
-        foreach(IntervalItem *interval, item->intervals()) {
-
-            foreach (QString token, tokens) {
-
-                if (interval->name.contains(token, Qt::CaseInsensitive)) {
-                    filenames << item->fileName;
-                    goto nextItem;
-                }
-            }
-        }
-        nextItem:;
-    }
+    // rides with metadata or intervals containing any of the tokens
+    RideCache *rideCache = context->athlete->rideCache;
+    filenames = rideCache->searchIndex()->search(tokens, rideCache->rides());
 
     emit results(filenames);
 
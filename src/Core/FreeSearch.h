@@ -21,14 +21,73 @@
 
 #include <QObject>
 #include <QString>
+#include <QStringList>
 #include <QDir>
 #include <QMutex>
+#include <QHash>
+#include <QSet>
+#include <QVector>
 
 #include "Context.h"
 #include "RideMetadata.h"
 #include "RideCache.h"
 #include "RideItem.h"
 
+//
+// Inverted index for free text search
+//
+// Free search matches rides where any of the tokens appears in a metadata
+// value (including the notes) or an interval name. Rather than scanning
+// every ride (and decoding every ride's intervals) each time, we keep the
+// distinct case folded words of each ride and a map from each word to
+// the rides that use it. Tokens are matched against the words, which are
+// far fewer than the rides; anywhere in the word as free search always
+// has, so prefixes match whilst typing. Tokens with spaces or punctuation
+// are checked against the rides that have a word matching their longest.
+//
+// It is maintained by the ride cache as rides are added, removed and
+// changed, and saved alongside it so it survives restarts. It is only
+// read when first searched, when rides that changed since it was saved
+// are indexed again.
+//
+class FreeSearchIndex
+{
+    public:
+
+        FreeSearchIndex(QString cachePath);
+
+        // ride changed, only the metadata if intervals is false
+        void update(RideItem *item, bool intervals=true);
+        void remove(QString filename);
+
+        // rides matching any of the tokens, in the same order as rides
+        QStringList search(const QStringList &tokens, const QVector<RideItem*> &rides);
+
+        // write it out if it changed
+        void save();
+
+    private:
+
+        struct entry {
+            quint64 stamp;          // ride content when indexed
+            QStringList metadata;   // words in metadata values
+            QStringList intervals;  // words in interval names
+        };
+
+        void load(const QVector<RideItem*> &rides);
+        void index(RideItem *item, bool intervals);
+        void unindex(const QString &filename);
+        QSet<QString> matching(const QString &word) const;
+
+        QString filename;
+        QMutex lock;
+        bool loaded, dirty;
+
+        QHash<QString, entry> entries;              // by ride filename
+        QHash<QString, QSet<QString> > postings;    // word -> ride filenames
+        QSet<QString> stale;                        // rides to index before searching
+};
+
 class FreeSearch : public QObject
 {
     Q_OBJECT
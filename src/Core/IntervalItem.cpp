@@ -23,6 +23,7 @@
 #include "Athlete.h"
 #include "Colors.h"
 #include "ColorButton.h"
+#include "Settings.h"
 
 IntervalItem::IntervalItem(const RideItem *ride, QString name, double start, double stop, 
                            double startKM, double stopKM, int displaySequence, QColor color, bool test,
@@ -39,13 +40,16 @@ IntervalItem::IntervalItem(const RideItem *ride, QString name, double start, dou
     this->selected = false;
     this->test = test;
     this->rideInterval = NULL;
+    this->discovered = -1;
     this->rideItem_ = const_cast<RideItem*>(ride);
+    this->pending_ = this->computing_ = false;
     metrics_.fill(0, RideMetricFactory::instance().metricCount());
     count_.fill(0, RideMetricFactory::instance().metricCount());
 }
 
 IntervalItem::IntervalItem() : rideItem_(NULL), selected(false), name(""), type(RideFileInterval::USER), start(0), stop(0),
-                               startKM(0), stopKM(0), displaySequence(0), color(Qt::black), test(false), rideInterval(NULL)
+                               startKM(0), stopKM(0), displaySequence(0), color(Qt::black), test(false),
+                               discovered(-1), pending_(false), computing_(false), rideInterval(NULL)
 {
     metrics_.fill(0, RideMetricFactory::instance().metricCount());
     count_.fill(0, RideMetricFactory::instance().metricCount());
@@ -94,22 +98,39 @@ IntervalItem::setValues(QString name, double duration1, double duration2,
 }
 
 void
-IntervalItem::refresh()
+IntervalItem::refresh(const QStringList &only)
 {
+    // we can't reuse values we don't have yet
+    if (only.count() && pending_) {
+        refreshHot(hotMetrics());
+        return;
+    }
+
     // metrics
     const RideMetricFactory &factory = RideMetricFactory::instance();
 
+    // a partial refresh keeps the values we have, unless the
+    // metric schema has changed since they were computed
+    bool partial = only.count() && metrics_.count() == factory.metricCount()
+                   && count_.count() == factory.metricCount();
+
     // resize and set to zero
-    metrics_.fill(0, factory.metricCount());
-    count_.fill(0, factory.metricCount());
+    if (!partial) {
+        metrics_.fill(0, factory.metricCount());
+        count_.fill(0, factory.metricCount());
+    }
 
     // don't open on our account - we should be called with a ride available
     RideFile *f = rideItem_->ride_;
     if (!f) return;
 
+    // we will have them all
+    pending_ = false;
+    computed_.clear();
 
     // ok, lets collect the metrics
-    QHash<QString,RideMetricPtr> computed=RideMetric::computeMetrics(rideItem_, Specification(this, f->recIntSecs()), factory.allMetrics());
+    QHash<QString,RideMetricPtr> computed=RideMetric::computeMetrics(rideItem_, Specification(this, f->recIntSecs()),
+                                                                     partial ? only : factory.allMetrics(), partial);
     // take a deep copy, quick before the thread exits.
     //XXXcomputed.detach();
 
@@ -135,6 +156,69 @@ IntervalItem::refresh()
         }
 }
 
+// just the hot metrics, the rest are computed when they're first needed
+void
+IntervalItem::refreshHot(const QStringList &hot)
+{
+    const RideMetricFactory &factory = RideMetricFactory::instance();
+
+    metrics_.fill(0, factory.metricCount());
+    count_.fill(0, factory.metricCount());
+    stdmean_.clear();
+    stdvariance_.clear();
+
+    RideFile *f = rideItem_->ride_;
+    if (!f) return;
+
+    computed_.fill(false, factory.metricCount());
+    foreach(QString symbol, hot) computed_.setBit(factory.rideMetric(symbol)->index());
+    pending_ = true;
+
+    // computeMetrics uses metrics(), which mustn't complete us
+    computing_ = true;
+    QHash<QString,RideMetricPtr> computed=RideMetric::computeMetrics(rideItem_, Specification(this, f->recIntSecs()), hot);
+    computing_ = false;
+
+    QHashIterator<QString, RideMetricPtr> i(computed);
+    while (i.hasNext()) {
+        i.next();
+        int index = i.value()->index();
+        double value = i.value()->value();
+
+        // clean any bad values
+        if (std::isinf(value) || std::isnan(value)) {
+            metrics_[index] = 0.00f;
+            count_[index] = 0.00f;
+        } else {
+            metrics_[index] = value;
+            count_[index] = i.value()->count();
+        }
+
+        double stdmean = i.value()->stdmean();
+        double stdvariance = i.value()->stdvariance();
+        if (stdmean || stdvariance) {
+            stdmean_.insert(index, stdmean);
+            stdvariance_.insert(index, stdvariance);
+        }
+    }
+}
+
+// the metrics shown in the interval summary and those used when
+// discovering intervals (naming efforts and sustained time in zone)
+QStringList
+IntervalItem::hotMetrics()
+{
+    QString s = GC_SETTINGS_INTERVAL_METRICS_DEFAULT;
+    if (appsettings->contains(GC_SETTINGS_INTERVAL_METRICS))
+        s = appsettings->value(NULL, GC_SETTINGS_INTERVAL_METRICS).toString();
+
+    const RideMetricFactory &factory = RideMetricFactory::instance();
+    QStringList returning;
+    foreach(QString symbol, s.split(",") << "workout_time" << "average_power" << "power_zone")
+        if (factory.haveMetric(symbol) && !returning.contains(symbol)) returning << symbol;
+
+    return returning;
+}
 
 double
 IntervalItem::getForSymbol(QString name, bool useMetricUnits)
@@ -145,6 +229,7 @@ IntervalItem::getForSymbol(QString name, bool useMetricUnits)
         // return the precomputed metric value
         const RideMetric *m = factory.rideMetric(name);
         if (m) {
+            if (!have(m->index())) complete();
             if (useMetricUnits) return metrics_[m->index()];
             else {
                 // little hack to set/get for conversion
@@ -168,6 +253,7 @@ IntervalItem::getStringForSymbol(QString name, bool useMetricUnits)
         const RideMetric *m = factory.rideMetric(name);
         if (m) {
 
+            if (!have(m->index())) complete();
             double value = metrics_[m->index()];
             if (std::isinf(value) || std::isnan(value)) value=0;
             const_cast<RideMetric*>(m)->setValue(value);
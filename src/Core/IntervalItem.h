@@ -23,6 +23,7 @@
 #include "RideItem.h"
 #include "RideItem.h"
 #include <QtGui>
+#include <QBitArray>
 #include <QDialog>
 #include <QLabel>
 #include <QLineEdit>
@@ -69,21 +70,34 @@ class IntervalItem
         QColor color;                        // color to use on plots that differentiate by color
         QUuid route;                         // the route this interval is for
         bool test;                            // is a performance test
+        int discovered;                       // which discovery found it, see RideItem::updateIntervals
 
         // order to show on plot
         void setDisplaySequence(int seq) { displaySequence = seq; }
 
         // precomputed metrics
-        void refresh();
+        // recompute metrics, or just those in only reusing the rest
+        void refresh(const QStringList &only=QStringList());
         QVector<double> metrics_;
         QVector<double> count_;
         QMap <int, double>stdmean_;
         QMap <int, double>stdvariance_;
 
-        QVector<double> &metrics() { return metrics_; }
-        QVector<double> &counts() { return count_; }
-        QMap <int, double>&stdmeans() { return stdmean_; }
-        QMap <int, double>&stdvariances() { return stdvariance_; }
+        // most interval metrics are never looked at, so when intervals are
+        // discovered we only compute hotMetrics() and the rest are computed
+        // the first time they are needed, see RideItem::completeIntervals()
+        void refreshHot(const QStringList &hot);
+        static QStringList hotMetrics(); // reads the settings, so once per ride
+        bool isPending() const { return pending_; }
+        void complete() { if (pending_ && !computing_ && rideItem_) rideItem_->completeIntervals(); }
+        bool have(int index) const { return !pending_ || (index < computed_.size() && computed_.testBit(index)); }
+        bool pending_, computing_;
+        QBitArray computed_; // metrics we have whilst pending
+
+        QVector<double> &metrics() { complete(); return metrics_; }
+        QVector<double> &counts() { complete(); return count_; }
+        QMap <int, double>&stdmeans() { complete(); return stdmean_; }
+        QMap <int, double>&stdvariances() { complete(); return stdvariance_; }
 
         // extracted sample data
         RideFileInterval *rideInterval;
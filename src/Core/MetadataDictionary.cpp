@@ -0,0 +1,215 @@
+/*
+ * Copyright (c) 2020 Mark Liversedge (liversedge@gmail.com)
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by the Free
+ * Software Foundation; either version 2 of the License, or (at your option)
+ * any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License for
+ * more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc., 51
+ * Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+#include "MetadataDictionary.h"
+
+#include <QMutex>
+#include <QWeakPointer>
+#include <QDataStream>
+#include <algorithm>
+
+// value id for free text, which is held in the map not the dictionary
+static const int TEXT = -2;
+
+// free text is long or multi-line
+static bool isText(const QString &value)
+{
+    return value.length() > 64 || value.contains('\n');
+}
+
+QSharedPointer<MetadataDictionary>
+MetadataDictionary::dictionary(QString athlete)
+{
+    static QMutex mutex;
+    static QHash<QString, QWeakPointer<MetadataDictionary> > dictionaries;
+
+    QMutexLocker locker(&mutex);
+
+    QSharedPointer<MetadataDictionary> returning = dictionaries.value(athlete).toStrongRef();
+    if (returning.isNull()) {
+        returning = QSharedPointer<MetadataDictionary>(new MetadataDictionary());
+        dictionaries.insert(athlete, returning.toWeakRef());
+    }
+    return returning;
+}
+
+int
+MetadataDictionary::intern(const QString &string)
+{
+    // almost always already there
+    lock.lockForRead();
+    int returning = ids.value(string, -1);
+    lock.unlock();
+    if (returning >= 0) return returning;
+
+    QWriteLocker locker(&lock);
+
+    // may have been added whilst we waited
+    returning = ids.value(string, -1);
+    if (returning < 0) {
+        returning = strings.count();
+        strings << string;
+        ids.insert(string, returning);
+    }
+    return returning;
+}
+
+int
+MetadataDictionary::id(const QString &string) const
+{
+    QReadLocker locker(&lock);
+    return ids.value(string, -1);
+}
+
+QString
+MetadataDictionary::string(int id) const
+{
+    QReadLocker locker(&lock);
+    if (id < 0 || id >= strings.count()) return QString();
+    return strings.at(id);
+}
+
+int
+MetadataDictionary::count() const
+{
+    QReadLocker locker(&lock);
+    return strings.count();
+}
+
+MetadataMap::MetadataMap(QSharedPointer<MetadataDictionary> dictionary) : dictionary_(dictionary)
+{
+    // rides without an athlete share one
+    if (dictionary_.isNull()) dictionary_ = MetadataDictionary::dictionary(QString());
+}
+
+MetadataMap &
+MetadataMap::operator=(const MetadataMap &other)
+{
+    if (other.dictionary_ == dictionary_) {
+        entries = other.entries;
+        text = other.text;
+        return *this;
+    }
+
+    // different dictionary, so intern the strings in ours
+    return *this = other.toMap();
+}
+
+MetadataMap &
+MetadataMap::operator=(const QMap<QString,QString> &map)
+{
+    entries.clear();
+    entries.reserve(map.count());
+    text.clear();
+
+    QMapIterator<QString,QString> i(map);
+    while(i.hasNext()) {
+        i.next();
+        int key = dictionary_->intern(i.key());
+        if (isText(i.value())) {
+            entries << QPair<int,int>(key, TEXT);
+            text.insert(key, i.value());
+        } else {
+            entries << QPair<int,int>(key, dictionary_->intern(i.value()));
+        }
+    }
+    std::sort(entries.begin(), entries.end());
+    return *this;
+}
+
+int
+MetadataMap::find(int key) const
+{
+    if (key < 0) return -1;
+
+    QVector<QPair<int,int> >::const_iterator it = std::lower_bound(entries.constBegin(), entries.constEnd(), QPair<int,int>(key, -1));
+    if (it == entries.constEnd() || it->first != key) return -1;
+    return it - entries.constBegin();
+}
+
+int
+MetadataMap::valueId(int key) const
+{
+    int index = find(key);
+    return index < 0 || entries.at(index).second == TEXT ? -1 : entries.at(index).second;
+}
+
+QString
+MetadataMap::value(const QString &key, const QString &fallback) const
+{
+    int index = find(dictionary_->id(key));
+    if (index < 0) return fallback;
+    if (entries.at(index).second == TEXT) return text.value(entries.at(index).first);
+    return dictionary_->string(entries.at(index).second);
+}
+
+bool
+MetadataMap::contains(const QString &key) const
+{
+    return find(dictionary_->id(key)) >= 0;
+}
+
+void
+MetadataMap::insert(const QString &key, const QString &value)
+{
+    QPair<int,int> entry(dictionary_->intern(key), TEXT);
+    if (isText(value)) text.insert(entry.first, value);
+    else {
+        entry.second = dictionary_->intern(value);
+        text.remove(entry.first);
+    }
+
+    QVector<QPair<int,int> >::iterator it = std::lower_bound(entries.begin(), entries.end(), QPair<int,int>(entry.first, -1));
+    if (it != entries.end() && it->first == entry.first) it->second = entry.second;
+    else entries.insert(it, entry);
+}
+
+void
+MetadataMap::remove(const QString &key)
+{
+    int index = find(dictionary_->id(key));
+    if (index >= 0) {
+        text.remove(entries.at(index).first);
+        entries.remove(index);
+    }
+}
+
+QMap<QString,QString>
+MetadataMap::toMap() const
+{
+    QMap<QString,QString> returning;
+    for(int i=0; i<entries.count(); i++)
+        returning.insert(dictionary_->string(entries[i].first),
+                         entries[i].second == TEXT ? text.value(entries[i].first) : dictionary_->string(entries[i].second));
+    return returning;
+}
+
+QDataStream &
+operator<<(QDataStream &out, const MetadataMap &map)
+{
+    return out << map.toMap();
+}
+
+QDataStream &
+operator>>(QDataStream &in, MetadataMap &map)
+{
+    QMap<QString,QString> strings;
+    in >> strings;
+    map = strings;
+    return in;
+}
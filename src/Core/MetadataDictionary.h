@@ -0,0 +1,117 @@
+/*
+ * Copyright (c) 2020 Mark Liversedge (liversedge@gmail.com)
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by the Free
+ * Software Foundation; either version 2 of the License, or (at your option)
+ * any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License for
+ * more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc., 51
+ * Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+#ifndef _GC_MetadataDictionary_h
+#define _GC_MetadataDictionary_h 1
+
+#include <QString>
+#include <QVector>
+#include <QHash>
+#include <QMap>
+#include <QPair>
+#include <QSharedPointer>
+#include <QReadWriteLock>
+
+class QDataStream;
+
+//
+// Interned metadata strings
+//
+// Every ride has much the same metadata keys ("Sport", "Workout Code",
+// "Device" ...) and the values repeat a lot too, so rather than every
+// RideItem holding a QMap of strings we keep each distinct string once
+// in a dictionary for the athlete and rides hold pairs of ids.
+//
+// Strings are never removed, ids are stable for the life of the
+// dictionary, which goes when the last ride using it does. So free
+// text values (long or multi-line, like "Notes" or the generated
+// "Calendar Text") are not interned, they are mostly unique and are
+// edited or regenerated, so would grow the dictionary without bound.
+//
+class MetadataDictionary
+{
+    public:
+
+        // the dictionary for an athlete, shared by all their rides
+        static QSharedPointer<MetadataDictionary> dictionary(QString athlete);
+
+        // id for string, adding it if we haven't seen it before
+        int intern(const QString &string);
+
+        // id for string, or -1 if we haven't seen it
+        int id(const QString &string) const;
+
+        // the string for an id
+        QString string(int id) const;
+
+        int count() const;
+
+    private:
+
+        mutable QReadWriteLock lock;
+        QHash<QString, int> ids;
+        QVector<QString> strings;
+};
+
+//
+// Ride metadata as key/value id pairs
+//
+// Used in place of QMap<QString,QString> so has the same sort of API,
+// plus access by id for aggregating across rides without comparing
+// strings. Assigning keeps our own dictionary, re-interning if the
+// other map uses a different one.
+//
+class MetadataMap
+{
+    public:
+
+        MetadataMap(QSharedPointer<MetadataDictionary> dictionary=QSharedPointer<MetadataDictionary>());
+
+        MetadataMap &operator=(const MetadataMap &other);
+        MetadataMap &operator=(const QMap<QString,QString> &map);
+
+        QString value(const QString &key, const QString &fallback=QString()) const;
+        bool contains(const QString &key) const;
+        void insert(const QString &key, const QString &value);
+        void remove(const QString &key);
+        void clear() { entries.clear(); text.clear(); }
+
+        int count() const { return entries.count(); }
+        bool isEmpty() const { return entries.isEmpty(); }
+
+        // as strings, sorted by key
+        QMap<QString,QString> toMap() const;
+
+        // by id, -1 if not set or the value is free text
+        QSharedPointer<MetadataDictionary> dictionary() const { return dictionary_; }
+        int valueId(int key) const;
+
+    private:
+
+        int find(int key) const; // index in entries, or -1
+
+        QSharedPointer<MetadataDictionary> dictionary_;
+        QVector<QPair<int,int> > entries; // key and value id, sorted by key
+        QHash<int,QString> text; // values that aren't interned, by key id
+};
+
+// streamed as QMap<QString,QString>, so the ride cache store format is unchanged
+QDataStream &operator<<(QDataStream &out, const MetadataMap &map);
+QDataStream &operator>>(QDataStream &in, MetadataMap &map);
+
+#endif // _GC_MetadataDictionary_h
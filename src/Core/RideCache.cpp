@@ -25,6 +25,9 @@
 #include "Specification.h"
 #include "DataProcessor.h"
 #include "Estimator.h"
+#include "DataFilterCache.h"
+#include "FreeSearch.h"
+#include "PMCData.h"
 
 #include "Route.h"
 
@@ -34,10 +37,6 @@
 
 #include "JsonRideFile.h" // for DATETIME_FORMAT
 
-#ifdef SLOW_REFRESH
-#include "unistd.h"
-#endif
-
 // we initialise the global user metrics
 #include "RideMetric.h"
 #include "UserMetricSettings.h"
@@ -46,7 +45,6 @@
 #include <QXmlSimpleReader>
 
 // for sorting
-bool rideCacheGreaterThan(const RideItem *a, const RideItem *b) { return a->dateTime > b->dateTime; }
 bool rideCacheLessThan(const RideItem *a, const RideItem *b) { return a->dateTime < b->dateTime; }
 
 class RideCacheLoader : public QThread
@@ -61,14 +59,20 @@ private:
         RideCache *cache;
 };
 
-RideCache::RideCache(Context *context) : context(context)
+RideCache::RideCache(Context *context) : context(context), loadTime_(0)
 {
+    startup.start();
+
     directory = context->athlete->home->activities();
     plannedDirectory = context->athlete->home->planned();
 
     progress_ = 100;
     exiting = false;
     estimator = new Estimator(context);
+    refresher = new RideCacheRefresh(this);
+    store = new RideDBStore(context->athlete->home->cache().canonicalPath());
+    searchIndex_ = new FreeSearchIndex(context->athlete->home->cache().canonicalPath());
+    compact_ = false;
 
     // initial load of user defined metrics - do once we have an initial context
     // but before we refresh or check metrics for the first time
@@ -138,6 +142,7 @@ RideCache::RideCache(Context *context) : context(context)
 
     // now sort it - we need to use find on it
     std::sort(rides_.begin(), rides_.end(), rideCacheLessThan);
+    table_.rebuild(rides_);
 
     // load the store - will unstale once cache restored
     RideCacheLoader *rideCacheLoader = new RideCacheLoader(this);
@@ -149,6 +154,12 @@ RideCache::RideCache(Context *context) : context(context)
 void
 RideCache::postLoad()
 {
+    // how long did it take to list and restore ?
+    loadTime_ = startup.elapsed();
+
+    // values were restored by load()
+    table_.rebuild(rides_);
+
     // set model once we have the basics
     model_ = new RideCacheModel(context, this);
 
@@ -163,12 +174,16 @@ RideCache::postLoad()
     connect(context, SIGNAL(configChanged(qint32)), this, SLOT(configChanged(qint32)));
 
 
-    // future watching
-    connect(&watcher, SIGNAL(finished()), this, SLOT(garbageCollect()));
-    connect(&watcher, SIGNAL(finished()), this, SLOT(save()));
-    connect(&watcher, SIGNAL(finished()), context, SLOT(notifyRefreshEnd()));
-    connect(&watcher, SIGNAL(started()), context, SLOT(notifyRefreshStart()));
-    connect(&watcher, SIGNAL(progressValueChanged(int)), this, SLOT(progressing(int)));
+    // refresh watching
+    connect(refresher, SIGNAL(finished()), this, SLOT(garbageCollect()));
+    connect(refresher, SIGNAL(finished()), this, SLOT(save()));
+    connect(refresher, SIGNAL(finished()), context, SLOT(notifyRefreshEnd()));
+    connect(refresher, SIGNAL(started()), context, SLOT(notifyRefreshStart()));
+    connect(refresher, SIGNAL(progressing(int,int,QDate)), this, SLOT(progressing(int,int,QDate)));
+
+    // refresh what the user is looking at first
+    connect(context, SIGNAL(rideSelected(RideItem*)), this, SLOT(reprioritise()));
+    connect(context, SIGNAL(dateRangeSelected(DateRange)), this, SLOT(reprioritise()));
 }
 
 struct comparerideitem { bool operator()(const RideItem *p1, const RideItem *p2) { return p1->dateTime < p2->dateTime; } };
@@ -194,6 +209,8 @@ RideCache::~RideCache()
 
     // save to store
     save();
+    delete store;
+    delete searchIndex_;
 }
 
 void
@@ -230,6 +247,7 @@ RideCache::configChanged(qint32 what)
     if (what & CONFIG_FIELDS) {
         foreach(RideItem *item, rides()) {
             item->metadata_.insert("Calendar Text", GlobalContext::context()->rideMetadata->calendarText(item));
+            searchIndex_->update(item, false);
         }
     }
 
@@ -255,6 +273,9 @@ RideCache::itemChanged()
     // the model is particularly interested in ANY item that changes
     emit itemChanged(item);
 
+    // and free search
+    searchIndex_->update(item);
+
     // current ride changed is more relevant for the charts lets notify
     // them the ride they're showing has changed
     if (item == context->currentRideItem()) {
@@ -289,6 +310,9 @@ RideCache::addRide(QString name, bool dosignal, bool select, bool useTempActivit
     bool added = false;
     for (int index=0; index < rides_.count(); index++) {
         if (rides_[index]->fileName == last->fileName) {
+            changedLock.lock();
+            changed_.remove(rides_[index]);
+            changedLock.unlock();
             rides_[index] = last;
             added = true;
             break;
@@ -302,9 +326,11 @@ RideCache::addRide(QString name, bool dosignal, bool select, bool useTempActivit
         std::sort(rides_.begin(), rides_.end(), rideCacheLessThan);
         model_->endReset();
     }
+    table_.rebuild(rides_);
 
     // refresh metrics for *this ride only*
     last->refresh();
+    searchIndex_->update(last);
 
     if (dosignal) context->notifyRideAdded(last); // here so emitted BEFORE rideSelected is emitted!
 
@@ -369,8 +395,15 @@ RideCache::removeCurrentRide()
     // but model needs to know about this!
     model_->startRemove(index);
     rides_.remove(index, 1);
+    refresher->cancel(todelete);
+    changedLock.lock();
+    changed_.remove(todelete);
+    removed_ << todelete->fileName;
+    changedLock.unlock();
+    searchIndex_->remove(todelete->fileName);
     delete_<<todelete;
     model_->endRemove(index);
+    table_.rebuild(rides_);
 
     // delete the file by renaming it
     QString strOldFileName = context->ride->fileName;
@@ -480,44 +513,55 @@ RideCache::writeAsCSV(QString filename)
 }
 
 void
-itemRefresh(RideItem *&item)
+RideCache::progressing(int done, int total, QDate date)
+{
+    // we're working away, notfy everyone where we got
+    progress_ = total ? 100.0f * (double(done) / double(total)) : 100;
+    context->notifyRefreshUpdate(date);
+}
+
+void
+RideCache::refreshed(RideItem *item)
 {
-    // debugging below to watch refreshing take place
-    //fprintf(stderr, "%s %s refresh\n", item->context->athlete->cyclist.toStdString().c_str(), item->dateTime.toString().toStdString().c_str()); fflush(stderr);
+    // only our items, not temporary ones
+    if (!table_.update(item)) return;
 
-    // need parser to be reentrant !item->refresh();
-    if (item->isstale) {
-        item->refresh();
+    changedLock.lock();
+    changed_.insert(item);
+    changedLock.unlock();
 
-        // and trap changes during refresh to current ride
-        if (item == item->context->currentRideItem())
-            item->context->notifyRideChanged(item);
+    // metadata and intervals may have been updated
+    searchIndex_->update(item);
 
-#ifdef SLOW_REFRESH
-        sleep(1);
-#endif
-    }
+    // memoised DataFilter results may have used the old metrics
+    if (context->athlete->filterCache) context->athlete->filterCache->invalidate();
+
+    // and so will the stress for its PMCs
+    PMCStress::refreshed(context, item);
 }
 
 void
-RideCache::progressing(int value)
+RideCache::modified(RideItem *item)
 {
-    // we're working away, notfy everyone where we got
-    progress_ = 100.0f * (double(value) / double(watcher.progressMaximum()));
-    if (value) {
-        QDate here = reverse_.at(value-1)->dateTime.date();
-        context->notifyRefreshUpdate(here);
-    }
+    // only our items, not temporary ones
+    if (!table_.contains(item)) return;
+
+    changedLock.lock();
+    changed_.insert(item);
+    changedLock.unlock();
 }
 
-// cancel the refresh map, we're about to exit !
+void
+RideCache::reprioritise()
+{
+    refresher->prioritise(context->ride, context->currentDateRange());
+}
+
+// cancel the refresh, we're about to exit !
 void
 RideCache::cancel()
 {
-    if (future.isRunning()) {
-        future.cancel();
-        future.waitForFinished();
-    }
+    refresher->cancel();
 }
 
 // check if we need to refresh the metrics then start the thread if needed
@@ -525,25 +569,29 @@ void
 RideCache::refresh()
 {
     // already on it !
-    if (future.isRunning()) return;
+    if (refresher->isRunning()) return;
 
     // how many need refreshing ?
-    int staleCount = 0;
+    QVector<RideItem*> stale;
 
     foreach(RideItem *item, rides_) {
 
         // ok set stale so we refresh
         if (item->checkStale())
-            staleCount++;
+            stale << item;
     }
 
     // start if there is work to do
     // and future watcher can notify of updates
-    if (staleCount)  {
-        reverse_ = rides_;
-        std::sort(reverse_.begin(), reverse_.end(), rideCacheGreaterThan);
-        future = QtConcurrent::map(reverse_, itemRefresh);
-        watcher.setFuture(future);
+    if (stale.count())  {
+
+        // metric schema may have changed (user metrics)
+        // rows are updated as each item is refreshed
+        if (table_.columns() != RideMetricFactory::instance().metricCount()) table_.rebuild(rides_);
+
+        // current ride and visible dates first, then recent, then history
+        refresher->prioritise(context->ride, context->currentDateRange());
+        refresher->start(stale);
 
     } else {
 
@@ -555,6 +603,17 @@ RideCache::refresh()
     }
 }
 
+// rows of the metric table that pass the specification
+// caller must hold the table lock so rows match rides_
+RideCacheTable::Selection
+RideCache::select(Specification spec)
+{
+    if (table_.rows() != rides_.count()) return RideCacheTable::Selection(table_.rows(), 0);
+
+    // same as spec.pass() for each ride
+    return table_.select(spec.dateRange(), spec.filterSet());
+}
+
 QString
 RideCache::getAggregate(QString name, Specification spec, bool useMetricUnits, bool nofmt)
 {
@@ -565,71 +624,11 @@ RideCache::getAggregate(QString name, Specification spec, bool useMetricUnits, b
         return QString("%1 unknown").arg(name);
     }
 
-    // what we will return
+    // aggregate over the selected rows of the metric table
     double rvalue = 0;
-    double rcount = 0; // using double to avoid rounding issues with int when dividing
-
-    // loop through and aggregate
-    foreach (RideItem *item, rides()) {
-
-        // skip filtered rides
-        if (!spec.pass(item)) continue;
-
-        // get this value
-        double value = item->getForSymbol(name);
-        double count = item->getForSymbol("workout_time"); // for averaging
-
-        // check values are bounded, just in case
-        if (std::isnan(value) || std::isinf(value)) value = 0;
-
-        // do we aggregate zero values ?
-        bool aggZero = metric->aggregateZero();
-
-        // set aggZero to false and value to zero if is temperature and -255
-        if (metric->symbol() == "average_temp" && value == RideFile::NA) {
-            value = 0;
-            aggZero = false;
-        }
-
-        switch (metric->type()) {
-        case RideMetric::RunningTotal:
-        case RideMetric::Total:
-            rvalue += value;
-            break;
-        default:
-        case RideMetric::Average:
-            {
-            // average should be calculated taking into account
-            // the duration of the ride, otherwise high value but
-            // short rides will skew the overall average
-            if (value || aggZero) {
-                rvalue += value*count;
-                rcount += count;
-            }
-            break;
-            }
-        case RideMetric::Low:
-            {
-            if (value < rvalue) rvalue = value;
-            break;
-            }
-        case RideMetric::Peak:
-            {
-            if (value > rvalue) rvalue = value;
-            break;
-            }
-        case RideMetric::MeanSquareRoot:
-            {
-                rvalue = sqrt((pow(rvalue, 2)*rcount + pow(value,2)*count)/(rcount + count));
-                rcount += count;
-                break;
-            }
-        }
-    }
-
-    // now compute the average
-    if (metric->type() == RideMetric::Average) {
-        if (rcount) rvalue = rvalue / rcount;
+    {
+        QReadLocker locker(&table_.lock);
+        rvalue = table_.aggregate(metric, select(spec));
     }
 
     const_cast<RideMetric*>(metric)->setValue(rvalue);
@@ -740,13 +739,39 @@ QHash<QString,int>
 RideCache::getRankedValues(QString field)
 {
     QHash<QString, int> returning;
+    if (rides().isEmpty()) return returning;
+
+    // rides share the athlete's metadata dictionary, so we
+    // count value ids and only look up the strings at the end
+    QSharedPointer<MetadataDictionary> dictionary = rides().first()->metadata().dictionary();
+    int key = dictionary->id(field);
+    int empty = dictionary->id("");
+
+    QHash<int, int> counts;
     foreach(RideItem *item, rides()) {
-        QString value = item->metadata().value(field, "");
+
+        const MetadataMap &metadata = item->metadata();
+        if (metadata.dictionary() == dictionary) {
+            int value = metadata.valueId(key);
+            if (value >= 0) {
+                if (value != empty) counts[value]++;
+                continue;
+            }
+        }
+
+        // not one of ours (shouldn't happen) or free text
+        QString value = metadata.value(field, "");
         if (value != "") {
             int count = returning.value(value,0);
             returning.insert(value,++count);
         }
     }
+
+    QHashIterator<int,int> i(counts);
+    while(i.hasNext()) {
+        i.next();
+        returning[dictionary->string(i.key())] += i.value();
+    }
     return returning;
 }
 
@@ -786,24 +811,8 @@ void
 RideCache::getRideTypeCounts(Specification specification, int& nActivities,
                              int& nRides, int& nRuns, int& nSwims, QString& sport)
 {
-    nActivities = nRides = nRuns = nSwims = 0;
-    sport = "";
-
-    // loop through and aggregate
-    foreach (RideItem *ride, rides_) {
-
-        // skip filtered rides
-        if (!specification.pass(ride)) continue;
-
-        // sport is not empty only when all activities are from the same sport
-        if (nActivities == 0) sport = ride->sport;
-        else if (sport != ride-> sport) sport = "";
-
-        nActivities++;
-        if (ride->isSwim) nSwims++;
-        else if (ride->isRun) nRuns++;
-        else if (ride->isBike) nRides++;
-    }
+    QReadLocker locker(&table_.lock);
+    table_.typeCounts(select(specification), nActivities, nRides, nRuns, nSwims, sport);
 }
 
 bool
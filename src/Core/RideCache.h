@@ -23,14 +23,16 @@
 #include "MainWindow.h"
 #include "RideFile.h"
 #include "RideItem.h"
+#include "RideCacheTable.h"
+#include "RideCacheRefresh.h"
+#include "RideDBStore.h"
 #include "PDModel.h"
 
 #include <QVector>
+#include <QSet>
+#include <QMutex>
 #include <QThread>
-
-#include <QFuture>
-#include <QFutureWatcher>
-# include <QtConcurrent>
+#include <QElapsedTimer>
 
 class Context;
 class LTMPlot;
@@ -40,6 +42,7 @@ class AthleteBest;
 class RideCacheModel;
 class Estimator;
 class Banister;
+class FreeSearchIndex;
 
 class RideCache : public QObject
 {
@@ -80,11 +83,22 @@ class RideCache : public QObject
                                       SportRestriction sport=AnySport);
 
         // is running ?
-        bool isRunning() { return future.isRunning(); }
+        bool isRunning() { return refresher->isRunning(); }
 
         // the ride list
 	    QVector<RideItem*>&rides() { return rides_; } 
 
+        // column oriented copy of the metrics for aggregating
+        RideCacheTable &table() { return table_; }
+
+        // item has been refreshed, update table and mark for saving
+        // (called from RideItem::refresh, possibly in a worker thread)
+        void refreshed(RideItem *item);
+
+        // item has changed but its metrics haven't, just mark for saving
+        // (called from RideItem::completeIntervals, in any thread)
+        void modified(RideItem *item);
+
         // add/remove a ride to the list
         void addRide(QString name, bool dosignal, bool select, bool useTempActivities, bool planned);
         void removeCurrentRide();
@@ -96,12 +110,23 @@ class RideCache : public QObject
         void refresh();
         double progress() { return progress_; }
 
+        // refresh queue state (done, running, queued etc)
+        RideCacheRefresh *refreshQueue() { return refresher; }
+
+        // index for free text search
+        FreeSearchIndex *searchIndex() { return searchIndex_; }
+
+        // cold start timing, ms since we were created and ms until load() was done
+        qint64 startupTime() const { return startup.elapsed(); }
+        qint64 loadTime() const { return loadTime_; }
+
     public slots:
 
         // restore / dump cache to disk (json)
         void load();
         void postLoad();
         void save(bool opendata=false, QString filename="");
+        void saveStore();
 
         // find entry quickly
         int find(RideItem *);
@@ -110,7 +135,10 @@ class RideCache : public QObject
         void configChanged(qint32);
 
         // background refresh progress update
-        void progressing(int);
+        void progressing(int done, int total, QDate date);
+
+        // selection changed, refresh what the user is looking at first
+        void reprioritise();
 
         // cancel background processing because about to exit
         void cancel();
@@ -146,19 +174,33 @@ class RideCache : public QObject
         Context *context;
         QDir directory, plannedDirectory;
 
-        // rides and reverse are the main lists
+        // rides is the main list
         // delete_ is a list of items to garbage collect (delete later)
         // deletelist is a list of items that no longer exist (deleted)
-        QVector<RideItem*> rides_, reverse_, delete_, deletelist;
+        QVector<RideItem*> rides_, delete_, deletelist;
+        RideCacheTable table_;
         RideCacheModel *model_;
         bool exiting;
 	    double progress_; // percent
 
-        QFuture<void> future;
-        QFutureWatcher<void> watcher;
+        RideCacheRefresh *refresher;
+
+        // journaled store, items changed since last save
+        RideDBStore *store;
+        FreeSearchIndex *searchIndex_;
+        QSet<RideItem*> changed_;
+        QStringList removed_;
+        QMutex changedLock;
+        bool compact_; // e.g. after importing rideDB.json
+
+        QElapsedTimer startup;
+        qint64 loadTime_;
 
         Estimator *estimator;
         bool first; // updated when estimates are marked stale
+
+        // rows in table_ that pass the specification
+        RideCacheTable::Selection select(Specification spec);
 };
 
 class AthleteBest
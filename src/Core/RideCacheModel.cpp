@@ -95,15 +95,15 @@ RideCacheModel::data(const QModelIndex &index, int role) const
                 // but not if high precision, which means
                 // metrics with high precision don't sort this is crap XXX
                 if (m->isTime()) {
-                    return QTime(0,0,0).addSecs(rideCache->rides().at(index.row())->metrics_[m->index()]);
+                    return QTime(0,0,0).addSecs(rideCache->rides().at(index.row())->getForSymbol(m->symbol()));
                 } else if (m->units(true) != "km" && m->precision() > 0) {
-                    m->setValue(rideCache->rides().at(index.row())->metrics_[m->index()]);
+                    m->setValue(rideCache->rides().at(index.row())->getForSymbol(m->symbol()));
                     return m->toString(GlobalContext::context()->useMetricUnits); // string
                 } else {
 
                     // make low precision numbers sort, including distance which we picked
                     // up as a special case. not sure about pace ....
-                    double value = rideCache->rides().at(index.row())->metrics_[m->index()];
+                    double value = rideCache->rides().at(index.row())->getForSymbol(m->symbol());
 
                     // convert to imperial if needed
                     if (GlobalContext::context()->useMetricUnits == false) 
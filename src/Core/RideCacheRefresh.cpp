@@ -0,0 +1,279 @@
+/*
+ * Copyright (c) 2020 Mark Liversedge (liversedge@gmail.com)
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by the Free
+ * Software Foundation; either version 2 of the License, or (at your option)
+ * any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License for
+ * more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc., 51
+ * Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+#include "RideCacheRefresh.h"
+#include "RideItem.h"
+#include "Context.h"
+
+#include <QThreadPool>
+#include <QRunnable>
+#include <QThread>
+#include <algorithm>
+
+#ifdef SLOW_REFRESH
+#include "unistd.h"
+#endif
+
+// for sorting, newest first
+static bool refreshGreaterThan(const RideItem *a, const RideItem *b) { return a->dateTime > b->dateTime; }
+
+static void
+itemRefresh(RideItem *item)
+{
+    // debugging below to watch refreshing take place
+    //fprintf(stderr, "%s %s refresh\n", item->context->athlete->cyclist.toStdString().c_str(), item->dateTime.toString().toStdString().c_str()); fflush(stderr);
+
+    // need parser to be reentrant !item->refresh();
+    if (item->isstale) {
+        item->refresh();
+
+        // and trap changes during refresh to current ride
+        if (item == item->context->currentRideItem())
+            item->context->notifyRideChanged(item);
+
+#ifdef SLOW_REFRESH
+        sleep(1);
+#endif
+    }
+}
+
+// runs on the global thread pool pulling items until there are none left
+class RideCacheRefreshWorker : public QRunnable
+{
+    public:
+        RideCacheRefreshWorker(RideCacheRefresh *scheduler) : scheduler(scheduler) {}
+
+        void run() {
+            RideItem *item;
+            while ((item = scheduler->next()) != NULL) {
+                itemRefresh(item);
+                scheduler->completed(item);
+            }
+        }
+
+    private:
+        RideCacheRefresh *scheduler;
+};
+
+RideCacheRefresh::RideCacheRefresh(QObject *parent) : QObject(parent),
+    current_(NULL), workers_(0), total_(0), done_(0), cancelled_(false)
+{
+}
+
+RideCacheRefresh::~RideCacheRefresh()
+{
+    cancel();
+}
+
+void
+RideCacheRefresh::start(QVector<RideItem*> items)
+{
+    mutex.lock();
+
+    // starting afresh ?
+    bool starting = (workers_ == 0);
+    if (starting) total_ = done_ = 0;
+
+    // add to the queue, ignoring any we already have
+    foreach(RideItem *item, items) {
+        if (active_.contains(item)) continue;
+        bool found = false;
+        for(int p=0; p<Priorities && !found; p++) found = queue_[p].contains(item);
+        if (found) continue;
+
+        enqueue(item);
+        total_++;
+    }
+
+    for(int p=0; p<Priorities; p++) std::sort(queue_[p].begin(), queue_[p].end(), refreshGreaterThan);
+
+    // one worker per core, topped up if some have already finished
+    int want = qMax(1, QThread::idealThreadCount()) - workers_;
+    int waiting = count();
+    if (want > waiting) want = waiting;
+    if (want > 0) workers_ += want;
+
+    mutex.unlock();
+
+    if (starting && want > 0) emit started();
+    for(int i=0; i<want; i++) QThreadPool::globalInstance()->start(new RideCacheRefreshWorker(this));
+}
+
+void
+RideCacheRefresh::prioritise(RideItem *current, DateRange visible)
+{
+    QMutexLocker locker(&mutex);
+
+    current_ = current;
+    visible_ = visible;
+
+    // collect and requeue
+    QList<RideItem*> items;
+    for(int p=0; p<Priorities; p++) {
+        items.append(queue_[p]);
+        queue_[p].clear();
+    }
+    foreach(RideItem *item, items) enqueue(item);
+    for(int p=0; p<Priorities; p++) std::sort(queue_[p].begin(), queue_[p].end(), refreshGreaterThan);
+}
+
+bool
+RideCacheRefresh::cancel(RideItem *item)
+{
+    QMutexLocker locker(&mutex);
+
+    for(int p=0; p<Priorities; p++) {
+        if (queue_[p].removeOne(item)) {
+            total_--;
+            return true;
+        }
+    }
+    return false;
+}
+
+void
+RideCacheRefresh::cancel()
+{
+    QMutexLocker locker(&mutex);
+
+    // workers will stop when they next look for work
+    cancelled_ = true;
+    for(int p=0; p<Priorities; p++) queue_[p].clear();
+
+    // wait for items in progress to complete
+    while (workers_ > 0) idle.wait(&mutex);
+
+    cancelled_ = false;
+}
+
+bool
+RideCacheRefresh::isRunning()
+{
+    QMutexLocker locker(&mutex);
+    return workers_ > 0;
+}
+
+int
+RideCacheRefresh::total()
+{
+    QMutexLocker locker(&mutex);
+    return total_;
+}
+
+int
+RideCacheRefresh::done()
+{
+    QMutexLocker locker(&mutex);
+    return done_;
+}
+
+int
+RideCacheRefresh::running()
+{
+    QMutexLocker locker(&mutex);
+    return active_.count();
+}
+
+int
+RideCacheRefresh::queued(Priority p)
+{
+    QMutexLocker locker(&mutex);
+    return count(p);
+}
+
+int
+RideCacheRefresh::count(Priority p) const
+{
+    if (p != Priorities) return queue_[p].count();
+
+    int returning = 0;
+    for(int i=0; i<Priorities; i++) returning += queue_[i].count();
+    return returning;
+}
+
+double
+RideCacheRefresh::progress()
+{
+    QMutexLocker locker(&mutex);
+    if (total_ == 0) return 100;
+    return 100.0f * (double(done_) / double(total_));
+}
+
+RideItem *
+RideCacheRefresh::next()
+{
+    mutex.lock();
+
+    // highest priority first
+    RideItem *item = NULL;
+    if (!cancelled_) {
+        for(int p=Priorities-1; p>=0 && item == NULL; p--)
+            if (queue_[p].count()) item = queue_[p].takeFirst();
+    }
+
+    if (item) {
+        active_.insert(item);
+        mutex.unlock();
+        return item;
+    }
+
+    // nothing left so this worker retires, we do this whilst
+    // holding the lock so start() can always see how many
+    // workers are really going to look at the queue, and so
+    // cancel() can't return before we signal (it is queued)
+    workers_--;
+    if (workers_ == 0) {
+        emit finished();
+        idle.wakeAll();
+    }
+    mutex.unlock();
+
+    return NULL;
+}
+
+void
+RideCacheRefresh::completed(RideItem *item)
+{
+    mutex.lock();
+    active_.remove(item);
+    done_++;
+    int d = done_, t = total_;
+    mutex.unlock();
+
+    emit progressing(d, t, item->dateTime.date());
+}
+
+RideCacheRefresh::Priority
+RideCacheRefresh::priorityFor(RideItem *item) const
+{
+    if (item == current_) return Current;
+
+    // an empty date range passes everything, so ignore it
+    DateRange visible = visible_;
+    if ((visible.from.isValid() || visible.to.isValid()) && visible.pass(item->dateTime.date())) return Visible;
+
+    if (item->dateTime.date().daysTo(QDate::currentDate()) <= RECENTDAYS) return Recent;
+
+    return History;
+}
+
+void
+RideCacheRefresh::enqueue(RideItem *item)
+{
+    queue_[priorityFor(item)] << item;
+}
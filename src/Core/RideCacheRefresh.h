@@ -0,0 +1,118 @@
+/*
+ * Copyright (c) 2020 Mark Liversedge (liversedge@gmail.com)
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by the Free
+ * Software Foundation; either version 2 of the License, or (at your option)
+ * any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License for
+ * more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc., 51
+ * Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+#ifndef _GC_RideCacheRefresh_h
+#define _GC_RideCacheRefresh_h 1
+
+#include "TimeUtils.h" // for DateRange
+
+#include <QObject>
+#include <QVector>
+#include <QList>
+#include <QSet>
+#include <QDate>
+#include <QMutex>
+#include <QWaitCondition>
+
+class RideItem;
+class RideCacheRefreshWorker;
+
+//
+// Background refresh of stale RideItems
+//
+// Rather than handing the whole ride list to QtConcurrent::map we keep a
+// queue of stale items in priority order; the ride the user is looking
+// at first, then rides in the date range being viewed, then recent rides
+// and finally the rest of history, newest first within each.
+//
+// Worker tasks are run on the global thread pool and each one pulls the
+// next highest priority item off the shared queue when it is idle, so
+// if the selection changes the queue is reordered and the next item any
+// worker picks up reflects the new priorities.
+//
+class RideCacheRefresh : public QObject
+{
+    Q_OBJECT
+
+    public:
+
+        // higher value is refreshed first
+        enum priority { History=0, Recent, Visible, Current, Priorities };
+        typedef enum priority Priority;
+
+        // rides in the last RECENTDAYS are prioritised over history
+        static const int RECENTDAYS = 90;
+
+        RideCacheRefresh(QObject *parent=NULL);
+        ~RideCacheRefresh();
+
+        // add items to the queue and start workers, if we are
+        // already running they are merged into the queue
+        void start(QVector<RideItem*> items);
+
+        // selection changed, so reorder whatever is still queued
+        void prioritise(RideItem *current, DateRange visible);
+
+        // drop an item from the queue, returns false if it isn't
+        // queued (e.g. it is already being refreshed or done)
+        bool cancel(RideItem *item);
+
+        // drop everything and wait for running items to complete
+        void cancel();
+
+        // queue state
+        bool isRunning();
+        int total();                     // items queued since started
+        int done();                      // items refreshed
+        int running();                   // items being refreshed right now
+        int queued(Priority p=Priorities); // waiting (at priority p or all)
+        double progress();               // done as a percentage of total
+
+    signals:
+
+        void started();
+        void progressing(int done, int total, QDate date); // date of item just done
+        void finished();
+
+    private:
+
+        friend class ::RideCacheRefreshWorker;
+
+        // called by the workers
+        RideItem *next();
+        void completed(RideItem *item);
+
+        // not locked, caller must hold mutex
+        Priority priorityFor(RideItem *item) const;
+        int count(Priority p=Priorities) const;
+        void enqueue(RideItem *item);
+
+        QMutex mutex;
+        QWaitCondition idle;
+
+        QList<RideItem*> queue_[Priorities]; // each one newest first
+        QSet<RideItem*> active_;
+
+        RideItem *current_;
+        DateRange visible_;
+
+        int workers_, total_, done_;
+        bool cancelled_;
+};
+
+#endif // _GC_RideCacheRefresh_h
@@ -0,0 +1,275 @@
+/*
+ * Copyright (c) 2020 Mark Liversedge (liversedge@gmail.com)
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by the Free
+ * Software Foundation; either version 2 of the License, or (at your option)
+ * any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License for
+ * more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc., 51
+ * Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+#include "RideCacheTable.h"
+#include "RideItem.h"
+#include "RideMetric.h"
+#include "RideFile.h" // for RideFile::NA
+#include "Specification.h"
+
+#include <cmath>
+#include <algorithm>
+
+RideCacheTable::RideCacheTable() : rows_(0), columns_(0), durationIndex(-1) {}
+
+void
+RideCacheTable::rebuild(const QVector<RideItem*> &rides)
+{
+    QWriteLocker locker(&lock);
+
+    const RideMetricFactory &factory = RideMetricFactory::instance();
+
+    rows_ = rides.count();
+    columns_ = factory.metricCount();
+
+    const RideMetric *duration = factory.rideMetric("workout_time");
+    durationIndex = duration ? duration->index() : -1;
+
+    values_.fill(0, rows_ * columns_);
+    date_.fill(QDate(), rows_);
+    sport_.resize(rows_);
+    kind_.resize(rows_);
+    file_.fill(QString(), rows_);
+
+    row_.clear();
+    row_.reserve(rows_);
+    fileRow_.clear();
+    fileRow_.reserve(rows_);
+    for(int i=0; i<rows_; i++) {
+        row_.insert(rides.at(i), i);
+        setRow(i, rides.at(i));
+    }
+
+    // rides are sorted by date when the list changes
+    unsorted_.store(0);
+}
+
+bool
+RideCacheTable::update(RideItem *item)
+{
+    // we only update values, the shape of the
+    // table is fixed so concurrent updates to
+    // different rows are fine with a read lock
+    QReadLocker locker(&lock);
+
+    int row = row_.value(item, -1);
+    if (row < 0) return false; // not one of ours
+
+    setRow(row, item);
+    return true;
+}
+
+bool
+RideCacheTable::contains(RideItem *item)
+{
+    QReadLocker locker(&lock);
+    return row_.contains(item);
+}
+
+void
+RideCacheTable::setRow(int row, RideItem *item)
+{
+    // values, the item may not have been computed yet or is from a
+    // different metric schema, in which case we zero the row. Items
+    // restored from the store aren't decoded just to get these
+    QVector<double> metrics;
+    item->summary(metrics);
+    bool ok = metrics.count() == columns_;
+    for(int c=0; c<columns_; c++) {
+
+        double value = ok ? metrics[c] : 0;
+
+        // clean here so the scans don't need to check
+        if (std::isnan(value) || std::isinf(value)) value = 0;
+        values_[c * rows_ + row] = value;
+    }
+
+    // moving a ride to another date means rows may be out of order
+    QDate date = item->dateTime.date();
+    if (date_[row].isValid() && date_[row] != date) unsorted_.store(1);
+    date_[row] = date;
+
+    if (file_[row] != item->fileName) {
+        QMutexLocker locker(&filesLock);
+        if (fileRow_.value(file_[row], -1) == row) fileRow_.remove(file_[row]);
+        file_[row] = item->fileName;
+        fileRow_.insert(item->fileName, row);
+    }
+
+    unsigned char kind = 0;
+    if (item->isBike) kind |= Bike;
+    if (item->isRun) kind |= Run;
+    if (item->isSwim) kind |= Swim;
+    if (item->isXtrain) kind |= Xtrain;
+    if (item->planned) kind |= Planned;
+    kind_[row] = kind;
+
+    // sports dictionary is shared across rows
+    sportsLock.lock();
+    int index = sports_.indexOf(item->sport);
+    if (index < 0) {
+        index = sports_.count();
+        sports_ << item->sport;
+    }
+    sportsLock.unlock();
+    sport_[row] = index;
+}
+
+RideCacheTable::Selection
+RideCacheTable::select(DateRange dr, const FilterSet &fs) const
+{
+    Selection selection(rows_, 0);
+
+    // rows in the date range, an invalid date is open ended
+    int from = 0, to = rows_;
+    bool sorted = !unsorted_.load();
+    if (sorted) {
+        if (dr.from.isValid()) from = std::lower_bound(date_.constBegin(), date_.constEnd(), dr.from) - date_.constBegin();
+        if (dr.to.isValid()) to = std::upper_bound(date_.constBegin(), date_.constEnd(), dr.to) - date_.constBegin();
+    }
+
+    // rows that pass the filters, compiled up front rather than
+    // looking up every ride in every filter
+    QBitArray filtered;
+    if (fs.count()) {
+        QMutexLocker locker(&filesLock);
+        filtered = fs.compile(fileRow_, rows_);
+    }
+
+    // and set the rows that pass both, keeping track of the first and
+    // last so the aggregation doesn't need to scan the rest
+    selection.from = rows_;
+    selection.to = 0;
+    for(int i=from; i<to; i++) {
+        if (!filtered.isEmpty() && !filtered.testBit(i)) continue;
+        if (!sorted && !dr.pass(date_[i])) continue;
+        selection[i] = 1;
+        if (i < selection.from) selection.from = i;
+        selection.to = i + 1;
+    }
+    if (selection.to == 0) selection.from = 0;
+
+    return selection;
+}
+
+double
+RideCacheTable::aggregate(const RideMetric *metric, const Selection &selection) const
+{
+    int index = metric->index();
+    if (index < 0 || index >= columns_ || selection.count() != rows_) return 0;
+
+    const double *value = values_.constData() + (index * rows_);
+    const double *count = durationIndex >= 0 ? values_.constData() + (durationIndex * rows_) : NULL;
+    const double *selected = selection.constData();
+
+    // these loops are deliberately simple and branch free
+    // so the compiler can vectorise them, unselected rows
+    // are multiplied by zero
+    double rvalue = 0;
+    switch (metric->type()) {
+
+    case RideMetric::RunningTotal:
+    case RideMetric::Total:
+        {
+            for(int i=selection.from; i<selection.to; i++) rvalue += value[i] * selected[i];
+        }
+        break;
+
+    default:
+    case RideMetric::Average:
+        {
+            // weighted by duration, zero values are only included when the
+            // metric aggregates zero, but temperature NA is never included
+            if (!count) break;
+
+            bool aggZero = metric->aggregateZero();
+            bool temperature = metric->symbol() == "average_temp";
+
+            double rcount = 0;
+            for(int i=selection.from; i<selection.to; i++) {
+                double w = selected[i];
+                if (temperature && value[i] == RideFile::NA) w = 0;
+                else if (!aggZero && value[i] == 0) w = 0;
+                rvalue += value[i] * count[i] * w;
+                rcount += count[i] * w;
+            }
+            // only true averages are divided out, other types
+            // that fall through to here are left as weighted sums
+            if (rcount && metric->type() == RideMetric::Average) rvalue = rvalue / rcount;
+        }
+        break;
+
+    // the aggregate starts at zero, so an unselected row
+    // contributing zero doesn't change the result
+    case RideMetric::Low:
+        {
+            for(int i=selection.from; i<selection.to; i++) rvalue = std::min(rvalue, value[i] * selected[i]);
+        }
+        break;
+
+    case RideMetric::Peak:
+        {
+            for(int i=selection.from; i<selection.to; i++) rvalue = std::max(rvalue, value[i] * selected[i]);
+        }
+        break;
+
+    case RideMetric::MeanSquareRoot:
+        {
+            if (!count) break;
+
+            double rcount = 0;
+            for(int i=selection.from; i<selection.to; i++) {
+                rvalue += value[i] * value[i] * count[i] * selected[i];
+                rcount += count[i] * selected[i];
+            }
+            rvalue = rcount ? sqrt(rvalue / rcount) : 0;
+        }
+        break;
+    }
+
+    return rvalue;
+}
+
+void
+RideCacheTable::typeCounts(const Selection &selection, int &nActivities, int &nRides,
+                           int &nRuns, int &nSwims, QString &sport) const
+{
+    nActivities = nRides = nRuns = nSwims = 0;
+    sport = "";
+
+    if (selection.count() != rows_) return;
+
+    QMutexLocker locker(&sportsLock);
+
+    // -1 means not seen yet, -2 means more than one
+    int sportIndex = -1;
+    for(int i=selection.from; i<selection.to; i++) {
+
+        if (!selection[i]) continue;
+
+        nActivities++;
+        if (kind_[i] & Swim) nSwims++;
+        else if (kind_[i] & Run) nRuns++;
+        else if (kind_[i] & Bike) nRides++;
+
+        if (sportIndex == -1) sportIndex = sport_[i];
+        else if (sportIndex != sport_[i]) sportIndex = -2;
+    }
+
+    if (sportIndex >= 0 && sportIndex < sports_.count()) sport = sports_.at(sportIndex);
+}
@@ -0,0 +1,133 @@
+/*
+ * Copyright (c) 2020 Mark Liversedge (liversedge@gmail.com)
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by the Free
+ * Software Foundation; either version 2 of the License, or (at your option)
+ * any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License for
+ * more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc., 51
+ * Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+#ifndef _GC_RideCacheTable_h
+#define _GC_RideCacheTable_h 1
+
+#include <QVector>
+#include <QHash>
+#include <QDate>
+#include <QStringList>
+#include <QReadWriteLock>
+#include <QMutex>
+#include <QAtomicInt>
+
+class RideItem;
+class RideMetric;
+class DateRange;
+class FilterSet;
+
+//
+// A column oriented copy of the metric values held by each RideItem
+//
+// RideItems each hold their own metrics_ and count_ vectors, which is fine
+// when working with a single ride, but aggregating a metric over a season
+// then means chasing a pointer into a separate heap allocation for every
+// ride. The table holds one contiguous column per metric with one row per
+// ride (in the same order as RideCache::rides()) along with columns for
+// date, sport and planned so aggregation is a straight scan over arrays.
+//
+// The structure is rebuilt whenever the ride list changes (load, add,
+// remove) and individual rows are updated by RideItem::refresh(), which
+// may be running in a worker thread, so all access is via the lock.
+//
+class RideCacheTable
+{
+    public:
+
+        // bits in the kind column
+        enum { Bike=0x01, Run=0x02, Swim=0x04, Xtrain=0x08, Planned=0x10 };
+
+        RideCacheTable();
+
+        // ride list changed shape, so rebuild from scratch
+        void rebuild(const QVector<RideItem*> &rides);
+
+        // a ride was refreshed, so update its row, returns
+        // false if the item isn't in the table (e.g. temporary)
+        bool update(RideItem *item);
+
+        // is the item in the table, i.e. not temporary
+        bool contains(RideItem *item);
+
+        // dimensions
+        int rows() const { return rows_; }
+        int columns() const { return columns_; }
+
+        // row selection, 1 for rows to include and 0 otherwise. rows
+        // outside from..to (exclusive) are all 0 so aren't scanned
+        class Selection : public QVector<double> {
+            public:
+                Selection() : from(0), to(0) {}
+                Selection(int rows, double value) : QVector<double>(rows, value), from(0), to(value ? rows : 0) {}
+                int from, to;
+        };
+
+        // rows in the date range that pass the filter set, dates are
+        // found by binary search since rows are in date order
+        Selection select(DateRange dr, const FilterSet &fs) const;
+
+        // aggregate a metric over the selected rows with the same
+        // semantics as RideCache::getAggregate (see RideMetric::type)
+        double aggregate(const RideMetric *metric, const Selection &selection) const;
+
+        // count the selected rows by sport, sport is only set
+        // when all the selected rows are for the same sport
+        void typeCounts(const Selection &selection, int &nActivities, int &nRides,
+                        int &nRuns, int &nSwims, QString &sport) const;
+
+        // locking, readers can run concurrently
+        QReadWriteLock lock;
+
+    private:
+
+        // not locked, caller must hold lock
+        void setRow(int row, RideItem *item);
+
+        int rows_, columns_;
+
+        // metric-major; column c starts at values_[c * rows_]
+        QVector<double> values_;
+
+        // first class columns
+        QVector<QDate> date_;
+        QVector<int> sport_;        // index into sports_ dictionary
+        QVector<unsigned char> kind_;  // Bike, Run, Swim, Xtrain, Planned bits
+
+        // sport names are repeated, so we only keep each once
+        QStringList sports_;
+        mutable QMutex sportsLock;
+
+        // find the row for an item
+        QHash<RideItem*, int> row_;
+
+        // and for a filename, for filter sets. names only change
+        // when a ride is converted on save, but it can happen
+        QVector<QString> file_;
+        QHash<QString, int> fileRow_;
+        mutable QMutex filesLock;
+
+        // set if a ride date changed since the rebuild, so rows
+        // may not be in date order and we can't binary search
+        QAtomicInt unsorted_;
+
+        // workout_time is used to weight averages
+        int durationIndex;
+};
+
+#endif // _GC_RideCacheTable_h
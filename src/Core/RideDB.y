@@ -19,6 +19,7 @@
 
 #include "RideDB.h"
 #include "RideFileCache.h"
+#include "FreeSearch.h"
 #include "Settings.h"
 #ifdef GC_WANT_HTTP
 #include "APIWebService.h"
@@ -115,6 +116,7 @@ ride: '{' rideelement_list '}'                                  {
                                                                     jc->interval.route = QUuid();
                                                                     jc->item.clearIntervals();
                                                                     jc->item.overrides_.clear();
+                                                                    jc->item.fingerprints.clear();
                                                                     jc->item.fileName = "";
                                                                     jc->count = "";
                                                                     jc->value = "";
@@ -138,6 +140,10 @@ rideelement: ride_tuple
 ride_tuple: string ':' string                                   { 
                                                                      if ($1 == "filename") jc->item.fileName = $3;
                                                                      else if ($1 == "fingerprint") jc->item.fingerprint = $3.toULongLong();
+                                                                     else if ($1 == "fingerprints") {
+                                                                         jc->item.fingerprints.clear();
+                                                                         foreach(QString fp, $3.split(",")) jc->item.fingerprints << fp.toULongLong();
+                                                                     }
                                                                      else if ($1 == "crc") jc->item.crc = $3.toULongLong();
                                                                      else if ($1 == "metacrc") jc->item.metacrc = $3.toULongLong();
                                                                      else if ($1 == "timestamp") jc->item.timestamp = $3.toULongLong();
@@ -223,6 +229,8 @@ interval: '{' intervalelement_list '}'                          {
                                                                     jc->interval.counts().fill(0.0f);
                                                                     jc->interval.stdmeans().clear();
                                                                     jc->interval.stdvariances().clear();
+                                                                    jc->interval.pending_ = false;
+                                                                    jc->interval.computed_.clear();
 
                                                                 }
 
@@ -246,6 +254,14 @@ interval_tuple: string ':' string                               {
                                                                      else if ($1 == "seq") jc->interval.displaySequence = $3.toInt();
                                                                      else if ($1 == "route") jc->interval.route = QUuid($3);
                                                                      else if ($1 == "test") jc->interval.test = $3 == "true" ? true : false;
+                                                                     else if ($1 == "pending") {
+                                                                         jc->interval.pending_ = true;
+                                                                         jc->interval.computed_.fill(false, jc->interval.metrics_.count());
+                                                                         foreach(QString symbol, $3.split(",")) {
+                                                                             const RideMetric *m = RideMetricFactory::instance().rideMetric(symbol);
+                                                                             if (m && m->index() < jc->interval.computed_.size()) jc->interval.computed_.setBit(m->index());
+                                                                         }
+                                                                     }
                                                                 }
 
 interval_metrics: METRICS ':' '{' interval_metrics_list '}'                       ;
@@ -325,6 +341,42 @@ string: STRING                                               { jc->JsonString =
 void 
 RideCache::load()
 {
+    // use the journaled store if we have one, see RideDBStore.h
+    if (store->exists()) {
+
+        QDir directory = context->athlete->home->activities();
+        QString folder = context->athlete->home->root().canonicalPath();
+        int loading = 0;
+
+        // clean item
+        RideItem item;
+        item.path = directory.canonicalPath(); // TODO use plannedDirectory for planned
+        item.context = context;
+        item.isstale = item.isdirty = item.isedit = false;
+
+        bool loaded = store->read(item, [&](RideItem &here) {
+
+            double progress= double(loading++) / double(rides().count()) * 100.0f;
+            if (context->mainWindow->progress) {
+
+                // percentage progress
+                QString m = QString("%1%").arg(progress , 0, 'f', 0);
+                context->mainWindow->progress->setText(m);
+                QApplication::processEvents();
+            } else {
+                context->notifyLoadProgress(folder,progress);
+            }
+
+            // find entry and update it
+            int index=find(&here);
+            if (index==-1)  qDebug()<<"unable to load:"<<here.fileName<<here.dateTime<<here.weight;
+            else  rides().at(index)->setFrom(here);
+        });
+
+        // all good
+        if (loaded) return;
+    }
+
     // only load if it exists !
     QFile rideDB(QString("%1/%2").arg(context->athlete->home->cache().canonicalPath()).arg("rideDB.json"));
     if (rideDB.exists() && rideDB.open(QFile::ReadOnly)) {
@@ -378,6 +430,9 @@ RideCache::load()
         // regardless of errors we're done !
         delete jc;
 
+        // import into the journaled store when we next save
+        compact_ = true;
+
         return;
     }
 }
@@ -484,6 +539,12 @@ QString ConstructNameNumberNumberString(QString s0, QString name, QString s1, do
 //
 void RideCache::save(bool opendata, QString filename)
 {
+    // the athlete's own cache is kept in the journaled
+    // store, json is only written when exporting
+    if (!opendata && filename == "") {
+        saveStore();
+        return;
+    }
 
     // now save data away - use passed filename if set
     QFile rideDB(QString("%1/%2").arg(context->athlete->home->cache().canonicalPath()).arg("rideDB.json"));
@@ -536,6 +597,11 @@ void RideCache::save(bool opendata, QString filename)
                 // we don't send this info when sharing as opendata
                 stream << "\t\t\"filename\":\"" <<item->fileName <<"\",\n";
                 stream << "\t\t\"fingerprint\":\"" <<item->fingerprint <<"\",\n";
+                if (item->fingerprints.count()) {
+                    QStringList fps;
+                    foreach(unsigned long fp, item->fingerprints) fps << QString::number(fp);
+                    stream << "\t\t\"fingerprints\":\"" <<fps.join(",") <<"\",\n";
+                }
                 stream << "\t\t\"crc\":\"" <<item->crc <<"\",\n";
                 stream << "\t\t\"metacrc\":\"" <<item->metacrc <<"\",\n";
                 stream << "\t\t\"timestamp\":\"" <<item->timestamp <<"\",\n";
@@ -717,11 +783,12 @@ void RideCache::save(bool opendata, QString filename)
 
                 stream << ",\n\t\t\"TAGS\":{\n";
 
+                QMap<QString,QString> metadata = item->metadata().toMap();
                 QMap<QString,QString>::const_iterator i;
-                for (i=item->metadata().constBegin(); i != item->metadata().constEnd(); i++) {
+                for (i=metadata.constBegin(); i != metadata.constEnd(); i++) {
 
                     stream << "\t\t\t\"" << i.key() << "\":\"" << protect(i.value()) << "\"";
-                    if (i+1 != item->metadata().constEnd()) stream << ",\n";
+                    if (i+1 != metadata.constEnd()) stream << ",\n";
                     else stream << "\n";
                 }
 
@@ -783,12 +850,21 @@ void RideCache::save(bool opendata, QString filename)
                         stream << "\t\t\t\"route\":\"" << interval->route.toString() <<"\",\n"; // last one no ',\n' see METRICS below..
                     }
 
+                    // metrics we have if they haven't all been computed yet, we write
+                    // what we have rather than computing them just to save them
+                    if (interval->isPending()) {
+                        QStringList have;
+                        for(int i=0; i<factory.metricCount(); i++)
+                            if (interval->have(factory.rideMetric(factory.metricName(i))->index())) have << factory.metricName(i);
+                        stream << "\t\t\t\"pending\":\"" << have.join(",") <<"\",\n";
+                    }
+
                     stream << "\t\t\t\"seq\":\"" << interval->displaySequence <<"\""; // last one no ',\n' see METRICS below..
 
 
                     // check if we have any non-zero metrics
                     bool hasMetrics=false;
-                    foreach(double v, interval->metrics()) {
+                    foreach(double v, interval->metrics_) {
                         if (v > 0.00f || v < 0.00f) {
                             hasMetrics=true;
                             break;
@@ -805,25 +881,25 @@ void RideCache::save(bool opendata, QString filename)
         
                             // don't output 0 values, they're set to 0 by default
                             // unless aggregateZero indicates the count is relevant
-                            if ((interval->metrics()[index] > 0.00f || interval->metrics()[index] < 0.00f) ||
+                            if ((interval->metrics_[index] > 0.00f || interval->metrics_[index] < 0.00f) ||
                                 (item->metrics()[index] == 0.00f && item->counts()[i] > 1.0 && factory.rideMetric(name)->aggregateZero())) {
                                 if (!firstMetric) stream << ",\n";
                                 firstMetric = false;
 
-                                if (interval->stdmeans().value(index, 0.0f) || interval->stdvariances().value(index, 0.0f)) {
+                                if (interval->stdmean_.value(index, 0.0f) || interval->stdvariance_.value(index, 0.0f)) {
 
-                                    stream << "\t\t\t\t\"" << name << "\": [ \"" << QString("%1").arg(interval->metrics()[index], 0, 'f', 5) <<"\",\""
-                                                                               << QString("%1").arg(interval->counts()[index], 0, 'f', 5) << "\",\""
-                                                                               << QString("%1").arg(interval->stdmeans().value(index, 0.0f), 0, 'f', 5) << "\",\""
-                                                                               << QString("%1").arg(interval->stdvariances().value(index, 0.0f), 0, 'f', 5) <<"\"]";
+                                    stream << "\t\t\t\t\"" << name << "\": [ \"" << QString("%1").arg(interval->metrics_[index], 0, 'f', 5) <<"\",\""
+                                                                               << QString("%1").arg(interval->count_[index], 0, 'f', 5) << "\",\""
+                                                                               << QString("%1").arg(interval->stdmean_.value(index, 0.0f), 0, 'f', 5) << "\",\""
+                                                                               << QString("%1").arg(interval->stdvariance_.value(index, 0.0f), 0, 'f', 5) <<"\"]";
 
                                 // if count is 0 don't write it
-                                } else if (interval->counts()[index] == 0) {
+                                } else if (interval->count_[index] == 0) {
                                     stream << ConstructNameNumberString(QString("\t\t\t\""), name,
-                                        QString("\":\""), interval->metrics()[index], QString("\""));
+                                        QString("\":\""), interval->metrics_[index], QString("\""));
                                 } else {
                                     stream << ConstructNameNumberNumberString(QString("\t\t\t\""), name,
-                                        QString("\":[\""), interval->metrics()[index], QString("\",\""), interval->counts()[index], QString("\"]"));
+                                        QString("\":[\""), interval->metrics_[index], QString("\",\""), interval->count_[index], QString("\"]"));
                                 }
                             }
                         }
@@ -849,6 +925,51 @@ void RideCache::save(bool opendata, QString filename)
     }
 }
 
+// save changes to the journaled store
+void RideCache::saveStore()
+{
+    // take the changes
+    changedLock.lock();
+    QList<RideItem*> updated = changed_.toList();
+    QStringList removed = removed_;
+    changed_.clear();
+    removed_.clear();
+    changedLock.unlock();
+
+    QList<RideItem*> writing;
+    foreach(RideItem *item, updated) {
+
+        // skip if not loaded/refreshed, a special case
+        // if saving during an initial refresh
+        if (item->metrics().count() == 0) continue;
+
+        // don't save files with discarded changes at exit
+        if (item->skipsave == true) removed << item->fileName;
+        else writing << item;
+    }
+
+    // append to the journal, or compact if it's time to
+    // (or the journal can't be used e.g. metric schema changed)
+    bool saved = false;
+    if (!compact_ && !store->needsCompaction(rides_.count())) saved = store->append(writing, removed);
+    if (!saved) saved = store->compact(rides_);
+
+    // free search index is kept alongside
+    searchIndex_->save();
+
+    if (saved) {
+        compact_ = false;
+    } else {
+
+        // try again next time
+        qDebug()<<"unable to save ride cache to"<<context->athlete->home->cache().canonicalPath();
+        changedLock.lock();
+        foreach(RideItem *item, writing) changed_.insert(item);
+        removed_ << removed;
+        changedLock.unlock();
+    }
+}
+
 #ifdef GC_WANT_HTTP
 #include "RideMetadata.h"
 
@@ -858,14 +979,16 @@ APIWebService::listRides(QString athlete, HttpRequest &request, HttpResponse &re
     listRideSettings settings;
 
     // the ride db
-    QString ridedb = QString("%1/%2/cache/rideDB.json").arg(home.absolutePath()).arg(athlete);
+    QString cachePath = QString("%1/%2/cache").arg(home.absolutePath()).arg(athlete);
+    QString ridedb = QString("%1/rideDB.json").arg(cachePath);
     QFile rideDB(ridedb);
+    RideDBStore store(cachePath);
 
     // list activities and associated metrics
     response.setHeader("Content-Type", "text; charset=ISO-8859-1");
 
     // not known..
-    if (!rideDB.exists()) {
+    if (!store.exists() && !rideDB.exists()) {
         response.setStatus(404);
         response.write("malformed URL or unknown athlete.\n");
         return;
@@ -988,8 +1111,18 @@ APIWebService::listRides(QString athlete, HttpRequest &request, HttpResponse &re
         }
         response.bwrite("\n");
 
+        // read the store and write a line for each entry
+        RideItem item;
+        item.path = home.absolutePath() + "/activities";
+        item.context = NULL;
+        item.isstale = item.isdirty = item.isedit = false;
+
+        if (store.exists() && store.read(item, [&](RideItem &here) { writeRideLine(here, &request, &response); })) {
+
+            // all done
+
         // parse the rideDB and write a line for each entry
-        if (rideDB.exists() && rideDB.open(QFile::ReadOnly)) {
+        } else if (rideDB.exists() && rideDB.open(QFile::ReadOnly)) {
 
             // ok, lets read it in
             QTextStream stream(&rideDB);
@@ -0,0 +1,933 @@
+/*
+ * Copyright (c) 2020 Mark Liversedge (liversedge@gmail.com)
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by the Free
+ * Software Foundation; either version 2 of the License, or (at your option)
+ * any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License for
+ * more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc., 51
+ * Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+#include "RideDBStore.h"
+#include "RideDB.h" // for RIDEDB_VERSION
+#include "RideItem.h"
+#include "IntervalItem.h"
+#include "RideMetric.h"
+
+#include <QFile>
+#include <QSaveFile>
+#include <QDataStream>
+#include <QHash>
+#include <QDebug>
+#include <QReadLocker>
+#include <QWriteLocker>
+#include <QMutexLocker>
+#include <QBitArray>
+#include <cmath>
+
+#ifdef Q_OS_WIN
+#include <io.h>
+#else
+#include <unistd.h>
+#endif
+
+static const quint32 SNAPSHOT_MAGIC = 0x47435253; // "GCRS"
+static const quint32 JOURNAL_MAGIC = 0x4743524a;  // "GCRJ"
+static const quint32 STORE_VERSION = 1;
+static const quint32 BYTEORDER = 0x01020304;     // columns are native doubles
+
+// length, checksum and op
+static const int FRAMEHEADER = sizeof(quint32) + sizeof(quint16) + sizeof(quint8);
+
+// don't bother compacting small journals
+static const int MINJOURNAL = 250;
+
+RideDBStore::RideDBStore(QString cachePath) : snapshot(NULL), generation(0), records(0), old(false)
+{
+    snapshotFile = QString("%1/rideDB.snapshot").arg(cachePath);
+    journalFile = QString("%1/rideDB.journal").arg(cachePath);
+}
+
+RideDBStore::~RideDBStore()
+{
+    // rides that are still lazy refer to the snapshot, so the
+    // ride cache must have gone (or saved) before we do
+    if (snapshot) delete snapshot;
+}
+
+// flush and make sure it's on the disk, not just with the OS
+static bool
+syncToDisk(QFile &file)
+{
+    if (!file.flush()) return false;
+#ifdef Q_OS_WIN
+    return _commit(file.handle()) == 0;
+#else
+    return fsync(file.handle()) == 0;
+#endif
+}
+
+bool
+RideDBStore::exists() const
+{
+    return QFile(snapshotFile).exists() || QFile(journalFile).exists();
+}
+
+bool
+RideDBStore::exists(QString cachePath)
+{
+    return RideDBStore(cachePath).exists();
+}
+
+QStringList
+RideDBStore::schema()
+{
+    const RideMetricFactory &factory = RideMetricFactory::instance();
+
+    QStringList returning;
+    for(int i=0; i<factory.metricCount(); i++) returning << "";
+    foreach(QString name, factory.allMetrics()) {
+        const RideMetric *m = factory.rideMetric(name);
+        if (m && m->index() >= 0 && m->index() < returning.count()) returning[m->index()] = name;
+    }
+    return returning;
+}
+
+QVector<int>
+RideDBStore::mapping(const QStringList &symbols)
+{
+    const RideMetricFactory &factory = RideMetricFactory::instance();
+
+    QVector<int> returning(symbols.count(), -1);
+    for(int i=0; i<symbols.count(); i++) {
+        const RideMetric *m = factory.rideMetric(symbols[i]);
+        if (m) returning[i] = m->index();
+        else qDebug()<<"metric not found:"<<symbols[i];
+    }
+    return returning;
+}
+
+//
+// Metric values are sparse, most rides have zero for most metrics
+//
+static void
+writeMetrics(QDataStream &out, QVector<double> &metrics, QVector<double> &counts,
+             QMap<int,double> &stdmeans, QMap<int,double> &stdvariances)
+{
+    QList<quint32> nonzero;
+    for(int i=0; i<metrics.count(); i++) {
+        if (std::isinf(metrics[i]) || std::isnan(metrics[i])) continue;
+        if (metrics[i] != 0 || (i < counts.count() && counts[i] != 0)) nonzero << i;
+    }
+
+    out << quint32(nonzero.count());
+    foreach(quint32 i, nonzero) out << i << metrics[i] << (int(i) < counts.count() ? counts[i] : 0.0);
+
+    out << stdmeans << stdvariances;
+}
+
+static void
+readMetrics(QDataStream &in, const QVector<int> &map, QVector<double> &metrics, QVector<double> &counts,
+            QMap<int,double> &stdmeans, QMap<int,double> &stdvariances)
+{
+    quint32 n;
+    in >> n;
+    for(quint32 j=0; j<n && in.status() == QDataStream::Ok; j++) {
+        quint32 i;
+        double value, count;
+        in >> i >> value >> count;
+
+        int index = int(i) < map.count() ? map[i] : -1;
+        if (index >= 0 && index < metrics.count()) {
+            metrics[index] = value;
+            counts[index] = count;
+        }
+    }
+
+    QMap<int,double> means, variances;
+    in >> means >> variances;
+
+    QMapIterator<int,double> m(means);
+    while(m.hasNext()) {
+        m.next();
+        int index = m.key() < map.count() ? map[m.key()] : -1;
+        if (index >= 0) stdmeans.insert(index, m.value());
+    }
+    QMapIterator<int,double> v(variances);
+    while(v.hasNext()) {
+        v.next();
+        int index = v.key() < map.count() ? map[v.key()] : -1;
+        if (index >= 0) stdvariances.insert(index, v.value());
+    }
+}
+
+QByteArray
+RideDBStore::encode(RideItem *item)
+{
+    QByteArray returning;
+    QDataStream out(&returning, QIODevice::WriteOnly);
+    out.setVersion(QDataStream::Qt_5_0);
+
+    encodeHead(out, item);
+    encodeBody(out, item);
+
+    return returning;
+}
+
+void
+RideDBStore::encodeHead(QDataStream &out, RideItem *item)
+{
+    // first class state, same as rideDB.json, and the metadata which is
+    // needed at startup (color, calendar text, search and filters)
+    out << item->fileName << item->dateTime.toUTC()
+        << quint64(item->fingerprint) << quint64(item->crc) << quint64(item->metacrc) << quint64(item->timestamp)
+        << qint32(item->dbversion) << qint32(item->udbversion)
+        << item->color.name() << item->present << item->sport << item->weight
+        << qint32(item->zoneRange) << qint32(item->hrZoneRange) << qint32(item->paceZoneRange)
+        << item->overrides_ << item->samples
+        << item->metadata();
+
+    // and the fingerprint for each config
+    QVector<quint64> fingerprints;
+    foreach(unsigned long fp, item->fingerprints) fingerprints << fp;
+    out << fingerprints;
+}
+
+void
+RideDBStore::encodeBody(QDataStream &out, RideItem *item)
+{
+    writeMetrics(out, item->metrics(), item->counts(), item->stdmeans(), item->stdvariances());
+
+    out << item->xdata();
+
+    // intervals
+    out << quint32(item->intervals().count());
+    foreach(IntervalItem *interval, item->intervals()) {
+        out << interval->name << interval->start << interval->stop << interval->startKM << interval->stopKM
+            << qint32(interval->type) << interval->test << interval->color.name()
+            << interval->route.toString() << qint32(interval->displaySequence);
+
+        // don't compute metrics just to save them, so for those that
+        // aren't complete yet we keep which metrics we have
+        out << interval->pending_ << interval->computed_;
+        writeMetrics(out, interval->metrics_, interval->count_, interval->stdmean_, interval->stdvariance_);
+    }
+}
+
+void
+RideDBStore::reset(RideItem &item, bool lazy)
+{
+    // clean state, we don't want prior values, as with the
+    // rideDB.json parser intervals are not deleted, they
+    // were handed over by setFrom()
+    if (lazy) {
+        item.metrics_.clear();
+        item.count_.clear();
+    } else {
+        const RideMetricFactory &factory = RideMetricFactory::instance();
+        item.metrics_.fill(0.0f, factory.metricCount());
+        item.count_.fill(0.0f, factory.metricCount());
+    }
+    item.stdmean_.clear();
+    item.stdvariance_.clear();
+    item.xdata_.clear();
+    item.intervals_.clear();
+}
+
+void
+RideDBStore::decode(const QByteArray &bytes, const QVector<int> &map, RideItem &item)
+{
+    item.snapshot_.storeRelease(NULL);
+
+    QDataStream in(bytes);
+    in.setVersion(QDataStream::Qt_5_0);
+
+    decodeHead(in, item);
+    decodeBody(in, map, item);
+}
+
+void
+RideDBStore::decodeHead(QDataStream &in, RideItem &item)
+{
+    item.overrides_.clear();
+    item.metadata_.clear();
+
+    QDateTime utc;
+    quint64 fingerprint, crc, metacrc, timestamp;
+    qint32 dbversion, udbversion, zoneRange, hrZoneRange, paceZoneRange;
+    QString color;
+
+    in >> item.fileName >> utc >> fingerprint >> crc >> metacrc >> timestamp
+       >> dbversion >> udbversion
+       >> color >> item.present >> item.sport >> item.weight
+       >> zoneRange >> hrZoneRange >> paceZoneRange
+       >> item.overrides_ >> item.samples
+       >> item.metadata_;
+
+    // and the fingerprint for each config
+    QVector<quint64> fingerprints;
+    in >> fingerprints;
+    item.fingerprints.clear();
+    foreach(quint64 fp, fingerprints) item.fingerprints << fp;
+
+    item.dateTime = utc.toLocalTime();
+    item.fingerprint = fingerprint;
+    item.crc = crc;
+    item.metacrc = metacrc;
+    item.timestamp = timestamp;
+    item.dbversion = dbversion;
+    item.udbversion = udbversion;
+    item.color = QColor(color);
+    item.zoneRange = zoneRange;
+    item.hrZoneRange = hrZoneRange;
+    item.paceZoneRange = paceZoneRange;
+
+    item.isBike=item.isRun=item.isSwim=item.isXtrain=false;
+    if (item.sport == "Bike") item.isBike = true;
+    else if (item.sport == "Run") item.isRun = true;
+    else if (item.sport == "Swim") item.isSwim = true;
+    else item.isXtrain = true;
+}
+
+void
+RideDBStore::decodeBody(QDataStream &in, const QVector<int> &map, RideItem &item)
+{
+    reset(item, false);
+
+    readMetrics(in, map, item.metrics_, item.count_, item.stdmean_, item.stdvariance_);
+
+    in >> item.xdata_;
+
+    quint32 n;
+    in >> n;
+    for(quint32 i=0; i<n && in.status() == QDataStream::Ok; i++) {
+
+        IntervalItem interval;
+        qint32 type, seq;
+        QString icolor, route;
+
+        in >> interval.name >> interval.start >> interval.stop >> interval.startKM >> interval.stopKM
+           >> type >> interval.test >> icolor >> route >> seq;
+
+        interval.type = static_cast<RideFileInterval::intervaltype>(type);
+        interval.color = QColor(icolor);
+        interval.route = QUuid(route);
+        interval.displaySequence = seq;
+
+        bool pending;
+        QBitArray computed;
+        in >> pending >> computed;
+
+        // metrics we have, in the current schema
+        if (pending) {
+            interval.pending_ = true;
+            interval.computed_.fill(false, interval.metrics_.count());
+            for(int j=0; j<computed.size() && j<map.count(); j++)
+                if (computed.testBit(j) && map[j] >= 0 && map[j] < interval.computed_.size())
+                    interval.computed_.setBit(map[j]);
+        }
+
+        readMetrics(in, map, interval.metrics_, interval.count_, interval.stdmean_, interval.stdvariance_);
+
+        item.addInterval(interval);
+    }
+}
+
+bool
+RideDBStore::read(RideItem &item, std::function<void(RideItem&)> apply)
+{
+    // filename -> journal record
+    QHash<QString, QByteArray> rides;
+    QVector<int> map;
+    bool oldjournal = false;
+
+    // filename -> row in the mapped snapshot
+    QHash<QString, int> rows;
+
+    records = 0;
+    journalSchema.clear();
+    generation = 0;
+
+    if (snapshot) {
+        delete snapshot;
+        snapshot = NULL;
+    }
+
+    // SNAPSHOT
+    QFile file(snapshotFile);
+    if (file.exists()) {
+
+        snapshot = new RideDBSnapshot(snapshotFile);
+        if (!snapshot->open()) {
+            qDebug()<<"ride cache snapshot is corrupt:"<<snapshotFile;
+            delete snapshot;
+            snapshot = NULL;
+            return false;
+        }
+        for(int i=0; i<snapshot->rows(); i++) rows.insert(snapshot->fileName(i), i);
+        generation = snapshot->generation;
+    }
+
+    // JOURNAL
+    QFile journal(journalFile);
+    if (journal.exists() && journal.open(QFile::ReadWrite)) {
+
+        QDataStream in(&journal);
+        in.setVersion(QDataStream::Qt_5_0);
+
+        quint32 magic, version;
+        quint64 follows;
+        QString ridedbversion;
+        QStringList symbols;
+
+        in >> magic >> version >> follows >> ridedbversion >> symbols;
+        if (in.status() != QDataStream::Ok || magic != JOURNAL_MAGIC || version != STORE_VERSION) {
+
+            // unusable, the next save will start another one
+            qDebug()<<"ride cache journal header is corrupt:"<<journalFile;
+            journal.close();
+            journal.remove();
+
+        } else if (follows != generation) {
+
+            // crashed before it was reset, the snapshot already has it all
+            qDebug()<<"ride cache journal is stale:"<<journalFile;
+            journal.close();
+            journal.remove();
+
+        } else {
+
+            oldjournal = (ridedbversion != RIDEDB_VERSION);
+            map = mapping(symbols);
+            journalSchema = symbols;
+
+            // replay framed records until we run out or hit a torn write
+            while (!journal.atEnd()) {
+
+                qint64 pos = journal.pos();
+
+                QByteArray header = journal.read(FRAMEHEADER);
+                QByteArray payload;
+                quint32 length = 0;
+                quint16 checksum = 0;
+                quint8 op = 0;
+
+                if (header.count() == FRAMEHEADER) {
+                    QDataStream h(header);
+                    h.setVersion(QDataStream::Qt_5_0);
+                    h >> length >> checksum >> op;
+                    payload = journal.read(length);
+                }
+
+                if (header.count() != FRAMEHEADER || payload.count() != int(length) ||
+                    qChecksum(payload.constData(), payload.count()) != checksum) {
+
+                    // crashed mid-append, lose the partial record
+                    qDebug()<<"ride cache journal truncated at"<<pos;
+                    journal.resize(pos);
+                    break;
+                }
+
+                QDataStream p(payload);
+                p.setVersion(QDataStream::Qt_5_0);
+
+                QString filename;
+                p >> filename;
+
+                if (op == Update) {
+                    QByteArray record;
+                    p >> record;
+                    rides.insert(filename, record);
+                } else if (op == Remove) {
+                    rides.remove(filename);
+                }
+                rows.remove(filename);
+                records++;
+            }
+        }
+        journal.close();
+    }
+
+    if (!file.exists() && journalSchema.isEmpty()) return false;
+
+    // now apply, the mapped snapshot first, these only
+    // decode the summary and refer back to the snapshot
+    old = oldjournal || (snapshot && snapshot->isOld());
+    QHashIterator<QString, int> r(rows);
+    while (r.hasNext()) {
+        r.next();
+
+        if (!snapshot->summary(r.value(), item)) continue;
+        item.isstale = snapshot->isOld(); // force refresh after load
+        apply(item);
+    }
+
+    // and anything journalled, which is decoded in full
+    QHashIterator<QString, QByteArray> i(rides);
+    while (i.hasNext()) {
+        i.next();
+
+        decode(i.value(), map, item);
+        item.isstale = oldjournal; // force refresh after load
+        apply(item);
+    }
+
+    // the item is reused by the caller
+    item.snapshot_.storeRelease(NULL);
+    reset(item, false);
+    return true;
+}
+
+bool
+RideDBStore::openJournal()
+{
+    QFile journal(journalFile);
+
+    // we didn't read it, so check the header
+    if (journalSchema.isEmpty() && journal.exists() && journal.size() > 0) {
+
+        if (!journal.open(QFile::ReadOnly)) return false;
+
+        QDataStream in(&journal);
+        in.setVersion(QDataStream::Qt_5_0);
+        quint32 magic, version;
+        quint64 follows;
+        QString ridedbversion;
+        in >> magic >> version >> follows >> ridedbversion >> journalSchema;
+        journal.close();
+
+        if (magic != JOURNAL_MAGIC || version != STORE_VERSION || follows != generation || ridedbversion != RIDEDB_VERSION) {
+            journalSchema.clear();
+            return false;
+        }
+    }
+
+    // start a new one
+    if (!journal.exists() || journal.size() == 0) {
+
+        if (!journal.open(QFile::WriteOnly | QFile::Truncate)) return false;
+
+        journalSchema = schema();
+
+        QDataStream out(&journal);
+        out.setVersion(QDataStream::Qt_5_0);
+        out << JOURNAL_MAGIC << STORE_VERSION << generation << QString(RIDEDB_VERSION) << journalSchema;
+        bool ok = syncToDisk(journal);
+        journal.close();
+        if (!ok) return false;
+
+        records = 0;
+    }
+
+    // metric schema changed, needs a compaction
+    return journalSchema == schema();
+}
+
+bool
+RideDBStore::append(QList<RideItem*> updated, QStringList removed)
+{
+    if (updated.isEmpty() && removed.isEmpty()) return true;
+    if (!openJournal()) return false;
+
+    // build all the frames then write in one go
+    QByteArray buffer;
+    int count = 0;
+
+    for(int i=0; i<updated.count() + removed.count(); i++) {
+
+        quint8 op = i < updated.count() ? Update : Remove;
+
+        QByteArray payload;
+        QDataStream p(&payload, QIODevice::WriteOnly);
+        p.setVersion(QDataStream::Qt_5_0);
+
+        if (op == Update) p << updated[i]->fileName << encode(updated[i]);
+        else p << removed[i-updated.count()];
+
+        QByteArray header;
+        QDataStream h(&header, QIODevice::WriteOnly);
+        h.setVersion(QDataStream::Qt_5_0);
+        h << quint32(payload.count()) << quint16(qChecksum(payload.constData(), payload.count())) << op;
+
+        buffer.append(header);
+        buffer.append(payload);
+        count++;
+    }
+
+    QFile journal(journalFile);
+    if (!journal.open(QFile::WriteOnly | QFile::Append)) return false;
+    bool ok = journal.write(buffer) == buffer.count();
+    ok = syncToDisk(journal) && ok;
+    journal.close();
+
+    if (ok) records += count;
+    return ok;
+}
+
+bool
+RideDBStore::compact(const QVector<RideItem*> &rides)
+{
+    // rides that are still lazy have their summary re-encoded and the rest
+    // copied straight from the current snapshot, unless the metric schema
+    // has changed (they are stale anyway) or we couldn't use its columns,
+    // in which case they are decoded first
+    if (snapshot && (snapshot->schemaChanged() || !snapshot->columns))
+        foreach(RideItem *item, rides) item->materialise();
+
+    // rides we don't write can't be left referring to the old snapshot
+    foreach(RideItem *item, rides) if (item->skipsave) item->materialise();
+
+    // nobody decodes whilst we rewrite and swap the mapping
+    QWriteLocker locker(snapshot ? &snapshot->lock : NULL);
+
+    // only rides that have been refreshed and haven't had changes discarded
+    QList<RideItem*> writing;
+    QVector<bool> lazy;
+    foreach(RideItem *item, rides) {
+        bool unread = snapshot && snapshot->isLazy(item);
+        if (!unread && item->metrics().count() == 0) continue;
+        if (item->skipsave == true) continue;
+        writing << item;
+        lazy << unread;
+    }
+
+    const RideMetricFactory &factory = RideMetricFactory::instance();
+    const int columns = factory.metricCount();
+    const QStringList symbols = schema();
+    const quint64 next = generation + 1;
+
+    // header, written once with placeholders to size it, the
+    // offsets are all fixed width so it is the same size when
+    // it is rewritten at the end
+    QVector<RideDBSnapshot::entry> index(writing.count());
+    quint64 columnsOffset = 0;
+    auto header = [&]() {
+        QByteArray returning;
+        QDataStream out(&returning, QIODevice::WriteOnly);
+        out.setVersion(QDataStream::Qt_5_0);
+        out << SNAPSHOT_MAGIC << STORE_VERSION << next << QString(RIDEDB_VERSION) << symbols << quint32(writing.count());
+        out.writeRawData(reinterpret_cast<const char*>(&BYTEORDER), sizeof(BYTEORDER));
+        out << columnsOffset;
+        for(int i=0; i<index.count(); i++)
+            out << writing[i]->fileName << index[i].offset << index[i].length << index[i].body << index[i].intervals;
+        return returning;
+    };
+
+    // QSaveFile writes to a temporary, syncs it and renames on
+    // commit so we either have the old snapshot or the new one
+    QSaveFile file(snapshotFile);
+    if (!file.open(QFile::WriteOnly)) return false;
+
+    bool ok = file.write(header()) > 0;
+
+    // records
+    for(int i=0; ok && i<writing.count(); i++) {
+
+        RideItem *item = writing[i];
+
+        QByteArray head;
+        QDataStream out(&head, QIODevice::WriteOnly);
+        out.setVersion(QDataStream::Qt_5_0);
+        encodeHead(out, item);
+
+        QByteArray body;
+        if (lazy[i]) {
+            body = snapshot->body(item);
+            index[i].intervals = snapshot->index[item->snapshotRow_].intervals;
+        } else {
+            QDataStream b(&body, QIODevice::WriteOnly);
+            b.setVersion(QDataStream::Qt_5_0);
+            encodeBody(b, item);
+            index[i].intervals = item->intervals().count();
+        }
+
+        index[i].offset = file.pos();
+        index[i].length = head.count() + body.count();
+        index[i].body = head.count();
+
+        ok = file.write(head) == head.count() && file.write(body) == body.count();
+    }
+
+    // columns, aligned so they can be used in place, values then counts
+    if (ok) {
+        qint64 pad = (8 - (file.pos() % 8)) % 8;
+        ok = file.write(QByteArray(pad, 0)) == pad;
+        columnsOffset = file.pos();
+    }
+    for(int counts=0; ok && counts<2; counts++) {
+        for(int i=0; ok && i<writing.count(); i++) {
+
+            QVector<double> row(columns, 0);
+            if (lazy[i]) {
+                // same schema, checked above
+                const double *from = snapshot->row(writing[i]->snapshotRow_, counts);
+                if (from) for(int c=0; c<columns; c++) row[c] = from[c];
+            } else {
+                const QVector<double> &values = counts ? writing[i]->counts() : writing[i]->metrics();
+                for(int c=0; c<columns && c<values.count(); c++) row[c] = values[c];
+            }
+            for(int c=0; c<columns; c++) if (std::isinf(row[c]) || std::isnan(row[c])) row[c] = 0;
+            qint64 length = columns * sizeof(double);
+            ok = file.write(reinterpret_cast<const char*>(row.constData()), length) == length;
+        }
+    }
+
+    // and now we know where everything is
+    if (ok) {
+        QByteArray rewrite = header();
+        ok = file.seek(0) && file.write(rewrite) == rewrite.count();
+    }
+    if (!ok) {
+        file.cancelWriting();
+        return false;
+    }
+
+    // can't replace a mapped file on some platforms
+    if (snapshot) snapshot->close();
+    else snapshot = new RideDBSnapshot(snapshotFile);
+
+    bool committed = file.commit();
+
+    // map whichever we have now, on failure the old one is still there
+    if (!snapshot->open()) {
+
+        // can't get at the bodies any more, so they will need to be refreshed
+        qDebug()<<"ride cache snapshot could not be mapped:"<<snapshotFile;
+        foreach(RideItem *item, rides) {
+            if (item->snapshot_.loadAcquire() == snapshot) {
+                item->snapshot_.storeRelease(NULL);
+                reset(*item, false);
+                item->isstale = true;
+                item->stale = RideItem::StaleAll;
+            }
+        }
+        locker.unlock();
+        delete snapshot;
+        snapshot = NULL;
+
+    } else if (committed) {
+
+        // rides still to be decoded are in their new rows
+        for(int i=0; i<writing.count(); i++)
+            if (lazy[i]) writing[i]->snapshotRow_ = i;
+    }
+
+    if (!committed) return false;
+    generation = next;
+
+    // and reset the journal, if we crash before doing this it
+    // follows the last generation so is ignored when we next read
+    QFile::remove(journalFile);
+    journalSchema.clear();
+    records = 0;
+    return openJournal();
+}
+
+bool
+RideDBStore::needsCompaction(int rides) const
+{
+    return records >= qMax(MINJOURNAL, rides / 5);
+}
+
+//
+// Mapped snapshot
+//
+RideDBSnapshot::RideDBSnapshot(QString filename) : file(filename), map(NULL), size(0), generation(0), columns(0), old(false)
+{
+}
+
+RideDBSnapshot::~RideDBSnapshot()
+{
+    close();
+}
+
+bool
+RideDBSnapshot::open()
+{
+    close();
+
+    if (!file.open(QFile::ReadOnly)) return false;
+
+    size = file.size();
+    map = size > 0 ? file.map(0, size) : NULL;
+    if (map == NULL) {
+        file.close();
+        return false;
+    }
+
+    // read the header straight from the mapping
+    QByteArray bytes = QByteArray::fromRawData(reinterpret_cast<const char*>(map), size);
+    QDataStream in(bytes);
+    in.setVersion(QDataStream::Qt_5_0);
+
+    quint32 magic, version, count, byteorder;
+    QString ridedbversion;
+
+    in >> magic >> version >> generation >> ridedbversion >> symbols >> count;
+    in.readRawData(reinterpret_cast<char*>(&byteorder), sizeof(byteorder));
+    in >> columns;
+
+    if (in.status() != QDataStream::Ok || magic != SNAPSHOT_MAGIC || version != STORE_VERSION) {
+        close();
+        return false;
+    }
+
+    index.resize(count);
+    for(quint32 i=0; i<count; i++) {
+        entry &e = index[i];
+        in >> e.filename >> e.offset >> e.length >> e.body >> e.intervals;
+        if (in.status() != QDataStream::Ok || e.offset + e.length > quint64(size) || e.body > e.length) {
+            close();
+            return false;
+        }
+    }
+
+    old = (ridedbversion != RIDEDB_VERSION);
+
+    // metrics may have come and gone since it was written
+    const RideMetricFactory &factory = RideMetricFactory::instance();
+    mapping = RideDBStore::mapping(symbols);
+    column.fill(-1, factory.metricCount());
+    for(int i=0; i<mapping.count(); i++)
+        if (mapping[i] >= 0 && mapping[i] < column.count()) column[mapping[i]] = i;
+
+    // the columns are native doubles, so only use them if they were
+    // written on a machine with the same byte order, and are all there
+    quint64 needed = quint64(count) * quint64(symbols.count()) * sizeof(double) * 2;
+    if (byteorder != BYTEORDER || columns % sizeof(double) || columns + needed > quint64(size)) columns = 0;
+
+    return true;
+}
+
+void
+RideDBSnapshot::close()
+{
+    if (map) file.unmap(map);
+    if (file.isOpen()) file.close();
+    map = NULL;
+    size = 0;
+    columns = 0;
+    index.clear();
+}
+
+bool
+RideDBSnapshot::isLazy(const RideItem *item) const
+{
+    return map && item->snapshot_.loadAcquire() == this;
+}
+
+const double *
+RideDBSnapshot::row(int r, bool counts) const
+{
+    if (!columns) return NULL;
+
+    const double *values = reinterpret_cast<const double*>(map + columns);
+    if (counts) values += index.count() * symbols.count();
+    return values + (r * symbols.count());
+}
+
+QByteArray
+RideDBSnapshot::body(const RideItem *item) const
+{
+    const entry &e = index[item->snapshotRow_];
+    return QByteArray::fromRawData(reinterpret_cast<const char*>(map + e.offset + e.body), e.length - e.body);
+}
+
+bool
+RideDBSnapshot::summary(int row, RideItem &item)
+{
+    QReadLocker locker(&lock);
+
+    if (!map || row < 0 || row >= index.count()) return false;
+
+    const entry &e = index[row];
+    QByteArray bytes = QByteArray::fromRawData(reinterpret_cast<const char*>(map + e.offset), e.body);
+    QDataStream in(bytes);
+    in.setVersion(QDataStream::Qt_5_0);
+
+    RideDBStore::decodeHead(in, item);
+    RideDBStore::reset(item, true);
+
+    item.snapshotRow_ = row;
+    item.snapshot_.storeRelease(this);
+
+    return in.status() == QDataStream::Ok;
+}
+
+bool
+RideDBSnapshot::value(const RideItem *item, int metric, double &value, double &count)
+{
+    QReadLocker locker(&lock);
+
+    if (!isLazy(item) || !columns) return false;
+
+    value = count = 0;
+    int c = metric >= 0 && metric < column.count() ? column[metric] : -1;
+    if (c >= 0) {
+        value = row(item->snapshotRow_, false)[c];
+        count = row(item->snapshotRow_, true)[c];
+    }
+    return true;
+}
+
+bool
+RideDBSnapshot::values(const RideItem *item, QVector<double> &values)
+{
+    QReadLocker locker(&lock);
+
+    if (!isLazy(item) || !columns) return false;
+
+    const double *from = row(item->snapshotRow_, false);
+    values.fill(0, column.count());
+    for(int i=0; i<column.count(); i++) if (column[i] >= 0) values[i] = from[column[i]];
+    return true;
+}
+
+int
+RideDBSnapshot::intervals(const RideItem *item)
+{
+    QReadLocker locker(&lock);
+
+    if (!isLazy(item)) return -1;
+    return index[item->snapshotRow_].intervals;
+}
+
+void
+RideDBSnapshot::materialise(RideItem *item)
+{
+    QReadLocker locker(&lock);
+    QMutexLocker decoder(&decoding);
+
+    // somebody beat us to it
+    if (item->snapshot_.loadAcquire() != this) return;
+
+    // decode into a temporary and then hand over, so anyone looking
+    // at the item without the lock only sees it when it's complete
+    RideItem body;
+    if (map) {
+        const entry &e = index[item->snapshotRow_];
+        QByteArray bytes = QByteArray::fromRawData(reinterpret_cast<const char*>(map + e.offset + e.body), e.length - e.body);
+        QDataStream in(bytes);
+        in.setVersion(QDataStream::Qt_5_0);
+        RideDBStore::decodeBody(in, mapping, body);
+    }
+
+    item->metrics_ = body.metrics_;
+    item->count_ = body.count_;
+    item->stdmean_ = body.stdmean_;
+    item->stdvariance_ = body.stdvariance_;
+    item->xdata_ = body.xdata_;
+    item->intervals_ = body.intervals_;
+    foreach(IntervalItem *p, item->intervals_) p->rideItem_ = item;
+    body.clearIntervals();
+
+    item->snapshot_.storeRelease(NULL);
+}
@@ -0,0 +1,226 @@
+/*
+ * Copyright (c) 2020 Mark Liversedge (liversedge@gmail.com)
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by the Free
+ * Software Foundation; either version 2 of the License, or (at your option)
+ * any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License for
+ * more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc., 51
+ * Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+#ifndef _GC_RideDBStore_h
+#define _GC_RideDBStore_h 1
+
+#include <QString>
+#include <QStringList>
+#include <QByteArray>
+#include <QVector>
+#include <QList>
+#include <QFile>
+#include <QMutex>
+#include <QReadWriteLock>
+#include <functional>
+
+class RideItem;
+class QDataStream;
+class RideDBSnapshot;
+
+//
+// Journaled store for the ride cache
+//
+// rideDB.json is rewritten in full every time the cache is saved, which
+// with a large library and a few hundred metrics means writing (and at
+// startup parsing) hundreds of megabytes. Instead we keep:
+//
+//   cache/rideDB.snapshot - every ride at the time of the last compaction
+//   cache/rideDB.journal  - rides updated or removed since then
+//
+// Saving appends a record to the journal for each ride that has changed,
+// and once the journal gets large relative to the number of rides the
+// snapshot is rewritten (atomically via QSaveFile) and the journal reset.
+//
+// Each journal record is framed with its length and a checksum so a torn
+// write (crash or power loss mid-append) is detected on the next load and
+// the journal truncated back to the last good record. Appends are synced
+// to disk before we return, as is the snapshot when it is committed.
+//
+// Each snapshot has a generation, one more than the last, and the journal
+// is stamped with the generation of the snapshot it follows. If we crash
+// after committing a snapshot but before resetting the journal, the old
+// journal is ignored rather than replaying older rides over the snapshot.
+//
+// Both files carry the metric symbols they were written with, so values
+// are remapped if the metric schema changes (e.g. user metrics).
+//
+// The snapshot is memory mapped rather than read, see RideDBSnapshot below,
+// so startup only decodes the summary of each ride.
+//
+// When neither file exists RideCache::load() falls back to parsing an
+// existing rideDB.json, which is then imported on the next save. The
+// json format is still used when exporting (e.g. OpenData).
+//
+class RideDBStore
+{
+    public:
+
+        RideDBStore(QString cachePath);
+        ~RideDBStore();
+
+        // do we have a store to load from ?
+        bool exists() const;
+        static bool exists(QString cachePath);
+
+        // read the snapshot and replay the journal, calling apply for each
+        // ride. The item passed is reused for each ride, so the callback must
+        // copy what it needs, (e.g. RideItem::setFrom). Rides from the snapshot
+        // are lazy and refer to it, so the store must outlive them. Returns
+        // false if there was nothing to read or the snapshot was unreadable.
+        bool read(RideItem &item, std::function<void(RideItem&)> apply);
+
+        // set if the rides were written by an older version of RIDEDB_VERSION
+        bool isOld() const { return old; }
+
+        // append changes to the journal
+        bool append(QList<RideItem*> updated, QStringList removed);
+
+        // rewrite the snapshot with all rides and reset the journal
+        bool compact(const QVector<RideItem*> &rides);
+
+        // is it time to compact given the number of rides ?
+        bool needsCompaction(int rides) const;
+
+        // number of records currently in the journal
+        int journalled() const { return records; }
+
+    private:
+
+        friend class ::RideDBSnapshot;
+
+        enum { Update=1, Remove=2 };
+
+        // encode a ride using the current metric schema and decode using
+        // map, which is the current metric index for each one in the file.
+        // The head is the summary decoded at startup, the body is the
+        // metrics, xdata and intervals that are decoded when first used
+        static QByteArray encode(RideItem *item);
+        static void encodeHead(QDataStream &out, RideItem *item);
+        static void encodeBody(QDataStream &out, RideItem *item);
+        static void decode(const QByteArray &bytes, const QVector<int> &map, RideItem &item);
+        static void decodeHead(QDataStream &in, RideItem &item);
+        static void decodeBody(QDataStream &in, const QVector<int> &map, RideItem &item);
+
+        // current metric symbols in index order, and mapping from a file
+        static QStringList schema();
+        static QVector<int> mapping(const QStringList &symbols);
+
+        // journal header, written when the journal is created
+        bool openJournal();
+
+        // clear the body of an item before decoding, or leave it empty if lazy
+        static void reset(RideItem &item, bool lazy);
+
+        QString snapshotFile, journalFile;
+
+        RideDBSnapshot *snapshot;  // mapped snapshot, rides may refer to it
+        QStringList journalSchema; // schema the journal was written with
+        quint64 generation;        // of the snapshot, 0 if there isn't one
+        int records;               // records in the journal
+        bool old;
+};
+
+//
+// Memory mapped ride cache snapshot
+//
+// The snapshot file is laid out so it can be used straight from the
+// mapping without reading it all in:
+//
+//   header  - magic, version, generation, RIDEDB_VERSION, metric symbols, rows,
+//             byte order, offset of the columns and an index entry for
+//             each ride (filename, record offset, length, body offset and
+//             number of intervals)
+//   columns - metric values and then counts for every ride, as native
+//             doubles, one row per ride in metric symbol order
+//   records - each ride encoded as head then body (see RideDBStore)
+//
+// At startup only the head of each record is decoded into the RideItem,
+// which is left pointing at its row here. Metric values are served from
+// the columns and the body is decoded the first time anything else is
+// touched (RideItem::materialise). If the columns were written with a
+// different byte order they are ignored and the body is decoded instead.
+//
+// Compaction rewrites the file, so the mapping is swapped under the write
+// lock and rides that are still lazy are moved to their new rows.
+//
+class RideDBSnapshot
+{
+    public:
+
+        RideDBSnapshot(QString filename);
+        ~RideDBSnapshot();
+
+        // map the file and read the index
+        bool open();
+        void close();
+
+        int rows() const { return index.count(); }
+        QString fileName(int row) const { return index[row].filename; }
+        bool isOld() const { return old; }
+        bool schemaChanged() const { return symbols != RideDBStore::schema(); }
+
+        // decode the head of the record for row, leaving item lazy
+        bool summary(int row, RideItem &item);
+
+        // value and count for the metric at the current index, returns
+        // false if the item has been decoded or we have no columns
+        bool value(const RideItem *item, int metric, double &value, double &count);
+
+        // all the metric values, returns false as above
+        bool values(const RideItem *item, QVector<double> &values);
+
+        // intervals in the record
+        int intervals(const RideItem *item);
+
+        // decode the body of the record into item
+        void materialise(RideItem *item);
+
+    private:
+
+        friend class ::RideDBStore;
+
+        struct entry {
+            entry() : offset(0), length(0), body(0), intervals(0) {}
+            QString filename;
+            quint64 offset;
+            quint32 length, body, intervals;
+        };
+
+        // not locked, caller must hold lock
+        bool isLazy(const RideItem *item) const;
+        const double *row(int r, bool counts) const;
+        QByteArray body(const RideItem *item) const;
+
+        QReadWriteLock lock;
+        QMutex decoding;
+
+        QFile file;
+        uchar *map;
+        qint64 size;
+        quint64 generation;
+
+        QStringList symbols;
+        QVector<int> mapping;  // current index for each column
+        QVector<int> column;   // column for each current index
+        QVector<entry> index;
+        quint64 columns;       // offset of the columns, 0 if unusable
+        bool old;
+};
+
+#endif // _GC_RideDBStore_h
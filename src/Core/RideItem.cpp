@@ -18,6 +18,7 @@
 
 #include "RideItem.h"
 #include "RideCache.h"
+#include "RideDBStore.h" // for RideDBSnapshot
 #include "RideMetric.h"
 #include "RideFile.h"
 #include "RideFileCache.h"
@@ -33,6 +34,7 @@
 #include "AddIntervalDialog.h" // till we fixup ridefilecache to have offsets
 #include "TimeUtils.h" // time_to_string()
 #include "WPrime.h" // for matches
+#include <QtConcurrent>
 
 #include <cmath>
 #include <QtAlgorithms>
@@ -40,21 +42,28 @@
 #include <QMapIterator>
 #include <QByteArray>
 
+// metadata strings are shared by all of an athlete's rides
+static QSharedPointer<MetadataDictionary>
+metadataDictionary(Context *context)
+{
+    return MetadataDictionary::dictionary(context && context->athlete ? context->athlete->cyclist : QString());
+}
+
 // used to create a temporary ride item that is not in the cache and just
 // used to enable using the same calling semantics in things like the
 // merge wizard and interval navigator
 RideItem::RideItem() 
     : 
     ride_(NULL), fileCache_(NULL), context(NULL), isdirty(false), isstale(true), isedit(false), skipsave(false), path(""), fileName(""),
-    color(QColor(1,1,1)), sport(""), isBike(false), isRun(false), isSwim(false), isXtrain(false), samples(false), zoneRange(-1), hrZoneRange(-1), paceZoneRange(-1), fingerprint(0), metacrc(0), crc(0), timestamp(0), dbversion(0), udbversion(0), weight(0) {
+    color(QColor(1,1,1)), sport(""), isBike(false), isRun(false), isSwim(false), isXtrain(false), samples(false), zoneRange(-1), hrZoneRange(-1), paceZoneRange(-1), fingerprint(0), stale(0), metacrc(0), crc(0), timestamp(0), dbversion(0), udbversion(0), weight(0), snapshotRow_(-1), completing(QMutex::Recursive) {
     metrics_.fill(0, RideMetricFactory::instance().metricCount());
     count_.fill(0, RideMetricFactory::instance().metricCount());
 }
 
 RideItem::RideItem(RideFile *ride, Context *context) 
     : 
-    ride_(ride), fileCache_(NULL), context(context), isdirty(false), isstale(true), isedit(false), skipsave(false), path(""), fileName(""),
-    color(QColor(1,1,1)), sport(""), isBike(false), isRun(false), isSwim(false), isXtrain(false), samples(false), zoneRange(-1), hrZoneRange(-1), paceZoneRange(-1), fingerprint(0), metacrc(0), crc(0), timestamp(0), dbversion(0), udbversion(0), weight(0)
+    ride_(ride), fileCache_(NULL), metadata_(metadataDictionary(context)), context(context), isdirty(false), isstale(true), isedit(false), skipsave(false), path(""), fileName(""),
+    color(QColor(1,1,1)), sport(""), isBike(false), isRun(false), isSwim(false), isXtrain(false), samples(false), zoneRange(-1), hrZoneRange(-1), paceZoneRange(-1), fingerprint(0), stale(0), metacrc(0), crc(0), timestamp(0), dbversion(0), udbversion(0), weight(0), snapshotRow_(-1), completing(QMutex::Recursive)
 {
     metrics_.fill(0, RideMetricFactory::instance().metricCount());
     count_.fill(0, RideMetricFactory::instance().metricCount());
@@ -62,9 +71,9 @@ RideItem::RideItem(RideFile *ride, Context *context)
 
 RideItem::RideItem(QString path, QString fileName, QDateTime &dateTime, Context *context, bool planned)
     :
-    ride_(NULL), fileCache_(NULL), context(context), isdirty(false), isstale(true), isedit(false), skipsave(false), path(path), fileName(fileName),
-    dateTime(dateTime), color(QColor(1,1,1)), planned(planned), sport(""), isBike(false), isRun(false), isSwim(false), isXtrain(false), samples(false), zoneRange(-1), hrZoneRange(-1), paceZoneRange(-1), fingerprint(0),
-    metacrc(0), crc(0), timestamp(0), dbversion(0), udbversion(0), weight(0) 
+    ride_(NULL), fileCache_(NULL), metadata_(metadataDictionary(context)), context(context), isdirty(false), isstale(true), isedit(false), skipsave(false), path(path), fileName(fileName),
+    dateTime(dateTime), color(QColor(1,1,1)), planned(planned), sport(""), isBike(false), isRun(false), isSwim(false), isXtrain(false), samples(false), zoneRange(-1), hrZoneRange(-1), paceZoneRange(-1), fingerprint(0), stale(0),
+    metacrc(0), crc(0), timestamp(0), dbversion(0), udbversion(0), weight(0), snapshotRow_(-1), completing(QMutex::Recursive)
 {
     metrics_.fill(0, RideMetricFactory::instance().metricCount());
     count_.fill(0, RideMetricFactory::instance().metricCount());
@@ -74,8 +83,8 @@ RideItem::RideItem(QString path, QString fileName, QDateTime &dateTime, Context
 // pre-computed metrics and storing ride metadata
 RideItem::RideItem(RideFile *ride, QDateTime &dateTime, Context *context)
     :
-    ride_(ride), fileCache_(NULL), context(context), isdirty(true), isstale(true), isedit(false), skipsave(false), dateTime(dateTime),
-    zoneRange(-1), hrZoneRange(-1), paceZoneRange(-1), fingerprint(0), metacrc(0), crc(0), timestamp(0), dbversion(0), udbversion(0), weight(0)
+    ride_(ride), fileCache_(NULL), metadata_(metadataDictionary(context)), context(context), isdirty(true), isstale(true), isedit(false), skipsave(false), dateTime(dateTime),
+    zoneRange(-1), hrZoneRange(-1), paceZoneRange(-1), fingerprint(0), stale(0), metacrc(0), crc(0), timestamp(0), dbversion(0), udbversion(0), weight(0), snapshotRow_(-1), completing(QMutex::Recursive)
 {
     metrics_.fill(0, RideMetricFactory::instance().metricCount());
     count_.fill(0, RideMetricFactory::instance().metricCount());
@@ -85,6 +94,12 @@ RideItem::RideItem(RideFile *ride, QDateTime &dateTime, Context *context)
 void
 RideItem::setFrom(RideItem&here, bool temp) // used when loading cache/rideDB.json
 {
+    // a temporary copy needs everything, otherwise if here hasn't been
+    // decoded from the ride cache snapshot yet we take that over instead
+    if (temp) here.materialise();
+    snapshotRow_ = here.snapshotRow_;
+    snapshot_.storeRelease(here.snapshot_.loadAcquire());
+
     ride_ = NULL;
     fileCache_ = NULL;
     metrics_ = here.metrics_;
@@ -115,6 +130,8 @@ RideItem::setFrom(RideItem&here, bool temp) // used when loading cache/rideDB.js
     hrZoneRange = here.hrZoneRange;
     paceZoneRange = here.paceZoneRange;
     fingerprint = here.fingerprint;
+    fingerprints = here.fingerprints;
+    stale = here.stale;
     metacrc = here.metacrc;
     crc = here.crc;
     timestamp = here.timestamp;
@@ -136,6 +153,8 @@ RideItem::setFrom(RideItem&here, bool temp) // used when loading cache/rideDB.js
 void
 RideItem::setFrom(QHash<QString, RideMetricPtr> computed)
 {
+    materialise();
+
     QHashIterator<QString, RideMetricPtr> i(computed);
     while (i.hasNext()) {
         i.next();
@@ -154,7 +173,7 @@ RideItem::setFrom(QHash<QString, RideMetricPtr> computed)
 unsigned long 
 RideItem::metaCRC()
 {
-    QMapIterator<QString,QString> i(metadata_);
+    QMapIterator<QString,QString> i(metadata_.toMap());
     QByteArray ba;
     i.toFront();
     while(i.hasNext()) {
@@ -179,6 +198,9 @@ RideFile *RideItem::ride(bool open)
     ride_ = RideFileFactory::instance().openRideFile(context, file, errors_);
     if (ride_ == NULL) return NULL; // failed to read ride
 
+    // we need the intervals now
+    materialise();
+
     // update the overrides
     overrides_.clear();
     QMap<QString,QMap<QString, QString> >::const_iterator k;
@@ -291,6 +313,8 @@ RideItem::setRide(RideFile *overwrite)
 bool
 RideItem::removeInterval(IntervalItem *x)
 {
+    materialise();
+
     int index = intervals_.indexOf(x);
 
     if (ride_ == NULL) return false; // file not open
@@ -307,6 +331,8 @@ RideItem::removeInterval(IntervalItem *x)
 void
 RideItem::moveInterval(int from, int to)
 {
+    materialise();
+
     // Move in RideFile
     int from2 = ride()->intervals().indexOf(intervals_.at(from)->rideInterval);
     int to2 = ride()->intervals().indexOf(intervals_.at(to)->rideInterval);
@@ -319,6 +345,8 @@ RideItem::moveInterval(int from, int to)
 void
 RideItem::addInterval(IntervalItem item)
 {
+    materialise();
+
     IntervalItem *add = new IntervalItem(item);
     add->rideItem_ = this;
     intervals_ << add;
@@ -353,10 +381,14 @@ RideItem::notifyRideDataChanged()
 {
     // refresh the metrics
     isstale=true;
+    stale=StaleAll;
 
     // wipe user data
     userCache.clear();
 
+    // the crc is of the file, not what we have in memory
+    discoveries.clear();
+
     // force a recompute of derived data series
     if (ride_) {
         ride_->wstale = true;
@@ -377,6 +409,7 @@ RideItem::notifyRideMetadataChanged()
 {
     // refresh the metrics
     isstale=true;
+    stale=StaleAll;
     refresh();
 
     emit rideMetadataChanged();
@@ -393,6 +426,8 @@ RideItem::saved()
 {
     setDirty(false);
     isstale=true;
+    stale=StaleAll;
+    discoveries.clear(); // crc is stale until checkStale() next looks
     refresh(); // update !
     context->notifyRideSaved(this);
 }
@@ -402,6 +437,8 @@ RideItem::reverted()
 {
     setDirty(false);
     isstale=true;
+    stale=StaleAll;
+    discoveries.clear(); // crc is stale until checkStale() next looks
     refresh();
 }
 
@@ -439,6 +476,9 @@ RideItem::isOpen()
 void
 RideItem::close()
 {
+    // not while intervals are being completed
+    QMutexLocker locker(&completing);
+
     // ride data
     if (ride_) {
         // break link to ride file
@@ -465,83 +505,98 @@ RideItem::setStartTime(QDateTime newDateTime)
 bool
 RideItem::checkStale()
 {
-    // if we're marked stale already then just return that !
-    if (isstale) return true;
+    // if we're marked stale already then just return that ! unless
+    // only some of the metrics are stale, since more may have changed
+    if (isstale && (stale == 0 || stale == StaleAll)) return true;
 
     // just change it .. its as quick to change as it is to check !
     color = GlobalContext::context()->colorEngine->colorFor(getText(GlobalContext::context()->rideMetadata->getColorField(), ""));
 
+    // what has changed, see RideMetric::dependsOn()
+    int changed = 0;
+
     // upgraded metrics
-    if (udbversion != UserMetricSchemaVersion || dbversion != DBSchemaVersion) {
+    if (dbversion != DBSchemaVersion) {
 
-        isstale = true;
+        changed = StaleAll;
 
     } else {
 
+        // only the user metrics
+        if (udbversion != UserMetricSchemaVersion) changed |= RideMetric::UserProgram;
+
         // has weight changed?
         unsigned long prior  = 1000.0f * weight;
         unsigned long now = 1000.0f * getWeight();
 
-        if (prior != now) {
-
-            getWeight();
-            isstale = true;
-
-        } else {
-
-            // or have cp / zones or routes fingerprints changed ?
-            // note we now get the fingerprint from the zone range
-            // and not the entire config so that if you add a new
-            // range (e.g. set CP from today) but none of the other
-            // ranges change then there is no need to recompute the
-            // metrics for older rides !
-            // HRV fingerprint added to detect changes on HRV Measures
-
-            // get the new zone configuration fingerprint that applies for the ride date
-            unsigned long rfingerprint = static_cast<unsigned long>(context->athlete->zones(sport)->getFingerprint(dateTime.date()))
-                        + (appsettings->cvalue(context->athlete->cyclist, context->athlete->zones(sport)->useCPforFTPSetting(), 0).toInt() ? 1 : 0)
-                        + static_cast<unsigned long>(context->athlete->paceZones(isSwim)->getFingerprint(dateTime.date()))
-                        + static_cast<unsigned long>(context->athlete->hrZones(sport)->getFingerprint(dateTime.date()))
-                        + static_cast<unsigned long>(context->athlete->routes->getFingerprint())
-                        + static_cast<unsigned long>(getHrvFingerprint())
-                        + appsettings->cvalue(context->athlete->cyclist, GC_DISCOVERY, 57).toInt(); // 57 does not include search for PEAKS
-
-            if (fingerprint != rfingerprint) {
-
-                isstale = true;
-
-            } else {
+        if (prior != now) changed |= RideMetric::Weight;
+
+        // or have cp / zones or routes fingerprints changed ?
+        // note we now get the fingerprint from the zone range
+        // and not the entire config so that if you add a new
+        // range (e.g. set CP from today) but none of the other
+        // ranges change then there is no need to recompute the
+        // metrics for older rides !
+        // HRV fingerprint added to detect changes on HRV Measures
+
+        // get the new zone configuration fingerprints that apply for the ride date
+        QVector<unsigned long> rfingerprints;
+        unsigned long rfingerprint = getFingerprints(rfingerprints);
+
+        if (fingerprints.count() == Fingerprints) {
+
+            // interval discovery uses CP, W', Pmax and the power zones too
+            static const int affects[Fingerprints] = {
+                RideMetric::PowerZones | StaleIntervals,  // PowerFp
+                RideMetric::CP | StaleIntervals,          // CPFp
+                RideMetric::HrZones,                      // HrFp
+                RideMetric::PaceZones,                    // PaceFp
+                RideMetric::Hrv,                          // HrvFp
+                StaleIntervals,                           // RoutesFp
+                StaleIntervals                            // DiscoveryFp
+            };
+            for(int i=0; i<Fingerprints; i++)
+                if (fingerprints[i] != rfingerprints[i]) changed |= affects[i];
+
+        } else if (fingerprint != rfingerprint) {
+
+            // we don't know which one changed
+            changed = StaleAll;
+        }
 
-                // or has file content changed ?
-                QString fullPath =  QString(context->athlete->home->activities().absolutePath()) + "/" + fileName;
-                QFile file(fullPath);
+        // or has file content changed ?
+        if (changed != StaleAll) {
+            QString fullPath =  QString(context->athlete->home->activities().absolutePath()) + "/" + fileName;
+            QFile file(fullPath);
 
-                // has timestamp changed ?
-                if (timestamp < QFileInfo(file).lastModified().toTime_t()) {
+            // has timestamp changed ?
+            if (timestamp < QFileInfo(file).lastModified().toTime_t()) {
 
-                    // if timestamp has changed then check crc
-                    unsigned long fcrc = RideFile::computeFileCRC(fullPath);
+                // if timestamp has changed then check crc
+                unsigned long fcrc = RideFile::computeFileCRC(fullPath);
 
-                    if (crc == 0 || crc != fcrc) {
-                        crc = fcrc; // update as expensive to calculate
-                        isstale = true;
-                    }
+                if (crc == 0 || crc != fcrc) {
+                    crc = fcrc; // update as expensive to calculate
+                    changed = StaleAll;
                 }
-
-
-                // no intervals ?
-                if (samples && intervals_.count() == 0)
-                    isstale = true;
-
             }
         }
+
+        // no intervals ?
+        if (samples && intervalCount() == 0) changed = StaleAll;
     }
 
     // still reckon its clean? what about the cache ?
-    if (isstale == false) isstale = RideFileCache::checkStale(context, this);
+    if (changed == 0 && !isstale && RideFileCache::checkStale(context, this)) changed = StaleAll;
 
     // we need to mark stale in case "special" fields may have changed (e.g. CP)
-    if (metacrc != metaCRC()) isstale = true;
+    if (metacrc != metaCRC()) changed = StaleAll;
+
+    // add to anything already stale
+    if (changed) {
+        stale = isstale ? (stale | changed) : changed;
+        isstale = true;
+    }
 
     return isstale;
 }
@@ -551,8 +606,24 @@ RideItem::refresh()
 {
     if (!isstale) return;
 
+    // completeIntervals() may be using ride_ and intervals_ in another
+    // thread, the lock is recursive since we may close() below
+    QMutexLocker locker(&completing);
+
+    // intervals etc are updated below, not replaced
+    materialise();
+
+    // if only athlete config has changed we just recompute the metrics
+    // that depend upon it, see checkStale(). the ride must be clean
+    // since we don't look at the ride data other than for those metrics
+    int config = stale;
+    bool partial = config != 0 && config != StaleAll && !isdirty
+                   && metrics_.count() == RideMetricFactory::instance().metricCount()
+                   && count_.count() == RideMetricFactory::instance().metricCount();
+
     // update current state coz we'll fix it below
     isstale = false;
+    stale = 0;
 
     // open ride file will extract details too, but only if not
     // already open since its a user entry point and will call
@@ -567,96 +638,98 @@ RideItem::refresh()
 
     if (f) {
 
-        // get the metadata
-        metadata_ = f->tags();
-
-        // get xdata definitions
-        QMapIterator<QString, XDataSeries *>ie(f->xdata());
-        ie.toFront();
-        while(ie.hasNext()) {
-            ie.next();
+        if (partial) {
 
-            // xdata and series names
-            xdata_.insert(ie.value()->name, ie.value()->valuename);
-        }
+            // just the affected metrics
+            refreshMetrics(config);
 
-        // overrides
-        overrides_.clear();
-        QMap<QString,QMap<QString, QString> >::const_iterator k;
-        for (k=ride_->metricOverrides.constBegin(); k != ride_->metricOverrides.constEnd(); k++) {
-            overrides_ << k.key();
-        }
-
-        // get weight that applies to the date
-        getWeight();
-
-        // first class stuff
-        sport = f->sport();
-        isBike = f->isBike();
-        isRun = f->isRun();
-        isSwim = f->isSwim();
-        isXtrain = f->isXtrain();
-        color = GlobalContext::context()->colorEngine->colorFor(f->getTag(GlobalContext::context()->rideMetadata->getColorField(), ""));
-        present = f->getTag("Data", "");
-        samples = f->dataPoints().count() > 0;
-
-        // zone ranges
-        if (context->athlete->zones(sport)) zoneRange = context->athlete->zones(sport)->whichRange(dateTime.date());
-        else zoneRange = -1;
-
-        if (context->athlete->hrZones(sport)) hrZoneRange = context->athlete->hrZones(sport)->whichRange(dateTime.date());
-        else hrZoneRange = -1;
+        } else {
 
-        if (context->athlete->paceZones(isSwim)) paceZoneRange = context->athlete->paceZones(isSwim)->whichRange(dateTime.date());
-        else paceZoneRange = -1;
+            // get the metadata
+            metadata_ = f->tags();
 
-        // RideFile cache refresh before metrics, as meanmax may be used in user formulas
-        RideFileCache updater(context, context->athlete->home->activities().canonicalPath() + "/" + fileName, getWeight(), ride_, true);
+            // get xdata definitions
+            QMapIterator<QString, XDataSeries *>ie(f->xdata());
+            ie.toFront();
+            while(ie.hasNext()) {
+                ie.next();
 
-        // refresh metrics etc
-        const RideMetricFactory &factory = RideMetricFactory::instance();
+                // xdata and series names
+                xdata_.insert(ie.value()->name, ie.value()->valuename);
+            }
 
-        // ressize and initialize so we can store metric values at
-        // RideMetric::index offsets into the metrics_ qvector
-        metrics_.fill(0, factory.metricCount());
-        count_.fill(0, factory.metricCount());
+            // overrides
+            overrides_.clear();
+            QMap<QString,QMap<QString, QString> >::const_iterator k;
+            for (k=ride_->metricOverrides.constBegin(); k != ride_->metricOverrides.constEnd(); k++) {
+                overrides_ << k.key();
+            }
 
-        // we compute all with not specification (not an interval)
-        QHash<QString,RideMetricPtr> computed= RideMetric::computeMetrics(this, Specification(), factory.allMetrics());
+            // get weight that applies to the date
+            getWeight();
 
-        // snaffle away all the computed values into the array
-        QHashIterator<QString, RideMetricPtr> i(computed);
-        while (i.hasNext()) {
-            i.next();
-            //DEBUG if (i.value()->isUser()) qDebug()<<dateTime.date()<<i.value()->symbol()<<i.value()->value();
-            metrics_[i.value()->index()] = i.value()->value();
-            count_[i.value()->index()] = i.value()->count();
-            double stdmean = i.value()->stdmean();
-            double stdvariance = i.value()->stdvariance();
-            if (stdmean || stdvariance) {
-                stdmean_.insert(i.value()->index(), stdmean);
-                stdvariance_.insert(i.value()->index(), stdvariance);
+            // first class stuff
+            sport = f->sport();
+            isBike = f->isBike();
+            isRun = f->isRun();
+            isSwim = f->isSwim();
+            isXtrain = f->isXtrain();
+            color = GlobalContext::context()->colorEngine->colorFor(f->getTag(GlobalContext::context()->rideMetadata->getColorField(), ""));
+            present = f->getTag("Data", "");
+            samples = f->dataPoints().count() > 0;
+
+            // zone ranges
+            if (context->athlete->zones(sport)) zoneRange = context->athlete->zones(sport)->whichRange(dateTime.date());
+            else zoneRange = -1;
+
+            if (context->athlete->hrZones(sport)) hrZoneRange = context->athlete->hrZones(sport)->whichRange(dateTime.date());
+            else hrZoneRange = -1;
+
+            if (context->athlete->paceZones(isSwim)) paceZoneRange = context->athlete->paceZones(isSwim)->whichRange(dateTime.date());
+            else paceZoneRange = -1;
+
+            // RideFile cache refresh before metrics, as meanmax may be used in user formulas
+            RideFileCache updater(context, context->athlete->home->activities().canonicalPath() + "/" + fileName, getWeight(), ride_, true);
+
+            // refresh metrics etc
+            const RideMetricFactory &factory = RideMetricFactory::instance();
+
+            // ressize and initialize so we can store metric values at
+            // RideMetric::index offsets into the metrics_ qvector
+            metrics_.fill(0, factory.metricCount());
+            count_.fill(0, factory.metricCount());
+
+            // we compute all with not specification (not an interval)
+            QHash<QString,RideMetricPtr> computed= RideMetric::computeMetrics(this, Specification(), factory.allMetrics());
+
+            // snaffle away all the computed values into the array
+            QHashIterator<QString, RideMetricPtr> i(computed);
+            while (i.hasNext()) {
+                i.next();
+                //DEBUG if (i.value()->isUser()) qDebug()<<dateTime.date()<<i.value()->symbol()<<i.value()->value();
+                metrics_[i.value()->index()] = i.value()->value();
+                count_[i.value()->index()] = i.value()->count();
+                double stdmean = i.value()->stdmean();
+                double stdvariance = i.value()->stdvariance();
+                if (stdmean || stdvariance) {
+                    stdmean_.insert(i.value()->index(), stdmean);
+                    stdvariance_.insert(i.value()->index(), stdvariance);
+                }
             }
-        }
 
-        // clean any bad values
-        for(int j=0; j<factory.metricCount(); j++)
-            if (std::isinf(metrics_[j]) || std::isnan(metrics_[j])) {
-                metrics_[j] = 0.00f;
-                count_[j] = 0.00f;
-            }
+            // clean any bad values
+            for(int j=0; j<factory.metricCount(); j++)
+                if (std::isinf(metrics_[j]) || std::isnan(metrics_[j])) {
+                    metrics_[j] = 0.00f;
+                    count_[j] = 0.00f;
+                }
 
-        // Update auto intervals AFTER ridefilecache as used for bests
-        updateIntervals();
+            // Update auto intervals AFTER ridefilecache as used for bests
+            updateIntervals();
+        }
 
         // update fingerprints etc, crc done above
-        fingerprint = static_cast<unsigned long>(context->athlete->zones(sport)->getFingerprint(dateTime.date()))
-                    + (appsettings->cvalue(context->athlete->cyclist, context->athlete->zones(sport)->useCPforFTPSetting(), 0).toInt() ? 1 : 0)
-                    + static_cast<unsigned long>(context->athlete->paceZones(isSwim)->getFingerprint(dateTime.date()))
-                    + static_cast<unsigned long>(context->athlete->hrZones(sport)->getFingerprint(dateTime.date()))
-                    + static_cast<unsigned long>(context->athlete->routes->getFingerprint()) +
-                    + static_cast<unsigned long>(getHrvFingerprint())
-                    + appsettings->cvalue(context->athlete->cyclist, GC_DISCOVERY, 57).toInt(); // 57 does not include search for PEAKS
+        fingerprint = getFingerprints(fingerprints);
 
         dbversion = DBSchemaVersion;
         udbversion = UserMetricSchemaVersion;
@@ -668,6 +741,9 @@ RideItem::refresh()
         // Construct the summary text used on the calendar
         metadata_.insert("Calendar Text", GlobalContext::context()->rideMetadata->calendarText(this));
 
+        // keep the ride cache metric table and store in sync
+        if (context->athlete->rideCache) context->athlete->rideCache->refreshed(this);
+
         // close if we opened it
         if (doclose) {
             close();
@@ -686,6 +762,74 @@ RideItem::refresh()
     }
 }
 
+// recompute just the metrics affected by a change to the athlete config,
+// the rest are left as they are and used as dependencies. ride_ is open.
+void
+RideItem::refreshMetrics(int config)
+{
+    const RideMetricFactory &factory = RideMetricFactory::instance();
+
+    // a new range may apply
+    if (context->athlete->zones(sport)) zoneRange = context->athlete->zones(sport)->whichRange(dateTime.date());
+    else zoneRange = -1;
+
+    if (context->athlete->hrZones(sport)) hrZoneRange = context->athlete->hrZones(sport)->whichRange(dateTime.date());
+    else hrZoneRange = -1;
+
+    if (context->athlete->paceZones(isSwim)) paceZoneRange = context->athlete->paceZones(isSwim)->whichRange(dateTime.date());
+    else paceZoneRange = -1;
+
+    // the cpx holds w/kg bests, and W'bal uses CP and W'
+    if (config & RideMetric::Weight) {
+        RideFileCache updater(context, context->athlete->home->activities().canonicalPath() + "/" + fileName, getWeight(), ride_, true);
+    }
+    if (config & RideMetric::CP) ride_->wstale = true;
+
+    // metrics that depend on the config, or on metrics that do
+    QStringList affected = factory.affectedBy(config);
+
+    if (affected.count()) {
+
+        QHash<QString,RideMetricPtr> computed= RideMetric::computeMetrics(this, Specification(), affected, true);
+
+        QHashIterator<QString, RideMetricPtr> i(computed);
+        while (i.hasNext()) {
+            i.next();
+            int index = i.value()->index();
+            double value = i.value()->value();
+
+            // clean any bad values
+            if (std::isinf(value) || std::isnan(value)) {
+                metrics_[index] = 0.00f;
+                count_[index] = 0.00f;
+            } else {
+                metrics_[index] = value;
+                count_[index] = i.value()->count();
+            }
+
+            double stdmean = i.value()->stdmean();
+            double stdvariance = i.value()->stdvariance();
+            if (stdmean || stdvariance) {
+                stdmean_.insert(index, stdmean);
+                stdvariance_.insert(index, stdvariance);
+            }
+        }
+    }
+
+    // discovery may find different intervals, otherwise
+    // just recompute the affected interval metrics too
+    if (config & StaleIntervals) updateIntervals();
+    else if (affected.count()) {
+        QStringList hot = IntervalItem::hotMetrics();
+        foreach(IntervalItem *interval, intervals_) {
+            if (interval->isPending()) interval->refreshHot(hot);
+            else interval->refresh(affected);
+        }
+    }
+
+    //qDebug()<<fileName<<"refreshed"<<affected.count()<<"metrics for config"<<config;
+}
+
 double
 RideItem::getWeight(int type)
 {
@@ -740,37 +884,63 @@ RideItem::getHrvFingerprint()
     }
 }
 
+// the fingerprints for the config that applies on the date of the ride,
+// returns the combined fingerprint
+unsigned long
+RideItem::getFingerprints(QVector<unsigned long> &fps)
+{
+    QDate date = dateTime.date();
+    unsigned long useCP = appsettings->cvalue(context->athlete->cyclist, context->athlete->zones(sport)->useCPforFTPSetting(), 0).toInt() ? 1 : 0;
+
+    fps.resize(Fingerprints);
+    fps[PowerFp] = static_cast<unsigned long>(context->athlete->zones(sport)->getFingerprint(date));
+    fps[CPFp] = static_cast<unsigned long>(context->athlete->zones(sport)->getCPFingerprint(date)) + useCP;
+    fps[HrFp] = static_cast<unsigned long>(context->athlete->hrZones(sport)->getFingerprint(date));
+    fps[PaceFp] = static_cast<unsigned long>(context->athlete->paceZones(isSwim)->getFingerprint(date));
+    fps[HrvFp] = static_cast<unsigned long>(getHrvFingerprint());
+    fps[RoutesFp] = static_cast<unsigned long>(context->athlete->routes->getFingerprint());
+    fps[DiscoveryFp] = appsettings->cvalue(context->athlete->cyclist, GC_DISCOVERY, 57).toInt(); // 57 does not include search for PEAKS
+
+    // as it always has been, so rideDB.json written before we
+    // kept them separately is still current
+    return fps[PowerFp] + useCP + fps[PaceFp] + fps[HrFp] + fps[RoutesFp] + fps[HrvFp] + fps[DiscoveryFp];
+}
+
 double
 RideItem::getForSymbol(QString name, bool useMetricUnits)
 {
     const RideMetricFactory &factory = RideMetricFactory::instance();
-    if (metrics_.size() && metrics_.size() == factory.metricCount()) {
+    const RideMetric *m = factory.rideMetric(name);
+    double value, count;
+    if (m && lookup(m->index(), value, count)) {
         // return the precomputed metric value
-        const RideMetric *m = factory.rideMetric(name);
-        if (m) {
-            if (useMetricUnits) return metrics_[m->index()];
-            else {
-                // little hack to set/get for conversion
-                const_cast<RideMetric*>(m)->setValue(metrics_[m->index()]);
-                return m->value(useMetricUnits);
-            }
+        if (useMetricUnits) return value;
+        else {
+            // little hack to set/get for conversion
+            const_cast<RideMetric*>(m)->setValue(value);
+            return m->value(useMetricUnits);
         }
     }
     return 0.0f;
 }
 
+double
+RideItem::getForIndex(int index)
+{
+    double value, count;
+    if (index >= 0 && lookup(index, value, count)) return value;
+    return 0.0f;
+}
+
 double
 RideItem::getCountForSymbol(QString name)
 {
     const RideMetricFactory &factory = RideMetricFactory::instance();
-    if (metrics_.size() && metrics_.size() == factory.metricCount()) {
-        // return the precomputed metric value
-        const RideMetric *m = factory.rideMetric(name);
-        if (m)  {
-            // don't return zero (!)
-            double returning = count_[m->index()];
-            return returning ? returning : 1;
-        }
+    const RideMetric *m = factory.rideMetric(name);
+    double value, count;
+    if (m && lookup(m->index(), value, count)) {
+        // don't return zero (!)
+        return count ? count : 1;
     }
     // don't return zero, thats impossible
     return 1.0f;
@@ -779,6 +949,8 @@ RideItem::getCountForSymbol(QString name)
 double
 RideItem::getStdMeanForSymbol(QString name)
 {
+    materialise();
+
     const RideMetricFactory &factory = RideMetricFactory::instance();
     if (metrics_.size() && metrics_.size() == factory.metricCount()) {
         // return the precomputed metric value
@@ -794,6 +966,8 @@ RideItem::getStdMeanForSymbol(QString name)
 double
 RideItem::getStdVarianceForSymbol(QString name)
 {
+    materialise();
+
     const RideMetricFactory &factory = RideMetricFactory::instance();
     if (metrics_.size() && metrics_.size() == factory.metricCount()) {
         // return the precomputed metric value
@@ -812,148 +986,103 @@ RideItem::getStringForSymbol(QString name, bool useMetricUnits)
     QString returning("-");
 
     const RideMetricFactory &factory = RideMetricFactory::instance();
-    if (metrics_.size() && metrics_.size() == factory.metricCount()) {
+    const RideMetric *m = factory.rideMetric(name);
+    double value, count;
+    if (m && lookup(m->index(), value, count)) {
 
         // return the precomputed metric value
-        const RideMetric *m = factory.rideMetric(name);
-        if (m) {
-
-            double value = metrics_[m->index()];
-            if (std::isinf(value) || std::isnan(value)) value=0;
-            returning = m->toString(m->value(value, useMetricUnits));
-        }
+        if (std::isinf(value) || std::isnan(value)) value=0;
+        returning = m->toString(m->value(value, useMetricUnits));
     }
     return returning;
 }
 
-struct effort {
-    int start, duration, joules;
-    int zone;
-    double quality;
-};
-
-static bool intervalGreaterThanZone(const IntervalItem *a, const IntervalItem *b) { 
-    return const_cast<IntervalItem*>(a)->getForSymbol("power_zone") > 
-           const_cast<IntervalItem*>(b)->getForSymbol("power_zone"); 
-}
-
-void
-RideItem::updateIntervals()
+// metric value and count, straight from the ride cache snapshot
+// if we haven't been decoded yet
+bool
+RideItem::lookup(int index, double &value, double &count)
 {
-    // what do we need ?
-    int discovery = appsettings->cvalue(context->athlete->cyclist, GC_DISCOVERY, 57).toInt(); // 57 does not include search for PEAKS
-
-    // DO NOT USE ride() since it will call a refresh !
-    RideFile *f = ride_;
-
-    QList<IntervalItem*> deletelist = intervals_;
-    intervals_.clear();
-
-    // no ride data available ?
-    if (!samples) {
-        context->notifyIntervalsUpdate(this);
-        return;
+    RideDBSnapshot *snapshot = snapshot_.loadAcquire();
+    if (snapshot) {
+        if (snapshot->value(this, index, value, count)) return true;
+        materialise(); // no columns we can use
     }
 
-    // Get CP and W' estimates for date of ride
-    double CP = 0;
-    double WPRIME = 0;
-    double PMAX = 0;
-    bool zoneok = false;
-
-    if (context->athlete->zones(sport)) {
-
-        // if range is -1 we need to fall back to a default value
-        CP = zoneRange >= 0 ? context->athlete->zones(sport)->getCP(zoneRange) : 0;
-        WPRIME = zoneRange >= 0 ? context->athlete->zones(sport)->getWprime(zoneRange) : 0;
-        PMAX = zoneRange >= 0 ? context->athlete->zones(sport)->getPmax(zoneRange) : 0;
-
-        // did we override CP in metadata ?
-        int oCP = getText("CP","0").toInt();
-        int oW = getText("W'","0").toInt();
-        int oPMAX = getText("Pmax","0").toInt();
-        if (oCP) CP=oCP;
-        if (oW) WPRIME=oW;
-        if (oPMAX) PMAX=oPMAX;
-
-        if (zoneRange >= 0 && context->athlete->zones(sport)) zoneok=true;
+    const RideMetricFactory &factory = RideMetricFactory::instance();
+    if (metrics_.size() && metrics_.size() == factory.metricCount() && index >= 0 && index < metrics_.size()) {
+        value = metrics_[index];
+        count = count_[index];
+        return true;
     }
+    return false;
+}
 
-    // USER / DEVICE INTERVALS
-    // first we create interval items for all intervals
-    // that are in the ridefile, but ignore Peaks since we
-    // add those automatically for HR and Power where those
-    // data series are present
-
-    // ride start and end
-    RideFilePoint *begin = f->dataPoints().first();
-    RideFilePoint *end = f->dataPoints().last();
-
-    // ALL interval
-    if (discovery & RideFileInterval::intervalTypeBits(RideFileInterval::ALL)) {
-
-        // add entire ride using ride metrics
-        IntervalItem *entire = new IntervalItem(this, tr("Entire Activity"), 
-                                                begin->secs, end->secs, 
-                                                f->timeToDistance(begin->secs),
-                                                f->timeToDistance(end->secs),
-                                                0,
-                                                QColor(Qt::darkBlue),
-                                                false,
-                                                RideFileInterval::ALL);
+void
+RideItem::summary(QVector<double> &values)
+{
+    RideDBSnapshot *snapshot = snapshot_.loadAcquire();
+    if (snapshot && snapshot->values(this, values)) return;
 
-        // same as the whole ride, not need to compute
-        entire->refresh();
-        entire->rideInterval = NULL;
-        intervals_ << entire;
-    }
+    values = metrics();
+}
 
-    int count = 0;
-    foreach(RideFileInterval *interval, f->intervals()) {
+int
+RideItem::intervalCount()
+{
+    RideDBSnapshot *snapshot = snapshot_.loadAcquire();
+    int count = snapshot ? snapshot->intervals(this) : -1;
+    return count >= 0 ? count : intervals_.count();
+}
 
-        // skip peaks when autodiscovered
-        if (discovery & RideFileInterval::intervalTypeBits(RideFileInterval::PEAKPOWER) && interval->isPeak()) continue;
+void
+RideItem::unpack()
+{
+    RideDBSnapshot *snapshot = snapshot_.loadAcquire();
+    if (snapshot) snapshot->materialise(this);
+}
 
-        // skip climbs when autodiscovered
-        if (discovery & RideFileInterval::intervalTypeBits(RideFileInterval::CLIMB) && interval->isClimb()) continue;
+struct effort {
+    int start, duration, joules;
+    int zone;
+    double quality;
+};
 
-        // skip matches when autodiscovered
-        if (discovery & RideFileInterval::intervalTypeBits(RideFileInterval::EFFORT) && interval->isMatch()) continue;
+static bool intervalGreaterThanZone(const IntervalItem *a, const IntervalItem *b) { 
+    return const_cast<IntervalItem*>(a)->getForSymbol("power_zone") > 
+           const_cast<IntervalItem*>(b)->getForSymbol("power_zone"); 
+}
 
-        // skip entire ride when autodiscovered
-        if (discovery & RideFileInterval::intervalTypeBits(RideFileInterval::ALL) && 
-           ((interval->start <= begin->secs && interval->stop >= end->secs) ||
-           (((interval->start - f->recIntSecs()) <= begin->secs && (interval->stop-f->recIntSecs()) >= end->secs) ||
-           (interval->start <= begin->secs && (interval->stop+f->recIntSecs()) >= end->secs))))
-             continue;
+// interval discovery, each kind is searched for by a task and they run
+// concurrently, what they find is added to the ride in this order
+enum { DiscoverPeakPower=0, DiscoverPeakPace, DiscoverEfforts, DiscoverClimbs, DiscoverRoutes, DiscoverMatches, Discoveries };
 
-        // skip empty backward intervals
-        if (interval->start >= interval->stop) continue;
+struct RideItemDiscovery {
+    int kind;
+    RideItem *item;
+    RideFile *f;
 
-        // create a new interval item
-        const int seq = count; // if passed directly, it could be incremented BEFORE being evaluated for the sequence arg as arg eval order is undefined
-        IntervalItem *intervalItem = new IntervalItem(this, interval->name, 
-                                                      interval->start, interval->stop, 
-                                                      f->timeToDistance(interval->start),
-                                                      f->timeToDistance(interval->stop),
-                                                      seq,
-                                                      (interval->color == Qt::black) ? standardColor(count) : interval->color,
-                                                      interval->test,
-                                                      RideFileInterval::USER);
+    int discovery;              // GC_DISCOVERY
+    double CP, WPRIME, PMAX;
+    bool zoneok;
+    bool metric;                // pace units
 
-        intervalItem->rideInterval = interval;
-        intervalItem->refresh();        // XXX will get called in constructor when refactor
-        intervals_ << intervalItem;
+    bool reused;                // inputs unchanged, found is from last time
+    QList<IntervalItem*> found;
+    QList<Match> matches;       // for each found by DiscoverMatches
+};
 
-        count++;
-        //qDebug()<<"interval:"<<interval.name<<interval.start<<interval.stop<<"f:"<<begin->secs<<end->secs;
-    }
+// search the ride, the intervals are numbered and their
+// metrics computed when they are added to the ride
+void
+RideItem::discover(RideItemDiscovery &task)
+{
+    if (task.reused) return;
 
-    // DISCOVERY
+    RideItem *item = task.item;
 
     //qDebug() << "SEARCH PEAK POWERS"
-    if ((discovery & RideFileInterval::intervalTypeBits(RideFileInterval::PEAKPOWER)) &&
-        !f->isRun() && !f->isSwim() && f->isDataPresent(RideFile::watts)) {
+    if (task.kind == DiscoverPeakPower && (task.discovery & RideFileInterval::intervalTypeBits(RideFileInterval::PEAKPOWER)) &&
+        !task.f->isRun() && !task.f->isSwim() && task.f->isDataPresent(RideFile::watts)) {
 
         // what we looking for ?
         static int durations[] = { 1, 5, 10, 15, 20, 30, 60, 300, 600, 1200, 1800, 2700, 3600, 0 };
@@ -965,29 +1094,26 @@ RideItem::updateIntervals()
 
             // go hunting for best peak
             QList<AddIntervalDialog::AddedInterval> results;
-            AddIntervalDialog::findPeaks(context, true, f, Specification(), RideFile::watts, RideFile::original, durations[i], 1, results, "", "");
+            AddIntervalDialog::findPeaks(item->context, true, task.f, Specification(), RideFile::watts, RideFile::original, durations[i], 1, results, "", "");
 
             // did we get one ?
             if (results.count() > 0 && results[0].avg > 0 && results[0].stop > 0) {
                 // qDebug()<<"found"<<names[i]<<"peak power"<<results[0].start<<"-"<<results[0].stop<<"of"<<results[0].avg<<"watts";
-                IntervalItem *intervalItem = new IntervalItem(this, QString(tr("%1 (%2 watts)")).arg(names[i]).arg(int(results[0].avg)),
+                IntervalItem *intervalItem = new IntervalItem(item, QString(tr("%1 (%2 watts)")).arg(names[i]).arg(int(results[0].avg)),
                                                             results[0].start, results[0].stop, 
-                                                            f->timeToDistance(results[0].start),
-                                                            f->timeToDistance(results[0].stop),
-                                                            count++,
+                                                            task.f->timeToDistance(results[0].start),
+                                                            task.f->timeToDistance(results[0].stop),
+                                                            0, // numbered when merged
                                                             QColor(Qt::gray),
                                                             false,
                                                             RideFileInterval::PEAKPOWER);
-                intervalItem->rideInterval = NULL;
-                intervalItem->refresh();        // XXX will get called in constructore when refactor
-                intervals_ << intervalItem;
+                task.found << intervalItem;
             }
         }
     }
-
     //qDebug() << "SEARCH PEAK PACE"
-    if ((discovery & RideFileInterval::intervalTypeBits(RideFileInterval::PEAKPACE)) &&
-        (f->isRun() || f->isSwim()) && f->isDataPresent(RideFile::kph)) {
+    if (task.kind == DiscoverPeakPace && (task.discovery & RideFileInterval::intervalTypeBits(RideFileInterval::PEAKPACE)) &&
+        (task.f->isRun() || task.f->isSwim()) && task.f->isDataPresent(RideFile::kph)) {
 
         // what we looking for ?
         static int durations[] = { 10, 15, 20, 30, 60, 300, 600, 1200, 1800, 2700, 3600, 0 };
@@ -995,40 +1121,37 @@ RideItem::updateIntervals()
                                 tr("1 minute"), tr("5 minutes"), tr("10 minutes"), tr("20 minutes"), tr("30 minutes"), tr("45 minutes"),
                                 tr("1 hour") };
 
-        bool metric = appsettings->value(this, context->athlete->paceZones(f->isSwim())->paceSetting(), GlobalContext::context()->useMetricUnits).toBool();
+        bool metric = task.metric;
         for(int i=0; durations[i] != 0; i++) {
 
             // go hunting for best peak
             QList<AddIntervalDialog::AddedInterval> results;
-            AddIntervalDialog::findPeaks(context, true, f, Specification(), RideFile::kph, RideFile::original, durations[i], 1, results, "", "");
+            AddIntervalDialog::findPeaks(item->context, true, task.f, Specification(), RideFile::kph, RideFile::original, durations[i], 1, results, "", "");
 
             // did we get one ?
             if (results.count() > 0 && results[0].avg > 0 && results[0].stop > 0) {
                 // qDebug()<<"found"<<names[i]<<"peak pace"<<results[0].start<<"-"<<results[0].stop<<"of"<<results[0].avg<<"kph";
-                IntervalItem *intervalItem = new IntervalItem(this, QString(tr("%1 (%2 %3)")).arg(names[i])
-                               .arg(context->athlete->paceZones(f->isSwim())->kphToPaceString(results[0].avg, metric))
-                               .arg(context->athlete->paceZones(f->isSwim())->paceUnits(metric)),
+                IntervalItem *intervalItem = new IntervalItem(item, QString(tr("%1 (%2 %3)")).arg(names[i])
+                               .arg(item->context->athlete->paceZones(task.f->isSwim())->kphToPaceString(results[0].avg, metric))
+                               .arg(item->context->athlete->paceZones(task.f->isSwim())->paceUnits(metric)),
                                                             results[0].start, results[0].stop, 
-                                                            f->timeToDistance(results[0].start),
-                                                            f->timeToDistance(results[0].stop),
-                                                            count++,
+                                                            task.f->timeToDistance(results[0].start),
+                                                            task.f->timeToDistance(results[0].stop),
+                                                            0, // numbered when merged
                                                             QColor(Qt::gray),
                                                             false,
                                                             RideFileInterval::PEAKPACE);
-                intervalItem->rideInterval = NULL;
-                intervalItem->refresh();        // XXX will get called in constructore when refactor
-                intervals_ << intervalItem;
+                task.found << intervalItem;
             }
         }
     }
-
-
     //qDebug() << "SEARCH EFFORTS";
+    double CP = task.CP, WPRIME = task.WPRIME, PMAX = task.PMAX;
     QList<effort> candidates[10];
     QList<effort> candidates_sprint;
     
-    if ((discovery & RideFileInterval::intervalTypeBits(RideFileInterval::EFFORT)) &&
-        CP > 0 && WPRIME > 0 && PMAX > 0 && !f->isRun() && !f->isSwim() && f->isDataPresent(RideFile::watts)) {
+    if (task.kind == DiscoverEfforts && (task.discovery & RideFileInterval::intervalTypeBits(RideFileInterval::EFFORT)) &&
+        CP > 0 && WPRIME > 0 && PMAX > 0 && !task.f->isRun() && !task.f->isSwim() && task.f->isDataPresent(RideFile::watts)) {
 
         const int SAMPLERATE = 1000; // 1000ms samplerate = 1 second samples
 
@@ -1037,7 +1160,7 @@ RideItem::updateIntervals()
         double lastT = 0.0f;         // last sample time seen in seconds
 
         // set the array size
-        int arraySize = f->dataPoints().last()->secs + f->recIntSecs();
+        int arraySize = task.f->dataPoints().last()->secs + task.f->recIntSecs();
 
         // anything longer than a day or negative is skipped
         if (arraySize >= 0 && arraySize < (24*3600)) { // no indent, as added late
@@ -1051,11 +1174,11 @@ RideItem::updateIntervals()
         long rtot = 0;
 
         long secs = 0;
-        foreach(RideFilePoint *p, f->dataPoints()) {
+        foreach(RideFilePoint *p, task.f->dataPoints()) {
 
             // increment secs by recIntSecs as the time series
             // always starts at zero, normalized by the file reader
-            double psecs = p->secs + f->recIntSecs();
+            double psecs = p->secs + task.f->recIntSecs();
 
             // whats the dt in microseconds
             int dt = (psecs * 1000) - (lastT * 1000);
@@ -1154,7 +1277,7 @@ RideItem::updateIntervals()
                         tte.duration = t;
                         tte.joules = integrated_series[i+t]-integrated_series[i];
                         tte.quality = tc / double(t);
-                        tte.zone = zoneok ? context->athlete->zones(sport)->whichZone(zoneRange, tte.joules/tte.duration) : 1;
+                        tte.zone = task.zoneok ? item->context->athlete->zones(item->sport)->whichZone(item->zoneRange, tte.joules/tte.duration) : 1;
 
                     } else {
 
@@ -1165,7 +1288,7 @@ RideItem::updateIntervals()
                             tte.duration = t;
                             tte.joules = integrated_series[i+t]-integrated_series[i];
                             tte.quality = thisquality;
-                            tte.zone = zoneok ? context->athlete->zones(sport)->whichZone(zoneRange, tte.joules/tte.duration) : 1;
+                            tte.zone = task.zoneok ? item->context->athlete->zones(item->sport)->whichZone(item->zoneRange, tte.joules/tte.duration) : 1;
                         }
 
                     }
@@ -1286,25 +1409,23 @@ RideItem::updateIntervals()
         foreach(effort x, candidates[i]) {
 
             IntervalItem *intervalItem=NULL;
-            int zone = zoneok ? 1 + context->athlete->zones(sport)->whichZone(zoneRange, x.joules/x.duration) : 1;
+            int zone = task.zoneok ? 1 + item->context->athlete->zones(item->sport)->whichZone(item->zoneRange, x.joules/x.duration) : 1;
 
             if (x.quality >= 1.0f) {
-                intervalItem = new IntervalItem(this, 
+                intervalItem = new IntervalItem(item, 
                                                 QString(tr("L%3 TTE of %1  (%2 watts)")).arg(time_to_string(x.duration)).arg(x.joules/x.duration).arg(zone),
                                                 x.start, x.start+x.duration, 
-                                                f->timeToDistance(x.start), f->timeToDistance(x.start+x.duration),
-                                                count++, QColor(Qt::red), false, RideFileInterval::EFFORT);
+                                                task.f->timeToDistance(x.start), task.f->timeToDistance(x.start+x.duration),
+                                                0, QColor(Qt::red), false, RideFileInterval::EFFORT);
             } else {
-                intervalItem = new IntervalItem(this, 
+                intervalItem = new IntervalItem(item, 
                                                 QString(tr("L%4 %3% EFFORT of %1  (%2 watts)")).arg(time_to_string(x.duration)).arg(x.joules/x.duration).arg(int(x.quality*100)).arg(zone),
                                                 x.start, x.start+x.duration, 
-                                                f->timeToDistance(x.start), f->timeToDistance(x.start+x.duration),
-                                                count++, QColor(Qt::red), false, RideFileInterval::EFFORT);
+                                                task.f->timeToDistance(x.start), task.f->timeToDistance(x.start+x.duration),
+                                                0, QColor(Qt::red), false, RideFileInterval::EFFORT);
             }
 
-            intervalItem->rideInterval = NULL;
-            intervalItem->refresh();        // XXX will get called in constructore when refactor
-            intervals_ << intervalItem;
+            task.found << intervalItem;
 
             //qDebug()<<fileName<<"IS EFFORT"<<x.quality<<"at"<<x.start<<"duration"<<x.duration;
 
@@ -1315,17 +1436,15 @@ RideItem::updateIntervals()
 
             IntervalItem *intervalItem=NULL;
 
-            int zone = zoneok ? 1 + context->athlete->zones(sport)->whichZone(zoneRange, x.joules/x.duration) : 1;
-            intervalItem = new IntervalItem(this,
+            int zone = task.zoneok ? 1 + item->context->athlete->zones(item->sport)->whichZone(item->zoneRange, x.joules/x.duration) : 1;
+            intervalItem = new IntervalItem(item,
                                             QString(tr("L%3 SPRINT of %1 secs (%2 watts)")).arg(x.duration).arg(x.joules/x.duration).arg(zone),
                                             x.start, x.start+x.duration,
-                                            f->timeToDistance(x.start), f->timeToDistance(x.start+x.duration),
-                                            count++, QColor(Qt::red), false, RideFileInterval::EFFORT);
+                                            task.f->timeToDistance(x.start), task.f->timeToDistance(x.start+x.duration),
+                                            0, QColor(Qt::red), false, RideFileInterval::EFFORT);
 
 
-            intervalItem->rideInterval = NULL;
-            intervalItem->refresh();        // XXX will get called in constructore when refactor
-            intervals_ << intervalItem;
+            task.found << intervalItem;
 
             //qDebug()<<fileName<<"IS EFFORT"<<x.quality<<"at"<<x.start<<"duration"<<x.duration;
 
@@ -1337,20 +1456,19 @@ RideItem::updateIntervals()
         //qDebug()<<fileName<<"of"<<secs<<"seconds took "<<timer.elapsed()<<"ms to find"<<candidates.count();
     }
     } // if arraySize is in bounds, no indent from above
-
     //qDebug() << "SEARCH HILLS";
-    if ((discovery & RideFileInterval::intervalTypeBits(RideFileInterval::CLIMB)) &&
-        !f->isSwim() && f->isDataPresent(RideFile::alt)) {
+    if (task.kind == DiscoverClimbs && (task.discovery & RideFileInterval::intervalTypeBits(RideFileInterval::CLIMB)) &&
+        !task.f->isSwim() && task.f->isDataPresent(RideFile::alt)) {
 
         //qDebug() << "SEARCH CLIMB STARTS: " << fileName;
 
         // Initialisation
         int hills = 0;
 
-        RideFilePoint *pstart = f->dataPoints().at(0);
-        RideFilePoint *pstop = f->dataPoints().at(0);
+        RideFilePoint *pstart = task.f->dataPoints().at(0);
+        RideFilePoint *pstop = task.f->dataPoints().at(0);
 
-        foreach(RideFilePoint *p, f->dataPoints()) {
+        foreach(RideFilePoint *p, task.f->dataPoints()) {
             // new min altitude
             if (pstart->alt > p->alt) {
                 //update start
@@ -1366,7 +1484,7 @@ RideItem::updateIntervals()
 
             bool downhill = (pstop->alt > p->alt+0.2*(pstop->alt-pstart->alt));
             bool flat = (!downhill && (p->km - pstop->km)>1/3.0*(p->km - pstart->km));
-            bool end = (p == f->dataPoints().last() );
+            bool end = (p == task.f->dataPoints().last() );
 
 
 
@@ -1378,11 +1496,11 @@ RideItem::updateIntervals()
                     // Candidat
 
                     // Check groundrise at end
-                    int start = f->dataPoints().indexOf(pstart);
-                    int stop = f->dataPoints().indexOf(pstop);
+                    int start = task.f->dataPoints().indexOf(pstart);
+                    int stop = task.f->dataPoints().indexOf(pstop);
 
                     for (int i=stop;i>start;i--) {
-                        RideFilePoint *p2 = f->dataPoints().at(i);
+                        RideFilePoint *p2 = task.f->dataPoints().at(i);
                         double distance2 =  pstop->km - p2->km;
                         if (distance2>0.1) {
                             if ((pstop->alt-p2->alt)/distance2<20.0) {
@@ -1394,7 +1512,7 @@ RideItem::updateIntervals()
                     }
 
                     for (int i=start;i<stop;i++) {
-                        RideFilePoint *p2 = f->dataPoints().at(i);
+                        RideFilePoint *p2 = task.f->dataPoints().at(i);
                         double distance2 = p2->km-pstart->km;
                         if (distance2>0.1) {
                             if ((p2->alt-pstart->alt)/distance2<20.0) {
@@ -1416,17 +1534,15 @@ RideItem::updateIntervals()
                             //qDebug() << "    NEW HILL " << (hills+1) << " at " << pstart->km  << "km " << pstart->secs/60.0 <<"-"<< pstop->secs/60.0 << "min " << distance << "km " << height/distance/10.0 << "%";
 
                             // create a new interval item
-                            IntervalItem *intervalItem = new IntervalItem(this, QString(tr("Climb %1")).arg(++hills),
+                            IntervalItem *intervalItem = new IntervalItem(item, QString(tr("Climb %1")).arg(++hills),
                                                                           pstart->secs, pstop->secs,
                                                                           pstart->km,
                                                                           pstop->km,
-                                                                          count++,
+                                                                          0, // numbered when merged
                                                                           QColor(Qt::green),
                                                                           false,
                                                                           RideFileInterval::CLIMB);
-                            intervalItem->rideInterval = NULL;
-                            intervalItem->refresh();        // XXX will get called in constructore when refactor
-                            intervals_ << intervalItem;
+                            task.found << intervalItem;
                         } else {
                             //qDebug() << "        NOT HILL " << "at " << pstart->km << "km " <<  pstart->secs/60.0 <<"-"<< pstop->secs/60.0 << "min " <<  distance  << "km" << height/distance/10.0 << "%";
                         }
@@ -1438,14 +1554,12 @@ RideItem::updateIntervals()
         }
         //qDebug() << "STOP" << QDateTime::currentDateTime().toString() + "\r\n";
     }
-
-
     //Search routes
-    if ((discovery & RideFileInterval::intervalTypeBits(RideFileInterval::ROUTE)) && f->isDataPresent(RideFile::lon)) {
+    if (task.kind == DiscoverRoutes && (task.discovery & RideFileInterval::intervalTypeBits(RideFileInterval::ROUTE)) && task.f->isDataPresent(RideFile::lon)) {
 
         // set intervals for routes
         QList<IntervalItem*> here;
-        context->athlete->routes->search(this, f, here);
+        item->context->athlete->routes->search(item, task.f, here);
 
         // Sort routes so they are added by start time to the activity.
         std::sort(
@@ -1458,32 +1572,213 @@ RideItem::updateIntervals()
 
         // add to ride !
         foreach(IntervalItem *add, here) {
-            add->rideInterval = NULL;
-            add->refresh();
-            intervals_ << add;
+            task.found << add;
         }
     }
-
     // Search W' MATCHES incl. those that take us to EXHAUSTION
-    if ((discovery & RideFileInterval::intervalTypeBits(RideFileInterval::EFFORT)) &&
-        f->isDataPresent(RideFile::watts) && f->wprimeData()) {
+    if (task.kind == DiscoverMatches && (task.discovery & RideFileInterval::intervalTypeBits(RideFileInterval::EFFORT)) &&
+        task.f->isDataPresent(RideFile::watts) && task.f->wprimeData()) {
 
         // add one for each
-        foreach(struct Match match, f->wprimeData()->matches) {
+        foreach(struct Match match, task.f->wprimeData()->matches) {
 
             // anything under 2000joules isn't worth worrying about
             if (match.cost > 2000) {
 
                 // create a new interval item
-                IntervalItem *intervalItem = new IntervalItem(this, "", // will update name once AP computed
+                IntervalItem *intervalItem = new IntervalItem(item, "", // will update name once AP computed
                                                             match.start, match.stop,
-                                                            f->timeToDistance(match.start), f->timeToDistance(match.stop),
-                                                            count++,
+                                                            task.f->timeToDistance(match.start), task.f->timeToDistance(match.stop),
+                                                            0, // numbered when merged
                                                             match.exhaust ? QColor(255,69,0) : QColor(255,165,0),
                                                             false, // XXX FIXME should this be a test if to exhaustion ??? XXX
                                                             RideFileInterval::EFFORT);
-                intervalItem->rideInterval = NULL;
-                intervalItem->refresh();        // XXX will get called in constructore when refactor
+                task.found << intervalItem;
+                task.matches << match;
+            }
+        }
+    }
+}
+
+void
+RideItem::updateIntervals()
+{
+    // what do we need ?
+    int discovery = appsettings->cvalue(context->athlete->cyclist, GC_DISCOVERY, 57).toInt(); // 57 does not include search for PEAKS
+    QStringList hot = IntervalItem::hotMetrics();
+
+    // DO NOT USE ride() since it will call a refresh !
+    RideFile *f = ride_;
+
+    QList<IntervalItem*> deletelist = intervals_;
+    intervals_.clear();
+
+    // no ride data available ?
+    if (!samples) {
+        context->notifyIntervalsUpdate(this);
+        return;
+    }
+
+    // Get CP and W' estimates for date of ride
+    double CP = 0;
+    double WPRIME = 0;
+    double PMAX = 0;
+    bool zoneok = false;
+
+    if (context->athlete->zones(sport)) {
+
+        // if range is -1 we need to fall back to a default value
+        CP = zoneRange >= 0 ? context->athlete->zones(sport)->getCP(zoneRange) : 0;
+        WPRIME = zoneRange >= 0 ? context->athlete->zones(sport)->getWprime(zoneRange) : 0;
+        PMAX = zoneRange >= 0 ? context->athlete->zones(sport)->getPmax(zoneRange) : 0;
+
+        // did we override CP in metadata ?
+        int oCP = getText("CP","0").toInt();
+        int oW = getText("W'","0").toInt();
+        int oPMAX = getText("Pmax","0").toInt();
+        if (oCP) CP=oCP;
+        if (oW) WPRIME=oW;
+        if (oPMAX) PMAX=oPMAX;
+
+        if (zoneRange >= 0 && context->athlete->zones(sport)) zoneok=true;
+    }
+
+    // USER / DEVICE INTERVALS
+    // first we create interval items for all intervals
+    // that are in the ridefile, but ignore Peaks since we
+    // add those automatically for HR and Power where those
+    // data series are present
+
+    // ride start and end
+    RideFilePoint *begin = f->dataPoints().first();
+    RideFilePoint *end = f->dataPoints().last();
+
+    // ALL interval
+    if (discovery & RideFileInterval::intervalTypeBits(RideFileInterval::ALL)) {
+
+        // add entire ride using ride metrics
+        IntervalItem *entire = new IntervalItem(this, tr("Entire Activity"), 
+                                                begin->secs, end->secs, 
+                                                f->timeToDistance(begin->secs),
+                                                f->timeToDistance(end->secs),
+                                                0,
+                                                QColor(Qt::darkBlue),
+                                                false,
+                                                RideFileInterval::ALL);
+
+        // same as the whole ride, not need to compute
+        entire->refreshHot(hot);
+        entire->rideInterval = NULL;
+        intervals_ << entire;
+    }
+
+    int count = 0;
+    foreach(RideFileInterval *interval, f->intervals()) {
+
+        // skip peaks when autodiscovered
+        if (discovery & RideFileInterval::intervalTypeBits(RideFileInterval::PEAKPOWER) && interval->isPeak()) continue;
+
+        // skip climbs when autodiscovered
+        if (discovery & RideFileInterval::intervalTypeBits(RideFileInterval::CLIMB) && interval->isClimb()) continue;
+
+        // skip matches when autodiscovered
+        if (discovery & RideFileInterval::intervalTypeBits(RideFileInterval::EFFORT) && interval->isMatch()) continue;
+
+        // skip entire ride when autodiscovered
+        if (discovery & RideFileInterval::intervalTypeBits(RideFileInterval::ALL) && 
+           ((interval->start <= begin->secs && interval->stop >= end->secs) ||
+           (((interval->start - f->recIntSecs()) <= begin->secs && (interval->stop-f->recIntSecs()) >= end->secs) ||
+           (interval->start <= begin->secs && (interval->stop+f->recIntSecs()) >= end->secs))))
+             continue;
+
+        // skip empty backward intervals
+        if (interval->start >= interval->stop) continue;
+
+        // create a new interval item
+        const int seq = count; // if passed directly, it could be incremented BEFORE being evaluated for the sequence arg as arg eval order is undefined
+        IntervalItem *intervalItem = new IntervalItem(this, interval->name, 
+                                                      interval->start, interval->stop, 
+                                                      f->timeToDistance(interval->start),
+                                                      f->timeToDistance(interval->stop),
+                                                      seq,
+                                                      (interval->color == Qt::black) ? standardColor(count) : interval->color,
+                                                      interval->test,
+                                                      RideFileInterval::USER);
+
+        intervalItem->rideInterval = interval;
+        intervalItem->refreshHot(hot);        // XXX will get called in constructor when refactor
+        intervals_ << intervalItem;
+
+        count++;
+        //qDebug()<<"interval:"<<interval.name<<interval.start<<interval.stop<<"f:"<<begin->secs<<end->secs;
+    }
+
+    // DISCOVERY
+
+    // what each kind of discovery depends on, if it's the same as last time
+    // we reuse the intervals it found then instead of searching again
+    QString common = QString("%1:%2:%3:%4").arg(crc).arg(discovery).arg(f->isRun()).arg(f->isSwim());
+    const PaceZones *pacezones = context->athlete->paceZones(f->isSwim());
+    bool metric = pacezones ? appsettings->value(this, pacezones->paceSetting(), GlobalContext::context()->useMetricUnits).toBool()
+                            : GlobalContext::context()->useMetricUnits;
+    unsigned long powerfp = context->athlete->zones(sport) ? context->athlete->zones(sport)->getFingerprint(dateTime.date()) : 0;
+    unsigned long pacefp = pacezones ? pacezones->getFingerprint(dateTime.date()) : 0;
+
+    QStringList signatures;
+    signatures << common // DiscoverPeakPower
+               << QString("%1:%2:%3").arg(common).arg(pacefp).arg(metric) // DiscoverPeakPace
+               << QString("%1:%2:%3:%4:%5:%6").arg(common).arg(CP).arg(WPRIME).arg(PMAX).arg(zoneRange).arg(powerfp) // DiscoverEfforts
+               << common // DiscoverClimbs
+               << QString("%1:%2").arg(common).arg(context->athlete->routes->getFingerprint()) // DiscoverRoutes
+               << QString(); // DiscoverMatches, W'bal has settings of its own so always search
+
+    // set up the tasks
+    QVector<RideItemDiscovery> tasks(Discoveries);
+    for(int i=0; i<Discoveries; i++) {
+
+        RideItemDiscovery &task = tasks[i];
+        task.kind = i;
+        task.item = this;
+        task.f = f;
+        task.discovery = discovery;
+        task.CP = CP;
+        task.WPRIME = WPRIME;
+        task.PMAX = PMAX;
+        task.zoneok = zoneok;
+        task.metric = metric;
+
+        // the intervals we found last time, they must all still be there
+        foreach(IntervalItem *x, deletelist) if (x->discovered == i) task.found << x;
+        // the crc is of the file on disk, so when it's been edited
+        // in memory we can't tell whether the data has changed
+        task.reused = crc && !isdirty && !signatures[i].isEmpty() && i < discoveries.count() &&
+                      discoveries[i] == QString("%1#%2").arg(signatures[i]).arg(task.found.count());
+
+        if (task.reused) foreach(IntervalItem *x, task.found) deletelist.removeOne(x);
+        else task.found.clear();
+    }
+
+    // search, each kind concurrently
+    QtConcurrent::blockingMap(tasks, discover);
+
+    // add them to the ride in the same order every time
+    discoveries.clear();
+    for(int i=0; i<Discoveries; i++) {
+
+        RideItemDiscovery &task = tasks[i];
+        discoveries << QString("%1#%2").arg(signatures[i]).arg(task.found.count());
+
+        for(int j=0; j<task.found.count(); j++) {
+
+            IntervalItem *intervalItem = task.found[j];
+            if (i != DiscoverRoutes) intervalItem->setDisplaySequence(count++); // routes are numbered amongst themselves
+            intervalItem->discovered = i;
+            intervalItem->rideInterval = NULL;
+            intervalItem->refreshHot(hot);        // XXX will get called in constructore when refactor
+
+            if (i == DiscoverMatches && !task.reused) {
+
+                const Match &match = task.matches[j];
 
                 // now all the metrics are computed update the name to
                 // reflect the AP which was calculated for it, and duration
@@ -1499,9 +1794,8 @@ RideItem::updateIntervals()
                                                  .arg((int)ap)
                                                  .arg(match.cost/1000)
                                                  .arg(match.exhaust ? tr("TE MATCH") : tr("MATCH"));
-
-                intervals_ << intervalItem;
             }
+            intervals_ << intervalItem;
         }
     }
 
@@ -1553,8 +1847,38 @@ RideItem::updateIntervals()
     foreach(IntervalItem *x, deletelist) delete x;
 }
 
+// discovered intervals only have their hot metrics computed, the rest are
+// computed when first needed. We do all the intervals for the ride at once
+// since it needs to be opened, but don't refresh it if it is stale
+void
+RideItem::completeIntervals()
+{
+    QMutexLocker locker(&completing);
+
+    bool doclose = false;
+    if (!ride_) {
+        QFile file(path + "/" + fileName);
+        QStringList errors;
+        ride_ = RideFileFactory::instance().openRideFile(context, file, errors);
+        doclose = true;
+    }
+
+    foreach(IntervalItem *interval, intervals_) {
+        if (!interval->isPending()) continue;
+        if (ride_) interval->refresh();
+        else interval->pending_ = false; // can't read it, so don't keep trying
+    }
+
+    // the ride cache will need saving, but nothing it derives from the
+    // ride metrics has changed so don't invalidate it mid-evaluation
+    if (ride_ && context && context->athlete->rideCache) context->athlete->rideCache->modified(this);
+
+    if (doclose) close();
+}
+
 QList<IntervalItem*> RideItem::intervalsSelected() const
 {
+    materialise();
     QList<IntervalItem*> returning;
     foreach(IntervalItem *p, intervals_) {
         if (p && p->selected) returning << p;
@@ -1564,6 +1888,7 @@ QList<IntervalItem*> RideItem::intervalsSelected() const
 
 QList<IntervalItem*> RideItem::intervalsSelected(RideFileInterval::intervaltype type) const
 {
+    materialise();
     QList<IntervalItem*> returning;
     foreach(IntervalItem *p, intervals_) {
         if (p && p->selected && p->type==type) returning << p;
@@ -1573,6 +1898,7 @@ QList<IntervalItem*> RideItem::intervalsSelected(RideFileInterval::intervaltype
 
 QList<IntervalItem*> RideItem::intervals(RideFileInterval::intervaltype type) const
 {
+    materialise();
     QList<IntervalItem*> returning;
     foreach(IntervalItem *p, intervals_) {
         if (p && p->type == type) returning << p;
@@ -1586,6 +1912,8 @@ QList<IntervalItem*> RideItem::intervals(RideFileInterval::intervaltype type) co
 bool
 RideItem::xdataMatch(QString name, QString series, QString &mname, QString &mseries)
 {
+    materialise();
+
     QMapIterator<QString, QStringList>xi(xdata_);
     xi.toFront();
     while (xi.hasNext()) {
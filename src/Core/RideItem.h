@@ -23,10 +23,13 @@
 
 #include "RideMetric.h"
 #include "Measures.h"
+#include "MetadataDictionary.h"
 
 #include <QString>
 #include <QMap>
 #include <QVector>
+#include <QAtomicPointer>
+#include <QMutex>
 
 class RideFile;
 class RideFileCache;
@@ -37,6 +40,9 @@ class IntervalSummaryWindow;
 class Context;
 class UserData;
 class ComparePane;
+class RideDBStore;
+class RideDBSnapshot;
+struct RideItemDiscovery;
 
 class RideItem : public QObject
 {
@@ -53,6 +59,8 @@ class RideItem : public QObject
         friend class ::IntervalSummaryWindow;
         friend class ::UserData;
         friend class ::ComparePane;
+        friend class ::RideDBStore;
+        friend class ::RideDBSnapshot;
 
         // ridefile
         RideFile *ride_;
@@ -66,8 +74,8 @@ class RideItem : public QObject
         QMap<int, double> stdmean_;
         QMap<int, double> stdvariance_;
 
-        // metadata (used by navigator)
-        QMap<QString,QString> metadata_;
+        // metadata (used by navigator), interned per athlete
+        MetadataMap metadata_;
 
         // xdata series definitions
         QMap<QString,QStringList>xdata_;
@@ -120,6 +128,7 @@ class RideItem : public QObject
 
         // access the metric value
         double getForSymbol(QString name, bool useMetricUnits=true);
+        double getForIndex(int index); // by metric index, in metric units
         double getCountForSymbol(QString name);
 
         // access the stdmean and stdvariance value
@@ -149,6 +158,18 @@ class RideItem : public QObject
 
         // context the item was updated to
         unsigned long fingerprint; // zones
+
+        // the fingerprint above is made up of these, kept separately so when
+        // the config changes we only recompute the metrics that depend on it
+        // (see RideMetric::dependsOn). Empty if not known, e.g. old rideDB.json
+        enum { PowerFp=0, CPFp, HrFp, PaceFp, HrvFp, RoutesFp, DiscoveryFp, Fingerprints };
+        QVector<unsigned long> fingerprints;
+
+        // what is stale (RideMetric::MetricDepends or'ed with the below)
+        // when isstale is set, zero means we don't know so refresh it all
+        enum { StaleIntervals=0x100, StaleAll=0xffff };
+        int stale;
+
         unsigned long metacrc, crc, timestamp; // file content
         int dbversion; // metric version
         int udbversion; // user metric version
@@ -157,17 +178,18 @@ class RideItem : public QObject
         // access to the cached data !
         RideFile *ride(bool open=true);
         RideFileCache *fileCache();
-        QVector<double> &metrics() { return metrics_; }
-        QVector<double> &counts() { return count_; }
-        QMap <int, double>&stdmeans() { return stdmean_; }
-        QMap <int, double>&stdvariances() { return stdvariance_; }
+        QVector<double> &metrics() { materialise(); return metrics_; }
+        QVector<double> &counts() { materialise(); return count_; }
+        QMap <int, double>&stdmeans() { materialise(); return stdmean_; }
+        QMap <int, double>&stdvariances() { materialise(); return stdvariance_; }
         const QStringList errors() { return errors_; }
         double getWeight(int type=0);
         double getHrvMeasure(QString fieldSymbol);
         unsigned short getHrvFingerprint();
+        unsigned long getFingerprints(QVector<unsigned long> &fps);
 
         // when retrieving interval lists we can provide criteria too
-        QList<IntervalItem*> &intervals()  { return intervals_; }
+        QList<IntervalItem*> &intervals()  { materialise(); return intervals_; }
         QList<IntervalItem*> intervalsSelected() const;
         QList<IntervalItem*> intervals(RideFileInterval::intervaltype) const;
         QList<IntervalItem*> intervalsSelected(RideFileInterval::intervaltype) const;
@@ -175,10 +197,17 @@ class RideItem : public QObject
         void moveInterval(int from, int to);
 
         // metadata
-        QMap<QString, QString> &metadata() { return metadata_; }
+        MetadataMap &metadata() { return metadata_; }
 
         // xdata definitions maps QString<xdata>, QStringList<xdataseries>
-        QMap<QString,QStringList> &xdata() { return xdata_; }
+        QMap<QString,QStringList> &xdata() { materialise(); return xdata_; }
+
+        // rides restored from the ride cache snapshot only have their summary
+        // decoded at startup, the rest is decoded when first used, see
+        // RideDBStore.h. metric values don't need it, so summary() gets
+        // them without decoding if it hasn't happened yet
+        void materialise() const { if (snapshot_.loadAcquire()) const_cast<RideItem*>(this)->unpack(); }
+        void summary(QVector<double> &values);
 
         // hunt down the xdata series by matching, returns true or false on match
         // and will set mname and mseries to the value that matched
@@ -207,6 +236,9 @@ class RideItem : public QObject
         // refresh when stale
         void refresh();
 
+        // compute interval metrics that weren't needed during refresh
+        void completeIntervals();
+
         // get/set
         void setRide(RideFile *);
         void setFileName(QString, QString);
@@ -218,6 +250,24 @@ class RideItem : public QObject
 
     private:
         void updateIntervals();
+        static void discover(RideItemDiscovery &task);
+
+        // what each kind of interval discovery depended on last
+        // time and how many it found, see updateIntervals()
+        QStringList discoveries;
+        void refreshMetrics(int config);
+
+        // lazy decoding from the ride cache snapshot
+        void unpack();
+        bool lookup(int index, double &value, double &count);
+        int intervalCount();
+
+        QAtomicPointer<RideDBSnapshot> snapshot_;
+        int snapshotRow_;
+
+        // held whilst completing intervals, refreshing or closing
+        // recursive since completeIntervals() and refresh() close()
+        QMutex completing;
 };
 
 Q_DECLARE_OPAQUE_POINTER(RideItem*);
@@ -100,13 +100,13 @@ static QString DetermineKey(QString & key, int& store, int& fileIndex) {
 
 // -----------------------------constructor and public instance methods ------------------------//
 
-GSettings::GSettings(QString org, QString app) : newFormat(true){
+GSettings::GSettings(QString org, QString app) : newFormat(true), cacheGeneration(0){
     oldsystemsettings = new QSettings(org,app);
     systemsettings = new QSettings(QSettings::IniFormat, QSettings::UserScope, org, app);
     global = new QVector<QSettings*>();
 }
 
-GSettings::GSettings(QString file, QSettings::Format format) : newFormat(false){
+GSettings::GSettings(QString file, QSettings::Format format) : newFormat(false), cacheGeneration(0){
     systemsettings = new QSettings(file,format);
 }
 
@@ -175,6 +175,20 @@ GSettings::cvalue(QString athleteName, QString key, QVariant def) {
 
     if (athleteName.isNull() || athleteName.isEmpty()) return def;
 
+    // seen it before ?
+    cacheLock.lockForRead();
+    quint64 generation = cacheGeneration;
+    QHash<QString, QHash<QString, QVariant> >::const_iterator c = cache.constFind(athleteName);
+    if (c != cache.constEnd()) {
+        QHash<QString, QVariant>::const_iterator v = c.value().constFind(key);
+        if (v != c.value().constEnd()) {
+            QVariant returning = v.value().isValid() ? v.value() : def;
+            cacheLock.unlock();
+            return returning;
+        }
+    }
+    cacheLock.unlock();
+
     QString keyVar = QString(key);
     if (newFormat) {
         int store;
@@ -189,7 +203,17 @@ GSettings::cvalue(QString athleteName, QString key, QVariant def) {
                 qDebug() << "GetCValue key, keyVar, store:" << key << ":" << keyVar  << ": " << store; // error cases on code configuration
                 break;
             case SETTINGS_ATHLETE:
-                return i.value()->getQSettings(file)->value(keyVar, def);
+                {
+                    QSettings *settings = i.value()->getQSettings(file);
+                    QVariant value = settings->contains(keyVar) ? settings->value(keyVar) : QVariant();
+
+                    // unless it was written (or invalidated) whilst we read it
+                    cacheLock.lockForWrite();
+                    if (generation == cacheGeneration) cache[athleteName].insert(key, value);
+                    cacheLock.unlock();
+
+                    return value.isValid() ? value : def;
+                }
                 break;
             }
         } else {
@@ -223,6 +247,11 @@ GSettings::setCValue(QString athleteName, QString key, QVariant value) {
                 break;
             case SETTINGS_ATHLETE:
                 i.value()->getQSettings(file)->setValue(keyVar, value);
+
+                cacheLock.lockForWrite();
+                cache[athleteName].insert(key, value);
+                cacheGeneration++;
+                cacheLock.unlock();
                 break;
             }
         } // if we do have have the athlete - then we do not store anything
@@ -383,6 +412,7 @@ GSettings::initializeQSettingsAthlete(QString athletesRootDir, QString athleteNa
                     i2.value()->getQSettings(ATHLETE_PREFERENCES)->allKeys().isEmpty() &&
                     i2.value()->getQSettings(ATHLETE_PRIVATE)->allKeys().isEmpty() ) {
                 upgradeAthlete(athleteName);
+                invalidate(athleteName);
 
             }
         }
@@ -403,6 +433,7 @@ GSettings::initializeQSettingsNewAthlete(QString athletesRootDir, QString athlet
     athleteSettings->setQSettings(new QSettings(baseName+settingFileNamesAthlete[ATHLETE_PREFERENCES], QSettings::IniFormat), ATHLETE_PREFERENCES );
     athleteSettings->setQSettings(new QSettings(baseName+settingFileNamesAthlete[ATHLETE_PRIVATE], QSettings::IniFormat), ATHLETE_PRIVATE );
     athlete.insert(athleteName, athleteSettings);
+    invalidate(athleteName);
 
 }
 
@@ -450,6 +481,18 @@ GSettings::clearGlobalAndAthletes() {
     syncQSettings();
     global->clear();
     athlete.clear();
+    invalidate();
+}
+
+void
+GSettings::invalidate(QString athleteName) {
+
+    // drop cached athlete config, e.g. when the QSettings are replaced
+    // or written directly during an upgrade
+    QWriteLocker locker(&cacheLock);
+    if (athleteName.isEmpty()) cache.clear();
+    else cache.remove(athleteName);
+    cacheGeneration++;
 }
 
 
@@ -433,6 +433,8 @@
 // --------------------------------------------------------------------------------
 #include <QSettings>
 #include <QFileInfo>
+#include <QHash>
+#include <QReadWriteLock>
 
 // Helper Class for the Athlete QSettings
 
@@ -499,6 +501,16 @@ private:
     QVector<QSettings*> *global;
     QHash<QString, AthleteQSettings*> athlete;
 
+    // athlete config is read a lot (e.g. per ride when refreshing) so values
+    // are cached by athlete and key, an invalid QVariant means not set.
+    // setCValue() writes through so QSettings is only read the first time.
+    // the generation goes up with every write, so a value read from
+    // QSettings isn't cached if it may have changed whilst we read it
+    QReadWriteLock cacheLock;
+    QHash<QString, QHash<QString, QVariant> > cache;
+    quint64 cacheGeneration;
+    void invalidate(QString athleteName=QString());
+
     // special methods for Migration/Upgrade
     void migrateValue(QString key);
     void migrateCValue(QString athleteName, QString key);
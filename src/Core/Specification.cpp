@@ -21,6 +21,54 @@
 #include "IntervalItem.h"
 #include "RideFile.h"
 
+#include <QMutex>
+#include <QCryptographicHash>
+
+// filter set contents seen recently (by digest, they can be long lists
+// of ride files), each is given its own fingerprint so they can be
+// compared (and used in cache keys) as a number
+static const int MAXFINGERPRINTS = 10000;
+static QMutex fingerprintLock;
+static QHash<QByteArray, uint> fingerprints;
+static uint lastFingerprint = 0;
+
+void
+FilterSet::refingerprint()
+{
+    if (filters_.isEmpty()) {
+        fingerprint_ = 0;
+        return;
+    }
+
+    // the contents as text, sorted so the order the filters and the
+    // names were added doesn't matter, and with each name and set
+    // prefixed with its length so no two filter sets look the same
+    QStringList sets;
+    foreach(const QSet<QString> &set, filters_) {
+        QStringList names = set.toList();
+        names.sort();
+
+        QString text;
+        foreach(const QString &name, names) text += QString::number(name.length()) + ":" + name;
+        sets << QString::number(text.length()) + ":" + text;
+    }
+    sets.sort();
+    QByteArray contents = QCryptographicHash::hash(sets.join("").toUtf8(), QCryptographicHash::Sha1);
+
+    QMutexLocker locker(&fingerprintLock);
+    fingerprint_ = fingerprints.value(contents, 0);
+    if (fingerprint_ == 0) {
+
+        // start again when full, fingerprints are never reused so
+        // the ones already given out still only match their contents
+        if (fingerprints.count() >= MAXFINGERPRINTS) fingerprints.clear();
+        if (++lastFingerprint == 0) ++lastFingerprint;
+
+        fingerprint_ = lastFingerprint;
+        fingerprints.insert(contents, fingerprint_);
+    }
+}
+
 Specification::Specification(DateRange dr, FilterSet fs) : dr(dr), fs(fs), it(NULL), recintsecs(0), ri(NULL) {}
 Specification::Specification(IntervalItem *it, double recintsecs) : it(it), recintsecs(recintsecs), ri(NULL) {}
 Specification::Specification() : it(NULL), recintsecs(0), ri(NULL) {}
@@ -73,6 +121,26 @@ Specification::setIntervalItem(IntervalItem *it, double recintsecs)
     this->recintsecs = recintsecs;
 }
 
+QString
+Specification::signature() const
+{
+    return QString("%1:%2:%3:%4:%5:%6")
+           .arg(dr.from.toString(Qt::ISODate))
+           .arg(dr.to.toString(Qt::ISODate))
+           .arg(fs.fingerprint())
+           .arg(quintptr(it))
+           .arg(recintsecs)
+           .arg(quintptr(ri));
+}
+
+bool
+Specification::sameAs(const Specification &other) const
+{
+    return dr.from == other.dr.from && dr.to == other.dr.to &&
+           fs.fingerprint() == other.fs.fingerprint() &&
+           it == other.it && recintsecs == other.recintsecs && ri == other.ri;
+}
+
 double 
 Specification::secsStart() const
 {
@@ -22,6 +22,8 @@
 #include <QString>
 #include <QStringList>
 #include <QSet>
+#include <QHash>
+#include <QBitArray>
 #include "TimeUtils.h"
 
 //
@@ -43,24 +45,33 @@ class FilterSet
     // used to collect filters and apply if needed
     QVector<QSet<QString>> filters_;
 
+    // identifies the contents, see fingerprint()
+    uint fingerprint_;
+    void refingerprint();
+
     public:
 
         // create one with a set
-        FilterSet(bool on, QStringList list) {
+        FilterSet(bool on, QStringList list) : fingerprint_(0) {
             if (on) filters_ << list.toSet();
+            refingerprint();
         }
 
         // create an empty set
-        FilterSet() {}
+        FilterSet() : fingerprint_(0) {}
 
         // add a new filter
         void addFilter(bool on, QStringList list) {
-            if (on) filters_ << list.toSet();
+            if (on) {
+                filters_ << list.toSet();
+                refingerprint();
+            }
         }
 
         // clear the filter set
         void clear() {
             filters_.clear();
+            fingerprint_ = 0;
         }
 
         // does the name in question pass the filter set ?
@@ -71,7 +82,27 @@ class FilterSet
             return true;
         }
 
-        int count() { return filters_.count(); }
+        int count() const { return filters_.count(); }
+
+        // different filters never give the same fingerprint, and the same
+        // filters do regardless of order, unless the table of them was
+        // cleared in between (see Specification.cpp), 0 when there are none
+        uint fingerprint() const { return fingerprint_; }
+
+        // the rows that pass as a bitset, row maps each name to its
+        // row (e.g. position in the ride cache), missing names are ignored
+        QBitArray compile(const QHash<QString,int> &row, int rows) const {
+            QBitArray returning(rows, true);
+            foreach(const QSet<QString> &set, filters_) {
+                QBitArray matches(rows, false);
+                foreach(const QString &name, set) {
+                    int index = row.value(name, -1);
+                    if (index >= 0 && index < rows) matches.setBit(index);
+                }
+                returning &= matches;
+            }
+            return returning;
+        }
 };
 
 class RideFileIterator;
@@ -114,6 +145,12 @@ class Specification
         // when working with samples
         void print();
 
+        // identifies what the specification selects, for caching results
+        QString signature() const;
+
+        // does the other select exactly the same ?
+        bool sameAs(const Specification &other) const;
+
         // when working with intervals secs start and end
         // if no interval is set then they return -1 to indicate
         // that the entire ride is in scope
@@ -252,6 +252,7 @@ FixLapSwim::postProcess(RideFile *ride, DataProcessorConfig *config=0, QString o
         // rebuild intervals and force metric update
         ride->fillInIntervals();
         ride->context->rideItem()->isstale = true;
+        ride->context->rideItem()->stale = RideItem::StaleAll;
         ride->context->rideItem()->refresh();
     }
 
@@ -899,6 +899,7 @@ AnalysisSidebar::editRoute()
                     if (interval->route == activeInterval->route) {
                         //Make stale
                         ride->isstale = true;
+                        ride->stale = RideItem::StaleAll;
                     }
                 }
             }
@@ -404,7 +404,9 @@ SolveCPDialog::newBest(int k,WBParms p,double sum)
 void
 SolveCPDialog::current(int k,WBParms p,double sum)
 {
-    citLabel->setText(QString("%1").arg(k));
+    // k counts candidates across all the solver's chains
+    double rate = k * 1000.0 / qMax(1, solving.elapsed());
+    citLabel->setText(QString("%1 (%2/s)").arg(k).arg(rate, 0, 'f', 0));
     ccpLabel->setText(QString("%1").arg(p.CP));
     cwLabel->setText(QString("%1").arg(p.W));
     if (integral) ctLabel->setText(QString("%1").arg(p.TAU));
@@ -416,7 +418,11 @@ SolveCPDialog::current(int k,WBParms p,double sum)
     // visualise new point
     solverDisplay->addPoint(SolverPoint(p.CP, p.W, sum, p.TAU));
 
-    if (!(k++%200) || k == 99999)  QApplication::processEvents();
+    // candidates arrive in bursts between rounds, so update on time
+    if (updated.elapsed() > 50) {
+        QApplication::processEvents();
+        updated.start();
+    }
 }
 
 void
@@ -484,6 +490,8 @@ SolveCPDialog::solveClicked()
         solverDisplay->setConstraints(constraints);
         solver->setData(constraints, solveme);
         solve->setText(tr("Stop"));
+        solving.start();
+        updated.start();
         solver->start();
     }
     return;
@@ -24,6 +24,7 @@
 #include <QWidget>
 #include <QTreeWidget>
 #include <QDoubleSpinBox>
+#include <QTime>
 
 class Context;
 class SolverDisplay;
@@ -73,6 +74,9 @@ class SolveCPDialog : public QDialog
         Context *context;
         QList<RideItem*> items;
 
+        // for throughput and keeping the ui responsive whilst solving
+        QTime solving, updated;
+
     private slots:
 
         // updates from solver
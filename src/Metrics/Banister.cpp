@@ -51,13 +51,18 @@
 #include <QVector>
 #include <QMutex>
 #include <QApplication>
-#include "lmcurve.h"
+#include <QCryptographicHash>
+#include <QtConcurrent>
+#include "LMCurve.h"
 
 // the mean athlete from opendata analysis
 const double typical_CP = 261,
              typical_WPrime = 15500,
              typical_Pmax = 1100;
 
+// fits we remember, they're small but t1/t2 are tuned on the chart
+static const int MAXFITS = 1000;
+
 // used to control breaking into windows, but the performance is good enough
 // that we don't need to, and more data stops the fit from going bad.
 const int typical_SeasonBreak = 42;
@@ -456,33 +461,62 @@ banisterFit::f(double d, const double *parms)
     }
 
     // return previously computed
-    //printd("result perf(%s)=%g vs test=%g\n", parent->start.addDays(d).toString().toStdString().c_str(),parent->data[int(d)].perf, parent->data[int(d)].test);
-    return parent->data[int(d)].perf;
+    //printd("result perf(%s)=%g vs test=%g\n", parent->start.addDays(d).toString().toStdString().c_str(),series[int(d)-startIndex].perf, parent->data[int(d)].test);
+    long index = long(d)-startIndex;
+    if (index < 0 || index >= series.count()) return parent->data[int(d)].perf; // test on the last day
+    return series[index].perf;
 }
 
 void
 banisterFit::compute(long start, long stop)
 {
     // ack, we need to recompute our window using the parameters supplied
+    // the loads are read from the parent, results go in our series
+    series.resize(stopIndex-startIndex);
+    double d1 = exp(-1/t1), d2 = exp(-1/t2);
     bool first = true;
     for (int index=start; index < stop; index++) {
 
+        banisterData &day = series[index-startIndex];
+        day = parent->data[index];
+
         // g and h are just accumulated training load with different decay parameters
         if (first) {
-            parent->data[index].g =  parent->data[index].h = 0;
+            day.g =  day.h = 0;
             first = false;
         } else {
-            parent->data[index].g = (parent->data[index-1].g * exp (-1/parent->t1)) + parent->data[index].score;
-            parent->data[index].h = (parent->data[index-1].h * exp (-1/parent->t2)) + parent->data[index].score;
+            day.g = (series[index-startIndex-1].g * d1) + day.score;
+            day.h = (series[index-startIndex-1].h * d2) + day.score;
         }
 
         // apply coefficients
-        parent->data[index].pte = parent->data[index].g * k1;
-        parent->data[index].nte = parent->data[index].h * k2;
-        parent->data[index].perf = p0 + (parent->data[index].pte - parent->data[index].nte);
+        day.pte = day.g * k1;
+        day.nte = day.h * k2;
+        day.perf = p0 + (day.pte - day.nte);
     }
 }
 
+QByteArray
+banisterFit::signature() const
+{
+    QCryptographicHash hash(QCryptographicHash::Sha1);
+
+    // decay constants and priors
+    double parms[4] = { parent->t1, parent->t2, parent->k1, parent->k2 };
+    hash.addData(reinterpret_cast<const char*>(parms), sizeof(parms));
+
+    // loads across the window
+    for(long index=startIndex; index < stopIndex; index++)
+        hash.addData(reinterpret_cast<const char*>(&parent->data[index].score), sizeof(double));
+
+    // tests, relative to the start of the window
+    for(int i=testoffset; i>=0 && i<testoffset+tests; i++) {
+        double test[2] = { parent->performanceDay[i] - startIndex, parent->performanceScore[i] };
+        hash.addData(reinterpret_cast<const char*>(test), sizeof(test));
+    }
+    return hash.result();
+}
+
 void
 banisterFit::combine(banisterFit other)
 {
@@ -498,12 +532,6 @@ banisterFit::combine(banisterFit other)
     }
 }
 
-// used to wrap a function call when deriving parameters
-static banisterFit *calllmfitm = NULL;
-static double calllmfitb(double t, const double *p) {
-return static_cast<banisterFit*>(calllmfitm)->f(t, p);
-}
-
 void Banister::setDecay(double one, double two)
 {
     // we will need to refit too...
@@ -514,35 +542,70 @@ void Banister::setDecay(double one, double two)
     fit();
 
 }
-void Banister::fit()
+void
+Banister::fitWindow(banisterFit &window)
 {
-    for(int i=0; i<windows.length(); i++) {
+    // t1/t2 are fixed (for now)
+    window.t1 = window.parent->t1;
+    window.t2 = window.parent->t2;
+
+    if (!window.cached) {
 
-        double prior[3]={ k1, k2, performanceScore[windows[i].testoffset] };
+        double prior[3]={ window.parent->k1, window.parent->k2, window.parent->performanceScore[window.testoffset] };
 
         lm_control_struct control = lm_control_double;
         control.patience = 1000; // more than this and there really is a problem
         lm_status_struct status;
 
-        printd("fitting window %d start=%s [k1=%g k2=%g p0=%g]\n", i, windows[i].startDate.toString().toStdString().c_str(), prior[0], prior[1], prior[2]);
+        printd("fitting window start=%s [k1=%g k2=%g p0=%g]\n", window.startDate.toString().toStdString().c_str(), prior[0], prior[1], prior[2]);
 
-        // use forwarder via global variable, so mutex around this !
-        calllmfit.lock();
-        calllmfitm=&windows[i];
+        // the window is passed to the curve, so fits can run concurrently
+        lmcurve_r(3, prior, window.tests, window.parent->performanceDay.constData()+window.testoffset,
+                  window.parent->performanceScore.constData()+window.testoffset,
+                  lmcurve_f<banisterFit>, &window, &control, &status);
 
-        //fprintf(stderr, "Fitting ...\n" ); fflush(stderr);
-        lmcurve(3, prior, windows[i].tests, performanceDay.constData()+windows[i].testoffset, performanceScore.constData()+windows[i].testoffset,
-                calllmfitb, &control, &status);
+        // keep what we fitted
+        window.k1 = prior[0];
+        window.k2 = prior[1];
+        window.p0 = prior[2];
+    }
 
-        // release for others
-        calllmfit.unlock();
+    // and the curve for it
+    window.compute(window.startIndex, window.stopIndex);
+}
 
-        if (status.outcome >= 0) {
-            int n=0;
-            double x=RMSE(windows[i].startDate, windows[i].stopDate, n);
-            printd("RMSE %g for %d points: window %d %s [k1=%g k2=%g p0=%g]\n", x, n, i, lm_infmsg[status.outcome], prior[0], prior[1], prior[2]);
+void Banister::fit()
+{
+    // windows we've fitted before don't need fitting again
+    // the rest are fitted concurrently, each in its own copy
+    for(int i=0; i<windows.length(); i++) {
+        windows[i].key = windows[i].signature();
+        QHash<QByteArray, QVector<double> >::const_iterator found = fits.constFind(windows[i].key);
+        windows[i].cached = (found != fits.constEnd());
+        if (windows[i].cached) {
+            windows[i].k1 = found.value()[0];
+            windows[i].k2 = found.value()[1];
+            windows[i].p0 = found.value()[2];
         }
     }
+    QtConcurrent::blockingMap(windows, fitWindow);
+
+    // remember the new fits
+    if (fits.count() > MAXFITS) fits.clear();
+    for(int i=0; i<windows.length(); i++)
+        if (!windows[i].cached) fits.insert(windows[i].key, QVector<double>() << windows[i].k1 << windows[i].k2 << windows[i].p0);
+
+    // copy the results back in order, windows overlap
+    // and later windows replace earlier ones
+    for(int i=0; i<windows.length(); i++) {
+        for(long index=windows[i].startIndex; index < windows[i].stopIndex; index++)
+            data[index] = windows[i].series[index-windows[i].startIndex];
+        windows[i].series.clear();
+
+        int n=0;
+        double x=RMSE(windows[i].startDate, windows[i].stopDate, n);
+        printd("RMSE %g for %d points: window %d%s [k1=%g k2=%g p0=%g]\n", x, n, i, windows[i].cached ? " (cached)" : "", windows[i].k1, windows[i].k2, windows[i].p0);
+    }
 
 #if 0 // doesn't really make sense for now
     // fill curves
@@ -22,6 +22,8 @@
 #include <QObject>
 #include <QDate>
 #include <QVector>
+#include <QHash>
+#include <QByteArray>
 
 #ifndef GC_Banister_h
 #define GC_Banister_h 1
@@ -52,12 +54,15 @@ public:
 class Banister;
 class banisterFit {
 public:
-    banisterFit(Banister *parent) : p0(0),k1(0),k2(0),t1(0),t2(0),tests(0),testoffset(-1),parent(parent) {}
+    banisterFit(Banister *parent) : p0(0),k1(0),k2(0),t1(0),t2(0),tests(0),testoffset(-1),cached(false),parent(parent) {}
 
     double f(double t, const double *p);
     void combine(banisterFit other);
     void compute(long startIndex, long stopIndex);
 
+    // the window's loads, tests and the decay constants
+    QByteArray signature() const;
+
     long startIndex, stopIndex;
     QDate startDate, stopDate;
 
@@ -67,6 +72,12 @@ public:
     int tests;
     int testoffset;
 
+    // we fit into our own copy of the window so windows can be
+    // fitted concurrently, it is copied back when they're done
+    QVector<banisterData> series;
+    QByteArray key;
+    bool cached;
+
     Banister *parent;
 };
 
@@ -122,5 +133,10 @@ private:
     Context *context;
     bool isstale;
 
+    // fitted k1, k2, p0 by window signature, so we only refit
+    // windows whose loads or tests changed, or new decay constants
+    QHash<QByteArray, QVector<double> > fits;
+    static void fitWindow(banisterFit &window);
+
 };
 #endif
@@ -627,6 +627,7 @@ class AthleteWeight : public RideMetric {
     }
 
     MetricClass classification() const { return Undefined; }
+    int dependsOn() const { return RideMetric::Weight; }
     MetricValidity validity() const { return Unknown; }
     RideMetric *clone() const { return new AthleteWeight(*this); }
 };
@@ -669,6 +670,7 @@ class AthleteFat : public RideMetric {
     }
 
     MetricClass classification() const { return Undefined; }
+    int dependsOn() const { return RideMetric::Weight; }
     MetricValidity validity() const { return Unknown; }
     RideMetric *clone() const { return new AthleteFat(*this); }
 };
@@ -706,6 +708,7 @@ class AthleteBones : public RideMetric {
     }
 
     MetricClass classification() const { return Undefined; }
+    int dependsOn() const { return RideMetric::Weight; }
     MetricValidity validity() const { return Unknown; }
     RideMetric *clone() const { return new AthleteBones(*this); }
 };
@@ -743,6 +746,7 @@ class AthleteMuscles : public RideMetric {
     }
 
     MetricClass classification() const { return Undefined; }
+    int dependsOn() const { return RideMetric::Weight; }
     MetricValidity validity() const { return Unknown; }
     RideMetric *clone() const { return new AthleteMuscles(*this); }
 };
@@ -780,6 +784,7 @@ class AthleteLean : public RideMetric {
     }
 
     MetricClass classification() const { return Undefined; }
+    int dependsOn() const { return RideMetric::Weight; }
     MetricValidity validity() const { return Unknown; }
     RideMetric *clone() const { return new AthleteLean(*this); }
 };
@@ -821,6 +826,7 @@ class AthleteFatP : public RideMetric {
     }
 
     MetricClass classification() const { return Undefined; }
+    int dependsOn() const { return RideMetric::Weight; }
     MetricValidity validity() const { return Unknown; }
     RideMetric *clone() const { return new AthleteFatP(*this); }
 };
@@ -1695,6 +1701,7 @@ class APPercent : public RideMetric {
 
     bool isRelevantForRide(const RideItem *ride) const { return ride->present.contains("P") || (!ride->isSwim && !ride->isRun); }
     MetricClass classification() const { return Undefined; }
+    int dependsOn() const { return RideMetric::CP; }
     MetricValidity validity() const { return Unknown; }
     RideMetric *clone() const { return new APPercent(*this); }
 };
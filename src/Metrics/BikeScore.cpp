@@ -188,6 +188,7 @@ class RelativeIntensity : public RideMetric {
 
     bool isRelevantForRide(const RideItem*ride) const { return ride->present.contains("P") || (!ride->isRun && !ride->isSwim); }
     MetricClass classification() const { return Undefined; }
+    int dependsOn() const { return RideMetric::CP; }
     MetricValidity validity() const { return Unknown; }
     RideMetric *clone() const { return new RelativeIntensity(*this); }
 };
@@ -227,6 +228,7 @@ class CriticalPower : public RideMetric {
 
     bool isRelevantForRide(const RideItem*ride) const { return ride->present.contains("P") || (!ride->isRun && !ride->isSwim); }
     MetricClass classification() const { return Undefined; }
+    int dependsOn() const { return RideMetric::CP; }
     MetricValidity validity() const { return Unknown; }
     RideMetric *clone() const { return new CriticalPower(*this); }
 };
@@ -284,6 +286,7 @@ class aTISS : public RideMetric {
 
     bool isRelevantForRide(const RideItem*ride) const { return ride->present.contains("P") || (!ride->isRun && !ride->isSwim); }
     MetricClass classification() const { return Undefined; }
+    int dependsOn() const { return RideMetric::CP; }
     MetricValidity validity() const { return Unknown; }
     RideMetric *clone() const { return new aTISS(*this); }
 };
@@ -342,6 +345,7 @@ class anTISS : public RideMetric {
     bool isRelevantForRide(const RideItem*ride) const { return ride->present.contains("P") || (!ride->isRun && !ride->isSwim); }
 
     MetricClass classification() const { return Undefined; }
+    int dependsOn() const { return RideMetric::CP; }
     MetricValidity validity() const { return Unknown; }
     RideMetric *clone() const { return new anTISS(*this); }
 };
@@ -381,6 +385,7 @@ class dTISS : public RideMetric {
 
     bool isRelevantForRide(const RideItem*ride) const { return ride->present.contains("P") || (!ride->isRun && !ride->isSwim); }
     MetricClass classification() const { return Undefined; }
+    int dependsOn() const { return RideMetric::CP; }
     MetricValidity validity() const { return Unknown; }
     RideMetric *clone() const { return new dTISS(*this); }
 };
@@ -430,6 +435,7 @@ class BikeScore : public RideMetric {
 
     bool isRelevantForRide(const RideItem*ride) const { return (!ride->isRun && !ride->isSwim); }
     MetricClass classification() const { return Undefined; }
+    int dependsOn() const { return RideMetric::CP; }
     MetricValidity validity() const { return Unknown; }
     RideMetric *clone() const { return new BikeScore(*this); }
 };
@@ -19,6 +19,32 @@
 
 #include "CPSolver.h"
 #include <ctime>
+#include <algorithm>
+
+#include <QThread>
+#include <QtConcurrent>
+#include <QFutureWatcher>
+#include <QEventLoop>
+
+// a chain in the parallel tempering, each one is annealed in
+// its own thread for a round of ROUND steps, then neighbouring
+// chains may swap states before the next round
+static const int ROUND = 250;
+static const double LADDER = 4.0; // each chain this much hotter than the last
+
+struct CPSolverChain {
+    const CPSolver *solver;
+    double heat;            // temperature multiplier for this chain
+    std::mt19937 random;    // each chain has its own, rand() isn't thread safe
+
+    int k, kmax;            // where we are in the schedule
+    WBParms s, sbest;       // current and best state
+    double E, Ebest;
+
+    bool record;            // remember candidates, for the display
+    QVector<WBParms> candidates;
+    QVector<double> costs;
+};
 
 CPSolver::CPSolver(Context *context)
    : context(context)
@@ -52,6 +78,22 @@ CPSolver::setData(CPSolverConstraints constraints, QList<RideItem*> rides)
             data << power1s(item->ride(), rp->secs);
         }
     }
+
+    // lay it out for cost(), longest first so the datasets
+    // still going at any second are the first few columns
+    QList<QVector<int> > sorted = data;
+    std::stable_sort(sorted.begin(), sorted.end(), [](const QVector<int> &a, const QVector<int> &b) { return a.count() > b.count(); });
+
+    int n = sorted.count();
+    int length = n ? sorted[0].count() : 0;
+    samples.fill(0, n * length);
+    active.fill(0, length);
+    for(int j=0; j<n; j++) {
+        for(int t=0; t<sorted[j].count(); t++) {
+            samples[t*n + j] = sorted[j][t];
+            active[t] = j+1;
+        }
+    }
 }
 
 // get a 1s array to the point secs
@@ -71,37 +113,69 @@ CPSolver::power1s(RideFile *f, double secs)
 
 // compute the cost, using the settings passed
 double
-CPSolver::cost(WBParms parms)
+CPSolver::cost(WBParms parms) const
 {
     // returning sum(W'bal ^ 2)
+    int n = data.count();
+    if (n == 0) return 0;
+
+    // all the exhaustion points are computed together, a second at a time
+    // across the columns, so the inner loops are simple and vectorise.
+    // the integral model is decayed recursively, see WPrimeDecay
+    QVector<double> wpbal(n, parms.W);
+    QVector<double> I(n, 0.0);
+    QVector<double> excess(n, 0.0);
+    double *wb = wpbal.data();
+    double *in = I.data();
+    double *ex = excess.data();
+
+    const double decay = WPrimeDecay::decay(parms.TAU);
+    const double CP = parms.CP;
+    const double W = parms.W;
+    const double R = double(parms.TAU) / 100.0f;
+
+    for(int t=0; t<active.count(); t++) {
+
+        const double *watts = samples.constData() + (t*n);
+        const int m = active[t];
+
+        if (integral) {
+
+            // INTEGRAL
+            for(int j=0; j<m; j++) ex[j] = watts[j] > CP ? watts[j]-CP : 0;
+            WPrimeDecay::step(in, ex, m, decay);
+
+        } else {
+
+            // DIFFERENTIAL
+            for(int j=0; j<m; j++) wb[j] += watts[j] < CP ? (R * (W - wb[j])/W * (CP - watts[j])) : (CP - watts[j]);
+        }
+    }
 
-    // loop through each ride for now, but avoid foreach()
-    // since it will make a copy of the contents which has
-    // a significant performance impact
     double sumwb2=0;
-    for(int i=0; i<data.count();i++)  sumwb2 += pow(compute(data[i], parms),2);
+    for(int j=0; j<n; j++) {
 
-    //qDebug()<<"cost="<<QString("%1").arg(sumwb2, 0, 'g', 7);
+        // solve for W'bal=500, see compute() below
+        double error = (integral ? W - in[j] : wb[j]) - 500;
+        sumwb2 += error * error;
+    }
 
     // what we got - normalise to number of fits
-    return (sumwb2/data.count()) /1000.0f;
+    return (sumwb2/n) /1000.0f;
 }
 
 double
-CPSolver::compute(QVector<int> &ride, WBParms parms)
+CPSolver::compute(QVector<int> &ride, WBParms parms) const
 {
     // compute w'bal for the ride using the paramters
-    // XXX for now we use the integral model
-    double I=0.00f;
-    int t=0;
+    WPrimeDecay I(parms.TAU);
     double wpbal=parms.W;
     foreach(int watts, ride) {
 
         if (integral) {
 
             // INTEGRAL
-            I += exp(((double)(t) / parms.TAU)) * (watts > parms.CP ? watts-parms.CP : 0);
-            wpbal = parms.W - (exp(-((double)(t) / parms.TAU)) * I);
+            wpbal = parms.W - I.add(watts > parms.CP ? watts-parms.CP : 0);
 
         } else {
 
@@ -109,8 +183,6 @@ CPSolver::compute(QVector<int> &ride, WBParms parms)
             // DIFFERENTIAL
             wpbal  += watts < parms.CP ? ((double(parms.TAU)/100.0f) * (parms.W - wpbal)/parms.W * (parms.CP - watts) ) : (parms.CP-watts);
         }
-
-        t++;
     }
 
     // we solve for W'bal=500 as it is not possible to completely
@@ -122,7 +194,7 @@ CPSolver::compute(QVector<int> &ride, WBParms parms)
 
 // get us a neighbour
 WBParms
-CPSolver::neighbour(WBParms p, int k, int kmax)
+CPSolver::neighbour(WBParms p, int k, int kmax, std::mt19937 &random) const
 {
     WBParms returning;
 
@@ -142,13 +214,10 @@ CPSolver::neighbour(WBParms p, int k, int kmax)
     int TAUrange = 3 + ((constraints.tto - constraints.tf) * factor);
     int it=0;
 
-    // scale rand() to our range (32767 is typical for RAND_MAX)
-    double f = double(Wrange) / double(RAND_MAX);
-
     do {
-        returning.CP = p.CP + (rand()%CPrange - (CPrange/2));
-        returning.W = p.W + (int(double(rand())*f)%Wrange - (Wrange/2));
-        returning.TAU = p.TAU + (rand()%TAUrange - (TAUrange/2));
+        returning.CP = p.CP + (int(random()%CPrange) - (CPrange/2));
+        returning.W = p.W + (int(random()%Wrange) - (Wrange/2));
+        returning.TAU = p.TAU + (int(random()%TAUrange) - (TAUrange/2));
 
     } while (it++ < 3 && (returning.CP < constraints.cpf || returning.CP > constraints.cpto ||
                           returning.W > constraints.cpto || returning.W < constraints.cpf ||
@@ -170,6 +239,44 @@ CPSolver::reset()
 {
     rides.clear();
     data.clear();
+    samples.clear();
+    active.clear();
+}
+
+void
+CPSolver::anneal(CPSolverChain &chain)
+{
+    const CPSolver *solver = chain.solver;
+
+    for(int i=0; i<ROUND && chain.k < chain.kmax; i++, chain.k++) {
+
+        // stop pressed whilst we were running
+        if (solver->halt.load()) break;
+
+        WBParms snew = solver->neighbour(chain.s, chain.k, chain.kmax, chain.random);
+        double Enew = solver->cost(snew);
+
+        if (chain.record) {
+            chain.candidates << snew;
+            chain.costs << Enew;
+        }
+
+        // probability - always 1 if better, but randomly accept higher
+        double random = double(chain.random()%101)/100.00f;
+        double temp = chain.heat * solver->temperature(double(chain.k)/double(chain.kmax));
+        double prob = solver->probability(chain.E,Enew,temp);
+
+        if (prob > random) {
+            chain.s = snew;
+            chain.E = Enew;
+        }
+
+        // is it better than our very best?
+        if (chain.E < chain.Ebest) {
+            chain.Ebest = chain.E;
+            chain.sbest = chain.s;
+        }
+    }
 }
 
 void
@@ -179,7 +286,7 @@ CPSolver::start()
     if (data.count() == 0 || rides.count() == 0) return;
 
     // to flag when to stop
-    halt = false;
+    halt.store(0);
 
     // set starting conditions at maximals
     s0.CP =   constraints.cpto;
@@ -190,63 +297,89 @@ CPSolver::start()
     p.start();
 
     // initial conditions
-    srand((unsigned int) time (NULL)); // seed ONCE!
     double E = cost(s0);
     double Ebest = E;
-    WBParms s = s0;
-    WBParms sbest = s;
+    sbest = s0;
 
-    // 10,000 iterations at most
-    int k=0;
+    // 100,000 iterations per chain at most
     int kmax = 100000;
 
-    // give up when we're on it or run out of loops
-    while (halt == false && k < kmax) {
-
-        WBParms snew = neighbour(s, k, kmax);
-        double Enew = cost(snew);
-
-        // progress update k=0 means stop so we offset by one
-        emit current(k+1, snew,Enew);
-
-        // probability - always 1 if better, but randomly accept higher
-        double random = double(rand()%101)/100.00f;
-        double temp = temperature(double(k)/double(kmax));
-        double prob = probability(E,Enew,temp);
+    // a chain per core, but at least two to temper
+    std::mt19937 random((unsigned int) time (NULL)); // seed ONCE!
+    QVector<CPSolverChain> chains(qMax(2, QThread::idealThreadCount()));
+    for(int i=0; i<chains.count(); i++) {
+        CPSolverChain &chain = chains[i];
+        chain.solver = this;
+        chain.heat = pow(LADDER, i);
+        chain.random.seed(random());
+        chain.k = 0;
+        chain.kmax = kmax;
+        chain.s = chain.sbest = s0;
+        chain.E = chain.Ebest = E;
+        chain.record = (i == 0); // the cold one
+    }
 
-        if (prob > random) {
-            s = snew;
-            E = Enew;
-        }
+    // give up when we're on it or run out of loops
+    int done = 0;
+    while (!halt.load() && chains[0].k < kmax) {
+
+        // a round for each chain, we're in the GUI thread so we
+        // keep processing events whilst the chains are running
+        QEventLoop loop;
+        QFutureWatcher<void> watcher;
+        connect(&watcher, SIGNAL(finished()), &loop, SLOT(quit()));
+        watcher.setFuture(QtConcurrent::map(chains, anneal));
+        loop.exec();
+
+        // progress update k=0 means stop so we offset by one, we
+        // report what the cold chain looked at, counting them all
+        CPSolverChain &cold = chains[0];
+        for(int i=0; i<cold.candidates.count(); i++)
+            emit current(done + ((i+1) * chains.count()), cold.candidates[i], cold.costs[i]);
+        done += cold.candidates.count() * chains.count();
+        cold.candidates.clear();
+        cold.costs.clear();
 
         // is it better than our very best?
-        if (E < Ebest) {
-            Ebest = E;
-            sbest = s;
+        for(int i=0; i<chains.count(); i++) {
+            if (chains[i].Ebest < Ebest) {
+                Ebest = chains[i].Ebest;
+                sbest = chains[i].sbest;
 
-            // k of zero means stop so we offset by one
-            emit newBest(k+1, sbest, Ebest);
-            //qDebug()<<k<<"new best"<<Ebest <<s.CP<<s.W<<s.TAU;
+                // k of zero means stop so we offset by one
+                emit newBest(done, sbest, Ebest);
+            }
         }
 
-        // don't run forever
-        k++;
+        // neighbours may swap, alternating between even and odd pairs
+        // the usual replica exchange acceptance is used
+        double alpha = double(cold.k)/double(kmax);
+        for(int i=(done/chains.count()/ROUND)%2; i+1<chains.count(); i+=2) {
 
+            double Ti = chains[i].heat * temperature(alpha);
+            double Tj = chains[i+1].heat * temperature(alpha);
+            double prob = exp((chains[i].E - chains[i+1].E) * ((1.0/Ti) - (1.0/Tj)));
+
+            if (prob > double(random()%101)/100.00f) {
+                std::swap(chains[i].s, chains[i+1].s);
+                std::swap(chains[i].E, chains[i+1].E);
+            }
+        }
     }
 
     // k of zero means stop
     emit newBest(0, sbest,Ebest);
-    //qDebug()<<"TOOK"<<p.elapsed();
+    //qDebug()<<"TOOK"<<p.elapsed()<<"candidates/s"<<(done*1000.0/qMax(1,p.elapsed()));
 }
 
 double
-CPSolver::temperature(double alpha)
+CPSolver::temperature(double alpha) const
 {
     return (1.0-(0.02*alpha));
 }
 
 double
-CPSolver::probability(double sold, double snew, double temperature)
+CPSolver::probability(double sold, double snew, double temperature) const
 {
     if(snew < sold ) return 1.0;
     return(exp((sold - snew)/temperature));
@@ -260,7 +393,7 @@ CPSolver::pause()
 void
 CPSolver::stop()
 {
-    halt = true;
+    halt.store(1);
 }
 
 // Metric of best 'R' for first exhaustion point in a ride
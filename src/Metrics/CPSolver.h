@@ -29,8 +29,12 @@
 #include <QList>
 #include <QVector>
 #include <QObject>
+#include <QAtomicInt>
+
+#include <random>
 
 class Context;
+struct CPSolverChain;
 
 // W'bal parameters passed around as a set
 class WBParms {
@@ -72,20 +76,30 @@ class CPSolver : public QObject {
 
         // as simulated annealing algorithm to solve W', CP and tau
         // from a collection of exhaustion points within a ride
+        //
+        // we run a number of chains in parallel (parallel tempering), the
+        // first at the usual temperature and the others progressively hotter
+        // so they roam the search space more freely. every few hundred steps
+        // neighbouring chains may swap their states, so a good solution found
+        // by a hot chain can be refined by the cold one.
+        //
+        // k in the signals is the number of candidates evaluated so far
+        // across all the chains, so progress over time is the throughput
         CPSolver(Context *);
 
         // set the data to solve
         void setData(CPSolverConstraints constraints, QList<RideItem*>);
 
         // compute the cost, using the settings passed
-        double cost(WBParms parms);
+        // it is thread safe, the chains call it concurrently
+        double cost(WBParms parms) const;
 
         // compute ending W'bal for the exhaustion series
-        double compute(QVector<int> &ride, WBParms parms);
+        double compute(QVector<int> &ride, WBParms parms) const;
 
-        WBParms neighbour(WBParms, int k, int kmax);
-        double probability(double,double,double);
-        double temperature(double);
+        WBParms neighbour(WBParms, int k, int kmax, std::mt19937 &random) const;
+        double probability(double,double,double) const;
+        double temperature(double) const;
 
         // get a 1s power array from the data
         QVector<int> power1s(RideFile *f, double secs);
@@ -114,11 +128,20 @@ class CPSolver : public QObject {
         QList<QVector<int> > data;
         QList<RideItem*> rides;
 
+        // the same data laid out for cost(), one row per second with a
+        // column for each exhaustion point, longest first, and how many
+        // of them are still going at each second
+        QVector<double> samples;
+        QVector<int> active;
+
+        // run a chain for a round
+        static void anneal(CPSolverChain &chain);
+
         // annealling parms
         WBParms s0, sbest;
 
-        // to signal we need to stop
-        bool halt;
+        // to signal we need to stop, the chains check it as they run
+        QAtomicInt halt;
 };
 
 #endif
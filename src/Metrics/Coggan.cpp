@@ -203,6 +203,7 @@ class IntensityFactor : public RideMetric {
 
     bool isRelevantForRide(const RideItem*ride) const { return ride->present.contains("P") || (!ride->isRun && !ride->isSwim); }
     MetricClass classification() const { return Undefined; }
+    int dependsOn() const { return RideMetric::CP; }
     MetricValidity validity() const { return Unknown; }
     RideMetric *clone() const { return new IntensityFactor(*this); }
 };
@@ -263,6 +264,7 @@ class BikeStress : public RideMetric {
 
     bool isRelevantForRide(const RideItem*ride) const { return (!ride->isRun && !ride->isSwim); }
     MetricClass classification() const { return Undefined; }
+    int dependsOn() const { return RideMetric::CP; }
     MetricValidity validity() const { return Unknown; }
     RideMetric *clone() const { return new BikeStress(*this); }
 };
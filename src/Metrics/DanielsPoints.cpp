@@ -157,6 +157,7 @@ public:
     }
     bool isRelevantForRide(const RideItem *ride) const { return (ride->present.contains("P") || ride->isRun || ride->isSwim); }
     MetricClass classification() const { return Undefined; }
+    int dependsOn() const { return RideMetric::CP | RideMetric::PaceZones; }
     MetricValidity validity() const { return Unknown; }
     RideMetric *clone() const { return new DanielsPoints(*this); }
 
@@ -307,6 +308,7 @@ class DanielsEquivalentPower : public RideMetric {
     }
     bool isRelevantForRide(const RideItem *ride) const { return (ride->present.contains("P")); }
     MetricClass classification() const { return Undefined; }
+    int dependsOn() const { return RideMetric::CP; }
     MetricValidity validity() const { return Unknown; }
     RideMetric *clone() const { return new DanielsEquivalentPower(*this); }
 };
@@ -26,6 +26,11 @@
 
 #include "Banister.h"
 
+#include <QCryptographicHash>
+#include <QDataStream>
+#include <QSaveFile>
+#include <QtConcurrent>
+
 #ifndef ESTIMATOR_DEBUG
 #define ESTIMATOR_DEBUG false
 #endif
@@ -99,11 +104,34 @@ class RollingBests {
         }
 };
 
+// reading the bests for a week
+struct EstimatorBests {
+    Estimator *estimator;
+    bool isRun;
+    int index;
+    QDate begin, end;
+    QVector<float> week, wpk;
+    QVector<QDate> dates;
+};
+
+// fitting the models for a week
+struct EstimatorFit {
+    Estimator *estimator;
+    bool isRun;
+    QDate begin, end;
+    EstimatorBests week; // this week's
+    QVector<QVector<float> > bests, bestsWPK; // the weeks in the window
+    EstimatorWeek fitted;
+};
+
 Estimator::Estimator(Context *context) : context(context)
 {
     // used to flag when we need to stop
     abort = false;
 
+    // per week results are loaded when we first run
+    loaded = dirty = false;
+
     // lazy start signal
     connect(&singleshot, SIGNAL(timeout()), this, SLOT(calculate()));
 
@@ -164,18 +192,15 @@ Estimator::calculate()
 void
 Estimator::run()
 {
+  // what we had last time, or last session
+  if (!loaded) load();
+
   for (int i = 0; i < 2; i++) {
 
     bool isRun = (i > 0); // two times: one for rides and other for runs
 
     printd("%s Estimates start.\n", isRun ? "Run" : "Bike");
 
-    // this needs to be done once all the other metrics
-    // Calculate a *monthly* estimate of CP, W' etc using
-    // bests data from the previous 6 weeks
-    RollingBests bests(6);
-    RollingBests bestsWPK(6);
-
     // clear any previous calculations
     QList<PDEstimate> est;
     QList<Performance> perfs;
@@ -208,16 +233,207 @@ Estimator::run()
     // if we don't have 2 rides or more then skip this
     if (from == to || to == QDate()) {
         printd("%s Estimator ends, less than 2 rides with power data.\n", isRun ? "Run" : "Bike");
+        if (!weeks[i].isEmpty()) dirty = true;
+        weeks[i].clear();
         continue;
     }
 
-    // set up the models we support
-    CP2Model p2model(context);
-    CP3Model p3model(context);
-    ExtendedModel extmodel(context);
+    // from has first ride with Power data / looking at the next 7 days of data with Power
+    // calculate Estimates for all data per week including the week of the last Power recording
+    int count = (from.daysTo(to) + 6) / 7;
+
+    // the bests for a week come from the .cpx files for its rides, so
+    // the rides and their content are the signature of the week..
+    QVector<QByteArray> signatures(count);
+    foreach(RideItem *item, rides) {
+        if (item->isRun != isRun || item->dateTime.date() < from) continue;
+
+        int week = from.daysTo(item->dateTime.date()) / 7;
+        if (week >= count) continue;
+
+        signatures[week] += QString("%1:%2:%3:%4:%5:%6;").arg(item->fileName).arg(item->crc).arg(item->metacrc)
+                                                         .arg(item->timestamp).arg(item->fingerprint).arg(item->weight).toUtf8();
+    }
+
+    // ..and the estimates for a week are fitted to the bests for the
+    // 6 weeks up to and including it, so they only need fitting again
+    // when the signature of any of those weeks changes
+    QVector<QByteArray> windows(count);
+    for (int week=0; week < count; week++) {
+        QCryptographicHash hash(QCryptographicHash::Sha1);
+        for (int j=qMax(0, week-5); j <= week; j++) {
+            hash.addData(QByteArray::number(week-j) + "|");
+            hash.addData(signatures[j]);
+        }
+        windows[week] = hash.result();
+    }
+
+    // the weeks that need fitting again
+    QVector<int> stale;
+    for (int index=0; index < count; index++) {
+        QMap<QDate, EstimatorWeek>::const_iterator found = weeks[i].constFind(from.addDays(7 * index));
+        if (found == weeks[i].constEnd() || found.value().window != windows[index]) stale << index;
+    }
+
+    // each week is independent, so they're read and fitted across threads,
+    // a block of weeks at a time to keep the bests we hold in check
+    int block = QThread::idealThreadCount() * 4;
+    QMap<int, EstimatorBests> read; // bests for the weeks in the windows
+    for (int b=0; b < stale.count(); b += block) {
+
+        QVector<int> fitting = stale.mid(b, block);
+
+        // read the bests for the weeks in their windows we don't already have
+        QVector<EstimatorBests> reading;
+        for (int k=0; k < fitting.count(); k++) {
+            for (int j=qMax(0, fitting[k]-5); j <= fitting[k]; j++) {
+                if (read.contains(j)) continue;
+
+                EstimatorBests bests;
+                bests.estimator = this;
+                bests.isRun = isRun;
+                bests.index = j;
+                bests.begin = from.addDays(7 * j);
+                bests.end = bests.begin.addDays(6);
+                read.insert(j, bests);
+                reading << bests;
+            }
+        }
+        QtConcurrent::blockingMap(reading, readBests);
+        if (aborted()) return;
+        foreach(const EstimatorBests &bests, reading) read.insert(bests.index, bests);
+
+        // fit the models
+        QVector<EstimatorFit> fits;
+        for (int k=0; k < fitting.count(); k++) {
+            EstimatorFit fit;
+            fit.estimator = this;
+            fit.isRun = isRun;
+            fit.begin = from.addDays(7 * fitting[k]);
+            fit.end = fit.begin.addDays(6);
+            fit.week = read.value(fitting[k]);
+            for (int j=qMax(0, fitting[k]-5); j <= fitting[k]; j++) {
+                fit.bests << read.value(j).week;
+                fit.bestsWPK << read.value(j).wpk;
+            }
+            fit.fitted.window = windows[fitting[k]];
+            fits << fit;
+        }
+        QtConcurrent::blockingMap(fits, fitWeek);
+        if (aborted()) return;
+
+        // keep for next time
+        foreach(const EstimatorFit &fit, fits) weeks[i].insert(fit.begin, fit.fitted);
+        dirty = true;
+
+        // later blocks only need the windows of the weeks they fit
+        if (b + block < stale.count()) {
+            int first = stale[b + block] - 5;
+            while (!read.isEmpty() && read.firstKey() < first) read.erase(read.begin());
+        }
+    }
+
+    // in week order, as if done serially
+    for (int index=0; index < count; index++) {
+        const EstimatorWeek &week = weeks[i][from.addDays(7 * index)];
+        est << week.estimates;
+        if (week.performance.duration > 0) perfs << week.performance;
+    }
+
+    // forget weeks that are no longer in the history
+    QMap<QDate, EstimatorWeek>::iterator it = weeks[i].begin();
+    while (it != weeks[i].end()) {
+        int days = from.daysTo(it.key());
+        if (days < 0 || days % 7 || days / 7 >= count) {
+            it = weeks[i].erase(it);
+            dirty = true;
+        } else ++it;
+    }
+
+    // filter performances
+    perfs = filter(perfs);
+
+    // now update them
+    lock.lock();
+    if (i == 0) {
+        estimates = est;
+        performances = perfs;
+    } else {
+        estimates.append(est);
+        performances.append(perfs);
+    }
+    lock.unlock();
+
+    // debug dump peak performances
+    foreach(Performance p, performances) {
+        printd("%s %f Peak: %f for %f secs on %s\n", p.run ? "Run" : "Bike", p.powerIndex, p.power, p.duration, p.when.toString().toStdString().c_str());
+    }
+    printd("%s Estimates end.\n", isRun ? "Run" : "Bike");
+  }
+
+  // for next session
+  save();
+}
+
+// read the bests for a week
+void
+Estimator::readBests(EstimatorBests &task)
+{
+    task.estimator->bestsFor(task.begin, task.end, task.isRun, task.week, task.wpk, task.dates);
+}
+
+// fit the models to the bests for a week's window
+void
+Estimator::fitWeek(EstimatorFit &task)
+{
+    Estimator *estimator = task.estimator;
+    bool isRun = task.isRun;
+    QDate begin = task.begin;
+    QDate end = task.end;
+
+    printd("Model progress %d/%d\n", begin.year(), begin.month());
+
+    // this needs to be done once all the other metrics
+    // Calculate a *monthly* estimate of CP, W' etc using
+    // bests data from the previous 6 weeks
+    RollingBests bests(6);
+    RollingBests bestsWPK(6);
+    for (int j=0; j < task.bests.count(); j++) {
+        bests.addBests(task.bests[j]);
+        bestsWPK.addBests(task.bestsWPK[j]);
+    }
+
+    // lets extract the best performance of the week first.
+    // only care about performances between 3-20 minutes.
+    const QVector<float> &week = task.week.week;
+    const QVector<QDate> &weekdates = task.week.dates;
+    Performance bestperformance(end,0,0,0);
+    for (int t=240; t<week.length() && t<3600; t++) {
+
+        double p = double(week[t]);
+        if (week[t]<=0) continue;
+
+        double pix = powerIndex(p, t, isRun);
+        if (pix > bestperformance.powerIndex) {
+            bestperformance.duration = t;
+            bestperformance.power = p;
+            bestperformance.powerIndex = pix;
+            bestperformance.when = weekdates[t];
+            bestperformance.run = isRun;
+
+            // for filter, saves having to convert as we go
+            bestperformance.x = bestperformance.when.toJulianDay();
+        }
+    }
+    task.fitted.performance = bestperformance;
+
+    // set up the models we support, each fit has its own
+    CP2Model p2model(estimator->context);
+    CP3Model p3model(estimator->context);
+    ExtendedModel extmodel(estimator->context);
 #if 0 // disable until model fitting errors are fixed (!!!)
-    WSModel wsmodel(context);
-    MultiModel multimodel(context);
+    WSModel wsmodel(estimator->context);
+    MultiModel multimodel(estimator->context);
 #endif
 
     QList <PDModel *> models;
@@ -229,134 +445,204 @@ Estimator::run()
     models << &wsmodel;
 #endif
 
-    // from has first ride with Power data / looking at the next 7 days of data with Power
-    // calculate Estimates for all data per week including the week of the last Power recording
-    QDate date = from;
-    while (date < to) {
+    // we now have the data
+    foreach(PDModel *model, models) {
 
         // check if we've been asked to stop
-        if (abort == true) {
-            printd("Model estimator aborted.\n");
-            abort = false;
-            return;
+        if (estimator->abort == true) return;
+
+        PDEstimate add;
+
+        // set the data
+        model->setData(bests.aggregate());
+        model->saveParameters(add.parameters); // save the computed parms
+
+        add.run = isRun;
+        add.wpk = false;
+        add.from = begin;
+        add.to = end;
+        add.model = model->code();
+        add.WPrime = model->hasWPrime() ? model->WPrime() : 0;
+        add.CP = model->hasCP() ? model->CP() : 0;
+        add.PMax = model->hasPMax() ? model->PMax() : 0;
+        add.FTP = model->hasFTP() ? model->FTP() : 0;
+
+        if (add.CP && add.WPrime) add.EI = add.WPrime / add.CP ;
+
+        // so long as the important model derived values are sensible ...
+        if (add.WPrime > 1000 && add.CP > 100 && add.CP < 1000) {
+            printd("Estimates for %s - %s: CP=%.f W'=%.f\n", add.from.toString().toStdString().c_str(), add.to.toString().toStdString().c_str(), add.CP, add.WPrime);
+            task.fitted.estimates << add;
         }
 
-        QDate begin = date;
-        QDate end = date.addDays(6);
+        //qDebug()<<add.to<<add.from<<model->code()<< "W'="<< model->WPrime() <<"CP="<< model->CP() <<"pMax="<<model->PMax();
+
+        // set the wpk data
+        model->setData(bestsWPK.aggregate());
+        model->saveParameters(add.parameters); // save the computed parms
+
+        add.wpk = true;
+        add.from = begin;
+        add.to = end;
+        add.model = model->code();
+        add.WPrime = model->hasWPrime() ? model->WPrime() : 0;
+        add.CP = model->hasCP() ? model->CP() : 0;
+        add.PMax = model->hasPMax() ? model->PMax() : 0;
+        add.FTP = model->hasFTP() ? model->FTP() : 0;
+        if (add.CP && add.WPrime) add.EI = add.WPrime / add.CP ;
+
+        // so long as the model derived values are sensible ...
+        if ((!model->hasWPrime() || add.WPrime > 10.0f) &&
+            (!model->hasCP() || (add.CP > 1.0f && add.CP < 10.0)) &&
+            (!model->hasPMax() || add.PMax > 1.0f) &&
+            (!model->hasFTP() || add.FTP > 1.0f)) {
+            printd("WPK Estimates for %s - %s: CP=%.1f W'=%.1f\n", add.from.toString().toStdString().c_str(), add.to.toString().toStdString().c_str(), add.CP, add.WPrime);
+            task.fitted.estimates << add;
+        }
 
-        printd("Model progress %d/%d\n", date.year(), date.month());
+        //qDebug()<<add.from<<model->code()<< "KG W'="<< model->WPrime() <<"CP="<< model->CP() <<"pMax="<<model->PMax();
+    }
+}
 
-        // months is a rolling 3 months sets of bests
-        QVector<float> wpk; // for getting the wpk values
+bool
+Estimator::aborted()
+{
+    if (abort == true) {
+        printd("Model estimator aborted.\n");
+        abort = false;
+        return true;
+    }
+    return false;
+}
 
-        // include only rides or runs .............................................................vvvvv
-        QVector<QDate> weekdates;
-        QVector<float> week = RideFileCache::meanMaxPowerFor(context, wpk, begin, end, &weekdates, isRun);
+// as RideFileCache::meanMaxPowerFor for a date range
+void
+Estimator::bestsFor(QDate from, QDate to, bool isRun, QVector<float> &returning, QVector<float> &wpk, QVector<QDate> &dates)
+{
+    bool first = true;
 
-        // lets extract the best performance of the week first.
-        // only care about performances between 3-20 minutes.
-        Performance bestperformance(end,0,0,0);
-        for (int t=240; t<week.length() && t<3600; t++) {
+    // look at all the rides
+    foreach (RideItem *item, context->athlete->rideCache->rides()) {
 
-            double p = double(week[t]);
-            if (week[t]<=0) continue;
+        // stop as soon as we're asked to, we're going to throw it all away
+        if (abort == true) return;
 
-            double pix = powerIndex(p, t, isRun);
-            if (pix > bestperformance.powerIndex) {
-                bestperformance.duration = t;
-                bestperformance.power = p;
-                bestperformance.powerIndex = pix;
-                bestperformance.when = weekdates[t];
-                bestperformance.run = isRun;
+        if (item->dateTime.date() < from || item->dateTime.date() > to) continue; // not one we want
 
-                // for filter, saves having to convert as we go
-                bestperformance.x = bestperformance.when.toJulianDay();
-            }
-        }
-        if (bestperformance.duration > 0) perfs << bestperformance;
+        if (item->isRun != isRun) continue; // they don't want these
 
-        bests.addBests(week);
-        bestsWPK.addBests(wpk);
+        QVector<float> thiswpk;
+        QVector<float> ridebest = RideFileCache::meanMaxPowerFor(context, thiswpk, context->athlete->home->activities().canonicalPath() + "/" + item->fileName);
 
-        // we now have the data
-        foreach(PDModel *model, models) {
+        // first time through the whole thing is going to be best
+        if (first == true) {
+            returning = ridebest;
+            wpk = thiswpk;
+            dates.fill(item->dateTime.date(), returning.size());
+            first = false;
+            continue;
+        }
 
-            PDEstimate add;
+        // next time through we should only pick out better times
+        if (returning.size() < ridebest.size()) returning.resize(ridebest.size());
+        if (dates.size() < ridebest.size()) dates.resize(ridebest.size());
+        for (int i=0; i<ridebest.size(); i++) {
+            if (ridebest[i] > returning[i]) {
+                returning[i] = ridebest[i];
+                dates[i]=item->dateTime.date();
+            }
+        }
 
-            // set the data
-            model->setData(bests.aggregate());
-            model->saveParameters(add.parameters); // save the computed parms
+        if (wpk.size() < thiswpk.size()) wpk.resize(thiswpk.size());
+        for (int i=0; i<thiswpk.size(); i++)
+            if (thiswpk[i] > wpk[i]) wpk[i] = thiswpk[i];
+    }
+}
 
-            add.run = isRun;
-            add.wpk = false;
-            add.from = begin;
-            add.to = end;
-            add.model = model->code();
-            add.WPrime = model->hasWPrime() ? model->WPrime() : 0;
-            add.CP = model->hasCP() ? model->CP() : 0;
-            add.PMax = model->hasPMax() ? model->PMax() : 0;
-            add.FTP = model->hasFTP() ? model->FTP() : 0;
+//
+// Per week results are kept in the cache between sessions, if the models
+// or the way the bests are worked out change bump the version
+//
+static const quint32 ESTIMATES_MAGIC = 0x47434553; // "GCES"
+static const quint32 ESTIMATES_VERSION = 1;
 
-            if (add.CP && add.WPrime) add.EI = add.WPrime / add.CP ;
+static QDataStream &operator<<(QDataStream &out, const PDEstimate &e)
+{
+    return out << e.from << e.to << e.model << e.WPrime << e.CP << e.FTP << e.PMax << e.EI << e.wpk << e.run << e.parameters;
+}
 
-            // so long as the important model derived values are sensible ...
-            if (add.WPrime > 1000 && add.CP > 100 && add.CP < 1000) {
-                printd("Estimates for %s - %s: CP=%.f W'=%.f\n", add.from.toString().toStdString().c_str(), add.to.toString().toStdString().c_str(), add.CP, add.WPrime);
-                est << add;
-            }
+static QDataStream &operator>>(QDataStream &in, PDEstimate &e)
+{
+    return in >> e.from >> e.to >> e.model >> e.WPrime >> e.CP >> e.FTP >> e.PMax >> e.EI >> e.wpk >> e.run >> e.parameters;
+}
 
-            //qDebug()<<add.to<<add.from<<model->code()<< "W'="<< model->WPrime() <<"CP="<< model->CP() <<"pMax="<<model->PMax();
-
-            // set the wpk data
-            model->setData(bestsWPK.aggregate());
-            model->saveParameters(add.parameters); // save the computed parms
-
-            add.wpk = true;
-            add.from = begin;
-            add.to = end;
-            add.model = model->code();
-            add.WPrime = model->hasWPrime() ? model->WPrime() : 0;
-            add.CP = model->hasCP() ? model->CP() : 0;
-            add.PMax = model->hasPMax() ? model->PMax() : 0;
-            add.FTP = model->hasFTP() ? model->FTP() : 0;
-            if (add.CP && add.WPrime) add.EI = add.WPrime / add.CP ;
-
-            // so long as the model derived values are sensible ...
-            if ((!model->hasWPrime() || add.WPrime > 10.0f) &&
-                (!model->hasCP() || (add.CP > 1.0f && add.CP < 10.0)) &&
-                (!model->hasPMax() || add.PMax > 1.0f) &&
-                (!model->hasFTP() || add.FTP > 1.0f)) {
-                printd("WPK Estimates for %s - %s: CP=%.1f W'=%.1f\n", add.from.toString().toStdString().c_str(), add.to.toString().toStdString().c_str(), add.CP, add.WPrime);
-                est << add;
-            }
+static QDataStream &operator<<(QDataStream &out, const Performance &p)
+{
+    return out << p.when << p.weekcommencing << p.power << p.duration << p.powerIndex << p.run << p.x;
+}
 
-            //qDebug()<<add.from<<model->code()<< "KG W'="<< model->WPrime() <<"CP="<< model->CP() <<"pMax="<<model->PMax();
+static QDataStream &operator>>(QDataStream &in, Performance &p)
+{
+    return in >> p.when >> p.weekcommencing >> p.power >> p.duration >> p.powerIndex >> p.run >> p.x;
+}
+
+void
+Estimator::load()
+{
+    loaded = true;
+
+    QFile file(context->athlete->home->cache().canonicalPath() + "/estimates.cache");
+    if (!file.open(QFile::ReadOnly)) return;
+
+    QDataStream in(&file);
+    in.setVersion(QDataStream::Qt_5_0);
+
+    quint32 magic=0, version=0;
+    in >> magic >> version;
+    if (magic != ESTIMATES_MAGIC || version != ESTIMATES_VERSION) return;
+
+    for (int i=0; i<2 && in.status() == QDataStream::Ok; i++) {
+        quint32 count=0;
+        in >> count;
+        for (quint32 n=0; n<count && in.status() == QDataStream::Ok; n++) {
+            QDate begin;
+            EstimatorWeek week;
+            in >> begin >> week.window >> week.estimates >> week.performance;
+            weeks[i].insert(begin, week);
         }
+    }
 
-        // go forward a week
-        date = date.addDays(7);
+    // start again if its corrupt
+    if (in.status() != QDataStream::Ok) {
+        qDebug()<<"estimates cache is corrupt:"<<file.fileName();
+        weeks[0].clear();
+        weeks[1].clear();
     }
+}
 
-    // filter performances
-    perfs = filter(perfs);
+void
+Estimator::save()
+{
+    if (!dirty) return;
 
-    // now update them
-    lock.lock();
-    if (i == 0) {
-        estimates = est;
-        performances = perfs;
-    } else {
-        estimates.append(est);
-        performances.append(perfs);
-    }
-    lock.unlock();
+    QSaveFile file(context->athlete->home->cache().canonicalPath() + "/estimates.cache");
+    if (!file.open(QFile::WriteOnly)) return;
 
-    // debug dump peak performances
-    foreach(Performance p, performances) {
-        printd("%s %f Peak: %f for %f secs on %s\n", p.run ? "Run" : "Bike", p.powerIndex, p.power, p.duration, p.when.toString().toStdString().c_str());
+    QDataStream out(&file);
+    out.setVersion(QDataStream::Qt_5_0);
+    out << ESTIMATES_MAGIC << ESTIMATES_VERSION;
+
+    for (int i=0; i<2; i++) {
+        out << quint32(weeks[i].count());
+        QMapIterator<QDate, EstimatorWeek> it(weeks[i]);
+        while (it.hasNext()) {
+            it.next();
+            out << it.key() << it.value().window << it.value().estimates << it.value().performance;
+        }
     }
-    printd("%s Estimates end.\n", isRun ? "Run" : "Bike");
-  }
+
+    if (file.commit()) dirty = false;
+    else qDebug()<<"unable to save estimates cache"<<file.fileName();
 }
 
 Performance Estimator::getPerformanceForDate(QDate date, bool wantrun)
@@ -26,6 +26,8 @@
 
 #include <QThread>
 #include <QMutex>
+#include <QMap>
+#include <QByteArray>
 #include <QNetworkAccessManager>
 #include <QNetworkReply>
 #include <QScrollArea>
@@ -45,7 +47,22 @@ class Performance {
         double x; // different units, but basically when as a julian day
 };
 
+// the estimates and best performance for a week, they're kept between
+// runs (and in the cache between sessions) so only the weeks whose
+// 6 week window has changed are fitted again
+class EstimatorWeek {
+
+    public:
+        EstimatorWeek() : performance(QDate(),0,0,0) {}
+
+        QByteArray window; // signature of the rides in the window
+        QList<PDEstimate> estimates;
+        Performance performance; // best for the week, if duration > 0
+};
+
 class Banister;
+struct EstimatorBests;
+struct EstimatorFit;
 class Estimator : public QThread {
 
     Q_OBJECT
@@ -81,6 +98,20 @@ class Estimator : public QThread {
         friend class ::Athlete;
         friend class ::Banister;
 
+        // bests for the rides in a week, a ride at a time so we can stop
+        void bestsFor(QDate from, QDate to, bool isRun, QVector<float> &bests, QVector<float> &wpk, QVector<QDate> &dates);
+
+        // weeks are read and fitted concurrently
+        static void readBests(EstimatorBests &task);
+        static void fitWeek(EstimatorFit &task);
+
+        // been asked to stop ?
+        bool aborted();
+
+        // per week results, saved in the cache
+        void load();
+        void save();
+
         Context *context;
         QMutex lock;
         QList<PDEstimate> estimates;
@@ -88,6 +119,9 @@ class Estimator : public QThread {
         QVector<RideItem*> rides; // worklist
         QTimer singleshot;
 
+        QMap<QDate, EstimatorWeek> weeks[2]; // bike and run, by week commencing
+        bool loaded, dirty;
+
         bool abort;
 };
 
@@ -160,6 +160,7 @@ class LNP : public RideMetric {
     }
     bool isRelevantForRide(const RideItem *ride) const { return ride->isRun; }
     MetricClass classification() const { return Undefined; }
+    int dependsOn() const { return RideMetric::Weight; }
     MetricValidity validity() const { return Unknown; }
     RideMetric *clone() const { return new LNP(*this); }
 };
@@ -254,6 +255,7 @@ class XPace : public RideMetric {
     }
     bool isRelevantForRide(const RideItem *ride) const { return ride->isRun; }
     MetricClass classification() const { return Undefined; }
+    int dependsOn() const { return RideMetric::Weight; }
     MetricValidity validity() const { return Unknown; }
     RideMetric *clone() const { return new XPace(*this); }
 };
@@ -309,6 +311,7 @@ class RTP : public RideMetric {
     }
     bool isRelevantForRide(const RideItem *ride) const { return ride->isRun; }
     MetricClass classification() const { return Undefined; }
+    int dependsOn() const { return RideMetric::Weight | RideMetric::PaceZones; }
     MetricValidity validity() const { return Unknown; }
     RideMetric *clone() const { return new RTP(*this); }
 };
@@ -420,6 +423,7 @@ class GOVSS : public RideMetric {
     }
     bool isRelevantForRide(const RideItem *ride) const { return ride->isRun; }
     MetricClass classification() const { return Undefined; }
+    int dependsOn() const { return RideMetric::Weight; }
     MetricValidity validity() const { return Unknown; }
     RideMetric *clone() const { return new GOVSS(*this); }
 };
@@ -77,6 +77,7 @@ public:
     bool canAggregate() { return false; }
     void aggregateWith(const RideMetric &) {}
     MetricClass classification() const { return Undefined; }
+    int dependsOn() const { return RideMetric::HrZones; }
     MetricValidity validity() const { return Unknown; }
     RideMetric *clone() const { return new HrZoneTime(*this); }
 };
@@ -800,6 +801,7 @@ public:
     bool canAggregate() { return false; }
     void aggregateWith(const RideMetric &) {}
     MetricClass classification() const { return Undefined; }
+    int dependsOn() const { return RideMetric::HrZones; }
     MetricValidity validity() const { return Unknown; }
     RideMetric *clone() const { return new HrZoneTimeI(*this); }
 };
@@ -865,6 +867,7 @@ public:
     bool canAggregate() { return false; }
     void aggregateWith(const RideMetric &) {}
     MetricClass classification() const { return Undefined; }
+    int dependsOn() const { return RideMetric::HrZones; }
     MetricValidity validity() const { return Unknown; }
     RideMetric *clone() const { return new HrZoneTimeII(*this); }
 };
@@ -929,6 +932,7 @@ public:
     bool canAggregate() { return false; }
     void aggregateWith(const RideMetric &) {}
     MetricClass classification() const { return Undefined; }
+    int dependsOn() const { return RideMetric::HrZones; }
     MetricValidity validity() const { return Unknown; }
     RideMetric *clone() const { return new HrZoneTimeIII(*this); }
 };
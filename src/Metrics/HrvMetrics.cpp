@@ -570,6 +570,7 @@ public:
     bool isRelevantForRide(const RideItem *) const { return true; }
 
     MetricClass classification() const { return Undefined; }
+    int dependsOn() const { return RideMetric::Hrv; }
     MetricValidity validity() const { return Unknown; }
     RideMetric *clone() const { return new rest_hr(*this); }
 };
@@ -606,6 +607,7 @@ public:
     bool isRelevantForRide(const RideItem *) const { return true; }
 
     MetricClass classification() const { return Undefined; }
+    int dependsOn() const { return RideMetric::Hrv; }
     MetricValidity validity() const { return Unknown; }
     RideMetric *clone() const { return new rest_avnn(*this); }
 };
@@ -643,6 +645,7 @@ public:
     bool isRelevantForRide(const RideItem *) const { return true; }
 
     MetricClass classification() const { return Undefined; }
+    int dependsOn() const { return RideMetric::Hrv; }
     MetricValidity validity() const { return Unknown; }
     RideMetric *clone() const { return new rest_sdnn(*this); }
 };
@@ -680,6 +683,7 @@ public:
     bool isRelevantForRide(const RideItem *) const { return true; }
 
     MetricClass classification() const { return Undefined; }
+    int dependsOn() const { return RideMetric::Hrv; }
     MetricValidity validity() const { return Unknown; }
     RideMetric *clone() const { return new rest_rmssd(*this); }
 };
@@ -717,6 +721,7 @@ public:
     bool isRelevantForRide(const RideItem *) const { return true; }
 
     MetricClass classification() const { return Undefined; }
+    int dependsOn() const { return RideMetric::Hrv; }
     MetricValidity validity() const { return Unknown; }
     RideMetric *clone() const { return new rest_pNN50(*this); }
 };
@@ -755,6 +760,7 @@ public:
     bool isRelevantForRide(const RideItem *) const { return true; }
 
     MetricClass classification() const { return Undefined; }
+    int dependsOn() const { return RideMetric::Hrv; }
     MetricValidity validity() const { return Unknown; }
     RideMetric *clone() const { return new rest_lf(*this); }
 };
@@ -793,6 +799,7 @@ public:
     bool isRelevantForRide(const RideItem *) const { return true; }
 
     MetricClass classification() const { return Undefined; }
+    int dependsOn() const { return RideMetric::Hrv; }
     MetricValidity validity() const { return Unknown; }
     RideMetric *clone() const { return new rest_hf(*this); }
 };
@@ -836,6 +843,7 @@ public:
     bool isRelevantForRide(const RideItem *) const { return true; }
 
     MetricClass classification() const { return Undefined; }
+    int dependsOn() const { return RideMetric::Hrv; }
     MetricValidity validity() const { return Unknown; }
     RideMetric *clone() const { return new hrv_recovery_points(*this); }
 };
@@ -0,0 +1,46 @@
+/*
+ * Copyright (c) 2020 Mark Liversedge (liversedge@gmail.com)
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by the Free
+ * Software Foundation; either version 2 of the License, or (at your option)
+ * any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License for
+ * more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc., 51
+ * Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+#include "LMCurve.h"
+
+// the data and curve, passed through lmmin
+struct lmcurve_r_data {
+    const double *t;
+    const double *y;
+    double (*g)(const double t, const double *par, void *model);
+    void *model;
+};
+
+static void
+lmcurve_r_evaluate(const double *par, const int m_dat, const void *data, double *fvec, int *info)
+{
+    (void)(info);
+
+    const lmcurve_r_data *d = static_cast<const lmcurve_r_data*>(data);
+    for (int i = 0; i < m_dat; i++)
+        fvec[i] = d->y[i] - d->g(d->t[i], par, d->model);
+}
+
+void
+lmcurve_r(const int n_par, double *par, const int m_dat, const double *t, const double *y,
+          double (*g)(const double t, const double *par, void *model), void *model,
+          const lm_control_struct *control, lm_status_struct *status)
+{
+    lmcurve_r_data data = { t, y, g, model };
+    lmmin(n_par, par, m_dat, NULL, &data, lmcurve_r_evaluate, control, status);
+}
@@ -0,0 +1,45 @@
+/*
+ * Copyright (c) 2020 Mark Liversedge (liversedge@gmail.com)
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by the Free
+ * Software Foundation; either version 2 of the License, or (at your option)
+ * any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License for
+ * more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc., 51
+ * Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+#ifndef _GC_LMCurve_h
+#define _GC_LMCurve_h 1
+
+#include "lmmin.h"
+
+//
+// Reentrant curve fitting
+//
+// lmcurve from lmfit takes a plain function for the curve, so to fit a
+// model we used to point a global at it and hold a mutex for the whole
+// fit, which meant every fit in the app ran one at a time. lmmin itself
+// is reentrant, it passes the caller's data through to the evaluation,
+// so here the curve gets a pointer to the model it belongs to and fits
+// can run concurrently, so long as the models they fit are different.
+//
+void lmcurve_r(const int n_par, double *par, const int m_dat, const double *t, const double *y,
+               double (*g)(const double t, const double *par, void *model), void *model,
+               const lm_control_struct *control, lm_status_struct *status);
+
+// fit model->f(t, par), e.g. lmcurve_r(n, par, m, t, y, lmcurve_f<PDModel>, this, &control, &status)
+template<class T>
+double lmcurve_f(const double t, const double *par, void *model)
+{
+    return static_cast<T*>(model)->f(t, par);
+}
+
+#endif // _GC_LMCurve_h
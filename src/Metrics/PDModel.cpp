@@ -18,7 +18,7 @@
 
 #include "PDModel.h"
 #include "LTMTrend.h"
-#include "lmcurve.h"
+#include "LMCurve.h"
 
 //extern ztable PD_ZTABLE;
 // base class for all models
@@ -126,13 +126,6 @@ PDModel::setIntervals(double sanI1, double sanI2, double anI1, double anI2,
     emit intervalsChanged();
 }
 
-// used to wrap a function call when deriving parameters
-QMutex calllmfit;
-PDModel *calllmfitmodel = NULL;
-double calllmfitf(double t, const double *p) {
-    return static_cast<PDModel*>(calllmfitmodel)->f(t, p);
-}
-
 // using the data and intervals from above, derive the
 // cp, tau and t0 values needed for the model
 // this is the function originally found in CPPlot
@@ -291,15 +284,9 @@ PDModel::deriveCPParameters(int model)
         lm_control_struct control = lm_control_double;
         lm_status_struct status;
 
-        // use forwarder via global variable, so mutex around this !
-        calllmfit.lock();
-        calllmfitmodel = this;
-
+        // the model is passed to the curve, so fits can run concurrently
         //fprintf(stderr, "Fitting ...\n" ); fflush(stderr);
-        lmcurve(this->nparms(), par, p.count(), t.constData(), p.constData(), calllmfitf, &control, &status);
-
-        // release for others
-        calllmfit.unlock();
+        lmcurve_r(this->nparms(), par, p.count(), t.constData(), p.constData(), lmcurve_f<PDModel>, this, &control, &status);
 
         //fprintf(stderr, "Results:\n" );
         //fprintf(stderr, "status after %d function evaluations:\n  %s\n",
@@ -1024,15 +1011,9 @@ ExtendedModel::deriveExtCPParameters()
         lm_control_struct control = lm_control_double;
         lm_status_struct status;
 
-        // use forwarder via global variable, so mutex around this !
-        calllmfit.lock();
-        calllmfitmodel = this;
-
+        // the model is passed to the curve, so fits can run concurrently
         fprintf(stderr, "Fitting ...\n" ); fflush(stderr);
-        lmcurve(this->nparms(), par, p.count(), t.constData(), p.constData(), calllmfitf, &control, &status);
-
-        // release for others
-        calllmfit.unlock();
+        lmcurve_r(this->nparms(), par, p.count(), t.constData(), p.constData(), lmcurve_f<PDModel>, this, &control, &status);
 
         fprintf(stderr, "Results:\n" );
         fprintf(stderr, "status after %d function evaluations:\n  %s\n",
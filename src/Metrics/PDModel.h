@@ -177,11 +177,6 @@ class PDModel : public QObject, public QwtSyntheticPointData
         bool minutes;
 };
 
-// control calling lmfit
-extern QMutex calllmfit;
-extern PDModel *calllmfitmodel;
-extern double calllmfitf(double t, const double *p);
-
 // estimates are recorded
 class PDEstimate
 {
@@ -16,7 +16,6 @@
  * Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
  */
 
-
 #include "PMCData.h"
 
 #include "Athlete.h"
@@ -29,12 +28,121 @@
 
 #include <stdio.h>
 #include <cmath>
+#include <algorithm>
 
 #include <QSharedPointer>
 #include <QProgressDialog>
+#include <QThread>
+#include <QCoreApplication>
+
+//
+// Stress for each ride, shared by the PMCs
+//
+static QMutex registryLock;
+static QList<PMCStress*> registry; // all of them
+static QHash<QString, QWeakPointer<PMCStress> > shared; // by athlete and metric
+
+QSharedPointer<PMCStress>
+PMCStress::stressFor(Context *context, QString metricName)
+{
+    QString key = QString("%1|%2").arg(quintptr(context->athlete)).arg(metricName);
+
+    QMutexLocker locker(&registryLock);
+
+    QSharedPointer<PMCStress> returning = shared.value(key).toStrongRef();
+    if (returning.isNull()) {
+        returning = QSharedPointer<PMCStress>(new PMCStress(context, metricName, NULL));
+        returning->key = key;
+        shared.insert(key, returning.toWeakRef());
+        registry << returning.data();
+    }
+    return returning;
+}
+
+QSharedPointer<PMCStress>
+PMCStress::stressFor(Context *context, Leaf *expr)
+{
+    QSharedPointer<PMCStress> returning(new PMCStress(context, "", expr));
+
+    QMutexLocker locker(&registryLock);
+    registry << returning.data();
+    return returning;
+}
+
+void
+PMCStress::refreshed(Context *context, RideItem *item)
+{
+    // called from the refresh threads
+    QMutexLocker locker(&registryLock);
+    foreach(PMCStress *stress, registry)
+        if (stress->context->athlete == context->athlete)
+            stress->forget(item);
+}
 
+PMCStress::PMCStress(Context *context, QString metricName, Leaf *expr)
+    : context(context), metricName(metricName), expr(expr), df(NULL), stamp(0)
+{
+    if (expr) df = new DataFilter(this, context);
+
+    connect(context, SIGNAL(rideAdded(RideItem*)), this, SLOT(forget(RideItem*)));
+    connect(context, SIGNAL(rideDeleted(RideItem*)), this, SLOT(forget(RideItem*)));
+    connect(context, SIGNAL(configChanged(qint32)), this, SLOT(clear()));
+    connect(context->athlete->rideCache, SIGNAL(itemChanged(RideItem*)), this, SLOT(forget(RideItem*)));
+}
+
+PMCStress::~PMCStress()
+{
+    QMutexLocker locker(&registryLock);
+    registry.removeOne(this);
+
+    // unless another has taken our place already
+    if (key != "" && shared.value(key).isNull()) shared.remove(key);
+}
+
+double
+PMCStress::value(RideItem *item)
+{
+    lock.lock();
+    QHash<RideItem*, double>::const_iterator found = values.constFind(item);
+    if (found != values.constEnd()) {
+        double returning = found.value();
+        lock.unlock();
+        return returning;
+    }
+    int version = stamp;
+    lock.unlock();
+
+    double returning = 0;
+    if (expr) returning = expr->eval(&df->rt, expr, Result(0), 0, item).number();
+    else returning = item->getForSymbol(metricName);
+
+    // don't keep it if it was forgotten whilst we were busy
+    QMutexLocker locker(&lock);
+    if (version == stamp) values.insert(item, returning);
+    return returning;
+}
+
+void
+PMCStress::forget(RideItem *item)
+{
+    QMutexLocker locker(&lock);
+    stamp++;
+    values.remove(item);
+}
+
+void
+PMCStress::clear()
+{
+    QMutexLocker locker(&lock);
+    stamp++;
+    values.clear();
+}
+
+//
+// PMC for a metric or expression
+//
 PMCData::PMCData(Context *context, Specification spec, QString metricName, int stsDays, int ltsDays) 
-    : context(context), specification_(spec), metricName_(metricName), stsDays_(stsDays), ltsDays_(ltsDays), isstale(true)
+    : context(context), specification_(spec), metricName_(metricName), stsDays_(stsDays), ltsDays_(ltsDays), sbToday_(false), isstale(true)
 {
     // get defaults if not passed
     useDefaults = false;
@@ -42,6 +150,7 @@ PMCData::PMCData(Context *context, Specification spec, QString metricName, int s
     // we're not from a datafilter
     fromDataFilter = false;
     expr = NULL;
+    scores = PMCStress::stressFor(context, metricName_);
 
     if (ltsDays < 0) {
         QVariant lts = appsettings->cvalue(context->athlete->cyclist, GC_LTS_DAYS);
@@ -58,15 +167,15 @@ PMCData::PMCData(Context *context, Specification spec, QString metricName, int s
 
 
     refresh();
-    connect(context, SIGNAL(rideAdded(RideItem*)), this, SLOT(invalidate()));
-    connect(context, SIGNAL(rideDeleted(RideItem*)), this, SLOT(invalidate()));
+    connect(context, SIGNAL(rideAdded(RideItem*)), this, SLOT(itemChanged(RideItem*)));
+    connect(context, SIGNAL(rideDeleted(RideItem*)), this, SLOT(itemChanged(RideItem*)));
     connect(context, SIGNAL(refreshUpdate(QDate)), this, SLOT(invalidate()));
-    connect(context->athlete->rideCache, SIGNAL(itemChanged(RideItem*)), this, SLOT(invalidate()));
+    connect(context->athlete->rideCache, SIGNAL(itemChanged(RideItem*)), this, SLOT(itemChanged(RideItem*)));
     connect(context->athlete->seasons, SIGNAL(seasonsChanged()), this, SLOT(invalidate()));
 }
 
 PMCData::PMCData(Context *context, Specification spec, Leaf *expr, DataFilterRuntime *df, int stsDays, int ltsDays) 
-    : context(context), specification_(spec), metricName_(""), stsDays_(stsDays), ltsDays_(ltsDays), isstale(true)
+    : context(context), specification_(spec), metricName_(""), stsDays_(stsDays), ltsDays_(ltsDays), sbToday_(false), isstale(true)
 {
     // get defaults if not passed
     useDefaults = false;
@@ -79,10 +188,12 @@ PMCData::PMCData(Context *context, Specification spec, Leaf *expr, DataFilterRun
         metricName_ = metricName;
         fromDataFilter = false;
         expr = NULL;
+        scores = PMCStress::stressFor(context, metricName_);
     } else {
         // use an expression
         fromDataFilter = true;
         this->expr = expr;
+        scores = PMCStress::stressFor(context, expr);
     }
 
     if (ltsDays < 0) {
@@ -100,10 +211,10 @@ PMCData::PMCData(Context *context, Specification spec, Leaf *expr, DataFilterRun
 
 
     refresh();
-    connect(context, SIGNAL(rideAdded(RideItem*)), this, SLOT(invalidate()));
-    connect(context, SIGNAL(rideDeleted(RideItem*)), this, SLOT(invalidate()));
+    connect(context, SIGNAL(rideAdded(RideItem*)), this, SLOT(itemChanged(RideItem*)));
+    connect(context, SIGNAL(rideDeleted(RideItem*)), this, SLOT(itemChanged(RideItem*)));
     connect(context, SIGNAL(refreshUpdate(QDate)), this, SLOT(invalidate()));
-    connect(context->athlete->rideCache, SIGNAL(itemChanged(RideItem*)), this, SLOT(invalidate()));
+    connect(context->athlete->rideCache, SIGNAL(itemChanged(RideItem*)), this, SLOT(itemChanged(RideItem*)));
 }
 
 void PMCData::invalidate()
@@ -111,29 +222,19 @@ void PMCData::invalidate()
     isstale=true;
 }
 
-void PMCData::refresh()
+void PMCData::itemChanged(RideItem *item)
 {
-    if (!isstale) return;
-
-    // we need to reread config if refreshing (it might have changed)
-    if (useDefaults) {
-
-        QVariant lts = appsettings->cvalue(context->athlete->cyclist, GC_LTS_DAYS);
-        if (lts.isNull() || lts.toInt() == 0) ltsDays_ = 42;
-        else ltsDays_ = lts.toInt();
+    // it's all being recalculated anyway
+    if (isstale) return;
 
-        QVariant sts = appsettings->cvalue(context->athlete->cyclist, GC_STS_DAYS);
-        if (sts.isNull() || sts.toInt() == 0) stsDays_ = 7;
-        else stsDays_ = sts.toInt();
-    }
-
-    QTime timer;
-    timer.start();
-
-    //
-    // STEP ONE: What is the date range ?
-    //
+    // the day it was on and the day it's on now, which
+    // are the same unless the date changed
+    if (offsets_.contains(item)) dirty_ << start_.addDays(offsets_.take(item));
+    dirty_ << item->dateTime.date();
+}
 
+void PMCData::range(QDate &start, QDate &end)
+{
     // Date range needs to take into account seasons that
     // have a starting LTS/STS potentially before any rides
     QDate seed;
@@ -152,301 +253,539 @@ void PMCData::refresh()
     }
 
     // what is earliest date we got ? (substract 1 day to include first ride)
-    start_ = QDate(9999,12,31);
-    if (seed != QDate() && seed < start_) start_ = seed;
-    if (first != QDate() && first < start_) start_ = first.addDays(-1);
+    start = QDate(9999,12,31);
+    if (seed != QDate() && seed < start) start = seed;
+    if (first != QDate() && first < start) start = first.addDays(-1);
 
     // whats the latest date we got ? (and add a year for decay)
-    end_ = QDate();
-    if (last > seed) end_ = last.addDays(365);
-    else if (seed != QDate()) end_ = seed.addDays(365);
+    end = QDate();
+    if (last > seed) end = last.addDays(365);
+    else if (seed != QDate()) end = seed.addDays(365);
 
     // back to null date if not set, just to get round date arithmetic
-    if (start_ == QDate(9999,12,31)) start_ = QDate();
+    if (start == QDate(9999,12,31)) start = QDate();
 
     // We got a valid range ?
-    if (start_ != QDate() && end_ != QDate() && start_ < end_) {
-
-        // resize arrays
-        days_ = start_.daysTo(end_)+1;
-        stress_.resize(days_);
-        lts_.resize(days_);
-        sts_.resize(days_);
-        sb_.resize(days_+1); // for SB tomorrow!
-        rr_.resize(days_);
-
-        planned_stress_.resize(days_);
-        planned_lts_.resize(days_);
-        planned_sts_.resize(days_);
-        planned_sb_.resize(days_+1); // for SB tomorrow!
-        planned_rr_.resize(days_);
-
-        expected_lts_.resize(days_);
-        expected_sts_.resize(days_);
-        expected_sb_.resize(days_+1); // for SB tomorrow!
-        expected_rr_.resize(days_);
-
-    } else {
-
-        // nothing to calculate
-        start_= QDate();
-        end_ = QDate();
-        days_ = 0;
-        stress_.resize(0);
-        lts_.resize(0);
-        sts_.resize(0);
-        sb_.resize(0);
-        rr_.resize(0);
-
-        planned_stress_.resize(0);
-        planned_lts_.resize(0);
-        planned_sts_.resize(0);
-        planned_sb_.resize(0);
-        planned_rr_.resize(0);
-
-        expected_lts_.resize(0);
-        expected_sts_.resize(0);
-        expected_sb_.resize(0);
-        expected_rr_.resize(0);
+    if (start == QDate() || end == QDate() || start >= end) {
+        start = QDate();
+        end = QDate();
+    }
+}
 
+void PMCData::resize(int days)
+{
+    // new days are zero
+    stress_.resize(days);
+    lts_.resize(days);
+    sts_.resize(days);
+    sb_.resize(days ? days+1 : 0); // for SB tomorrow!
+    rr_.resize(days);
+
+    planned_stress_.resize(days);
+    planned_lts_.resize(days);
+    planned_sts_.resize(days);
+    planned_sb_.resize(days ? days+1 : 0); // for SB tomorrow!
+    planned_rr_.resize(days);
+
+    expected_lts_.resize(days);
+    expected_sts_.resize(days);
+    expected_sb_.resize(days ? days+1 : 0); // for SB tomorrow!
+    expected_rr_.resize(days);
+}
 
-        // give up
-        return;
+void PMCData::add(RideItem *item, int offset)
+{
+    if (!specification_.pass(item)) return;
+
+    // although metrics are cleansed, we check here because development
+    // builds have a rideDB.json that has nan and inf values in it.
+    double value = scores->value(item);
+
+    if (!std::isinf(value) && !std::isnan(value)) {
+        if (item->planned)
+            planned_stress_[offset] += value;
+        else
+            stress_[offset] += value;
+        //qDebug()<<"stress_["<<offset<<"] :"<<stress_[offset];
     }
-    //qDebug()<<"refresh PMC dates:"<<metricName_<<"days="<<days_<<"start="<<start_<<"end="<<end_;
+    offsets_.insert(item, offset);
+}
 
-    //
-    // STEP TWO What are the seedings and ride values
-    //
-    bool sbToday = appsettings->cvalue(context->athlete->cyclist, GC_SB_TODAY).toInt();
-    double lte = (double)exp(-1.0/ltsDays_);
-    double ste = (double)exp(-1.0/stsDays_);
-
-    // clear what's there
-    stress_.fill(0);
-    lts_.fill(0);
-    sts_.fill(0);
-    sb_.fill(0);
-    rr_.fill(0);
-
-    planned_stress_.fill(0);
-    planned_lts_.fill(0);
-    planned_sts_.fill(0);
-    planned_sb_.fill(0);
-    planned_rr_.fill(0);
-
-    expected_lts_.fill(0);
-    expected_sts_.fill(0);
-    expected_sb_.fill(0);
-    expected_rr_.fill(0);
+void PMCData::patch(int offset)
+{
+    QDate date = start_.addDays(offset);
 
-    // add the seeded values from seasons
-    foreach(Season x, context->athlete->seasons->seasons) {
-        if (x.getSeed()) {
-            int offset = start_.daysTo(x.getStart());
-            lts_[offset] = x.getSeed() * -1;
-            sts_[offset] = x.getSeed() * -1;
-
-            planned_lts_[offset] = x.getSeed() * -1;
-            planned_sts_[offset] = x.getSeed() * -1;
-        }
-    }
+    stress_[offset] = 0;
+    planned_stress_[offset] = 0;
 
-    DataFilter* df = new DataFilter(this, context);
+    // rides are sorted by date, so add the ones on the day in the
+    // same order as a refresh would, to get exactly the same sum
+    const QVector<RideItem*> &rides = context->athlete->rideCache->rides();
+    QVector<RideItem*>::const_iterator it = std::lower_bound(rides.constBegin(), rides.constEnd(), QDateTime(date, QTime(0,0,0)),
+                                                             [](const RideItem *item, const QDateTime &dt) { return item->dateTime < dt; });
+    for(; it != rides.constEnd() && (*it)->dateTime.date() == date; ++it) add(*it, offset);
+}
 
-    // add the stress scores
-    foreach(RideItem *item, context->athlete->rideCache->rides()) {
+//
+// The recurrences, for one or more PMCs at once
+//
+// The arrays are days x PMCs, with the values for each PMC on a day
+// together, so a batch of PMCs is calculated a day at a time with
+// simple loops across the PMCs that the compiler can vectorise. With
+// one PMC they're just the PMC's own arrays.
+//
+struct PMCMatrix {
+    int n; // how many PMCs
+    double *stress, *lts, *sts, *sb, *rr;
+    double *planned_stress, *planned_lts, *planned_sts, *planned_sb, *planned_rr;
+    double *expected_lts, *expected_sts, *expected_sb, *expected_rr;
+};
+
+static void
+recurrences(const PMCMatrix &m, int days, int from, const QVector<QPair<int,double> > &seeds,
+            int stsDays, int ltsDays, bool sbToday, QDate start)
+{
+    const int n = m.n;
+    const int tomorrow = sbToday ? 0 : n;
+    double lte = (double)exp(-1.0/ltsDays);
+    double ste = (double)exp(-1.0/stsDays);
+
+    // clear what's there from the day onwards
+    for(int j=from*n; j < days*n; j++) {
+        m.lts[j] = 0;
+        m.sts[j] = 0;
+        m.planned_lts[j] = 0;
+        m.planned_sts[j] = 0;
+        m.expected_lts[j] = 0;
+        m.expected_sts[j] = 0;
+    }
 
-        if (!specification_.pass(item)) continue;
+    // add the seeded values from seasons
+    for(int i=0; i<seeds.count(); i++) {
+        int offset = seeds[i].first;
+        if (offset < from) continue;
 
-        // seed with score for this one
-        int offset = start_.daysTo(item->dateTime.date());
-        if (offset > 0 && offset < stress_.count()) {
+        for(int k=0; k<n; k++) {
+            m.lts[offset*n+k] = seeds[i].second * -1;
+            m.sts[offset*n+k] = seeds[i].second * -1;
 
-            // although metrics are cleansed, we check here because development
-            // builds have a rideDB.json that has nan and inf values in it.
-            double value = 0;;
-            if (fromDataFilter) value = expr->eval(&df->rt, expr, Result(0), 0, item).number();
-            else value = item->getForSymbol(metricName_);
-
-            if (!std::isinf(value) && !std::isnan(value)) {
-                if (item->planned)
-                    planned_stress_[offset] += value;
-                else
-                    stress_[offset] += value;
-                //qDebug()<<"stress_["<<offset<<"] :"<<stress_[offset];
-            }
+            m.planned_lts[offset*n+k] = seeds[i].second * -1;
+            m.planned_sts[offset*n+k] = seeds[i].second * -1;
         }
     }
 
-    delete df;
-
-    //
-    // STEP THREE Calculate sts/lts, sb and rr
-    //
-    double lastLTS=0.0f;
-    double lastSTS=0.0f;
-
-    double rollingStress=0;
+    // rolling stress carries on from the day before
+    QVector<double> rollingStress(n), planned_rollingStress(n), expected_rollingStress(n);
+    for(int k=0; from && k<n; k++) {
+        rollingStress[k] = m.rr[(from-1)*n+k];
+        planned_rollingStress[k] = m.planned_rr[(from-1)*n+k];
+        expected_rollingStress[k] = m.expected_rr[(from-1)*n+k];
+    }
 
-    double planned_lastLTS=0.0f;
-    double planned_lastSTS=0.0f;
+    QDate today = QDate::currentDate();
 
-    double planned_rollingStress=0;
+    for(int day=from; day < days; day++) {
 
-#if notyet
-    double expected_lastLTS=0.0f;
-    double expected_lastSTS=0.0f;
-#endif
+        const int t = day*n;        // the day
+        const int y = (day-1)*n;    // the day before
+        const int s1 = (day-stsDays-1)*n, s2 = (day-stsDays)*n; // stsDays ago
 
-    double expected_rollingStress=0;
+        for(int k=0; k<n; k++) {
 
-    for(int day=0; day < days_; day++) {
+            // not seeded
+            if (m.lts[t+k] >=0 || m.sts[t+k]>=0) {
 
-        // not seeded
-        if (lts_[day] >=0 || sts_[day]>=0) {
+                // LTS
+                double lastLTS = day ? m.lts[y+k] : 0.0f;
+                m.lts[t+k] = (m.stress[t+k] * (1.0 - lte)) + (lastLTS * lte);
 
-            // LTS
-            if (day) lastLTS = lts_[day-1];
-            lts_[day] = (stress_[day] * (1.0 - lte)) + (lastLTS * lte);
+                // STS
+                double lastSTS = day ? m.sts[y+k] : 0.0f;
+                m.sts[t+k] = (m.stress[t+k] * (1.0 - ste)) + (lastSTS * ste);
 
-            // STS
-            if (day) lastSTS = sts_[day-1];
-            sts_[day] = (stress_[day] * (1.0 - ste)) + (lastSTS * ste);
+            } else if (m.lts[t+k]< 0 || m.sts[t+k]<0) {
 
-        } else if (lts_[day]< 0 || sts_[day]<0) {
+                m.lts[t+k] *= -1;
+                m.sts[t+k] *= -1;
+            }
 
-            lts_[day] *= -1;
-            sts_[day] *= -1;
-        }
+            // rolling stress for STS days
+            if (day && day <= stsDays) {
+                // just starting out
+                rollingStress[k] += m.lts[t+k] - m.lts[y+k];
+                m.rr[t+k] = rollingStress[k];
+            } else if (day) {
+                rollingStress[k] += m.lts[t+k] - m.lts[y+k];
+                rollingStress[k] -= m.lts[s2+k] - m.lts[s1+k];
+                m.rr[t+k] = rollingStress[k];
+            }
 
-        // rolling stress for STS days
-        if (day && day <= stsDays_) {
-            // just starting out
-            rollingStress += lts_[day] - lts_[day-1];
-            rr_[day] = rollingStress;
-        } else if (day) {
-            rollingStress += lts_[day] - lts_[day-1];
-            rollingStress -= lts_[day-stsDays_] - lts_[day-stsDays_-1];
-            rr_[day] = rollingStress;
+            // SB (stress balance)  long term - short term
+            // We allow it to be shown today or tomorrow where
+            // most (sane/thinking) folks usually show SB on the following day
+            m.sb[t+tomorrow+k] =  m.lts[t+k] - m.sts[t+k];
         }
 
-        // SB (stress balance)  long term - short term
-        // We allow it to be shown today or tomorrow where
-        // most (sane/thinking) folks usually show SB on the following day
-        sb_[day+(sbToday ? 0 : 1)] =  lts_[day] - sts_[day];
-
         // *******************
         // ****  PLANNED  ****
         // *******************
 
-        // not seeded
-        if (planned_lts_[day] >=0 || planned_sts_[day]>=0) {
+        for(int k=0; k<n; k++) {
 
-            // LTS
-            if (day) planned_lastLTS = planned_lts_[day-1];
-            planned_lts_[day] = (planned_stress_[day] * (1.0 - lte)) + (planned_lastLTS * lte);
+            // not seeded
+            if (m.planned_lts[t+k] >=0 || m.planned_sts[t+k]>=0) {
 
-            // STS
-            if (day) planned_lastSTS = planned_sts_[day-1];
-            planned_sts_[day] = (planned_stress_[day] * (1.0 - ste)) + (planned_lastSTS * ste);
+                // LTS
+                double planned_lastLTS = day ? m.planned_lts[y+k] : 0.0f;
+                m.planned_lts[t+k] = (m.planned_stress[t+k] * (1.0 - lte)) + (planned_lastLTS * lte);
 
-        } else if (planned_lts_[day]< 0 || planned_sts_[day]<0) {
+                // STS
+                double planned_lastSTS = day ? m.planned_sts[y+k] : 0.0f;
+                m.planned_sts[t+k] = (m.planned_stress[t+k] * (1.0 - ste)) + (planned_lastSTS * ste);
 
-            planned_lts_[day] *= -1;
-            planned_sts_[day] *= -1;
-        }
+            } else if (m.planned_lts[t+k]< 0 || m.planned_sts[t+k]<0) {
 
-        // rolling stress for STS days
-        if (day && day <= stsDays_) {
-            // just starting out
-            planned_rollingStress += planned_lts_[day] - planned_lts_[day-1];
-            planned_rr_[day] = planned_rollingStress;
-        } else if (day) {
-            planned_rollingStress += planned_lts_[day] - planned_lts_[day-1];
-            planned_rollingStress -= planned_lts_[day-stsDays_] - planned_lts_[day-stsDays_-1];
-            planned_rr_[day] = planned_rollingStress;
-        }
+                m.planned_lts[t+k] *= -1;
+                m.planned_sts[t+k] *= -1;
+            }
 
-        // SB (stress balance)  long term - short term
-        // We allow it to be shown today or tomorrow where
-        // most (sane/thinking) folks usually show SB on the following day
-        planned_sb_[day+(sbToday ? 0 : 1)] =  planned_lts_[day] - planned_sts_[day];
+            // rolling stress for STS days
+            if (day && day <= stsDays) {
+                // just starting out
+                planned_rollingStress[k] += m.planned_lts[t+k] - m.planned_lts[y+k];
+                m.planned_rr[t+k] = planned_rollingStress[k];
+            } else if (day) {
+                planned_rollingStress[k] += m.planned_lts[t+k] - m.planned_lts[y+k];
+                planned_rollingStress[k] -= m.planned_lts[s2+k] - m.planned_lts[s1+k];
+                m.planned_rr[t+k] = planned_rollingStress[k];
+            }
+
+            // SB (stress balance)  long term - short term
+            m.planned_sb[t+tomorrow+k] =  m.planned_lts[t+k] - m.planned_sts[t+k];
+        }
 
         // ********************
         // ****  EXPECTED  ****
         // ********************
 
-        if (start_.addDays(day).daysTo(QDate::currentDate())<0) {
-            double lastLts = 0.0;
-            double lastSts = 0.0;
-            double ltsAtStsDays1 = 0.0;
-            double ltsAtStsDays2 = 0.0;
-
-            if (day) {
-                if (start_.addDays(day).daysTo(QDate::currentDate())<-1) {
-                    lastLts = expected_lts_[day-1];
-                    lastSts = expected_sts_[day-1];
-                } else {
-                    lastLts = lts_[day-1];
-                    lastSts = sts_[day-1];
-                }
-                if (day > stsDays_) {
-                    if (start_.addDays(day).daysTo(QDate::currentDate())<-1-stsDays_) {
-                        ltsAtStsDays1 = expected_lts_[day-stsDays_-1];
-                    } else {
-                        ltsAtStsDays1 = lts_[day-stsDays_-1];
-                    }
+        int ahead = start.addDays(day).daysTo(today);
+        if (ahead < 0) {
 
-                    if (start_.addDays(day).daysTo(QDate::currentDate())<-stsDays_) {
-                        ltsAtStsDays2 = expected_lts_[day-stsDays_];
+            for(int k=0; k<n; k++) {
+
+                double lastLts = 0.0;
+                double lastSts = 0.0;
+                double ltsAtStsDays1 = 0.0;
+                double ltsAtStsDays2 = 0.0;
+
+                if (day) {
+                    if (ahead < -1) {
+                        lastLts = m.expected_lts[y+k];
+                        lastSts = m.expected_sts[y+k];
                     } else {
-                        ltsAtStsDays2 = lts_[day-stsDays_];
+                        lastLts = m.lts[y+k];
+                        lastSts = m.sts[y+k];
+                    }
+                    if (day > stsDays) {
+                        ltsAtStsDays1 = ahead < -1-stsDays ? m.expected_lts[s1+k] : m.lts[s1+k];
+                        ltsAtStsDays2 = ahead < -stsDays ? m.expected_lts[s2+k] : m.lts[s2+k];
                     }
                 }
+
+                // not seeded
+                if (m.expected_lts[t+k] >=0 || m.expected_sts[t+k]>=0) {
+                    // LTS
+                    m.expected_lts[t+k] = (m.planned_stress[t+k] * (1.0 - lte)) + (lastLts * lte);
+
+                    // STS
+                    m.expected_sts[t+k] = (m.planned_stress[t+k] * (1.0 - ste)) + (lastSts * ste);
+
+                } else if (m.expected_lts[t+k]< 0 || m.expected_sts[t+k]<0) {
+                    m.expected_lts[t+k] *= -1;
+                    m.expected_sts[t+k] *= -1;
+                }
+
+                // rolling stress for STS days
+                if (day && day <= stsDays) {
+                    // just starting out
+                    expected_rollingStress[k] += m.expected_lts[t+k] - lastLts;
+                    m.expected_rr[t+k] = expected_rollingStress[k];
+                } else if (day) {
+                    expected_rollingStress[k] += m.expected_lts[t+k] - lastLts;
+                    expected_rollingStress[k] -= ltsAtStsDays2 - ltsAtStsDays1;
+                    m.expected_rr[t+k] = expected_rollingStress[k];
+                }
+
+                // SB (stress balance)  long term - short term
+                m.expected_sb[t+tomorrow+k] =  m.expected_lts[t+k] - m.expected_sts[t+k];
             }
 
-            // not seeded
-            if (expected_lts_[day] >=0 || expected_sts_[day]>=0) {
-                // LTS
-                expected_lts_[day] = (planned_stress_[day] * (1.0 - lte)) + (lastLts * lte);
+        } else {
 
-                // STS
-                expected_sts_[day] = (planned_stress_[day] * (1.0 - ste)) + (lastSts * ste);
+            for(int k=0; k<n; k++) {
+                m.expected_lts[t+k] = 0;
+                m.expected_sts[t+k] = 0;
+                m.expected_sb[t+k] = 0;
+                m.expected_rr[t+k] = 0;
+            }
+        }
+    }
+}
+
+void PMCData::configure()
+{
+    // we need to reread config if refreshing (it might have changed)
+    if (useDefaults) {
+
+        int ltsDays = ltsDays_, stsDays = stsDays_;
+
+        QVariant lts = appsettings->cvalue(context->athlete->cyclist, GC_LTS_DAYS);
+        if (lts.isNull() || lts.toInt() == 0) ltsDays_ = 42;
+        else ltsDays_ = lts.toInt();
+
+        QVariant sts = appsettings->cvalue(context->athlete->cyclist, GC_STS_DAYS);
+        if (sts.isNull() || sts.toInt() == 0) stsDays_ = 7;
+        else stsDays_ = sts.toInt();
+
+        if (ltsDays != ltsDays_ || stsDays != stsDays_) isstale = true;
+    }
+
+    bool sbToday = appsettings->cvalue(context->athlete->cyclist, GC_SB_TODAY).toInt();
+    if (sbToday != sbToday_) isstale = true;
+    sbToday_ = sbToday;
+
+    // expected values are projected from today
+    if (today_ != QDate::currentDate()) isstale = true;
+}
+
+QVector<QPair<int,double> > PMCData::seeds()
+{
+    QVector<QPair<int,double> > returning;
+    foreach(Season x, context->athlete->seasons->seasons)
+        if (x.getSeed())
+            returning << QPair<int,double>(start_.daysTo(x.getStart()), x.getSeed());
+    return returning;
+}
+
+void PMCData::refresh()
+{
+    QMutexLocker locker(&refreshing);
+
+    // nothing changed since we last looked
+    if (!isstale && dirty_.isEmpty() && today_ == QDate::currentDate()) return;
+
+    configure();
+
+    QTime timer;
+    timer.start();
+
+    //
+    // STEP ONE: What is the date range ?
+    //
+    QDate start, end;
+    range(start, end);
 
-            } else if (expected_lts_[day]< 0 || expected_sts_[day]<0) {
-                expected_lts_[day] *= -1;
-                expected_sts_[day] *= -1;
+    //
+    // Just rides added, changed or deleted since last time
+    //
+    if (!isstale && start != QDate() && start == start_) {
+
+        int from = days_;
+
+        // the range changes at the end when the last ride changes
+        // e.g. adding today's, but the days before are the same
+        if (end != end_) {
+            int days = start_.daysTo(end)+1;
+            from = qMin(days_, days) - 1;
+
+            end_ = end;
+            days_ = days;
+            resize(days_);
+            if (sbToday_) {
+                sb_[days_] = 0;
+                planned_sb_[days_] = 0;
+                expected_sb_[days_] = 0;
             }
+        }
 
-            // rolling stress for STS days
-            if (day && day <= stsDays_) {
-                // just starting out
-                expected_rollingStress += expected_lts_[day] - lastLts;
-                expected_rr_[day] = expected_rollingStress;
-            } else if (day) {
-                expected_rollingStress += expected_lts_[day] - lastLts;
-                expected_rollingStress -= ltsAtStsDays2 - ltsAtStsDays1;
-                expected_rr_[day] = expected_rollingStress;
+        // update the stress for the days that changed
+        foreach(QDate date, dirty_) {
+            int offset = start_.daysTo(date);
+            if (offset > 0 && offset < days_) {
+                patch(offset);
+                if (offset < from) from = offset;
             }
+        }
+        dirty_.clear();
 
-            // SB (stress balance)  long term - short term
-            // We allow it to be shown today or tomorrow where
-            // most (sane/thinking) folks usually show SB on the following day
-            expected_sb_[day+(sbToday ? 0 : 1)] =  expected_lts_[day] - expected_sts_[day];
-        } else {
-            expected_lts_[day] = 0;
-            expected_sts_[day] = 0;
-            expected_sb_[day] = 0;
-            expected_rr_[day] = 0;
+        // and recalculate from the first one onwards
+        if (from < days_) recompute(from);
+
+        //qDebug()<<"patch PMC in="<<timer.elapsed()<<"ms";
+        return;
+    }
+
+    // the athlete's other PMCs that need refreshing are refreshed
+    // along with us, so it's one pass over the rides for all of them.
+    // the batch is refreshed with our specification, so only those
+    // with exactly the same filters and date range can join it.
+    // the others aren't ours to change from the threads computing
+    // metrics (e.g. a user metric using ctl), so only on the gui thread,
+    // and not whilst another thread is refreshing them
+    QList<PMCData*> batch;
+    batch << this;
+    if (QThread::currentThread() == QCoreApplication::instance()->thread() &&
+        context->athlete->pmcData.values().contains(this)) {
+        foreach(PMCData *pmc, context->athlete->pmcData) {
+            if (pmc == this || !pmc->specification_.sameAs(specification_)) continue;
+
+            // unless it's being refreshed already, e.g. computing our stress
+            if (!pmc->refreshing.tryLock()) continue;
+
+            pmc->configure();
+            if (pmc->isstale && pmc->stsDays_ == stsDays_ && pmc->ltsDays_ == ltsDays_) batch << pmc;
+            else pmc->refreshing.unlock();
+        }
+    }
+    refreshBatch(batch, start, end);
+    foreach(PMCData *pmc, batch) if (pmc != this) pmc->refreshing.unlock();
+
+    //qDebug()<<"refresh PMC in="<<timer.elapsed()<<"ms"<<"batch="<<batch.count();
+}
+
+void PMCData::refreshBatch(QList<PMCData*> pmcs, QDate start, QDate end)
+{
+    foreach(PMCData *pmc, pmcs) {
+        pmc->start_ = start;
+        pmc->end_ = end;
+        pmc->dirty_.clear();
+        pmc->offsets_.clear();
+    }
+
+    // We got a valid range ?
+    if (start == QDate() || end == QDate() || start >= end) {
+
+        // nothing to calculate
+        foreach(PMCData *pmc, pmcs) {
+            pmc->start_= QDate();
+            pmc->end_ = QDate();
+            pmc->days_ = 0;
+            pmc->resize(0);
+        }
+
+        // give up
+        return;
+    }
+
+    // resize arrays
+    int days = start.daysTo(end)+1;
+    foreach(PMCData *pmc, pmcs) {
+        pmc->days_ = days;
+        pmc->resize(days);
+
+        // clear what's there
+        pmc->stress_.fill(0);
+        pmc->sb_.fill(0);
+        pmc->rr_.fill(0);
+
+        pmc->planned_stress_.fill(0);
+        pmc->planned_sb_.fill(0);
+        pmc->planned_rr_.fill(0);
+
+        pmc->expected_sb_.fill(0);
+        pmc->expected_rr_.fill(0);
+    }
+    //qDebug()<<"refresh PMC dates:"<<metricName_<<"days="<<days_<<"start="<<start_<<"end="<<end_;
 
+    // a matrix for more than one, or the arrays of the one
+    const int n = pmcs.count();
+    QVector<double> matrix[14];
+    PMCMatrix m;
+    if (n == 1) {
+        PMCData *pmc = pmcs[0];
+        PMCMatrix arrays = { 1, pmc->stress_.data(), pmc->lts_.data(), pmc->sts_.data(), pmc->sb_.data(), pmc->rr_.data(),
+                             pmc->planned_stress_.data(), pmc->planned_lts_.data(), pmc->planned_sts_.data(),
+                             pmc->planned_sb_.data(), pmc->planned_rr_.data(),
+                             pmc->expected_lts_.data(), pmc->expected_sts_.data(), pmc->expected_sb_.data(),
+                             pmc->expected_rr_.data() };
+        m = arrays;
+    } else {
+        for(int i=0; i<14; i++) matrix[i].resize(n * (days+1)); // +1 for SB tomorrow!
+        PMCMatrix arrays = { n, matrix[0].data(), matrix[1].data(), matrix[2].data(), matrix[3].data(), matrix[4].data(),
+                             matrix[5].data(), matrix[6].data(), matrix[7].data(), matrix[8].data(), matrix[9].data(),
+                             matrix[10].data(), matrix[11].data(), matrix[12].data(), matrix[13].data() };
+        m = arrays;
+    }
+
+    //
+    // STEP TWO What are the ride values
+    //
+    Specification specification = pmcs[0]->specification_;
+    foreach(RideItem *item, pmcs[0]->context->athlete->rideCache->rides()) {
+
+        // seed with score for this one
+        int offset = start.daysTo(item->dateTime.date());
+        if (offset <= 0 || offset >= days || !specification.pass(item)) continue;
+
+        double *stress = (item->planned ? m.planned_stress : m.stress) + (offset * n);
+        for(int k=0; k<n; k++) {
+
+            // although metrics are cleansed, we check here because development
+            // builds have a rideDB.json that has nan and inf values in it.
+            double value = pmcs[k]->scores->value(item);
+            if (!std::isinf(value) && !std::isnan(value)) stress[k] += value;
+            pmcs[k]->offsets_.insert(item, offset);
+        }
+    }
+
+    //
+    // STEP THREE Calculate sts/lts, sb and rr
+    //
+    PMCData *first = pmcs[0];
+    recurrences(m, days, 0, first->seeds(), first->stsDays_, first->ltsDays_, first->sbToday_, start);
+
+    // copy out of the matrix
+    if (n > 1) {
+        for(int k=0; k<n; k++) {
+            PMCData *pmc = pmcs[k];
+            for(int day=0; day < days; day++) {
+                int j = day*n + k;
+                pmc->stress_[day] = m.stress[j];
+                pmc->lts_[day] = m.lts[j];
+                pmc->sts_[day] = m.sts[j];
+                pmc->sb_[day] = m.sb[j];
+                pmc->rr_[day] = m.rr[j];
+
+                pmc->planned_stress_[day] = m.planned_stress[j];
+                pmc->planned_lts_[day] = m.planned_lts[j];
+                pmc->planned_sts_[day] = m.planned_sts[j];
+                pmc->planned_sb_[day] = m.planned_sb[j];
+                pmc->planned_rr_[day] = m.planned_rr[j];
+
+                pmc->expected_lts_[day] = m.expected_lts[j];
+                pmc->expected_sts_[day] = m.expected_sts[j];
+                pmc->expected_sb_[day] = m.expected_sb[j];
+                pmc->expected_rr_[day] = m.expected_rr[j];
+            }
+            pmc->sb_[days] = m.sb[days*n + k];
+            pmc->planned_sb_[days] = m.planned_sb[days*n + k];
+            pmc->expected_sb_[days] = m.expected_sb[days*n + k];
         }
+    }
 
+    foreach(PMCData *pmc, pmcs) {
+        pmc->today_ = QDate::currentDate();
+        pmc->isstale = false;
     }
+}
 
-    //qDebug()<<"refresh PMC in="<<timer.elapsed()<<"ms";
+void PMCData::recompute(int from)
+{
+    PMCMatrix m = { 1, stress_.data(), lts_.data(), sts_.data(), sb_.data(), rr_.data(),
+                    planned_stress_.data(), planned_lts_.data(), planned_sts_.data(), planned_sb_.data(), planned_rr_.data(),
+                    expected_lts_.data(), expected_sts_.data(), expected_sb_.data(), expected_rr_.data() };
 
-    isstale=false;
+    recurrences(m, days_, from, seeds(), stsDays_, ltsDays_, sbToday_, start_);
 }
 
 int
@@ -32,6 +32,57 @@
 #include <QTreeWidgetItem>
 
 class Context;
+class RideItem;
+
+//
+// The stress for each ride
+//
+// Evaluating the stress metric (or worse, a DataFilter expression)
+// for every ride is the expensive part of a PMC, so the values are kept
+// and shared by all the PMCs for the athlete that use the same metric.
+// A ride's value is forgotten when it is added, changed or deleted or
+// its metrics are refreshed, and they're all forgotten when the config
+// changes.
+//
+class PMCStress : public QObject {
+
+    Q_OBJECT
+
+    public:
+
+        // shared by all the PMCs for the metric
+        static QSharedPointer<PMCStress> stressFor(Context *, QString metricName);
+
+        // expressions aren't shared, the expression belongs to the caller
+        static QSharedPointer<PMCStress> stressFor(Context *, Leaf *expr);
+
+        // metrics were refreshed for the ride
+        static void refreshed(Context *, RideItem *item);
+
+        ~PMCStress();
+
+        // stress for the ride
+        double value(RideItem *item);
+
+    public slots:
+
+        void forget(RideItem *item);
+        void clear();
+
+    private:
+
+        PMCStress(Context *, QString metricName, Leaf *expr);
+
+        Context *context;
+        QString key;        // in the shared ones
+        QString metricName;
+        Leaf *expr;
+        DataFilter *df;
+
+        QMutex lock;
+        int stamp;          // bumped when values are forgotten
+        QHash<RideItem*, double> values;
+};
 
 class PMCData : public QObject {
 
@@ -109,8 +160,33 @@ class PMCData : public QObject {
         void invalidate();
         void refresh();
 
+        // a ride was added, changed or deleted, so
+        // just the days it was on need refreshing
+        void itemChanged(RideItem *item);
+
     private:
 
+        // the dates needed to cover seasons and rides
+        void range(QDate &start, QDate &end);
+        void resize(int days);
+
+        // the stress for rides on the day at offset
+        void patch(int offset);
+        void add(RideItem *item, int offset);
+
+        // recalculate sts/lts, sb and rr from the day at offset onwards
+        void recompute(int from);
+
+        // reread config, it might have changed
+        void configure();
+
+        // days and values for the seasons with a starting LTS/STS
+        QVector<QPair<int,double> > seeds();
+
+        // refresh PMCs with the same specification and sts/lts days
+        // together, with one pass over the rides for all of them
+        static void refreshBatch(QList<PMCData*> pmcs, QDate start, QDate end);
+
         // who we for ?
         Context *context;
         Specification specification_;
@@ -131,7 +207,14 @@ class PMCData : public QObject {
         QVector<double> planned_stress_, planned_lts_, planned_sts_, planned_sb_, planned_rr_;
         QVector<double> expected_lts_, expected_sts_, expected_sb_, expected_rr_;
 
+        QSharedPointer<PMCStress> scores; // stress for each ride
+        QHash<RideItem*, int> offsets_; // the day each ride's stress was added to
+        QSet<QDate> dirty_; // days with rides added, changed or deleted
+        QDate today_; // the expected values are projected from today
+        bool sbToday_;
+
         bool isstale; // needs refreshing
+        QMutex refreshing; // held whilst refreshing, by us or a batch we're in
 };
 
 #endif // _GC_StressCalculator_h
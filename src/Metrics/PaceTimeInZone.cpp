@@ -82,6 +82,7 @@ class PaceZoneTime : public RideMetric {
     bool canAggregate() { return false; }
     void aggregateWith(const RideMetric &) {}
     MetricClass classification() const { return Undefined; }
+    int dependsOn() const { return RideMetric::PaceZones; }
     MetricValidity validity() const { return Unknown; }
     RideMetric *clone() const { return new PaceZoneTime(*this); }
 };
@@ -815,6 +816,7 @@ class PaceZoneTimeI : public RideMetric {
     bool canAggregate() { return false; }
     void aggregateWith(const RideMetric &) {}
     MetricClass classification() const { return Undefined; }
+    int dependsOn() const { return RideMetric::PaceZones; }
     MetricValidity validity() const { return Unknown; }
     RideMetric *clone() const { return new PaceZoneTimeI(*this); }
 };
@@ -885,6 +887,7 @@ class PaceZoneTimeII : public RideMetric {
     bool canAggregate() { return false; }
     void aggregateWith(const RideMetric &) {}
     MetricClass classification() const { return Undefined; }
+    int dependsOn() const { return RideMetric::PaceZones; }
     MetricValidity validity() const { return Unknown; }
     RideMetric *clone() const { return new PaceZoneTimeII(*this); }
 };
@@ -954,6 +957,7 @@ class PaceZoneTimeIII : public RideMetric {
     bool canAggregate() { return false; }
     void aggregateWith(const RideMetric &) {}
     MetricClass classification() const { return Undefined; }
+    int dependsOn() const { return RideMetric::PaceZones; }
     MetricValidity validity() const { return Unknown; }
     RideMetric *clone() const { return new PaceZoneTimeIII(*this); }
 };
@@ -95,6 +95,7 @@ class HrZone : public RideMetric {
         setValue(double(zone) + percent);
     }
     MetricClass classification() const { return Undefined; }
+    int dependsOn() const { return RideMetric::HrZones; }
     MetricValidity validity() const { return Unknown; }
     RideMetric *clone() const { return new HrZone(*this); }
 };
@@ -92,6 +92,7 @@ class PeakPercent : public RideMetric {
     }
 
     MetricClass classification() const { return Undefined; }
+    int dependsOn() const { return RideMetric::CP; }
     MetricValidity validity() const { return Unknown; }
     RideMetric *clone() const { return new PeakPercent(*this); }
 };
@@ -164,6 +165,7 @@ class PowerZone : public RideMetric {
         setValue(double(zone) + percent);
     }
     MetricClass classification() const { return Undefined; }
+    int dependsOn() const { return RideMetric::PowerZones; }
     MetricValidity validity() const { return Unknown; }
     RideMetric *clone() const { return new PowerZone(*this); }
 };
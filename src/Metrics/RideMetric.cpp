@@ -189,7 +189,7 @@ RideMetric::userMetricFingerprint(QList<UserMetricSettings> these)
 }
 
 QHash<QString,RideMetricPtr>
-RideMetric::computeMetrics(RideItem *item, Specification spec, const QStringList &metrics)
+RideMetric::computeMetrics(RideItem *item, Specification spec, const QStringList &metrics, bool reuse)
 {
     const RideMetricFactory &factory = RideMetricFactory::instance();
 
@@ -210,6 +210,7 @@ RideMetric::computeMetrics(RideItem *item, Specification spec, const QStringList
 
     // this is what we've completed as we go
     QHash<QString,RideMetric*> done;
+    QSet<QString> wanted = metrics.toSet();
 
     // resize the metric array in the interval if needed
     if (spec.interval() && spec.interval()->metrics().size() < factory.metricCount()) 
@@ -236,6 +237,17 @@ RideMetric::computeMetrics(RideItem *item, Specification spec, const QStringList
 
         // if the dependencies aren't done yet add to the end of the list
         foreach (QString dep, deps) {
+
+            // not asked for, so use the value we already have
+            if (reuse && !done.contains(dep) && !wanted.contains(dep) && factory.haveMetric(dep)) {
+                RideMetric *m = factory.newMetric(dep);
+                const QVector<double> &values = spec.interval() ? spec.interval()->metrics() : item->metrics();
+                const QVector<double> &counts = spec.interval() ? spec.interval()->counts() : item->counts();
+                m->setValue(m->index() < values.count() ? values[m->index()] : 0.0);
+                m->setCount(m->index() < counts.count() ? counts[m->index()] : 0);
+                done.insert(dep, m);
+            }
+
             if (!done.contains(dep)) {
                 ready = false;
                 if (!builtin.contains(dep))
@@ -28,6 +28,7 @@
 #include <QDebug>
 #include <QMutex>
 #include <QList>
+#include <QSet>
 
 #include "RideFile.h"
 #include "UserMetricSettings.h"
@@ -77,6 +78,14 @@ public:
     enum metricvalidity { Unreliable, Unknown, Unclear, Useful, Reliable, High };
     typedef enum metricvalidity MetricValidity;
 
+    // Athlete configuration the value depends upon (OR'ed together), beyond
+    // the ride itself, so when it changes only the metrics affected need to
+    // be recomputed, see RideItem::checkStale(). Metrics that use other
+    // metrics as dependencies inherit theirs.
+    enum metricdepends { NoConfig=0x00, PowerZones=0x01, CP=0x02, HrZones=0x04, PaceZones=0x08,
+                         Weight=0x10, Hrv=0x20, UserProgram=0x40, AnyConfig=0xff };
+    typedef enum metricdepends MetricDepends;
+
     int index_;
 
     RideMetric() {
@@ -116,6 +125,7 @@ public:
     virtual MetricClass classification() const { return Undefined; }
     virtual MetricValidity validity() const { return Unknown; }
     virtual int sport() const { return Bike; }
+    virtual int dependsOn() const { return NoConfig; }
 
     // English name used in metadata.xml for compatibility
     virtual QString internalName() const { return internalName_; }
@@ -220,8 +230,10 @@ public:
     // members from source and reference count them to be space efficient
     virtual RideMetric *clone() const { return NULL; }
 
+    // when reuse is set any dependencies not in metrics are not computed
+    // but taken from the values already stored in the item or interval
     static QHash<QString,RideMetricPtr>
-    computeMetrics(RideItem *item, Specification spec, const QStringList &metrics);
+    computeMetrics(RideItem *item, Specification spec, const QStringList &metrics, bool reuse=false);
 
     // get the value for metric m from precomputed values stored at p
     static double getForSymbol(QString m, const QHash<QString,RideMetric*> *p);
@@ -272,6 +284,9 @@ public:
     // is this a user defined one?
     bool isUser() const { return true; }
 
+    // programs can look at anything
+    int dependsOn() const { return AnyConfig; }
+
     // did we clone (i.e. datafilter doesn't belong to us)
     bool isClone() const { return clone_; }
 
@@ -460,6 +475,34 @@ private:
         QVector<QString> *result = dependencyMap.value(symbol);
         return result ? *result : noDeps;
     }
+
+    // metrics affected by a change to config (RideMetric::MetricDepends)
+    // either directly or via the metrics they depend upon, in index order
+    QStringList affectedBy(int config) const {
+        QSet<QString> affected;
+        foreach(const QString &symbol, metricNames)
+            if (metrics.value(symbol)->dependsOn() & config) affected.insert(symbol);
+
+        // and anything that uses them, until nothing changes
+        bool more = affected.count() > 0;
+        while (more) {
+            more = false;
+            foreach(const QString &symbol, metricNames) {
+                if (affected.contains(symbol)) continue;
+                foreach(const QString &dependency, dependencies(symbol)) {
+                    if (affected.contains(dependency)) {
+                        affected.insert(symbol);
+                        more = true;
+                        break;
+                    }
+                }
+            }
+        }
+
+        QStringList returning;
+        foreach(const QString &symbol, metricNames) if (affected.contains(symbol)) returning << symbol;
+        return returning;
+    }
 };
 
 #endif // _GC_RideMetric_h
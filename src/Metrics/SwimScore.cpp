@@ -124,6 +124,7 @@ class XPowerSwim : public RideMetric {
     }
     bool isRelevantForRide(const RideItem*ride) const { return ride->isSwim; }
     MetricClass classification() const { return Undefined; }
+    int dependsOn() const { return RideMetric::Weight; }
     MetricValidity validity() const { return Unknown; }
     RideMetric *clone() const { return new XPowerSwim(*this); }
 };
@@ -197,6 +198,7 @@ class XPaceSwim : public RideMetric {
     }
     bool isRelevantForRide(const RideItem *ride) const { return ride->isSwim; }
     MetricClass classification() const { return Undefined; }
+    int dependsOn() const { return RideMetric::Weight; }
     MetricValidity validity() const { return Unknown; }
     RideMetric *clone() const { return new XPaceSwim(*this); }
 };
@@ -250,6 +252,7 @@ class STP : public RideMetric {
     }
     bool isRelevantForRide(const RideItem *ride) const { return ride->isSwim; }
     MetricClass classification() const { return Undefined; }
+    int dependsOn() const { return RideMetric::Weight | RideMetric::PaceZones; }
     MetricValidity validity() const { return Unknown; }
     RideMetric *clone() const { return new STP(*this); }
 };
@@ -358,6 +361,7 @@ class SwimScore : public RideMetric {
     }
     bool isRelevantForRide(const RideItem *ride) const { return ride->isSwim; }
     MetricClass classification() const { return Undefined; }
+    int dependsOn() const { return RideMetric::Weight; }
     MetricValidity validity() const { return Unknown; }
     RideMetric *clone() const { return new SwimScore(*this); }
 };
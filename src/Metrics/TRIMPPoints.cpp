@@ -99,6 +99,7 @@ class TRIMPPoints : public RideMetric {
     }
 
     MetricClass classification() const { return Undefined; }
+    int dependsOn() const { return RideMetric::HrZones; }
     MetricValidity validity() const { return Unknown; }
     RideMetric *clone() const { return new TRIMPPoints(*this); }
 };
@@ -160,6 +161,7 @@ public:
         setValue(score);
     }
     MetricClass classification() const { return Undefined; }
+    int dependsOn() const { return RideMetric::HrZones; }
     MetricValidity validity() const { return Unknown; }
     RideMetric *clone() const { return new TRIMP100Points(*this); }
 };
@@ -301,6 +303,7 @@ public:
         return;
     }
     MetricClass classification() const { return Undefined; }
+    int dependsOn() const { return RideMetric::HrZones; }
     MetricValidity validity() const { return Unknown; }
     RideMetric *clone() const { return new TRIMPZonalPoints(*this); }
 };
@@ -73,6 +73,7 @@ class ZoneTime : public RideMetric {
     }
 
     MetricClass classification() const { return Undefined; }
+    int dependsOn() const { return RideMetric::PowerZones; }
     MetricValidity validity() const { return Unknown; }
     RideMetric *clone() const { return new ZoneTime(*this); }
 };
@@ -776,6 +777,7 @@ class ZoneTimeI : public RideMetric {
     }
 
     MetricClass classification() const { return Undefined; }
+    int dependsOn() const { return RideMetric::PowerZones | RideMetric::CP; }
     MetricValidity validity() const { return Unknown; }
     RideMetric *clone() const { return new ZoneTimeI(*this); }
 };
@@ -836,6 +838,7 @@ class ZoneTimeII : public RideMetric {
     }
 
     MetricClass classification() const { return Undefined; }
+    int dependsOn() const { return RideMetric::PowerZones | RideMetric::CP; }
     MetricValidity validity() const { return Unknown; }
     RideMetric *clone() const { return new ZoneTimeII(*this); }
 };
@@ -895,6 +898,7 @@ class ZoneTimeIII : public RideMetric {
     }
 
     MetricClass classification() const { return Undefined; }
+    int dependsOn() const { return RideMetric::PowerZones | RideMetric::CP; }
     MetricValidity validity() const { return Unknown; }
     RideMetric *clone() const { return new ZoneTimeIII(*this); }
 };
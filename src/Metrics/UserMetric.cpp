@@ -192,7 +192,7 @@ UserMetric::isRelevantForRide(const RideItem *item) const
 {
     if (item->context && root) {
         if (frelevant) {
-            Result res = root->eval(rt, frelevant, Result(0), 0, const_cast<RideItem*>(item), NULL, NULL);
+            Result res = rt->run(frelevant, Result(0), 0, const_cast<RideItem*>(item), NULL, NULL);
             return res.number();
         } else
             return true;
@@ -224,7 +224,7 @@ UserMetric::compute(RideItem *item, Specification spec, const QHash<QString,Ride
 
     //qDebug()<<"INIT";
     // always init first
-    if (finit) root->eval(rt, finit, Result(0), 0, const_cast<RideItem*>(item), NULL, c, spec);
+    if (finit) rt->run(finit, Result(0), 0, const_cast<RideItem*>(item), NULL, c, spec);
 
     //qDebug()<<"CHECK";
     // can it provide a value and is it relevant ?
@@ -240,7 +240,7 @@ UserMetric::compute(RideItem *item, Specification spec, const QHash<QString,Ride
 
         while(it.hasNext()) {
             struct RideFilePoint *point = it.next();
-            root->eval(rt, fbefore, Result(0), 0, const_cast<RideItem*>(item), point, c, spec);
+            rt->run(fbefore, Result(0), 0, const_cast<RideItem*>(item), point, c, spec);
         }
     }
 
@@ -248,11 +248,7 @@ UserMetric::compute(RideItem *item, Specification spec, const QHash<QString,Ride
     // process samples, if there are any and a function exists
     if (!spec.isEmpty(item->ride()) && fsample) {
         RideFileIterator it(item->ride(), spec);
-
-        while(it.hasNext()) {
-            struct RideFilePoint *point = it.next();
-            root->eval(rt, fsample, Result(0), 0, const_cast<RideItem*>(item), point, c, spec);
-        }
+        rt->runSamples(fsample, const_cast<RideItem*>(item), it, c, spec);
     }
 
     //qDebug()<<"AFTER";
@@ -261,7 +257,7 @@ UserMetric::compute(RideItem *item, Specification spec, const QHash<QString,Ride
 
         while(it.hasNext()) {
             struct RideFilePoint *point = it.next();
-            root->eval(rt, fafter, Result(0), 0, const_cast<RideItem*>(item), point, c, spec);
+            rt->run(fafter, Result(0), 0, const_cast<RideItem*>(item), point, c, spec);
         }
     }
 
@@ -269,14 +265,14 @@ UserMetric::compute(RideItem *item, Specification spec, const QHash<QString,Ride
     //qDebug()<<"VALUE";
     // value ?
     if (fvalue) {
-        Result v = root->eval(rt, fvalue, Result(0), 0, const_cast<RideItem*>(item), NULL, c, spec);
+        Result v = rt->run(fvalue, Result(0), 0, const_cast<RideItem*>(item), NULL, c, spec);
         setValue(v.number());
     }
 
     //qDebug()<<"COUNT";
     // count?
     if (fcount) {
-        Result n = root->eval(rt, fcount, Result(0), 0, const_cast<RideItem*>(item), NULL, c, spec);
+        Result n = rt->run(fcount, Result(0), 0, const_cast<RideItem*>(item), NULL, c, spec);
         setCount(n.number());
     }
 
@@ -652,12 +652,26 @@ void
 WPrimeIntegrator::run()
 {
     // run from start to stop adding decay to end
-    double I = 0.00f;
-    for (int t=0; t<=end; t++) {
+    WPrimeDecay I(TAU);
+    I.integrate(source.constData(), output.data(), end+1);
+}
 
-        I += exp(((double)(t) / TAU)) * source[t];
-        output[t] = exp(-((double)(t) / TAU)) * I;
+void
+WPrimeDecay::integrate(const int *source, double *output, int n)
+{
+    double total = I;
+    for (int t=0; t<n; t++) {
+        total = (total * factor) + source[t];
+        output[t] = total;
     }
+    I = total;
+}
+
+void
+WPrimeDecay::step(double *I, const double *source, int n, double factor)
+{
+    // independent, so vectorises
+    for (int j=0; j<n; j++) I[j] = (I[j] * factor) + source[j];
 }
 
 //
@@ -765,6 +779,7 @@ class MinWPrime : public RideMetric {
 
     bool isRelevantForRide(const RideItem *ride) const { return ride->present.contains("P") || (!ride->isSwim && !ride->isRun); }
     MetricClass classification() const { return Undefined; }
+    int dependsOn() const { return RideMetric::CP; }
     MetricValidity validity() const { return Unknown; }
     RideMetric *clone() const { return new MinWPrime(*this); }
 };
@@ -797,6 +812,7 @@ class MaxWPrime : public RideMetric {
 
     bool isRelevantForRide(const RideItem *ride) const { return ride->present.contains("P") || (!ride->isSwim && !ride->isRun); }
     MetricClass classification() const { return Undefined; }
+    int dependsOn() const { return RideMetric::CP; }
     MetricValidity validity() const { return Unknown; }
     RideMetric *clone() const { return new MaxWPrime(*this); }
 };
@@ -829,6 +845,7 @@ class MaxMatch : public RideMetric {
 
     bool isRelevantForRide(const RideItem *ride) const { return ride->present.contains("P") || (!ride->isSwim && !ride->isRun); }
     MetricClass classification() const { return Undefined; }
+    int dependsOn() const { return RideMetric::CP; }
     MetricValidity validity() const { return Unknown; }
     RideMetric *clone() const { return new MaxMatch(*this); }
 };
@@ -863,6 +880,7 @@ class Matches : public RideMetric {
 
     bool isRelevantForRide(const RideItem *ride) const { return ride->present.contains("P") || (!ride->isSwim && !ride->isRun); }
     MetricClass classification() const { return Undefined; }
+    int dependsOn() const { return RideMetric::CP; }
     MetricValidity validity() const { return Unknown; }
     RideMetric *clone() const { return new Matches(*this); }
 };
@@ -897,6 +915,7 @@ class WPrimeTau : public RideMetric {
     bool canAggregate() { return false; }
     bool isRelevantForRide(const RideItem *ride) const { return ride->present.contains("P") || (!ride->isSwim && !ride->isRun); }
     MetricClass classification() const { return Undefined; }
+    int dependsOn() const { return RideMetric::CP; }
     MetricValidity validity() const { return Unknown; }
     RideMetric *clone() const { return new WPrimeTau(*this); }
 };
@@ -943,6 +962,7 @@ class WPrimeExp : public RideMetric {
 
     bool isRelevantForRide(const RideItem *ride) const { return ride->present.contains("P") || (!ride->isSwim && !ride->isRun); }
     MetricClass classification() const { return Undefined; }
+    int dependsOn() const { return RideMetric::CP; }
     MetricValidity validity() const { return Unknown; }
     RideMetric *clone() const { return new WPrimeExp(*this); }
 };
@@ -989,6 +1009,7 @@ class WPrimeWatts : public RideMetric {
 
     bool isRelevantForRide(const RideItem *ride) const { return ride->present.contains("P") || (!ride->isSwim && !ride->isRun); }
     MetricClass classification() const { return Undefined; }
+    int dependsOn() const { return RideMetric::CP; }
     MetricValidity validity() const { return Unknown; }
     RideMetric *clone() const { return new WPrimeWatts(*this); }
 };
@@ -1044,6 +1065,7 @@ class CPExp : public RideMetric {
 
     bool isRelevantForRide(const RideItem *ride) const { return ride->present.contains("P") || (!ride->isSwim && !ride->isRun); }
     MetricClass classification() const { return Undefined; }
+    int dependsOn() const { return RideMetric::CP; }
     MetricValidity validity() const { return Unknown; }
     RideMetric *clone() const { return new CPExp(*this); }
 };
@@ -1097,6 +1119,7 @@ class WZoneTime : public RideMetric {
 
     bool isRelevantForRide(const RideItem *ride) const { return ride->present.contains("P") || (!ride->isSwim && !ride->isRun); }
     MetricClass classification() const { return Undefined; }
+    int dependsOn() const { return RideMetric::CP; }
     MetricValidity validity() const { return Unknown; }
     RideMetric *clone() const { return new WZoneTime(*this); }
 };
@@ -1247,6 +1270,7 @@ class WCPZoneTime : public RideMetric {
 
     bool isRelevantForRide(const RideItem *ride) const { return ride->present.contains("P") || (!ride->isSwim && !ride->isRun); }
     MetricClass classification() const { return Undefined; }
+    int dependsOn() const { return RideMetric::CP; }
     MetricValidity validity() const { return Unknown; }
     RideMetric *clone() const { return new WCPZoneTime(*this); }
 };
@@ -1388,6 +1412,7 @@ class WZoneWork : public RideMetric {
 
     bool isRelevantForRide(const RideItem *ride) const { return ride->present.contains("P") || (!ride->isSwim && !ride->isRun); }
     MetricClass classification() const { return Undefined; }
+    int dependsOn() const { return RideMetric::CP; }
     MetricValidity validity() const { return Unknown; }
     RideMetric *clone() const { return new WZoneWork(*this); }
 };
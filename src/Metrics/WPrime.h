@@ -100,6 +100,44 @@ class WPrime {
         bool wasIntegral;
 };
 
+// The integral model (Skiba et al) subtracts from W' the power above
+// CP at each second s, decayed by exp(-(t-s)/TAU). Summing exp(s/TAU)
+// scaled by exp(-t/TAU) costs two exp() calls a sample and overflows on
+// very long rides, so instead we decay the running total as we go;
+// I(t) = I(t-dt) * exp(-dt/TAU) + source(t), a multiply-add a sample.
+//
+// It can be fed a sample at a time (e.g. in train mode), run over a
+// whole series, or step many series at once (e.g. the CP solver).
+class WPrimeDecay
+{
+    public:
+        WPrimeDecay(double TAU=300, double dt=1) : I(0) { setTau(TAU, dt); }
+
+        // samples are dt seconds apart
+        void setTau(double TAU, double dt=1) { this->TAU = TAU; factor = decay(TAU, dt); }
+        void reset() { I = 0; }
+
+        // add the next sample, returns the total so far
+        double add(double source) { I = (I * factor) + source; return I; }
+
+        // add a sample dt seconds after the last, for irregular samples
+        double add(double source, double dt) { I = (I * decay(TAU, dt)) + source; return I; }
+
+        double value() const { return I; }
+
+        // integrate a series, output[t] is the total after source[t]
+        void integrate(const int *source, double *output, int n);
+
+        // step n series by a sample each
+        static void step(double *I, const double *source, int n, double factor);
+
+        // decay over dt seconds
+        static double decay(double TAU, double dt=1) { return exp(-dt / TAU); }
+
+    private:
+        double TAU, factor, I;
+};
+
 class WPrimeIntegrator : public QThread
 {
     public:
@@ -59,6 +59,7 @@ class AverageWPK : public RideMetric {
         setValue((secs && ap && weight) ? ap/weight : 0);
     }
     MetricClass classification() const { return Undefined; }
+    int dependsOn() const { return RideMetric::Weight; }
     MetricValidity validity() const { return Unknown; }
     RideMetric *clone() const { return new AverageWPK(*this); }
 };
@@ -97,6 +98,7 @@ class PeakWPK : public RideMetric {
         setValue(wpk);
     }
     MetricClass classification() const { return Undefined; }
+    int dependsOn() const { return RideMetric::Weight; }
     MetricValidity validity() const { return Unknown; }
     RideMetric *clone() const { return new PeakWPK(*this); }
 };
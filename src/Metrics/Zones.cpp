@@ -1091,6 +1091,25 @@ Zones::getFingerprint(QDate forDate) const
     return qChecksum(ba, ba.length());
 }
 
+// get fingerprint for just the power estimates that apply on this date
+quint16
+Zones::getCPFingerprint(QDate forDate) const
+{
+    quint64 x = 0;
+
+    int i = whichRange(forDate);
+    if (i >= 0) {
+        x += ranges[i].cp;
+        x += ranges[i].aet;
+        x += ranges[i].ftp;
+        x += ranges[i].wprime;
+        x += ranges[i].pmax;
+    }
+    QByteArray ba = QByteArray::number(x);
+
+    return qChecksum(ba, ba.length());
+}
+
 QString
 Zones::useCPforFTPSetting() const
 {
@@ -217,6 +217,10 @@ class Zones : public QObject
         // a particular ride change ?
         quint16 getFingerprint(QDate date) const;
 
+        // just the CP, AeT, FTP, W' and Pmax for a date, so metrics that
+        // only depend upon them aren't refreshed when the zones change
+        quint16 getCPFingerprint(QDate date) const;
+
         // USE_CP_FOR_FTP setting differenciated by sport
         QString useCPforFTPSetting() const;
 };
@@ -194,6 +194,7 @@ class aIntensityFactor : public RideMetric {
     }
 
     MetricClass classification() const { return Undefined; }
+    int dependsOn() const { return RideMetric::CP; }
     MetricValidity validity() const { return Unknown; }
     RideMetric *clone() const { return new aIntensityFactor(*this); }
 };
@@ -243,6 +244,7 @@ class aBikeStress : public RideMetric {
     }
 
     MetricClass classification() const { return Undefined; }
+    int dependsOn() const { return RideMetric::CP; }
     MetricValidity validity() const { return Unknown; }
     RideMetric *clone() const { return new aBikeStress(*this); }
 };
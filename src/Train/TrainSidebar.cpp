@@ -359,7 +359,9 @@ TrainSidebar::TrainSidebar(Context *context) : GcWindow(context), context(contex
     hrcount = 0;
     spdcount = 0;
     lodcount = 0;
-    wbalr = wbal = 0;
+    wbalr.reset();
+    wbalr_msecs = 0;
+    wbal = 0;
     load_msecs = total_msecs = lap_msecs = 0;
     displayWorkoutDistance = displayDistance = displayPower = displayHeartRate =
     displaySpeed = displayCadence = slope = load = 0;
@@ -1258,7 +1260,8 @@ void TrainSidebar::Start()       // when start button is pressed
         session_elapsed_msec = 0;
         lap_time.start();
         lap_elapsed_msec = 0;
-        wbalr = 0;
+        wbalr.reset();
+        wbalr_msecs = 0;
         wbal = WPRIME;
         
         resetTextAudioEmitTracking();
@@ -1478,7 +1481,8 @@ void TrainSidebar::Stop(int deviceStatus)        // when stop button is pressed
     spdcount = 0;
     lodcount = 0;
     displayWorkoutLap = 0;
-    wbalr = 0;
+    wbalr.reset();
+    wbalr_msecs = 0;
     wbal = WPRIME;
     session_elapsed_msec = 0;
     session_time.restart();
@@ -1954,9 +1958,10 @@ void TrainSidebar::guiUpdate()           // refreshes the telemetry
             double JOULES = double(rtData.getWatts() - FTP) / 5.00f;
             if (JOULES < 0) JOULES = 0;
 
-            // running total of replenishment
-            wbalr += JOULES * exp((total_msecs/1000.00f) / TAU);
-            wbal = WPRIME - (wbalr * exp((-total_msecs/1000.00f) / TAU));
+            // running total of replenishment, decayed since the last update
+            wbalr.setTau(TAU);
+            wbal = WPRIME - wbalr.add(JOULES, (total_msecs - wbalr_msecs) / 1000.00f);
+            wbalr_msecs = total_msecs;
 
             rtData.setWbal(wbal);
 
@@ -32,6 +32,7 @@
 #include "RemoteControl.h"
 #include "Tab.h"
 #include "PhysicsUtility.h"
+#include "WPrime.h"
 
 // standard stuff
 #include <QDir>
@@ -319,7 +320,9 @@ class TrainSidebar : public GcWindow
         QCheckBox   *recordSelector;
         QSharedPointer<QFileSystemWatcher> watcher;
         bool calibrating;
-        double wbalr, wbal;
+        WPrimeDecay wbalr; // replenishment, see WPrime.h
+        long wbalr_msecs;  // when we last added to it
+        double wbal;
 };
 
 class MultiDeviceDialog : public QDialog
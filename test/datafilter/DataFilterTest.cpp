@@ -0,0 +1,437 @@
+/*
+ * Copyright (c) 2020 Mark Liversedge (liversedge@gmail.com)
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by the Free
+ * Software Foundation; either version 2 of the License, or (at your option)
+ * any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License for
+ * more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc., 51
+ * Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+#include "MainWindow.h"
+#include "Tab.h"
+#include "Athlete.h"
+#include "Context.h"
+#include "Settings.h"
+#include "Colors.h"
+#include "PowerProfile.h"
+#include "TrainDB.h"
+#include "GcUpgrade.h"
+#include "RideCache.h"
+#include "RideItem.h"
+#include "RideFile.h"
+#include "DataFilter.h"
+#include "DataFilterProgram.h"
+#include "LTMSettings.h"
+#include "LTMChartParser.h"
+#include "GoldenCheetah.h"
+#include "GcWindowRegistry.h"
+#include "UserData.h"
+#include "Utils.h"
+
+#include <QtTest>
+#include <QApplication>
+#include <QTemporaryDir>
+#include <QXmlSimpleReader>
+#include <cmath>
+
+#include <gsl/gsl_errno.h>
+
+//
+// Differential tests for the DataFilter runtime
+//
+// Compiled programs (see DataFilterProgram) must give the same results as
+// the tree walker they replace, with or without optimisation. We check that with the formulas used by
+// the example charts in test/charts, evaluated for the example rides in
+// test/rides, which are imported into a new athlete in a temporary directory.
+//
+// Build with CONFIG += gc_tests in gcconfig.pri and run e.g.
+//     GoldenCheetahTests -platform offscreen
+//
+
+// the globals that are usually in main.cpp
+bool restarting = false;
+QString gcroot;
+QApplication *application;
+QDesktopWidget *desktop = NULL;
+
+#ifdef GC_WANT_HTTP
+#include "httplistener.h"
+HttpListener *listener = NULL;
+#endif
+
+#ifdef GC_WANT_R
+#include <RTool.h>
+RTool *rtool = NULL;
+#endif
+
+class DataFilterTest : public QObject
+{
+    Q_OBJECT
+
+    private slots:
+        void initTestCase();
+        void cleanupTestCase();
+
+        // compiled programs give the same results as the tree walker
+        void compiled_data();
+        void compiled();
+
+        // the optimiser doesn't change them either
+        void optimised_data();
+        void optimised();
+
+        // sample functions that accumulate run a chunk at a time, benchmark
+        // that against running them for each sample
+        void samples_data();
+        void samples();
+
+    private:
+        void charts(const QString &name, const LTMSettings &settings);
+
+        // a formula used by a chart, evaluated for each sample if sample is set
+        struct Expression {
+            QString name, formula;
+            bool sample;
+        };
+        QList<Expression> expressions;
+
+        void expressionData();
+        QList<Result> evaluate(DataFilter &filter, bool sample);
+        double accumulate(DataFilter &filter, RideItem *item, bool chunked);
+
+        QTemporaryDir *home;
+        MainWindow *mainWindow;
+        Context *context;
+};
+
+void
+DataFilterTest::initTestCase()
+{
+    home = new QTemporaryDir();
+    QVERIFY(home->isValid());
+
+    // a new athlete, as created by NewCyclistDialog
+    QDir root(home->path());
+    gcroot = root.canonicalPath();
+    appsettings->initializeQSettingsGlobal(gcroot);
+    trainDB = new TrainDB(root);
+
+    QVERIFY(root.mkdir("test"));
+    AthleteDirectoryStructure athleteHome(QDir(gcroot + "/test"));
+    athleteHome.createAllSubdirs();
+    appsettings->initializeQSettingsNewAthlete(gcroot, "test");
+    appsettings->setCValue("test", GC_UPGRADE_FOLDER_SUCCESS, true);
+    appsettings->setCValue("test", GC_VERSION_USED, QVariant(VERSION_LATEST));
+
+    // with the example rides
+    QDir rides(QFINDTESTDATA("../rides"));
+    QVERIFY(rides.exists());
+    foreach(QString name, RideFileFactory::instance().listRideFiles(rides)) {
+        QDateTime when;
+        if (RideFile::parseRideFileName(name, &when))
+            QFile::copy(rides.absoluteFilePath(name), athleteHome.activities().absoluteFilePath(name));
+    }
+
+    // open it and wait for the metrics to be computed
+    root.cd("test");
+    mainWindow = new MainWindow(root);
+    context = mainWindow->athleteTab()->context;
+    QTRY_VERIFY_WITH_TIMEOUT(!context->athlete->rideCache->isRunning(), 600000);
+    QVERIFY(context->athlete->rideCache->rides().count() > 0);
+
+    // the formulas used by the example charts
+    QDir examples(QFINDTESTDATA("../charts"));
+    QVERIFY(examples.exists());
+
+    foreach(QString name, examples.entryList(QStringList() << "*.xml", QDir::Files, QDir::Name)) {
+
+        QFile file(examples.absoluteFilePath(name));
+        QXmlInputSource source(&file);
+        QXmlSimpleReader reader;
+        LTMChartParser handler;
+        reader.setContentHandler(&handler);
+        reader.setErrorHandler(&handler);
+        reader.parse(source);
+
+        foreach(LTMSettings settings, handler.getSettings()) charts(name, settings);
+    }
+
+    foreach(QString name, examples.entryList(QStringList() << "*.gchart", QDir::Files, QDir::Name)) {
+
+        QList<QMap<QString,QString> > properties = GcChartWindow::chartPropertiesFromFile(examples.absoluteFilePath(name));
+        foreach(const QMap<QString,QString> &chart, properties) {
+
+            int type = chart.value("TYPE").toInt();
+            if (type == GcWindowTypes::LTM && chart.contains("settings")) {
+
+                // trends charts, same as HomeWindow
+                QByteArray unmarshall = QByteArray::fromBase64(chart.value("settings").toLatin1());
+                QDataStream s(&unmarshall, QIODevice::ReadOnly);
+                LTMSettings settings;
+                s >> settings;
+                charts(name, settings);
+
+            } else if (type == GcWindowTypes::AllPlot && chart.contains("userData")) {
+
+                // user data series on the ride plot, same as AllPlotWindow
+                QRegExp snippet("(\\<userdata .*\\<\\/userdata\\>)");
+                snippet.setMinimal(true);
+                QString settings = Utils::jsonunprotect(chart.value("userData"));
+                int pos = 0, n = 0;
+                while ((pos = snippet.indexIn(settings, pos)) != -1) {
+                    UserData data(snippet.cap(1));
+                    Expression expression;
+                    expression.name = QString("%1 userdata %2").arg(name).arg(++n);
+                    expression.formula = data.formula;
+                    expression.sample = true;
+                    expressions << expression;
+                    pos += snippet.matchedLength();
+                }
+            }
+        }
+    }
+    QVERIFY(expressions.count() > 0);
+}
+
+void
+DataFilterTest::charts(const QString &name, const LTMSettings &settings)
+{
+    int n = 0;
+    foreach(const MetricDetail &metric, settings.metrics) {
+
+        if (metric.type == METRIC_FORMULA && metric.formula != "") {
+            Expression expression;
+            expression.name = QString("%1 %2 formula %3").arg(name).arg(settings.name).arg(++n);
+            expression.formula = metric.formula;
+            expression.sample = false;
+            expressions << expression;
+        }
+
+        if (metric.datafilter != "") {
+            Expression expression;
+            expression.name = QString("%1 %2 filter %3").arg(name).arg(settings.name).arg(++n);
+            expression.formula = metric.datafilter;
+            expression.sample = false;
+            expressions << expression;
+        }
+    }
+}
+
+void
+DataFilterTest::cleanupTestCase()
+{
+    mainWindow->close();
+    delete mainWindow;
+    delete trainDB;
+    delete home;
+}
+
+void
+DataFilterTest::expressionData()
+{
+    QTest::addColumn<int>("expression");
+    for(int i=0; i<expressions.count(); i++)
+        QTest::newRow(expressions[i].name.toUtf8().constData()) << i;
+}
+
+// evaluate for every ride, and for every sample in them if asked
+QList<Result>
+DataFilterTest::evaluate(DataFilter &filter, bool sample)
+{
+    QList<Result> results;
+    foreach(RideItem *item, context->athlete->rideCache->rides()) {
+        if (!sample) results << filter.evaluate(item, NULL);
+        else if (item->ride())
+            foreach(RideFilePoint *p, item->ride()->dataPoints()) results << filter.evaluate(item, p);
+    }
+    return results;
+}
+
+// the same value, vectors included, exactly as they are computed
+// the same way, apart from not a number which is never equal
+static bool
+same(double a, double b)
+{
+    return a == b || (std::isnan(a) && std::isnan(b));
+}
+
+static bool
+same(Result a, Result b)
+{
+    if (a.isNumber != b.isNumber) return false;
+
+    if (a.isNumber) {
+        if (!same(a.number(), b.number()) || a.asNumeric().count() != b.asNumeric().count()) return false;
+        for(int i=0; i<a.asNumeric().count(); i++)
+            if (!same(a.asNumeric()[i], b.asNumeric()[i])) return false;
+        return true;
+    }
+    return a.string() == b.string() && a.asString() == b.asString();
+}
+
+static QString
+describe(Result r)
+{
+    if (r.isNumber) {
+        QStringList values;
+        foreach(double v, r.asNumeric()) values << QString::number(v, 'g', 17);
+        return QString("%1 [%2]").arg(r.number(), 0, 'g', 17).arg(values.join(","));
+    }
+    return QString("\"%1\" [%2]").arg(r.string()).arg(QStringList(r.asString().toList()).join(","));
+}
+
+static void
+compare(QList<Result> actual, QList<Result> expected)
+{
+    QCOMPARE(actual.count(), expected.count());
+
+    for(int i=0; i<actual.count(); i++)
+        QVERIFY2(same(actual[i], expected[i]), qPrintable(QString("result %1 is %2, expected %3").arg(i)
+                                                          .arg(describe(actual[i])).arg(describe(expected[i]))));
+}
+
+void
+DataFilterTest::compiled_data()
+{
+    expressionData();
+}
+
+void
+DataFilterTest::compiled()
+{
+    QFETCH(int, expression);
+    const Expression &e = expressions[expression];
+
+    // each has its own runtime, so symbols assigned to start afresh
+    DataFilter compiled(NULL, context, e.formula);
+    DataFilter walked(NULL, context, e.formula);
+    if (compiled.root() == NULL) QSKIP("formula doesn't parse");
+
+    // no programs or memoised calls, so everything is left to Leaf::eval
+    walked.rt.programs.clear();
+    walked.rt.memos.clear();
+
+    QList<Result> expected = evaluate(walked, e.sample);
+    QList<Result> actual = evaluate(compiled, e.sample);
+    compare(actual, expected);
+}
+
+void
+DataFilterTest::optimised_data()
+{
+    expressionData();
+}
+
+void
+DataFilterTest::optimised()
+{
+    QFETCH(int, expression);
+    const Expression &e = expressions[expression];
+
+    DataFilter optimised(NULL, context, e.formula);
+    DataFilter unoptimised(NULL, context, e.formula);
+    if (optimised.root() == NULL) QSKIP("formula doesn't parse");
+
+    unoptimised.rt.compile(unoptimised.root(), false);
+
+    QList<Result> expected = evaluate(unoptimised, e.sample);
+    QList<Result> actual = evaluate(optimised, e.sample);
+    compare(actual, expected);
+}
+
+// average power, as in the example user metric
+static const char *averagePower = "{\n"
+                                  "    init { joules <- 0; seconds <- 0; }\n"
+                                  "    sample {\n"
+                                  "        joules <- joules + (POWER * RECINTSECS);\n"
+                                  "        seconds <- seconds + RECINTSECS;\n"
+                                  "    }\n"
+                                  "    value { joules / seconds; }\n"
+                                  "}";
+
+// run the program for the samples in the ride, as UserMetric does
+double
+DataFilterTest::accumulate(DataFilter &filter, RideItem *item, bool chunked)
+{
+    DataFilterRuntime &rt = filter.rt;
+    Leaf *sample = rt.functions.value("sample");
+
+    rt.run(rt.functions.value("init"), Result(0), 0, item);
+
+    RideFileIterator it(item->ride(), Specification());
+    if (chunked) {
+        rt.runSamples(sample, item, it);
+    } else {
+        // what runSamples does when it can't be done in chunks
+        QSharedPointer<DataFilterProgram> program = rt.programs.value(sample);
+        DataFilterProgram::Registers registers;
+        while(it.hasNext()) program->run(&rt, Result(0), 0, item, it.next(), NULL, Specification(), DateRange(), &registers);
+    }
+
+    return rt.run(rt.functions.value("value"), Result(0), 0, item).number();
+}
+
+void
+DataFilterTest::samples_data()
+{
+    QTest::addColumn<bool>("chunked");
+    QTest::newRow("per sample") << false;
+    QTest::newRow("chunked") << true;
+}
+
+void
+DataFilterTest::samples()
+{
+    QFETCH(bool, chunked);
+
+    // the longest ride with power
+    RideItem *longest = NULL;
+    foreach(RideItem *item, context->athlete->rideCache->rides()) {
+        RideFile *ride = item->ride();
+        if (ride && ride->areDataPresent()->watts &&
+            (longest == NULL || ride->dataPoints().count() > longest->ride()->dataPoints().count())) longest = item;
+    }
+    QVERIFY(longest);
+
+    DataFilter filter(NULL, context, averagePower);
+    QVERIFY(filter.root());
+    QVERIFY(filter.rt.programs.value(filter.rt.functions.value("sample"))->isReduction());
+
+    // both ways give the same answer, allowing for the order the sums are made
+    double expected = accumulate(filter, longest, false);
+    double actual = accumulate(filter, longest, true);
+    QVERIFY2(qAbs(actual - expected) <= 1e-9 * qAbs(expected),
+             qPrintable(QString("chunked %1, per sample %2").arg(actual, 0, 'g', 17).arg(expected, 0, 'g', 17)));
+
+    QBENCHMARK {
+        accumulate(filter, longest, chunked);
+    }
+}
+
+int
+main(int argc, char *argv[])
+{
+    // same as main.cpp
+    gsl_set_error_handler_off();
+    QApplication app(argc, argv);
+    application = &app;
+    desktop = QApplication::desktop();
+
+    initPowerProfile();
+    GCColor::setupColors();
+    GCColor::readConfig();
+
+    DataFilterTest test;
+    return QTest::qExec(&test, argc, argv);
+}
+
+#include "DataFilterTest.moc"